@@ -0,0 +1,87 @@
+#include "arena.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdalign.h>
+
+// Default block size; larger requests get a block of their own
+#define ARENA_BLOCK_SIZE 4096
+
+struct arena_block {
+    arena_block_t *next;
+    size_t size;
+    size_t used;
+    alignas(max_align_t) unsigned char data[];
+};
+
+void arena_init(arena_t *arena) {
+    arena->head = NULL;
+}
+
+size_t arena_aligned_size(size_t size) {
+    size_t align = alignof(max_align_t);
+    size = (size + align - 1) & ~(align - 1);
+    return size ? size : align;
+}
+
+// Start a new block with at least size free bytes
+// Returns 0 on success, -1 on error
+static int arena_grow(arena_t *arena, size_t size) {
+    size_t block_size = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+    arena_block_t *block = malloc(sizeof(arena_block_t) + block_size);
+    if (!block) return -1;
+
+    block->size = block_size;
+    block->used = 0;
+    block->next = arena->head;
+    arena->head = block;
+    return 0;
+}
+
+int arena_reserve(arena_t *arena, size_t size) {
+    if (!arena) return -1;
+
+    size = arena_aligned_size(size);
+    arena_block_t *block = arena->head;
+    if (block && block->size - block->used >= size) return 0;
+    return arena_grow(arena, size);
+}
+
+void* arena_alloc(arena_t *arena, size_t size) {
+    if (!arena) return NULL;
+
+    // Keep every allocation aligned for any type
+    size = arena_aligned_size(size);
+
+    arena_block_t *block = arena->head;
+    if (!block || block->size - block->used < size) {
+        if (arena_grow(arena, size) != 0) return NULL;
+        block = arena->head;
+    }
+
+    void *ptr = block->data + block->used;
+    block->used += size;
+    memset(ptr, 0, size);
+    return ptr;
+}
+
+char* arena_strdup(arena_t *arena, const char *s) {
+    if (!s) return NULL;
+
+    size_t len = strlen(s);
+    char *copy = arena_alloc(arena, len + 1);
+    if (!copy) return NULL;
+    memcpy(copy, s, len + 1);
+    return copy;
+}
+
+void arena_free(arena_t *arena) {
+    if (!arena) return;
+
+    arena_block_t *block = arena->head;
+    while (block) {
+        arena_block_t *next = block->next;
+        free(block);
+        block = next;
+    }
+    arena->head = NULL;
+}
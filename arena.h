@@ -0,0 +1,35 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+// Bump allocator: everything allocated from an arena is freed together
+typedef struct arena_block arena_block_t;
+
+typedef struct {
+    arena_block_t *head;        // Block currently allocated from (newest first)
+} arena_t;
+
+// Initialize an empty arena (no memory is allocated until the first arena_alloc)
+void arena_init(arena_t *arena);
+
+// Make sure the next size bytes of allocations come from a single block
+// (lets callers that know their total size end up with one malloc/free)
+// Returns 0 on success, -1 on error
+int arena_reserve(arena_t *arena, size_t size);
+
+// Arena space taken by an allocation of size bytes (including alignment padding)
+size_t arena_aligned_size(size_t size);
+
+// Allocate size zeroed bytes, aligned for any type
+// Returns pointer on success, NULL on error
+void* arena_alloc(arena_t *arena, size_t size);
+
+// Copy a NUL-terminated string into the arena
+// Returns the copy on success, NULL on error
+char* arena_strdup(arena_t *arena, const char *s);
+
+// Free every allocation made from the arena and reset it to empty
+void arena_free(arena_t *arena);
+
+#endif // ARENA_H
@@ -0,0 +1,378 @@
+// Headless benchmark for the remap pipeline
+// Feeds generated event streams through device_runtime_feed() (remap lookup,
+// routing, frame assembly, emit) and reports throughput and per-frame latency.
+// Needs no input hardware: the memory sink replaces the uinput write, the
+// uinput sink (-u) creates real virtual devices through /dev/uinput.
+
+#include "../event-processor.h"
+#include "../config-loader.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <linux/input.h>
+#include <libevdev/libevdev.h>
+#include <libevdev/libevdev-uinput.h>
+
+#define BENCH_DEFAULT_EVENTS 2000000
+#define BENCH_DEFAULT_REMAPS 32
+#define BENCH_MAX_FRAME 32
+
+// Fills one source frame (SYN_REPORT last), returns number of events
+typedef int (*generate_fn)(uint64_t frame, struct input_event *out);
+
+typedef struct {
+    const char *name;
+    generate_fn generate;
+    int uinput_safe;            // Harmless when emitted to real virtual devices
+} scenario_t;
+
+typedef struct {
+    uint64_t events;
+    uint64_t frames;
+} memory_sink_t;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void set_event(struct input_event *ev, int type, int code, int value) {
+    memset(ev, 0, sizeof(*ev));
+    ev->type = type;
+    ev->code = code;
+    ev->value = value;
+}
+
+// Keys typed by the generators: F13-F24 are unbound on most desktops, so the
+// uinput sink does not type into the focused window
+static const int g_keys[] = {
+    KEY_F13, KEY_F14, KEY_F15, KEY_F16, KEY_F17, KEY_F18,
+    KEY_F19, KEY_F20, KEY_F21, KEY_F22, KEY_F23, KEY_F24,
+};
+#define KEY_COUNT ((int)(sizeof(g_keys) / sizeof(g_keys[0])))
+
+// Typing: one key press or release per frame
+static int generate_typing(uint64_t frame, struct input_event *out) {
+    set_event(&out[0], EV_KEY, g_keys[(frame / 2) % KEY_COUNT], frame % 2 == 0);
+    set_event(&out[1], EV_SYN, SYN_REPORT, 0);
+    return 2;
+}
+
+// 8 kHz mouse: X/Y motion every frame, wheel and a remapped side button now and then
+// Motion alternates direction so the pointer stays put on the uinput sink
+static int generate_mouse(uint64_t frame, struct input_event *out) {
+    int n = 0;
+    int step = frame % 2 == 0 ? 1 : -1;
+    set_event(&out[n++], EV_REL, REL_X, step);
+    set_event(&out[n++], EV_REL, REL_Y, -step);
+    if (frame % 64 == 0) {
+        set_event(&out[n++], EV_REL, REL_WHEEL, frame % 128 == 0 ? 1 : -1);
+    }
+    if (frame % 500 == 0) {
+        set_event(&out[n++], EV_KEY, BTN_SIDE, 1);
+    } else if (frame % 500 == 1) {
+        set_event(&out[n++], EV_KEY, BTN_SIDE, 0);
+    }
+    set_event(&out[n++], EV_SYN, SYN_REPORT, 0);
+    return n;
+}
+
+// Multitouch: three fingers moving, lifted and put down every 200 frames
+static int generate_multitouch(uint64_t frame, struct input_event *out) {
+    int n = 0;
+    int phase = (int)(frame % 200);
+    for (int slot = 0; slot < 3; slot++) {
+        set_event(&out[n++], EV_ABS, ABS_MT_SLOT, slot);
+        if (phase == 0) {
+            set_event(&out[n++], EV_ABS, ABS_MT_TRACKING_ID, (int)(frame / 200) * 3 + slot);
+        } else if (phase == 199) {
+            set_event(&out[n++], EV_ABS, ABS_MT_TRACKING_ID, -1);
+            continue;
+        }
+        set_event(&out[n++], EV_ABS, ABS_MT_POSITION_X, 1000 + slot * 500 + phase);
+        set_event(&out[n++], EV_ABS, ABS_MT_POSITION_Y, 1000 + phase);
+    }
+    if (phase == 0 || phase == 199) {
+        set_event(&out[n++], EV_KEY, BTN_TOUCH, phase == 0);
+    }
+    set_event(&out[n++], EV_ABS, ABS_X, 1000 + phase);
+    set_event(&out[n++], EV_ABS, ABS_Y, 1000 + phase);
+    set_event(&out[n++], EV_SYN, SYN_REPORT, 0);
+    return n;
+}
+
+// Chords: four keys pressed in one frame, released in the next
+static int generate_chords(uint64_t frame, struct input_event *out) {
+    int n = 0;
+    int base = (int)((frame / 2) % KEY_COUNT);
+    for (int i = 0; i < 4; i++) {
+        set_event(&out[n++], EV_KEY, g_keys[(base + i) % KEY_COUNT], frame % 2 == 0);
+    }
+    set_event(&out[n++], EV_SYN, SYN_REPORT, 0);
+    return n;
+}
+
+static const scenario_t g_scenarios[] = {
+    { "typing", generate_typing, 1 },
+    { "mouse-8khz", generate_mouse, 1 },
+    { "multitouch", generate_multitouch, 0 },
+    { "chords", generate_chords, 1 },
+};
+
+static int memory_sink(void *ctx, const struct input_event *ev) {
+    memory_sink_t *sink = ctx;
+    sink->events++;
+    if (ev->type == EV_SYN) {
+        sink->frames++;
+    }
+    return 0;
+}
+
+// Device config with remap_count rules; every other typed key is remapped and
+// the rest of the table is filler so lookups scan a realistic number of rules
+static int build_config(config_t *config, device_config_t *device, int remap_count) {
+    memset(config, 0, sizeof(*config));
+    memset(device, 0, sizeof(*device));
+    device->uuid = "bench";
+    device->identifier = "";
+    device->name_match = "keyswap-bench";
+    device->worker = -1;
+
+    device->remaps = calloc(remap_count, sizeof(remap_rule_t));
+    if (!device->remaps) return -1;
+
+    int n = 0;
+    for (int i = 0; i < remap_count; i++) {
+        remap_rule_t *remap = &device->remaps[n];
+        remap->source_type = EV_KEY;
+        remap->target_type = EV_KEY;
+        if (i == 0) {
+            remap->source_code = BTN_SIDE;
+            remap->target_code = KEY_F24;
+        } else if (i <= KEY_COUNT / 2) {
+            // Rules placed at the end of the table: worst case for the lookup
+            continue;
+        } else {
+            // Filler: codes never generated
+            remap->source_code = KEY_PROG1 + i;
+            remap->target_code = KEY_F13;
+        }
+        n++;
+    }
+    for (int i = 0; i < KEY_COUNT && n < remap_count; i += 2) {
+        device->remaps[n].source_type = EV_KEY;
+        device->remaps[n].target_type = EV_KEY;
+        device->remaps[n].source_code = g_keys[i];
+        device->remaps[n].target_code = g_keys[(i + 1) % KEY_COUNT];
+        n++;
+    }
+    device->remap_count = n;
+    config_compile_device(device);
+
+    config->devices = device;
+    config->device_count = 1;
+    return 0;
+}
+
+// Source capabilities for the uinput sink (what a real device would report)
+static struct libevdev* create_source_caps(void) {
+    struct libevdev *dev = libevdev_new();
+    if (!dev) return NULL;
+
+    libevdev_set_name(dev, "keyswap-bench-source");
+    libevdev_enable_event_type(dev, EV_KEY);
+    for (int i = 0; i < KEY_COUNT; i++) {
+        libevdev_enable_event_code(dev, EV_KEY, g_keys[i], NULL);
+    }
+    libevdev_enable_event_code(dev, EV_KEY, BTN_LEFT, NULL);
+    libevdev_enable_event_code(dev, EV_KEY, BTN_SIDE, NULL);
+    libevdev_enable_event_type(dev, EV_REL);
+    libevdev_enable_event_code(dev, EV_REL, REL_X, NULL);
+    libevdev_enable_event_code(dev, EV_REL, REL_Y, NULL);
+    libevdev_enable_event_code(dev, EV_REL, REL_WHEEL, NULL);
+    return dev;
+}
+
+static int compare_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+// Feed event_count events of one scenario and print a result line
+static void run_scenario(const scenario_t *scenario, const char *sink_name, device_runtime_t *rt,
+                         config_t *config, uint64_t event_count) {
+    // At least one event per frame, so this bounds the frame count
+    uint32_t *latencies = malloc(event_count * sizeof(uint32_t));
+    if (!latencies) {
+        fprintf(stderr, "ERROR: Failed to allocate latency samples\n");
+        return;
+    }
+
+    struct input_event frame[BENCH_MAX_FRAME];
+    uint64_t events = 0;
+    uint64_t frames = 0;
+    memset(&rt->stats, 0, sizeof(rt->stats));
+
+    uint64_t start_ns = now_ns();
+    while (events < event_count) {
+        int n = scenario->generate(frames, frame);
+
+        uint64_t t0 = now_ns();
+        // Kernel-style timestamp on the frame so stats latency is exercised too
+        frame[n - 1].input_event_sec = (long)(t0 / 1000000000ull);
+        frame[n - 1].input_event_usec = (long)((t0 % 1000000000ull) / 1000ull);
+        for (int i = 0; i < n; i++) {
+            device_runtime_feed(rt, config, NULL, &frame[i], 0, 0);
+        }
+        uint64_t t1 = now_ns();
+
+        latencies[frames++] = (uint32_t)(t1 - t0 > UINT32_MAX ? UINT32_MAX : t1 - t0);
+        events += n;
+    }
+    uint64_t elapsed_ns = now_ns() - start_ns;
+
+    // Leave nothing held on the virtual devices between scenarios
+    device_runtime_release_keys(rt);
+
+    uint64_t sum = 0;
+    for (uint64_t i = 0; i < frames; i++) sum += latencies[i];
+    qsort(latencies, frames, sizeof(uint32_t), compare_u32);
+
+    printf("%-12s %-7s %10llu %9llu %12.0f %8llu %8u %8u %9u %8llu\n",
+           scenario->name, sink_name,
+           (unsigned long long)events, (unsigned long long)frames,
+           elapsed_ns ? (double)events * 1e9 / (double)elapsed_ns : 0.0,
+           (unsigned long long)(sum / frames),
+           latencies[frames / 2],
+           latencies[(frames * 99) / 100],
+           latencies[frames - 1],
+           (unsigned long long)rt->stats.dropped);
+
+    free(latencies);
+}
+
+static void print_header(void) {
+    printf("%-12s %-7s %10s %9s %12s %8s %8s %8s %9s %8s\n",
+           "scenario", "sink", "events", "frames", "events/s",
+           "mean_ns", "p50_ns", "p99_ns", "max_ns", "dropped");
+}
+
+static void print_usage(const char *program_name) {
+    printf("Usage: %s [OPTIONS]\n", program_name);
+    printf("\n");
+    printf("Options:\n");
+    printf("  -n, --events N      Events per scenario (default %d)\n", BENCH_DEFAULT_EVENTS);
+    printf("  -r, --remaps N      Remap rules in the device config (default %d)\n", BENCH_DEFAULT_REMAPS);
+    printf("  -u, --uinput        Also emit to real uinput devices (needs /dev/uinput access;\n");
+    printf("                      emits F13-F24 keys and net-zero pointer motion)\n");
+    printf("  -h, --help          Show this help message\n");
+    printf("\n");
+    printf("Latency columns are the time to run one source frame through the pipeline.\n");
+}
+
+int main(int argc, char *argv[]) {
+    uint64_t event_count = BENCH_DEFAULT_EVENTS;
+    int remap_count = BENCH_DEFAULT_REMAPS;
+    int use_uinput = 0;
+
+    static struct option long_options[] = {
+        {"events", required_argument, 0, 'n'},
+        {"remaps", required_argument, 0, 'r'},
+        {"uinput", no_argument, 0, 'u'},
+        {"help", no_argument, 0, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "n:r:uh", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'n':
+                event_count = strtoull(optarg, NULL, 10);
+                break;
+            case 'r':
+                remap_count = atoi(optarg);
+                break;
+            case 'u':
+                use_uinput = 1;
+                break;
+            case 'h':
+                print_usage(argv[0]);
+                return 0;
+            default:
+                print_usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (event_count == 0 || remap_count <= 0) {
+        fprintf(stderr, "ERROR: --events and --remaps must be positive\n");
+        return 1;
+    }
+
+    config_t config;
+    device_config_t device;
+    if (build_config(&config, &device, remap_count) != 0) {
+        fprintf(stderr, "ERROR: Failed to build benchmark config\n");
+        return 1;
+    }
+    printf("keyswap pipeline benchmark: %llu events per scenario, %d remap rules\n\n",
+           (unsigned long long)event_count, device.remap_count);
+    print_header();
+
+    // Memory sink: pipeline cost only
+    memory_sink_t keyboard_sink = {0, 0};
+    memory_sink_t mouse_sink = {0, 0};
+    device_runtime_t rt;
+    memset(&rt, 0, sizeof(rt));
+    rt.fd = -1;
+    rt.worker = -1;
+    rt.cfg = &device;
+    snprintf(rt.path, sizeof(rt.path), "bench");
+    rt.keyboard.fd = -1;
+    rt.keyboard.sink = memory_sink;
+    rt.keyboard.sink_ctx = &keyboard_sink;
+    rt.mouse.fd = -1;
+    rt.mouse.sink = memory_sink;
+    rt.mouse.sink_ctx = &mouse_sink;
+
+    for (size_t i = 0; i < sizeof(g_scenarios) / sizeof(g_scenarios[0]); i++) {
+        run_scenario(&g_scenarios[i], "memory", &rt, &config, event_count);
+    }
+
+    // uinput sink: pipeline plus the write() into the kernel
+    if (use_uinput) {
+        struct libevdev *source = create_source_caps();
+        device_runtime_t urt;
+        memset(&urt, 0, sizeof(urt));
+        urt.fd = -1;
+        urt.worker = -1;
+        urt.cfg = &device;
+        snprintf(urt.path, sizeof(urt.path), "bench-uinput");
+
+        if (!source || setup_uinput_devices(source, &urt.keyboard.uinput, &urt.mouse.uinput, &device) != 0) {
+            fprintf(stderr, "WARNING: uinput unavailable, skipping uinput sink\n");
+        } else {
+            urt.keyboard.fd = libevdev_uinput_get_fd(urt.keyboard.uinput);
+            urt.mouse.fd = urt.mouse.uinput ? libevdev_uinput_get_fd(urt.mouse.uinput) : -1;
+
+            for (size_t i = 0; i < sizeof(g_scenarios) / sizeof(g_scenarios[0]); i++) {
+                if (!g_scenarios[i].uinput_safe) {
+                    printf("%-12s %-7s skipped (would act as a real touchscreen)\n", g_scenarios[i].name, "uinput");
+                    continue;
+                }
+                run_scenario(&g_scenarios[i], "uinput", &urt, &config, event_count);
+            }
+            device_runtime_close(&urt);
+        }
+        if (source) libevdev_free(source);
+    }
+
+    free(device.remaps);
+    return 0;
+}
@@ -0,0 +1,125 @@
+// HID-BPF program applying a keyswap rewrite table to the input reports of one
+// HID device, before hid-input turns them into evdev events
+// Built with clang -target bpf against the running kernel's vmlinux.h (make HID_BPF=1);
+// needs HID-BPF struct_ops (Linux 6.11+)
+
+#include "vmlinux.h"
+#include <bpf/bpf_helpers.h>
+#include <bpf/bpf_tracing.h>
+#include "hid-remap.h"
+
+extern __u8 *hid_bpf_get_data(struct hid_bpf_ctx *ctx, unsigned int offset, const size_t __sz) __ksym;
+
+// Filled in by the loader before the program is loaded (read-only afterwards)
+const volatile struct hid_remap_table table = {};
+
+static __always_inline int get_bit(__u8 *data, __u32 offset) {
+    return (data[(offset >> 3) & (HID_REMAP_MAX_REPORT - 1)] >> (offset & 7)) & 1;
+}
+
+static __always_inline void set_bit(__u8 *data, __u32 offset, int value) {
+    __u8 *byte = &data[(offset >> 3) & (HID_REMAP_MAX_REPORT - 1)];
+    if (value) {
+        *byte |= 1 << (offset & 7);
+    } else {
+        *byte &= ~(1 << (offset & 7));
+    }
+}
+
+// Unsigned value of a little-endian bit field
+static __always_inline __u32 get_field(__u8 *data, __u32 offset, __u32 size) {
+    __u32 value = 0;
+    for (__u32 i = 0; i < HID_REMAP_MAX_FIELD_BITS && i < size; i++) {
+        value |= (__u32)get_bit(data, offset + i) << i;
+    }
+    return value;
+}
+
+static __always_inline void set_field(__u8 *data, __u32 offset, __u32 size, __u32 value) {
+    for (__u32 i = 0; i < HID_REMAP_MAX_FIELD_BITS && i < size; i++) {
+        set_bit(data, offset + i, (value >> i) & 1);
+    }
+}
+
+// Two passes: every source is read (and cleared) before any target is written,
+// so swaps see the original report
+SEC("struct_ops/hid_device_event")
+int BPF_PROG(keyswap_device_event, struct hid_bpf_ctx *hctx, enum hid_report_type type, __u64 source)
+{
+    __u32 slots[HID_REMAP_MAX_OPS] = {};
+    __u64 pressed = 0;
+
+    (void)source;
+    if (type != HID_INPUT_REPORT) return 0;
+
+    __u8 *data = hid_bpf_get_data(hctx, 0, HID_REMAP_MAX_REPORT);
+    if (!data) return 0;
+
+    for (__u32 i = 0; i < HID_REMAP_MAX_OPS && i < table.op_count; i++) {
+        const volatile struct hid_remap_op *op = &table.ops[i];
+        if (op->report_id && data[0] != op->report_id) continue;
+
+        switch (op->kind) {
+        case HID_REMAP_BIT_MOVE:
+        case HID_REMAP_BIT_CLEAR:
+        case HID_REMAP_BIT_TO_ARRAY:
+            if (get_bit(data, op->src)) {
+                pressed |= 1ull << i;
+                set_bit(data, op->src, 0);
+            }
+            break;
+        case HID_REMAP_ARRAY_MAP:
+        case HID_REMAP_ARRAY_TO_BIT:
+            for (__u32 j = 0; j < HID_REMAP_MAX_SLOTS && j < op->count; j++) {
+                if (get_field(data, op->src + j * op->size, op->size) == (__u32)op->from) {
+                    slots[i] |= 1u << j;
+                }
+            }
+            if (slots[i]) pressed |= 1ull << i;
+            break;
+        }
+    }
+
+    for (__u32 i = 0; i < HID_REMAP_MAX_OPS && i < table.op_count; i++) {
+        const volatile struct hid_remap_op *op = &table.ops[i];
+        if (op->report_id && data[0] != op->report_id) continue;
+
+        if (op->kind == HID_REMAP_NEGATE) {
+            __u32 mask = op->size >= 32 ? ~0u : (1u << op->size) - 1;
+            set_field(data, op->src, op->size, (0u - get_field(data, op->src, op->size)) & mask);
+            continue;
+        }
+        if (!(pressed & (1ull << i))) continue;
+
+        switch (op->kind) {
+        case HID_REMAP_BIT_MOVE:
+            set_bit(data, op->dst, 1);
+            break;
+        case HID_REMAP_ARRAY_TO_BIT:
+            set_bit(data, op->dst, 1);
+            // fallthrough: the slots are emptied
+        case HID_REMAP_ARRAY_MAP:
+            for (__u32 j = 0; j < HID_REMAP_MAX_SLOTS && j < op->count; j++) {
+                if (slots[i] & (1u << j)) set_field(data, op->src + j * op->size, op->size, op->to);
+            }
+            break;
+        case HID_REMAP_BIT_TO_ARRAY:
+            for (__u32 j = 0; j < HID_REMAP_MAX_SLOTS && j < op->count; j++) {
+                if (get_field(data, op->dst + j * op->size, op->size) == (__u32)op->from) {
+                    set_field(data, op->dst + j * op->size, op->size, op->to);
+                    break;
+                }
+            }
+            break;
+        }
+    }
+
+    return 0;
+}
+
+SEC(".struct_ops.link")
+struct hid_bpf_ops keyswap_remap = {
+    .hid_device_event = (void *)keyswap_device_event,
+};
+
+char _license[] SEC("license") = "GPL";
@@ -0,0 +1,41 @@
+#ifndef HID_REMAP_H
+#define HID_REMAP_H
+
+// Rewrite table shared by the HID-BPF program (hid-remap.bpf.c) and its
+// loader (hid-offload.c): compiled from the rule tables against the device's
+// report descriptor, applied to every input report before hid-input sees it
+// Includers provide the __u8/__u16/__s32 types (linux/types.h, or vmlinux.h in BPF)
+
+// Largest input report handled, in bytes (HID-BPF buffers come in multiples of 64)
+#define HID_REMAP_MAX_REPORT 64
+#define HID_REMAP_MAX_OPS 32
+#define HID_REMAP_MAX_SLOTS 16          // Elements of an array field scanned
+#define HID_REMAP_MAX_FIELD_BITS 16     // Largest array element / axis size
+
+// Operation kinds; offsets are in bits from the start of the report (report id included)
+enum {
+    HID_REMAP_BIT_MOVE = 1,     // Bit src set: clear it, set bit dst (key swap within bitmaps)
+    HID_REMAP_BIT_CLEAR,        // Clear bit src (key blocked)
+    HID_REMAP_BIT_TO_ARRAY,     // Bit src set: clear it, write value to into a slot of array dst holding from
+    HID_REMAP_ARRAY_MAP,        // Slots of array src holding from get to (swap, or block with the empty value)
+    HID_REMAP_ARRAY_TO_BIT,     // Slots of array src holding from get to (empty value), bit dst is set
+    HID_REMAP_NEGATE            // Signed field src of size bits is negated (axis inversion)
+};
+
+struct hid_remap_op {
+    __u8 kind;
+    __u8 report_id;             // Report the op applies to, 0 = device without report ids
+    __u8 size;                  // Bits per array element / axis
+    __u8 count;                 // Array elements
+    __u16 src;
+    __u16 dst;
+    __s32 from;
+    __s32 to;
+};
+
+struct hid_remap_table {
+    __u32 op_count;
+    struct hid_remap_op ops[HID_REMAP_MAX_OPS];
+};
+
+#endif // HID_REMAP_H
@@ -1,10 +1,20 @@
 #include "config-loader.h"
 #include <jansson.h>
+#include <libevdev/libevdev.h>
+#include <stdarg.h>
+#include <fnmatch.h>
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <ctype.h>
 #include <regex.h>
 #include <unistd.h>
+#include <sched.h>
+#include <glob.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 
 // Expand environment variables in path (supports ${VAR:-default} syntax)
 char* expand_path(const char *path) {
@@ -74,205 +84,2591 @@ char* expand_path(const char *path) {
     return result;
 }
 
-// Resolve key name from JSON value (can be string or number)
-static int resolve_json_key(json_t *json_key, int *code, int *type) {
-    if (json_is_string(json_key)) {
-        const char *name = json_string_value(json_key);
-        return resolve_key_name(name, code, type);
-    } else if (json_is_integer(json_key)) {
-        *code = (int)json_integer_value(json_key);
-        *type = EV_KEY; // Default assumption
+// Arena space reserved per expanded path (${VAR} can make it longer than written)
+#define CONFIG_EXPANSION_SLACK 256
+
+// Highest CPU number accepted for pinning (size of glibc's cpu_set_t)
+#define CONFIG_MAX_CPU 1023
+
+// Limits of the chatter filters (debounce_ms, max_rate in presses per second)
+#define CONFIG_MAX_DEBOUNCE_MS 1000
+#define CONFIG_MAX_RATE 1000
+
+// Software autorepeat (rule.repeat: true uses the kernel's default timing) and
+// autofire (rule.turbo, presses per second)
+#define CONFIG_REPEAT_DELAY_MS 250
+#define CONFIG_REPEAT_RATE 30
+#define CONFIG_MAX_REPEAT_DELAY_MS 5000
+#define CONFIG_MAX_REPEAT_RATE 100
+#define CONFIG_MAX_TURBO_RATE 100
+
+// Button-hold scrolling defaults (device.scroll): 12 counts of motion per
+// wheel detent, click if released within 250 ms without scrolling
+#define CONFIG_SCROLL_SPEED 1000
+#define CONFIG_MAX_SCROLL_SPEED 10000
+#define CONFIG_SCROLL_TAP_MS 250
+#define CONFIG_MAX_SCROLL_TAP_MS 5000
+
+// Mouse gesture default: 40 counts of motion per stroke direction
+#define CONFIG_GESTURE_THRESHOLD 40
+#define CONFIG_MAX_GESTURE_THRESHOLD 10000
+
+// Mouse keys defaults: a tick per 16 ms, 2 to 20 counts per tick over one second
+// on a quadratic curve
+#define CONFIG_MOUSE_KEYS_INTERVAL_MS 16
+#define CONFIG_MAX_MOUSE_KEYS_INTERVAL_MS 1000
+#define CONFIG_MOUSE_KEYS_SPEED 2
+#define CONFIG_MOUSE_KEYS_MAX_SPEED 20
+#define CONFIG_MAX_MOUSE_KEYS_SPEED 1000
+#define CONFIG_MOUSE_KEYS_ACCEL_MS 1000
+#define CONFIG_MAX_MOUSE_KEYS_ACCEL_MS 10000
+#define CONFIG_MOUSE_KEYS_CURVE 2
+#define CONFIG_MAX_MOUSE_KEYS_CURVE 4
+
+// Scanner default: a record ends after 50 ms without a key (scanners type a
+// character every few milliseconds)
+#define CONFIG_SCANNER_TIMEOUT_MS 50
+#define CONFIG_MAX_SCANNER_TIMEOUT_MS 5000
+
+// Key sequence default: at most one second between two keys
+#define CONFIG_SEQUENCE_TIMEOUT_MS 1000
+#define CONFIG_MAX_SEQUENCE_TIMEOUT_MS 10000
+
+// Expected JSON type of a config member
+typedef enum {
+    KIND_OBJECT,
+    KIND_ARRAY,
+    KIND_STRING,
+    KIND_INTEGER,
+    KIND_BOOLEAN,
+    KIND_KEY                    // Key name (string) or event code (integer)
+} member_kind_t;
+
+// Parser state: JSON path of the node being parsed, for error messages
+typedef struct {
+    const char *file;
+    int flags;
+    int errors;
+    int warnings;
+    char path[512];
+    size_t path_len;
+    arena_t *arena;
+    config_t *config;           // Config being loaded (shared modifier names)
+} loader_t;
+
+static const char *const g_root_members[] = { "metadata", "paths", "config", NULL };
+static const char *const g_paths_members[] = { "config_file", "debug_log", NULL };
+static const char *const g_config_members[] = {
+    "debug", "realtime", "workers", "worker_cpus", "control_socket", "profiles", "devices", NULL
+};
+static const char *const g_profile_members[] = { "applications", NULL };
+static const char *const g_realtime_members[] = { "enabled", "policy", "priority", "lock_memory", "cpu", NULL };
+static const char *const g_device_members[] = {
+    "uuid", "identifier", "unique", "name_match", "match", "worker", "debounce_ms", "max_rate",
+    "offload", "invert", "scroll", "gestures", "mouse_keys", "sequences", "scanner", "modifiers", "remaps",
+    "profiles", NULL
+};
+static const char *const g_scroll_members[] = { "button", "speed", "tap_ms", NULL };
+static const char *const g_gesture_members[] = { "button", "threshold", "strokes", NULL };
+static const char *const g_mouse_keys_members[] = {
+    "keys", "interval_ms", "speed", "max_speed", "accel_ms", "curve", NULL
+};
+static const char *const g_sequences_members[] = { "timeout_ms", "expand", NULL };
+static const char *const g_expansion_members[] = { "text", NULL };
+static const char *const g_scanner_members[] = { "output", "timeout_ms", NULL };
+
+// Directions of device.mouse_keys.keys
+static const struct {
+    const char *name;
+    int dx, dy;
+} g_mouse_key_directions[] = {
+    { "up", 0, -1 }, { "down", 0, 1 }, { "left", -1, 0 }, { "right", 1, 0 },
+    { "up_left", -1, -1 }, { "up_right", 1, -1 }, { "down_left", -1, 1 }, { "down_right", 1, 1 },
+    { NULL, 0, 0 }
+};
+static const char *const g_match_members[] = {
+    "phys", "uniq", "name", "usb_port", "bus", "version", "require", "forbid", NULL
+};
+
+// Bus names accepted by device.match.bus (or a BUS_* number)
+static const struct {
+    const char *name;
+    int bus;
+} g_bus_names[] = {
+    { "pci", BUS_PCI }, { "usb", BUS_USB }, { "bluetooth", BUS_BLUETOOTH },
+    { "virtual", BUS_VIRTUAL }, { "isa", BUS_ISA }, { "i8042", BUS_I8042 },
+    { "ps2", BUS_I8042 }, { "rs232", BUS_RS232 }, { "host", BUS_HOST },
+    { "i2c", BUS_I2C }, { "spi", BUS_SPI }, { NULL, 0 }
+};
+static const char *const g_remap_members[] = {
+    "source", "target", "description", "debounce_ms", "max_rate", "repeat", "turbo", "when", NULL
+};
+static const char *const g_repeat_members[] = { "delay_ms", "rate", NULL };
+
+// Append ".key" to the current path, returns the mark to restore with path_pop
+static size_t path_push_key(loader_t *ld, const char *key) {
+    size_t mark = ld->path_len;
+    int n = snprintf(ld->path + mark, sizeof(ld->path) - mark, "%s%s", mark ? "." : "", key);
+    if (n > 0) ld->path_len = mark + (size_t)n < sizeof(ld->path) ? mark + (size_t)n : sizeof(ld->path) - 1;
+    return mark;
+}
+
+// Append "[index]" to the current path, returns the mark to restore with path_pop
+static size_t path_push_index(loader_t *ld, size_t index) {
+    size_t mark = ld->path_len;
+    int n = snprintf(ld->path + mark, sizeof(ld->path) - mark, "[%zu]", index);
+    if (n > 0) ld->path_len = mark + (size_t)n < sizeof(ld->path) ? mark + (size_t)n : sizeof(ld->path) - 1;
+    return mark;
+}
+
+static void path_pop(loader_t *ld, size_t mark) {
+    ld->path_len = mark;
+    ld->path[mark] = '\0';
+}
+
+static void loader_vreport(loader_t *ld, const char *level, const char *key, const char *fmt, va_list args) {
+    fprintf(stderr, "%s: %s: %s%s%s: ", level, ld->file, ld->path_len ? ld->path : "",
+            key && ld->path_len ? "." : "", key ? key : (ld->path_len ? "" : "(root)"));
+    vfprintf(stderr, fmt, args);
+    fputc('\n', stderr);
+}
+
+// Report an error at the current path (key: optional member name appended to the path)
+static void loader_error(loader_t *ld, const char *key, const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    loader_vreport(ld, "ERROR", key, fmt, args);
+    va_end(args);
+    ld->errors++;
+}
+
+static void loader_warning(loader_t *ld, const char *key, const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    loader_vreport(ld, "WARNING", key, fmt, args);
+    va_end(args);
+    ld->warnings++;
+}
+
+static const char* json_kind_name(const json_t *json) {
+    switch (json_typeof(json)) {
+        case JSON_OBJECT: return "object";
+        case JSON_ARRAY: return "array";
+        case JSON_STRING: return "string";
+        case JSON_INTEGER: return "integer";
+        case JSON_REAL: return "number";
+        case JSON_TRUE:
+        case JSON_FALSE: return "boolean";
+        default: return "null";
+    }
+}
+
+static const char* member_kind_name(member_kind_t kind) {
+    switch (kind) {
+        case KIND_OBJECT: return "object";
+        case KIND_ARRAY: return "array";
+        case KIND_STRING: return "string";
+        case KIND_INTEGER: return "integer";
+        case KIND_BOOLEAN: return "boolean";
+        default: return "key name or code";
+    }
+}
+
+static int member_kind_matches(const json_t *json, member_kind_t kind) {
+    switch (kind) {
+        case KIND_OBJECT: return json_is_object(json);
+        case KIND_ARRAY: return json_is_array(json);
+        case KIND_STRING: return json_is_string(json);
+        case KIND_INTEGER: return json_is_integer(json);
+        case KIND_BOOLEAN: return json_is_boolean(json);
+        default: return json_is_string(json) || json_is_integer(json);
+    }
+}
+
+// Look up a member and check its type
+// Returns the member, or NULL if absent (error if required) or of the wrong type (error)
+static json_t* get_member(loader_t *ld, json_t *obj, const char *key, member_kind_t kind, int required) {
+    json_t *member = json_object_get(obj, key);
+    if (!member) {
+        if (required) loader_error(ld, key, "missing required %s", member_kind_name(kind));
+        return NULL;
+    }
+    if (!member_kind_matches(member, kind)) {
+        loader_error(ld, key, "expected %s, got %s", member_kind_name(kind), json_kind_name(member));
+        return NULL;
+    }
+    return member;
+}
+
+// Warn about members the schema does not know (usually typos)
+static void check_members(loader_t *ld, json_t *obj, const char *const allowed[]) {
+    const char *key;
+    json_t *value;
+    json_object_foreach(obj, key, value) {
+        int known = 0;
+        for (int i = 0; allowed[i]; i++) {
+            if (strcmp(key, allowed[i]) == 0) {
+                known = 1;
+                break;
+            }
+        }
+        if (!known) loader_warning(ld, key, "unknown field (ignored)");
+    }
+}
+
+// Copy a string into the config arena
+// Returns the copy, or NULL on allocation failure (reported)
+static const char* loader_strdup(loader_t *ld, const char *key, const char *s) {
+    const char *copy = arena_strdup(ld->arena, s);
+    if (!copy) loader_error(ld, key, "out of memory");
+    return copy;
+}
+
+// Optional string member copied into the arena
+// Returns 0 on success (*out = copy, or fallback if absent), -1 on error
+static int get_string(loader_t *ld, json_t *obj, const char *key, const char *fallback, const char **out) {
+    *out = fallback;
+    if (!json_object_get(obj, key)) return 0;
+
+    json_t *member = get_member(ld, obj, key, KIND_STRING, 0);
+    if (!member) return -1;
+
+    const char *copy = loader_strdup(ld, key, json_string_value(member));
+    if (!copy) return -1;
+    *out = copy;
+    return 0;
+}
+
+// Optional integer member within [min, max]
+// Returns 0 on success (*out untouched if absent), -1 on error
+static int get_int(loader_t *ld, json_t *obj, const char *key, int min, int max, int *out) {
+    if (!json_object_get(obj, key)) return 0;
+
+    json_t *member = get_member(ld, obj, key, KIND_INTEGER, 0);
+    if (!member) return -1;
+
+    json_int_t value = json_integer_value(member);
+    if (value < min || value > max) {
+        loader_error(ld, key, "%lld out of range %d-%d", (long long)value, min, max);
+        return -1;
+    }
+    *out = (int)value;
+    return 0;
+}
+
+// Optional boolean member
+// Returns 0 on success (*out untouched if absent), -1 on error
+static int get_bool(loader_t *ld, json_t *obj, const char *key, int *out) {
+    if (!json_object_get(obj, key)) return 0;
+
+    json_t *member = get_member(ld, obj, key, KIND_BOOLEAN, 0);
+    if (!member) return -1;
+    *out = json_is_true(member) ? 1 : 0;
+    return 0;
+}
+
+// Resolve a key member (name string or event code)
+// Returns 0 on success, -1 on error
+static int get_key(loader_t *ld, json_t *obj, const char *key, const char **name, int *code, int *type) {
+    json_t *member = get_member(ld, obj, key, KIND_KEY, 1);
+    if (!member) return -1;
+
+    if (json_is_integer(member)) {
+        json_int_t value = json_integer_value(member);
+        if (value < 0 || value > KEY_MAX) {
+            loader_error(ld, key, "event code %lld out of range 0-%d", (long long)value, KEY_MAX);
+            return -1;
+        }
+        char number[16];
+        snprintf(number, sizeof(number), "%d", (int)value);
+        *code = (int)value;
+        *type = EV_KEY;
+        *name = loader_strdup(ld, key, number);
+    } else {
+        const char *key_name = json_string_value(member);
+        if (resolve_key_name(key_name, code, type) != 0) {
+            loader_error(ld, key, "unknown key name '%s' (see KEY-REFERENCE.md)", key_name);
+            return -1;
+        }
+        *name = loader_strdup(ld, key, key_name);
+    }
+    return *name ? 0 : -1;
+}
+
+// Parse config.realtime: {"enabled", "policy": "fifo"|"rr", "priority", "lock_memory", "cpu"}
+// Returns 0 on success, -1 on error (invalid members keep their defaults)
+static int parse_realtime(loader_t *ld, json_t *realtime_json, realtime_config_t *realtime) {
+    int rc = 0;
+
+    if (get_bool(ld, realtime_json, "enabled", &realtime->enabled) != 0) rc = -1;
+
+    const char *policy = NULL;
+    if (get_string(ld, realtime_json, "policy", NULL, &policy) != 0) {
+        rc = -1;
+    } else if (policy) {
+        if (strcmp(policy, "rr") == 0 || strcmp(policy, "SCHED_RR") == 0) {
+            realtime->policy = SCHED_RR;
+        } else if (strcmp(policy, "fifo") == 0 || strcmp(policy, "SCHED_FIFO") == 0) {
+            realtime->policy = SCHED_FIFO;
+        } else {
+            loader_error(ld, "policy", "unknown policy '%s' (fifo, rr)", policy);
+            rc = -1;
+        }
+    }
+
+    if (get_int(ld, realtime_json, "priority", 1, 99, &realtime->priority) != 0) rc = -1;
+    if (get_bool(ld, realtime_json, "lock_memory", &realtime->lock_memory) != 0) rc = -1;
+    if (get_int(ld, realtime_json, "cpu", -1, CONFIG_MAX_CPU, &realtime->cpu) != 0) rc = -1;
+
+    check_members(ld, realtime_json, g_realtime_members);
+    return rc;
+}
+
+// Parse config.workers (thread count) and config.worker_cpus (CPU per worker)
+// Returns 0 on success, -1 on error
+static int parse_workers(loader_t *ld, json_t *config_obj, config_t *config) {
+    int rc = 0;
+
+    if (get_int(ld, config_obj, "workers", 0, MAX_WORKERS, &config->workers) != 0) rc = -1;
+
+    if (!json_object_get(config_obj, "worker_cpus")) return rc;
+    json_t *cpus_json = get_member(ld, config_obj, "worker_cpus", KIND_ARRAY, 0);
+    if (!cpus_json) return -1;
+
+    if (json_array_size(cpus_json) > MAX_WORKERS) {
+        loader_error(ld, "worker_cpus", "more than %d entries", MAX_WORKERS);
+        return -1;
+    }
+
+    size_t mark = path_push_key(ld, "worker_cpus");
+    size_t i;
+    json_t *cpu_json;
+    json_array_foreach(cpus_json, i, cpu_json) {
+        size_t item = path_push_index(ld, i);
+        if (!json_is_integer(cpu_json) || json_integer_value(cpu_json) < -1 ||
+            json_integer_value(cpu_json) > CONFIG_MAX_CPU) {
+            loader_error(ld, NULL, "expected a CPU number or -1");
+            rc = -1;
+        } else {
+            config->worker_cpus[i] = (int)json_integer_value(cpu_json);
+        }
+        path_pop(ld, item);
+    }
+    path_pop(ld, mark);
+    return rc;
+}
+
+// Resolve a capability name: an event type ("EV_REL"), an event code by its
+// kernel name ("REL_WHEEL", "BTN_LEFT", "ABS_X"), or a key name from the key database
+// Returns 0 on success, -1 if unknown
+static int resolve_capability(const char *name, device_capability_t *cap) {
+    char upper[64];
+    size_t len = strlen(name);
+    if (len == 0 || len >= sizeof(upper)) return -1;
+    for (size_t i = 0; i <= len; i++) {
+        upper[i] = (char)toupper((unsigned char)name[i]);
+    }
+
+    int type = libevdev_event_type_from_name(upper);
+    if (type >= 0) {
+        cap->type = type;
+        cap->code = -1;
         return 0;
     }
+
+    static const struct { const char *prefix; int type; } prefixes[] = {
+        { "KEY_", EV_KEY }, { "BTN_", EV_KEY }, { "REL_", EV_REL }, { "ABS_", EV_ABS },
+        { "SW_", EV_SW }, { "LED_", EV_LED }, { "MSC_", EV_MSC }, { NULL, 0 }
+    };
+    for (int i = 0; prefixes[i].prefix; i++) {
+        if (strncmp(upper, prefixes[i].prefix, strlen(prefixes[i].prefix)) != 0) continue;
+        int code = libevdev_event_code_from_name(prefixes[i].type, upper);
+        if (code < 0) break;
+        cap->type = prefixes[i].type;
+        cap->code = code;
+        return 0;
+    }
+
+    return resolve_key_name(name, &cap->code, &cap->type);
+}
+
+// Parse a capability list (match.require / match.forbid)
+// Returns 0 on success, -1 on error
+static int parse_capabilities(loader_t *ld, json_t *match_json, const char *key,
+                              device_capability_t **caps, int *count) {
+    if (!json_object_get(match_json, key)) return 0;
+
+    json_t *caps_json = get_member(ld, match_json, key, KIND_ARRAY, 0);
+    if (!caps_json) return -1;
+    if (json_array_size(caps_json) == 0) return 0;
+
+    *caps = arena_alloc(ld->arena, json_array_size(caps_json) * sizeof(device_capability_t));
+    if (!*caps) {
+        loader_error(ld, key, "out of memory");
+        return -1;
+    }
+
+    int rc = 0;
+    size_t mark = path_push_key(ld, key);
+    size_t i;
+    json_t *cap_json;
+    json_array_foreach(caps_json, i, cap_json) {
+        size_t item = path_push_index(ld, i);
+        if (!json_is_string(cap_json)) {
+            loader_error(ld, NULL, "expected string, got %s", json_kind_name(cap_json));
+            rc = -1;
+        } else if (resolve_capability(json_string_value(cap_json), &(*caps)[*count]) != 0) {
+            loader_error(ld, NULL, "unknown capability '%s' (EV_*, KEY_*, BTN_*, REL_*, ABS_*, SW_*, LED_*, MSC_* or key name)",
+                         json_string_value(cap_json));
+            rc = -1;
+        } else {
+            (*count)++;
+        }
+        path_pop(ld, item);
+    }
+    path_pop(ld, mark);
+    return rc;
+}
+
+// Parse device.offload: true / false, or the backend name ("keymap", "hid-bpf")
+// Returns 0 on success, -1 on error
+static int parse_offload(loader_t *ld, json_t *device_json, int *offload) {
+    json_t *offload_json = json_object_get(device_json, "offload");
+    if (!offload_json || json_is_boolean(offload_json)) {
+        return get_bool(ld, device_json, "offload", offload);
+    }
+
+    if (!json_is_string(offload_json)) {
+        loader_error(ld, "offload", "expected boolean or string, got %s", json_kind_name(offload_json));
+        return -1;
+    }
+    const char *name = json_string_value(offload_json);
+    if (strcmp(name, "keymap") == 0) {
+        *offload = OFFLOAD_KEYMAP;
+    } else if (strcmp(name, "hid-bpf") == 0) {
+        *offload = OFFLOAD_HID_BPF;
+    } else {
+        loader_error(ld, "offload", "unknown backend '%s' (keymap, hid-bpf)", name);
+        return -1;
+    }
+    return 0;
+}
+
+// Resolve a relative axis name: "x", "y", "wheel", "hwheel" or a REL_* name
+// Returns the axis, -1 if unknown
+static int resolve_rel_axis(const char *name) {
+    static const struct { const char *name; int code; } aliases[] = {
+        { "x", REL_X }, { "y", REL_Y }, { "wheel", REL_WHEEL }, { "hwheel", REL_HWHEEL }, { NULL, 0 }
+    };
+    for (int i = 0; aliases[i].name; i++) {
+        if (strcasecmp(name, aliases[i].name) == 0) return aliases[i].code;
+    }
+
+    char upper[32];
+    size_t len = strlen(name);
+    if (len == 0 || len >= sizeof(upper)) return -1;
+    for (size_t i = 0; i <= len; i++) {
+        upper[i] = (char)toupper((unsigned char)name[i]);
+    }
+    return libevdev_event_code_from_name(EV_REL, upper);
+}
+
+// Parse device.invert: relative axes whose direction is reversed
+// The high-resolution wheel axes follow their wheel
+// Returns 0 on success, -1 on error
+static int parse_invert(loader_t *ld, json_t *device_json, uint32_t *invert_rel) {
+    if (!json_object_get(device_json, "invert")) return 0;
+
+    json_t *invert_json = get_member(ld, device_json, "invert", KIND_ARRAY, 0);
+    if (!invert_json) return -1;
+
+    int rc = 0;
+    size_t mark = path_push_key(ld, "invert");
+    size_t i;
+    json_t *axis_json;
+    json_array_foreach(invert_json, i, axis_json) {
+        size_t item = path_push_index(ld, i);
+        int axis;
+        if (!json_is_string(axis_json)) {
+            loader_error(ld, NULL, "expected string, got %s", json_kind_name(axis_json));
+            rc = -1;
+        } else if ((axis = resolve_rel_axis(json_string_value(axis_json))) < 0 || axis > REL_MAX) {
+            loader_error(ld, NULL, "unknown axis '%s' (x, y, wheel, hwheel or REL_*)", json_string_value(axis_json));
+            rc = -1;
+        } else {
+            *invert_rel |= 1u << axis;
+        }
+        path_pop(ld, item);
+    }
+    path_pop(ld, mark);
+
+    if (*invert_rel & (1u << REL_WHEEL)) *invert_rel |= 1u << REL_WHEEL_HI_RES;
+    if (*invert_rel & (1u << REL_HWHEEL)) *invert_rel |= 1u << REL_HWHEEL_HI_RES;
+    return rc;
+}
+
+// Parse device.scroll: {"button", "speed", "tap_ms"}
+// Returns 0 on success, -1 on error
+static int parse_scroll(loader_t *ld, json_t *scroll_json, scroll_config_t *scroll) {
+    int rc = 0;
+    const char *name;
+    int type;
+
+    scroll->speed = CONFIG_SCROLL_SPEED;
+    scroll->tap_ms = CONFIG_SCROLL_TAP_MS;
+    if (get_key(ld, scroll_json, "button", &name, &scroll->button, &type) != 0) {
+        rc = -1;
+    } else if (type != EV_KEY || scroll->button == KEY_RESERVED) {
+        loader_error(ld, "button", "'%s' is not a button", name);
+        rc = -1;
+    }
+    if (get_int(ld, scroll_json, "speed", 1, CONFIG_MAX_SCROLL_SPEED, &scroll->speed) != 0) rc = -1;
+    if (get_int(ld, scroll_json, "tap_ms", 0, CONFIG_MAX_SCROLL_TAP_MS, &scroll->tap_ms) != 0) rc = -1;
+    check_members(ld, scroll_json, g_scroll_members);
+
+    if (rc != 0) scroll->button = 0;
+    return rc;
+}
+
+// Parse device.scanner: {"output", "timeout_ms"}
+// Returns 0 on success, -1 on error
+static int parse_scanner(loader_t *ld, json_t *scanner_json, scanner_config_t *scanner) {
+    int rc = 0;
+
+    scanner->timeout_ms = CONFIG_SCANNER_TIMEOUT_MS;
+    if (get_int(ld, scanner_json, "timeout_ms", 1, CONFIG_MAX_SCANNER_TIMEOUT_MS, &scanner->timeout_ms) != 0) rc = -1;
+    check_members(ld, scanner_json, g_scanner_members);
+
+    json_t *output_json = get_member(ld, scanner_json, "output", KIND_STRING, 1);
+    const char *output = output_json ? json_string_value(output_json) : NULL;
+    if (!output) {
+        rc = -1;
+    } else if (output[0] == '\0' || strlen(output) >= sizeof(((struct sockaddr_un *)0)->sun_path)) {
+        loader_error(ld, "output", "expected socket or FIFO path (1-%zu characters)",
+                     sizeof(((struct sockaddr_un *)0)->sun_path) - 1);
+        rc = -1;
+    } else if (rc == 0) {
+        scanner->output = loader_strdup(ld, "output", output);
+        if (!scanner->output) rc = -1;
+    }
+
+    if (rc != 0) scanner->output = NULL;
+    return rc;
+}
+
+// Parse a gesture stroke: "U", "D", "L", "R" in stroke order, no direction twice in a row
+// Returns 0 on success, -1 if invalid
+static int parse_stroke(const char *text, uint32_t *stroke) {
+    static const char directions[] = "UDLR";
+    int length = 0;
+    int last = 0;
+
+    *stroke = 0;
+    for (const char *c = text; *c; c++) {
+        const char *found = strchr(directions, toupper((unsigned char)*c));
+        int direction = found ? (int)(found - directions) + 1 : 0;
+        if (!direction || direction == last || ++length > GESTURE_MAX_STROKE) return -1;
+        *stroke = *stroke * 5 + (uint32_t)direction;
+        last = direction;
+    }
+    return length > 0 ? 0 : -1;
+}
+
+// Parse a key combo: key names joined by '+' ("left_control+t")
+// Returns 0 on success, -1 on error (reported at key)
+static int parse_combo(loader_t *ld, const char *key, const char *text, key_combo_t *combo) {
+    char buf[256];
+    if (snprintf(buf, sizeof(buf), "%s", text) >= (int)sizeof(buf)) {
+        loader_error(ld, key, "key combo too long");
+        return -1;
+    }
+
+    combo->key_count = 0;
+    char *save = NULL;
+    for (char *name = strtok_r(buf, "+", &save); name; name = strtok_r(NULL, "+", &save)) {
+        int code;
+        int type;
+        if (resolve_key_name(name, &code, &type) != 0) {
+            loader_error(ld, key, "unknown key name '%s' (see KEY-REFERENCE.md)", name);
+            return -1;
+        }
+        if (type != EV_KEY || code == KEY_RESERVED) {
+            loader_error(ld, key, "'%s' is not a key", name);
+            return -1;
+        }
+        if (combo->key_count == COMBO_MAX_KEYS) {
+            loader_error(ld, key, "more than %d keys", COMBO_MAX_KEYS);
+            return -1;
+        }
+        combo->keys[combo->key_count++] = code;
+    }
+    if (combo->key_count == 0) {
+        loader_error(ld, key, "no keys");
+        return -1;
+    }
+    return 0;
+}
+
+// Parse device.gestures: {"button", "threshold", "strokes": {"<stroke>": "<combo>", ...}}
+// Returns 0 on success, -1 on error
+static int parse_gestures(loader_t *ld, json_t *gestures_json, gesture_config_t *gestures) {
+    int rc = 0;
+    const char *name;
+    int type;
+
+    gestures->threshold = CONFIG_GESTURE_THRESHOLD;
+    if (get_key(ld, gestures_json, "button", &name, &gestures->button, &type) != 0) {
+        rc = -1;
+    } else if (type != EV_KEY || gestures->button == KEY_RESERVED) {
+        loader_error(ld, "button", "'%s' is not a button", name);
+        rc = -1;
+    }
+    if (get_int(ld, gestures_json, "threshold", 1, CONFIG_MAX_GESTURE_THRESHOLD, &gestures->threshold) != 0) rc = -1;
+    check_members(ld, gestures_json, g_gesture_members);
+
+    json_t *strokes_json = get_member(ld, gestures_json, "strokes", KIND_OBJECT, 1);
+    if (!strokes_json) {
+        rc = -1;
+    } else if (json_object_size(strokes_json) == 0) {
+        loader_error(ld, "strokes", "no strokes");
+        rc = -1;
+    } else {
+        gestures->strokes = arena_alloc(ld->arena, json_object_size(strokes_json) * sizeof(gesture_t));
+        if (!gestures->strokes) {
+            loader_error(ld, "strokes", "out of memory");
+            gestures->button = 0;
+            return -1;
+        }
+
+        size_t mark = path_push_key(ld, "strokes");
+        const char *stroke;
+        json_t *combo_json;
+        json_object_foreach(strokes_json, stroke, combo_json) {
+            gesture_t *gesture = &gestures->strokes[gestures->stroke_count];
+            if (parse_stroke(stroke, &gesture->stroke) != 0) {
+                loader_error(ld, stroke, "not a stroke (1-%d of U, D, L, R, no direction twice in a row)",
+                             GESTURE_MAX_STROKE);
+                rc = -1;
+            } else if (!json_is_string(combo_json)) {
+                loader_error(ld, stroke, "expected key combo string, got %s", json_kind_name(combo_json));
+                rc = -1;
+            } else if (parse_combo(ld, stroke, json_string_value(combo_json), &gesture->combo) != 0) {
+                rc = -1;
+            } else {
+                // "L" and "l" are the same stroke
+                int i = 0;
+                while (i < gestures->stroke_count && gestures->strokes[i].stroke != gesture->stroke) i++;
+                if (i < gestures->stroke_count) {
+                    loader_error(ld, stroke, "stroke given twice");
+                    rc = -1;
+                } else {
+                    gestures->stroke_count++;
+                }
+            }
+        }
+        path_pop(ld, mark);
+    }
+
+    if (rc != 0) gestures->button = 0;
+    return rc;
+}
+
+// Parse one device.mouse_keys.keys entry: key name -> direction or button
+// Returns 0 on success, -1 on error (reported at name)
+static int parse_mouse_key(loader_t *ld, const char *name, json_t *action_json, mouse_key_t *key) {
+    int type;
+    memset(key, 0, sizeof(*key));
+    if (resolve_key_name(name, &key->code, &type) != 0) {
+        loader_error(ld, name, "unknown key name '%s' (see KEY-REFERENCE.md)", name);
+        return -1;
+    }
+    if (type != EV_KEY || key->code == KEY_RESERVED) {
+        loader_error(ld, name, "'%s' is not a key", name);
+        return -1;
+    }
+    if (!json_is_string(action_json)) {
+        loader_error(ld, name, "expected direction or button name, got %s", json_kind_name(action_json));
+        return -1;
+    }
+
+    // Directions first: "left" and "right" are also button aliases
+    const char *action = json_string_value(action_json);
+    for (int i = 0; g_mouse_key_directions[i].name; i++) {
+        if (strcmp(action, g_mouse_key_directions[i].name) == 0) {
+            key->dx = g_mouse_key_directions[i].dx;
+            key->dy = g_mouse_key_directions[i].dy;
+            return 0;
+        }
+    }
+    if (resolve_key_name(action, &key->button, &type) != 0 || type != EV_KEY ||
+        key->button < BTN_MOUSE || key->button >= BTN_JOYSTICK) {
+        loader_error(ld, name, "'%s' is neither a direction (up, down_left, ...) nor a mouse button", action);
+        return -1;
+    }
+    return 0;
+}
+
+// Parse device.mouse_keys: {"keys": {"<key>": "<direction or button>", ...},
+// "interval_ms", "speed", "max_speed", "accel_ms", "curve"}
+// Returns 0 on success, -1 on error
+static int parse_mouse_keys(loader_t *ld, json_t *mouse_keys_json, mouse_keys_config_t *mouse_keys) {
+    int rc = 0;
+
+    mouse_keys->interval_ms = CONFIG_MOUSE_KEYS_INTERVAL_MS;
+    mouse_keys->speed = CONFIG_MOUSE_KEYS_SPEED;
+    mouse_keys->max_speed = CONFIG_MOUSE_KEYS_MAX_SPEED;
+    mouse_keys->accel_ms = CONFIG_MOUSE_KEYS_ACCEL_MS;
+    mouse_keys->curve = CONFIG_MOUSE_KEYS_CURVE;
+    if (get_int(ld, mouse_keys_json, "interval_ms", 1, CONFIG_MAX_MOUSE_KEYS_INTERVAL_MS, &mouse_keys->interval_ms) != 0) rc = -1;
+    if (get_int(ld, mouse_keys_json, "speed", 1, CONFIG_MAX_MOUSE_KEYS_SPEED, &mouse_keys->speed) != 0) rc = -1;
+    if (get_int(ld, mouse_keys_json, "max_speed", 1, CONFIG_MAX_MOUSE_KEYS_SPEED, &mouse_keys->max_speed) != 0) rc = -1;
+    if (get_int(ld, mouse_keys_json, "accel_ms", 0, CONFIG_MAX_MOUSE_KEYS_ACCEL_MS, &mouse_keys->accel_ms) != 0) rc = -1;
+    if (get_int(ld, mouse_keys_json, "curve", 1, CONFIG_MAX_MOUSE_KEYS_CURVE, &mouse_keys->curve) != 0) rc = -1;
+    if (rc == 0 && mouse_keys->max_speed < mouse_keys->speed) {
+        loader_error(ld, "max_speed", "below speed (%d)", mouse_keys->speed);
+        rc = -1;
+    }
+    check_members(ld, mouse_keys_json, g_mouse_keys_members);
+
+    json_t *keys_json = get_member(ld, mouse_keys_json, "keys", KIND_OBJECT, 1);
+    if (!keys_json) return -1;
+    if (json_object_size(keys_json) == 0) {
+        loader_error(ld, "keys", "no keys");
+        return -1;
+    }
+    mouse_keys->keys = arena_alloc(ld->arena, json_object_size(keys_json) * sizeof(mouse_key_t));
+    if (!mouse_keys->keys) {
+        loader_error(ld, "keys", "out of memory");
+        return -1;
+    }
+
+    size_t mark = path_push_key(ld, "keys");
+    const char *name;
+    json_t *action_json;
+    json_object_foreach(keys_json, name, action_json) {
+        mouse_key_t *key = &mouse_keys->keys[mouse_keys->key_count];
+        if (parse_mouse_key(ld, name, action_json, key) != 0) {
+            rc = -1;
+        } else if (key_state_test(&mouse_keys->sources, key->code)) {
+            loader_error(ld, name, "key given twice");
+            rc = -1;
+        } else {
+            key_state_set(&mouse_keys->sources, key->code, 1);
+            mouse_keys->key_count++;
+        }
+    }
+    path_pop(ld, mark);
+
+    if (rc != 0) mouse_keys->key_count = 0;
+    return rc;
+}
+
+// Parse the keys of a sequence: key names separated by spaces ("caps_lock g s")
+// Returns 0 on success, -1 on error (reported at name)
+static int parse_sequence_keys(loader_t *ld, const char *name, sequence_t *sequence) {
+    char buf[256];
+    if (snprintf(buf, sizeof(buf), "%s", name) >= (int)sizeof(buf)) {
+        loader_error(ld, name, "sequence too long");
+        return -1;
+    }
+
+    sequence->key_count = 0;
+    char *save = NULL;
+    for (char *key = strtok_r(buf, " ", &save); key; key = strtok_r(NULL, " ", &save)) {
+        int code;
+        int type;
+        if (resolve_key_name(key, &code, &type) != 0) {
+            loader_error(ld, name, "unknown key name '%s' (see KEY-REFERENCE.md)", key);
+            return -1;
+        }
+        if (type != EV_KEY || code == KEY_RESERVED) {
+            loader_error(ld, name, "'%s' is not a key", key);
+            return -1;
+        }
+        if (sequence->key_count == SEQUENCE_MAX_KEYS) {
+            loader_error(ld, name, "more than %d keys", SEQUENCE_MAX_KEYS);
+            return -1;
+        }
+        sequence->keys[sequence->key_count++] = code;
+    }
+    if (sequence->key_count == 0) {
+        loader_error(ld, name, "no keys");
+        return -1;
+    }
+    return 0;
+}
+
+// Parse the expansion of a sequence: key combos separated by spaces
+// ("left_control+s"), or {"text": "..."} typed with the US layout
+// Returns 0 on success, -1 on error (reported at name)
+static int parse_expansion(loader_t *ld, const char *name, json_t *expansion_json, sequence_t *sequence) {
+    json_t *text_json = expansion_json;
+    int typed = json_is_object(expansion_json);
+    if (typed) {
+        size_t mark = path_push_key(ld, name);
+        check_members(ld, expansion_json, g_expansion_members);
+        text_json = get_member(ld, expansion_json, "text", KIND_STRING, 1);
+        path_pop(ld, mark);
+        if (!text_json) return -1;
+    } else if (!json_is_string(expansion_json)) {
+        loader_error(ld, name, "expected key combos or {\"text\": ...}, got %s", json_kind_name(expansion_json));
+        return -1;
+    }
+
+    // One combo per character or per space-separated word
+    const char *text = json_string_value(text_json);
+    size_t capacity = typed ? strlen(text) : 0;
+    for (const char *c = text; !typed && *c; c++) {
+        if (*c != ' ' && (c == text || c[-1] == ' ')) capacity++;
+    }
+    if (capacity > SEQUENCE_MAX_OUTPUT) {
+        loader_error(ld, name, "expansion longer than %d key combos", SEQUENCE_MAX_OUTPUT);
+        return -1;
+    }
+    sequence->output = arena_alloc(ld->arena, (capacity > 0 ? capacity : 1) * sizeof(key_combo_t));
+    if (!sequence->output) {
+        loader_error(ld, name, "out of memory");
+        return -1;
+    }
+    sequence->output_count = 0;
+
+    if (typed) {
+        for (const char *c = text; *c; c++) {
+            int code;
+            int shift;
+            if (resolve_layout_char(*c, &code, &shift) != 0) {
+                loader_error(ld, name, "cannot type byte 0x%02x (printable ASCII, newline and tab only)", (unsigned char)*c);
+                return -1;
+            }
+            key_combo_t *combo = &sequence->output[sequence->output_count++];
+            combo->key_count = 0;
+            if (shift) combo->keys[combo->key_count++] = KEY_LEFTSHIFT;
+            combo->keys[combo->key_count++] = code;
+        }
+    } else {
+        char buf[4096];
+        if (snprintf(buf, sizeof(buf), "%s", text) >= (int)sizeof(buf)) {
+            loader_error(ld, name, "expansion too long");
+            return -1;
+        }
+        char *save = NULL;
+        for (char *combo = strtok_r(buf, " ", &save); combo; combo = strtok_r(NULL, " ", &save)) {
+            if (parse_combo(ld, name, combo, &sequence->output[sequence->output_count]) != 0) return -1;
+            sequence->output_count++;
+        }
+    }
+    if (sequence->output_count == 0) {
+        loader_error(ld, name, "empty expansion");
+        return -1;
+    }
+    return 0;
+}
+
+// Check whether key sequence a occurs in b (b may equal a)
+static int sequence_within(const sequence_t *a, const sequence_t *b) {
+    for (int start = 0; start + a->key_count <= b->key_count; start++) {
+        int k = 0;
+        while (k < a->key_count && b->keys[start + k] == a->keys[k]) k++;
+        if (k == a->key_count) return 1;
+    }
+    return 0;
+}
+
+// Build the Aho-Corasick automaton of the sequences: a trie over their keys whose
+// missing transitions are filled in from the failure links (breadth first), so a
+// mismatch lands directly on the longest suffix that still starts a sequence
+// No sequence occurs in another, so only trie leaves complete one
+// Returns 0 on success, -1 on error (reported)
+static int compile_sequences(loader_t *ld, sequence_config_t *sequences) {
+    int bound = 1;
+    for (int i = 0; i < sequences->rule_count; i++) bound += sequences->rules[i].key_count;
+    if (bound > INT16_MAX) {
+        loader_error(ld, "expand", "too many sequences (%d keys in all, max %d)", bound - 1, INT16_MAX - 1);
+        return -1;
+    }
+
+    sequences->symbols = arena_alloc(ld->arena, KEY_CNT);
+    if (!sequences->symbols) {
+        loader_error(ld, "expand", "out of memory");
+        return -1;
+    }
+    memset(sequences->symbols, 0, KEY_CNT);
+    sequences->symbol_count = 0;
+    for (int i = 0; i < sequences->rule_count; i++) {
+        const sequence_t *sequence = &sequences->rules[i];
+        for (int k = 0; k < sequence->key_count; k++) {
+            if (sequences->symbols[sequence->keys[k]]) continue;
+            if (sequences->symbol_count == UINT8_MAX) {
+                loader_error(ld, "expand", "more than %d different keys", UINT8_MAX);
+                return -1;
+            }
+            sequences->symbols[sequence->keys[k]] = (uint8_t)++sequences->symbol_count;
+        }
+    }
+
+    int symbols = sequences->symbol_count;
+    sequences->next = arena_alloc(ld->arena, (size_t)bound * symbols * sizeof(int16_t));
+    sequences->depth = arena_alloc(ld->arena, (size_t)bound * sizeof(uint8_t));
+    sequences->match = arena_alloc(ld->arena, (size_t)bound * sizeof(int16_t));
+    int *fail = malloc((size_t)bound * sizeof(int));
+    int *queue = malloc((size_t)bound * sizeof(int));
+    if (!sequences->next || !sequences->depth || !sequences->match || !fail || !queue) {
+        free(fail);
+        free(queue);
+        loader_error(ld, "expand", "out of memory");
+        return -1;
+    }
+    for (int i = 0; i < bound * symbols; i++) sequences->next[i] = -1;
+
+    // Trie
+    int count = 1;
+    sequences->depth[0] = 0;
+    sequences->match[0] = -1;
+    for (int i = 0; i < sequences->rule_count; i++) {
+        const sequence_t *sequence = &sequences->rules[i];
+        int state = 0;
+        for (int k = 0; k < sequence->key_count; k++) {
+            int16_t *to = &sequences->next[state * symbols + sequences->symbols[sequence->keys[k]] - 1];
+            if (*to < 0) {
+                sequences->depth[count] = (uint8_t)(sequences->depth[state] + 1);
+                sequences->match[count] = -1;
+                *to = (int16_t)count++;
+            }
+            state = *to;
+        }
+        sequences->match[state] = (int16_t)i;
+    }
+
+    // Failure links and the full transition table
+    int head = 0;
+    int tail = 0;
+    for (int a = 0; a < symbols; a++) {
+        int16_t *to = &sequences->next[a];
+        if (*to < 0) {
+            *to = 0;
+        } else {
+            fail[*to] = 0;
+            queue[tail++] = *to;
+        }
+    }
+    while (head < tail) {
+        int state = queue[head++];
+        for (int a = 0; a < symbols; a++) {
+            int16_t *to = &sequences->next[state * symbols + a];
+            int fallback = sequences->next[fail[state] * symbols + a];
+            if (*to < 0) {
+                *to = (int16_t)fallback;
+            } else {
+                fail[*to] = fallback;
+                queue[tail++] = *to;
+            }
+        }
+    }
+    sequences->state_count = count;
+
+    free(fail);
+    free(queue);
+    return 0;
+}
+
+// Parse device.sequences: {"timeout_ms", "expand": {"<keys>": "<combos>" | {"text": "..."}, ...}}
+// Returns 0 on success, -1 on error
+static int parse_sequences(loader_t *ld, json_t *sequences_json, sequence_config_t *sequences) {
+    int rc = 0;
+
+    sequences->timeout_ms = CONFIG_SEQUENCE_TIMEOUT_MS;
+    if (get_int(ld, sequences_json, "timeout_ms", 1, CONFIG_MAX_SEQUENCE_TIMEOUT_MS, &sequences->timeout_ms) != 0) rc = -1;
+    check_members(ld, sequences_json, g_sequences_members);
+
+    json_t *expand_json = get_member(ld, sequences_json, "expand", KIND_OBJECT, 1);
+    if (!expand_json) return -1;
+    if (json_object_size(expand_json) == 0) {
+        loader_error(ld, "expand", "no sequences");
+        return -1;
+    }
+    sequences->rules = arena_alloc(ld->arena, json_object_size(expand_json) * sizeof(sequence_t));
+    if (!sequences->rules) {
+        loader_error(ld, "expand", "out of memory");
+        return -1;
+    }
+
+    size_t mark = path_push_key(ld, "expand");
+    const char *name;
+    json_t *expansion_json;
+    json_object_foreach(expand_json, name, expansion_json) {
+        sequence_t *sequence = &sequences->rules[sequences->rule_count];
+        memset(sequence, 0, sizeof(*sequence));
+        if (parse_sequence_keys(ld, name, sequence) != 0 || parse_expansion(ld, name, expansion_json, sequence) != 0) {
+            rc = -1;
+            continue;
+        }
+
+        // Held back keys are matched against every sequence at once: one inside
+        // another would always complete first
+        int i = 0;
+        while (i < sequences->rule_count && !sequence_within(&sequences->rules[i], sequence) &&
+               !sequence_within(sequence, &sequences->rules[i])) {
+            i++;
+        }
+        if (i < sequences->rule_count) {
+            loader_error(ld, name, "overlaps '%s': one sequence occurs in the other", sequences->rules[i].name);
+            rc = -1;
+            continue;
+        }
+        sequence->name = loader_strdup(ld, name, name);
+        if (!sequence->name) {
+            rc = -1;
+            continue;
+        }
+        sequences->rule_count++;
+    }
+    if (rc == 0 && compile_sequences(ld, sequences) != 0) rc = -1;
+    path_pop(ld, mark);
+
+    if (rc != 0) sequences->rule_count = 0;
+    return rc;
+}
+
+// Check whether any rule of the device, in any profile, has code as its source
+static int is_remapped(const device_config_t *device, int code) {
+    if (key_state_test(&device->remap_keys, code)) return 1;
+    for (int p = 1; p < device->profile_count; p++) {
+        if (key_state_test(&device->profiles[p].remap_keys, code)) return 1;
+    }
+    return 0;
+}
+
+// Parse device.match: identity predicates beyond identifier/name_match
+// Returns 0 on success, -1 on error
+static int parse_match(loader_t *ld, json_t *match_json, device_match_t *match) {
+    int rc = 0;
+    match->bus = -1;
+    match->version = -1;
+
+    if (get_string(ld, match_json, "phys", NULL, &match->phys) != 0) rc = -1;
+    if (get_string(ld, match_json, "uniq", NULL, &match->uniq) != 0) rc = -1;
+    if (get_string(ld, match_json, "name", NULL, &match->name) != 0) rc = -1;
+    if (get_string(ld, match_json, "usb_port", NULL, &match->usb_port) != 0) rc = -1;
+
+    json_t *bus_json = json_object_get(match_json, "bus");
+    if (json_is_string(bus_json)) {
+        for (int i = 0; g_bus_names[i].name && match->bus < 0; i++) {
+            if (strcasecmp(g_bus_names[i].name, json_string_value(bus_json)) == 0) match->bus = g_bus_names[i].bus;
+        }
+        if (match->bus < 0) {
+            loader_error(ld, "bus", "unknown bus '%s' (usb, bluetooth, i8042, virtual, i2c, host, ... or a number)",
+                         json_string_value(bus_json));
+            rc = -1;
+        }
+    } else if (bus_json && get_int(ld, match_json, "bus", 0, 0xffff, &match->bus) != 0) {
+        rc = -1;
+    }
+
+    // Version as a number or a hex string ("0x0111", as shown by evtest)
+    json_t *version_json = json_object_get(match_json, "version");
+    if (json_is_string(version_json)) {
+        char *end;
+        long version = strtol(json_string_value(version_json), &end, 0);
+        if (*end != '\0' || end == json_string_value(version_json) || version < 0 || version > 0xffff) {
+            loader_error(ld, "version", "invalid version '%s'", json_string_value(version_json));
+            rc = -1;
+        } else {
+            match->version = (int)version;
+        }
+    } else if (version_json && get_int(ld, match_json, "version", 0, 0xffff, &match->version) != 0) {
+        rc = -1;
+    }
+
+    if (parse_capabilities(ld, match_json, "require", &match->require, &match->require_count) != 0) rc = -1;
+    if (parse_capabilities(ld, match_json, "forbid", &match->forbid, &match->forbid_count) != 0) rc = -1;
+    check_members(ld, match_json, g_match_members);
+
+    match->set = match->phys || match->uniq || match->name || match->usb_port || match->bus >= 0 ||
+                 match->version >= 0 || match->require_count > 0 || match->forbid_count > 0;
+    if (rc == 0 && !match->set) {
+        loader_error(ld, NULL, "no predicates (phys, uniq, name, usb_port, bus, version, require, forbid)");
+        rc = -1;
+    }
+    return rc;
+}
+
+// Parse rule.repeat (true/false, or {"delay_ms", "rate"} in repeats per second)
+// and rule.turbo (presses per second): both generate events for a held key target
+// Returns 0 on success, -1 on error
+static int parse_repeat(loader_t *ld, json_t *remap_json, remap_rule_t *remap) {
+    int rc = 0;
+    int delay_ms = CONFIG_REPEAT_DELAY_MS;
+    int rate = CONFIG_REPEAT_RATE;
+    int enabled = 0;
+
+    json_t *repeat_json = json_object_get(remap_json, "repeat");
+    if (json_is_object(repeat_json)) {
+        size_t mark = path_push_key(ld, "repeat");
+        if (get_int(ld, repeat_json, "delay_ms", 0, CONFIG_MAX_REPEAT_DELAY_MS, &delay_ms) != 0) rc = -1;
+        if (get_int(ld, repeat_json, "rate", 1, CONFIG_MAX_REPEAT_RATE, &rate) != 0) rc = -1;
+        check_members(ld, repeat_json, g_repeat_members);
+        path_pop(ld, mark);
+        enabled = 1;
+    } else if (repeat_json && !json_is_boolean(repeat_json)) {
+        loader_error(ld, "repeat", "expected boolean or object, got %s", json_kind_name(repeat_json));
+        rc = -1;
+    } else if (get_bool(ld, remap_json, "repeat", &enabled) != 0) {
+        rc = -1;
+    }
+
+    int turbo = 0;
+    if (get_int(ld, remap_json, "turbo", 1, CONFIG_MAX_TURBO_RATE, &turbo) != 0) rc = -1;
+    if (rc != 0) return -1;
+
+    if (!enabled && !turbo) return 0;
+    if (enabled && turbo) {
+        loader_error(ld, "turbo", "a rule either repeats or autofires, not both");
+        return -1;
+    }
+    if (remap->target_type != EV_KEY || remap->target_code == KEY_RESERVED) {
+        loader_error(ld, enabled ? "repeat" : "turbo", "target '%s' is never pressed", remap->target_name);
+        return -1;
+    }
+
+    if (enabled) {
+        // Zero delay: the first repeat follows the press after one period
+        remap->repeat_period_ms = 1000 / rate;
+        remap->repeat_delay_ms = delay_ms > 0 ? delay_ms : remap->repeat_period_ms;
+    } else {
+        remap->turbo_period_ms = 1000 / turbo;
+    }
+    return 0;
+}
+
+// Bit of a shared modifier, allocated on first use
+// Returns index, or -1 on error (reported at key)
+static int loader_modifier(loader_t *ld, const char *key, const char *name) {
+    config_t *config = ld->config;
+    if (name[0] == '\0' || name[0] == '!') {
+        loader_error(ld, key, "'%s' is not a modifier name", name);
+        return -1;
+    }
+    int index = config_find_modifier(config, name);
+    if (index >= 0) return index;
+
+    if (config->modifier_count == MAX_MODIFIERS) {
+        loader_error(ld, key, "more than %d modifiers", MAX_MODIFIERS);
+        return -1;
+    }
+    const char *copy = loader_strdup(ld, key, name);
+    if (!copy) return -1;
+    config->modifiers[config->modifier_count] = copy;
+    return config->modifier_count++;
+}
+
+// Parse rule.when: a shared modifier name or an array of names, all of which
+// must be held ("!name": must not be held)
+// Returns 0 on success, -1 on error
+static int parse_when(loader_t *ld, json_t *remap_json, remap_rule_t *remap) {
+    json_t *when_json = json_object_get(remap_json, "when");
+    if (!when_json) return 0;
+
+    json_t *single = json_is_string(when_json) ? when_json : NULL;
+    if (!single && !json_is_array(when_json)) {
+        loader_error(ld, "when", "expected modifier name or array of names, got %s", json_kind_name(when_json));
+        return -1;
+    }
+
+    size_t count = single ? 1 : json_array_size(when_json);
+    for (size_t i = 0; i < count; i++) {
+        json_t *name_json = single ? single : json_array_get(when_json, i);
+        if (!json_is_string(name_json)) {
+            loader_error(ld, "when", "expected modifier name, got %s", json_kind_name(name_json));
+            return -1;
+        }
+        const char *name = json_string_value(name_json);
+        int negate = name[0] == '!';
+        int index = loader_modifier(ld, "when", name + negate);
+        if (index < 0) return -1;
+        if (negate) {
+            remap->when_up |= 1ull << index;
+        } else {
+            remap->when_down |= 1ull << index;
+        }
+    }
+    if (remap->when_down & remap->when_up) {
+        loader_error(ld, "when", "a modifier is both required and excluded");
+        return -1;
+    }
+    return 0;
+}
+
+// Parse device.modifiers: {"<key>": "<modifier name>", ...}; every modifier is set
+// by one device only
+// Returns 0 on success, -1 on error
+static int parse_modifiers(loader_t *ld, json_t *modifiers_json, device_config_t *device) {
+    int rc = 0;
+    device->modifier_keys = arena_alloc(ld->arena, json_object_size(modifiers_json) * sizeof(modifier_key_t));
+    if (json_object_size(modifiers_json) > 0 && !device->modifier_keys) {
+        loader_error(ld, NULL, "out of memory");
+        return -1;
+    }
+
+    const config_t *config = ld->config;
+    const char *key;
+    json_t *name_json;
+    json_object_foreach(modifiers_json, key, name_json) {
+        modifier_key_t *modifier = &device->modifier_keys[device->modifier_key_count];
+        int type;
+        if (resolve_key_name(key, &modifier->code, &type) != 0) {
+            loader_error(ld, key, "unknown key name '%s' (see KEY-REFERENCE.md)", key);
+            rc = -1;
+            continue;
+        }
+        if (type != EV_KEY || modifier->code == KEY_RESERVED) {
+            loader_error(ld, key, "'%s' is not a key", key);
+            rc = -1;
+            continue;
+        }
+        if (!json_is_string(name_json)) {
+            loader_error(ld, key, "expected modifier name, got %s", json_kind_name(name_json));
+            rc = -1;
+            continue;
+        }
+        modifier->modifier = loader_modifier(ld, key, json_string_value(name_json));
+        if (modifier->modifier < 0) {
+            rc = -1;
+            continue;
+        }
+        modifier->name = config->modifiers[modifier->modifier];
+
+        // Two devices would fight over the bit
+        for (int d = 0; d < config->device_count; d++) {
+            const device_config_t *other = &config->devices[d];
+            for (int m = 0; m < other->modifier_key_count; m++) {
+                if (other->modifier_keys[m].modifier == modifier->modifier) {
+                    loader_error(ld, key, "modifier '%s' is already set by device '%s'",
+                                 modifier->name, other->uuid);
+                    rc = -1;
+                    d = config->device_count;
+                    break;
+                }
+            }
+        }
+        if (rc == 0) {
+            key_state_set(&device->modifier_sources, modifier->code, 1);
+            device->modifier_key_count++;
+        }
+    }
+
+    if (rc != 0) {
+        device->modifier_key_count = 0;
+        key_state_clear(&device->modifier_sources);
+    }
+    return rc;
+}
+
+// Parse one remap rule; earlier rules of the same device are checked for duplicates
+// Chatter filters (debounce_ms, max_rate) describe the switch, so only the
+// device's own remaps may set them (allow_filters), not profile rules
+// Returns 0 on success, -1 on error
+static int parse_remap(loader_t *ld, json_t *remap_json, remap_rule_t *remap,
+                       const remap_rule_t *previous, int previous_count, int allow_filters) {
+    if (!json_is_object(remap_json)) {
+        loader_error(ld, NULL, "expected object, got %s", json_kind_name(remap_json));
+        return -1;
+    }
+
+    int rc = 0;
+    if (get_key(ld, remap_json, "source", &remap->source_name, &remap->source_code, &remap->source_type) != 0) {
+        rc = -1;
+    } else if (remap->source_type == EV_KEY && remap->source_code == KEY_RESERVED) {
+        loader_error(ld, "source", "'%s' is only valid as a target (blocks the source key)", remap->source_name);
+        rc = -1;
+    }
+    if (get_key(ld, remap_json, "target", &remap->target_name, &remap->target_code, &remap->target_type) != 0) rc = -1;
+    if (get_string(ld, remap_json, "description", "", &remap->description) != 0) rc = -1;
+
+    remap->debounce_ms = -1;
+    remap->max_rate = -1;
+    if (get_int(ld, remap_json, "debounce_ms", 0, CONFIG_MAX_DEBOUNCE_MS, &remap->debounce_ms) != 0) rc = -1;
+    if (get_int(ld, remap_json, "max_rate", 0, CONFIG_MAX_RATE, &remap->max_rate) != 0) rc = -1;
+    if (!allow_filters && (remap->debounce_ms >= 0 || remap->max_rate >= 0)) {
+        loader_error(ld, remap->debounce_ms >= 0 ? "debounce_ms" : "max_rate",
+                     "only allowed in the device's remaps (filters do not change with the profile)");
+        rc = -1;
+    }
+    if (rc == 0 && parse_repeat(ld, remap_json, remap) != 0) rc = -1;
+    if (parse_when(ld, remap_json, remap) != 0) rc = -1;
+    check_members(ld, remap_json, g_remap_members);
+    if (rc != 0) return -1;
+
+    // A rule after one for the same source without condition (or with the same
+    // one) would never match
+    for (int i = 0; i < previous_count; i++) {
+        if (previous[i].source_type != remap->source_type || previous[i].source_code != remap->source_code) continue;
+        if (!previous[i].when_down && !previous[i].when_up) {
+            loader_error(ld, "source", "'%s' is already remapped by an earlier rule ('%s')",
+                         remap->source_name, previous[i].source_name);
+            return -1;
+        }
+        if (previous[i].when_down == remap->when_down && previous[i].when_up == remap->when_up) {
+            loader_error(ld, "source", "'%s' is already remapped by an earlier rule with the same 'when' ('%s')",
+                         remap->source_name, previous[i].source_name);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Parse the rules of a device for one profile into table: its own rules first,
+// then the device's remaps for sources the profile does not override
+// Returns 0 on success, -1 on error (with CONFIG_ALLOW_PARTIAL only the invalid rules are dropped)
+static int parse_profile_table(loader_t *ld, json_t *rules_json, const device_config_t *device,
+                               remap_table_t *table) {
+    if (!json_is_array(rules_json)) {
+        loader_error(ld, NULL, "expected array of remap rules, got %s", json_kind_name(rules_json));
+        return -1;
+    }
+
+    table->remap_count = 0;
+    table->remaps = arena_alloc(ld->arena, (json_array_size(rules_json) + device->remap_count + 1) * sizeof(remap_rule_t));
+    if (!table->remaps) {
+        loader_error(ld, NULL, "out of memory");
+        return -1;
+    }
+
+    int rc = 0;
+    size_t j;
+    json_t *remap_json;
+    json_array_foreach(rules_json, j, remap_json) {
+        size_t item = path_push_index(ld, j);
+        remap_rule_t *remap = &table->remaps[table->remap_count];
+        if (parse_remap(ld, remap_json, remap, table->remaps, table->remap_count, 0) == 0) {
+            table->remap_count++;
+        } else {
+            memset(remap, 0, sizeof(*remap));
+            if (!(ld->flags & CONFIG_ALLOW_PARTIAL)) rc = -1;
+        }
+        path_pop(ld, item);
+    }
+
+    int own_count = table->remap_count;
+    for (int i = 0; i < device->remap_count; i++) {
+        const remap_rule_t *base = &device->remaps[i];
+        int overridden = 0;
+        for (int k = 0; k < own_count && !overridden; k++) {
+            overridden = table->remaps[k].source_type == base->source_type &&
+                         table->remaps[k].source_code == base->source_code;
+        }
+        if (!overridden) table->remaps[table->remap_count++] = *base;
+    }
+    return rc;
+}
+
+// Parse device.profiles; every config profile gets a table, those the device
+// does not mention share its own remaps
+// Returns 0 on success, -1 on error
+static int parse_device_profiles(loader_t *ld, json_t *device_json, const config_t *config,
+                                 device_config_t *device) {
+    json_t *profiles_json = NULL;
+    if (json_object_get(device_json, "profiles")) {
+        profiles_json = get_member(ld, device_json, "profiles", KIND_OBJECT, 0);
+        if (!profiles_json) return -1;
+    }
+    if (config->profile_count <= 1) return 0;
+
+    device->profiles = arena_alloc(ld->arena, config->profile_count * sizeof(remap_table_t));
+    if (!device->profiles) {
+        loader_error(ld, "profiles", "out of memory");
+        return -1;
+    }
+    device->profile_count = config->profile_count;
+    for (int p = 0; p < device->profile_count; p++) {
+        device->profiles[p].remaps = device->remaps;
+        device->profiles[p].remap_count = device->remap_count;
+    }
+    if (!profiles_json) return 0;
+
+    int rc = 0;
+    size_t mark = path_push_key(ld, "profiles");
+    const char *name;
+    json_t *rules_json;
+    json_object_foreach(profiles_json, name, rules_json) {
+        size_t item = path_push_key(ld, name);
+        int p = config_find_profile(config, name);
+        if (p == 0) {
+            loader_error(ld, NULL, "'default' is reserved for the device's own remaps");
+            rc = -1;
+        } else if (p < 0) {
+            loader_error(ld, NULL, "too many profiles (max %d)", MAX_PROFILES - 1);
+            rc = -1;
+        } else if (parse_profile_table(ld, rules_json, device, &device->profiles[p]) != 0) {
+            rc = -1;
+        }
+        path_pop(ld, item);
+    }
+    path_pop(ld, mark);
+    return rc;
+}
+
+// Minimum interval between presses for a rate limit, 0 = unlimited
+static uint16_t rate_interval_ms(int max_rate) {
+    return max_rate > 0 ? (uint16_t)(1000 / max_rate) : 0;
+}
+
+// Per-code chatter filters: the device settings for every key, overridden by
+// the filters of the rule remapping that key
+// Returns 0 on success (key_filters stays NULL if nothing is filtered), -1 on allocation error
+static int compile_key_filters(arena_t *arena, device_config_t *device) {
+    device->key_filters = NULL;
+
+    int filtered = device->debounce_ms > 0 || device->max_rate > 0;
+    for (int i = 0; i < device->remap_count && !filtered; i++) {
+        filtered = device->remaps[i].debounce_ms > 0 || device->remaps[i].max_rate > 0;
+    }
+    if (!filtered) return 0;
+
+    key_filter_t *filters = arena_alloc(arena, KEY_CNT * sizeof(key_filter_t));
+    if (!filters) return -1;
+
+    key_filter_t all = { (uint16_t)device->debounce_ms, rate_interval_ms(device->max_rate) };
+    for (int code = 0; code < KEY_CNT; code++) {
+        filters[code] = all;
+    }
+    for (int i = 0; i < device->remap_count; i++) {
+        const remap_rule_t *remap = &device->remaps[i];
+        if (remap->source_type != EV_KEY || remap->source_code < 0 || remap->source_code >= KEY_CNT) continue;
+        if (remap->debounce_ms >= 0) filters[remap->source_code].debounce_ms = (uint16_t)remap->debounce_ms;
+        if (remap->max_rate >= 0) filters[remap->source_code].interval_ms = rate_interval_ms(remap->max_rate);
+    }
+    device->key_filters = filters;
+    return 0;
+}
+
+// Parse one device entry
+// Returns 0 on success, -1 on error (with CONFIG_ALLOW_PARTIAL only the invalid rules are dropped)
+static int parse_device(loader_t *ld, json_t *device_json, const config_t *config, device_config_t *device) {
+    if (!json_is_object(device_json)) {
+        loader_error(ld, NULL, "expected object, got %s", json_kind_name(device_json));
+        return -1;
+    }
+
+    int rc = 0;
+    device->worker = -1;
+
+    json_t *uuid_json = get_member(ld, device_json, "uuid", KIND_STRING, 1);
+    if (!uuid_json) {
+        rc = -1;
+    } else if (json_string_length(uuid_json) == 0) {
+        loader_error(ld, "uuid", "must not be empty");
+        rc = -1;
+    } else if (!(device->uuid = loader_strdup(ld, "uuid", json_string_value(uuid_json)))) {
+        rc = -1;
+    }
+
+    // identifier (vendor:product or unique string), legacy "unique", or name_match (fallback)
+    const char *identifier_key = json_object_get(device_json, "identifier") ? "identifier" : "unique";
+    if (get_string(ld, device_json, identifier_key, "", &device->identifier) != 0) rc = -1;
+    if (get_string(ld, device_json, "name_match", "", &device->name_match) != 0) rc = -1;
+
+    if (json_object_get(device_json, "match")) {
+        json_t *match_json = get_member(ld, device_json, "match", KIND_OBJECT, 0);
+        size_t mark = path_push_key(ld, "match");
+        if (!match_json || parse_match(ld, match_json, &device->match) != 0) rc = -1;
+        path_pop(ld, mark);
+    }
+
+    if (rc == 0 && device->identifier[0] == '\0' && device->name_match[0] == '\0' && !device->match.set) {
+        loader_error(ld, NULL, "needs a non-empty 'identifier', 'name_match' or 'match'");
+        rc = -1;
+    }
+
+    if (get_int(ld, device_json, "worker", 0, MAX_WORKERS - 1, &device->worker) != 0) rc = -1;
+    if (get_int(ld, device_json, "debounce_ms", 0, CONFIG_MAX_DEBOUNCE_MS, &device->debounce_ms) != 0) rc = -1;
+    if (get_int(ld, device_json, "max_rate", 0, CONFIG_MAX_RATE, &device->max_rate) != 0) rc = -1;
+    if (parse_offload(ld, device_json, &device->offload) != 0) rc = -1;
+    if (parse_invert(ld, device_json, &device->invert_rel) != 0) rc = -1;
+
+    if (json_object_get(device_json, "scroll")) {
+        json_t *scroll_json = get_member(ld, device_json, "scroll", KIND_OBJECT, 0);
+        size_t mark = path_push_key(ld, "scroll");
+        if (!scroll_json || parse_scroll(ld, scroll_json, &device->scroll) != 0) rc = -1;
+        path_pop(ld, mark);
+    }
+
+    if (json_object_get(device_json, "gestures")) {
+        json_t *gestures_json = get_member(ld, device_json, "gestures", KIND_OBJECT, 0);
+        size_t mark = path_push_key(ld, "gestures");
+        if (!gestures_json || parse_gestures(ld, gestures_json, &device->gestures) != 0) rc = -1;
+        path_pop(ld, mark);
+    }
+
+    if (json_object_get(device_json, "modifiers")) {
+        json_t *modifiers_json = get_member(ld, device_json, "modifiers", KIND_OBJECT, 0);
+        size_t mark = path_push_key(ld, "modifiers");
+        if (!modifiers_json || parse_modifiers(ld, modifiers_json, device) != 0) rc = -1;
+        path_pop(ld, mark);
+    }
+
+    if (json_object_get(device_json, "mouse_keys")) {
+        json_t *mouse_keys_json = get_member(ld, device_json, "mouse_keys", KIND_OBJECT, 0);
+        size_t mark = path_push_key(ld, "mouse_keys");
+        if (!mouse_keys_json || parse_mouse_keys(ld, mouse_keys_json, &device->mouse_keys) != 0) rc = -1;
+        path_pop(ld, mark);
+    }
+
+    if (json_object_get(device_json, "sequences")) {
+        json_t *sequences_json = get_member(ld, device_json, "sequences", KIND_OBJECT, 0);
+        size_t mark = path_push_key(ld, "sequences");
+        if (!sequences_json || parse_sequences(ld, sequences_json, &device->sequences) != 0) rc = -1;
+        path_pop(ld, mark);
+    }
+
+    if (json_object_get(device_json, "scanner")) {
+        json_t *scanner_json = get_member(ld, device_json, "scanner", KIND_OBJECT, 0);
+        size_t mark = path_push_key(ld, "scanner");
+        if (!scanner_json || parse_scanner(ld, scanner_json, &device->scanner) != 0) rc = -1;
+        path_pop(ld, mark);
+    }
+
+    json_t *remaps_json = get_member(ld, device_json, "remaps", KIND_ARRAY, 1);
+    if (!remaps_json) {
+        rc = -1;
+    } else if (json_array_size(remaps_json) > 0) {
+        device->remaps = arena_alloc(ld->arena, json_array_size(remaps_json) * sizeof(remap_rule_t));
+        if (!device->remaps) {
+            loader_error(ld, "remaps", "out of memory");
+            return -1;
+        }
+
+        size_t mark = path_push_key(ld, "remaps");
+        size_t j;
+        json_t *remap_json;
+        json_array_foreach(remaps_json, j, remap_json) {
+            size_t item = path_push_index(ld, j);
+            remap_rule_t *remap = &device->remaps[device->remap_count];
+            if (parse_remap(ld, remap_json, remap, device->remaps, device->remap_count, 1) == 0) {
+                device->remap_count++;
+            } else {
+                memset(remap, 0, sizeof(*remap));
+                if (!(ld->flags & CONFIG_ALLOW_PARTIAL)) rc = -1;
+            }
+            path_pop(ld, item);
+        }
+        path_pop(ld, mark);
+    }
+
+    if (parse_device_profiles(ld, device_json, config, device) != 0) rc = -1;
+
+    check_members(ld, device_json, g_device_members);
+    config_compile_device(device);
+
+    // The scroll button is taken before remapping: a rule for it would never match
+    if (device->scroll.button && is_remapped(device, device->scroll.button)) {
+        size_t mark = path_push_key(ld, "scroll");
+        loader_error(ld, "button", "also a remap source, its rules would never match");
+        path_pop(ld, mark);
+        device->scroll.button = 0;
+        rc = -1;
+    }
+    if (device->gestures.button && is_remapped(device, device->gestures.button)) {
+        size_t mark = path_push_key(ld, "gestures");
+        loader_error(ld, "button", "also a remap source, its rules would never match");
+        path_pop(ld, mark);
+        device->gestures.button = 0;
+        rc = -1;
+    } else if (device->gestures.button && device->gestures.button == device->scroll.button) {
+        size_t mark = path_push_key(ld, "gestures");
+        loader_error(ld, "button", "also the scroll button");
+        path_pop(ld, mark);
+        device->gestures.button = 0;
+        rc = -1;
+    }
+    for (int i = 0; i < device->mouse_keys.key_count; i++) {
+        int code = device->mouse_keys.keys[i].code;
+        if (is_remapped(device, code) || code == device->scroll.button || code == device->gestures.button) {
+            size_t mark = path_push_key(ld, "mouse_keys");
+            const char *name = get_canonical_name(code, EV_KEY);
+            loader_error(ld, "keys", "%s is also a remap source, scroll or gesture button", name ? name : "key");
+            path_pop(ld, mark);
+            device->mouse_keys.key_count = 0;
+            rc = -1;
+            break;
+        }
+    }
+    // Sequences come first in the pipeline: they would take these keys' presses
+    const sequence_config_t *sequences = &device->sequences;
+    for (int code = 0; code < KEY_CNT && sequences->rule_count; code++) {
+        if (!sequences->symbols[code]) continue;
+        if (code == device->scroll.button || code == device->gestures.button ||
+            key_state_test(&device->mouse_keys.sources, code)) {
+            size_t mark = path_push_key(ld, "sequences");
+            const char *name = get_canonical_name(code, EV_KEY);
+            loader_error(ld, "expand", "%s is also a mouse key, scroll or gesture button", name ? name : "key");
+            path_pop(ld, mark);
+            device->sequences.rule_count = 0;
+            rc = -1;
+        }
+    }
+    // A scanner's keys become records: nothing else sees them
+    if (device->scanner.output) {
+        int remapped = device->remap_count > 0;
+        for (int p = 1; p < device->profile_count; p++) {
+            remapped |= device->profiles[p].remap_count > 0;
+        }
+        if (remapped || device->scroll.button || device->gestures.button || device->mouse_keys.key_count ||
+            device->sequences.rule_count || device->modifier_key_count) {
+            loader_error(ld, "scanner", "a scanner cannot also have remaps, scrolling, gestures, mouse keys, "
+                         "sequences or modifiers");
+            device->scanner.output = NULL;
+            rc = -1;
+        }
+    }
+    if (compile_key_filters(ld->arena, device) != 0) {
+        loader_error(ld, NULL, "out of memory");
+        return -1;
+    }
+    return rc;
+}
+
+// Parse config.devices
+// Returns 0 on success, -1 on error
+static int parse_devices(loader_t *ld, json_t *devices_json, config_t *config) {
+    size_t device_count = json_array_size(devices_json);
+    if (device_count == 0) {
+        loader_error(ld, "devices", "no devices configured");
+        return -1;
+    }
+
+    config->devices = arena_alloc(ld->arena, device_count * sizeof(device_config_t));
+    if (!config->devices) {
+        loader_error(ld, "devices", "out of memory");
+        return -1;
+    }
+
+    int rc = 0;
+    size_t mark = path_push_key(ld, "devices");
+    size_t i;
+    json_t *device_json;
+    json_array_foreach(devices_json, i, device_json) {
+        size_t item = path_push_index(ld, i);
+        device_config_t *device = &config->devices[config->device_count];
+
+        int device_rc = parse_device(ld, device_json, config, device);
+
+        // Compared against the JSON so duplicates of invalid entries are reported too
+        for (size_t j = 0; device_rc == 0 && j < i; j++) {
+            json_t *other_uuid = json_object_get(json_array_get(devices_json, j), "uuid");
+            if (json_is_string(other_uuid) && strcmp(json_string_value(other_uuid), device->uuid) == 0) {
+                loader_error(ld, "uuid", "duplicate uuid '%s' (also used by devices[%zu])", device->uuid, j);
+                device_rc = -1;
+            }
+        }
+
+        if (device_rc == 0) {
+            config->device_count++;
+        } else {
+            memset(device, 0, sizeof(*device));
+            if (!(ld->flags & CONFIG_ALLOW_PARTIAL)) rc = -1;
+        }
+        path_pop(ld, item);
+    }
+    path_pop(ld, mark);
+
+    if (rc == 0 && config->device_count == 0) {
+        loader_error(ld, "devices", "no valid devices");
+        rc = -1;
+    }
+    return rc;
+}
+
+// Add a profile name to the config
+// Returns its index, -1 if the table is full
+static int add_profile(loader_t *ld, config_t *config, const char *name) {
+    if (config->profile_count >= MAX_PROFILES) return -1;
+
+    profile_t *profile = &config->profiles[config->profile_count];
+    if (!(profile->name = loader_strdup(ld, NULL, name))) return -1;
+    return config->profile_count++;
+}
+
+// Parse config.profiles, then add the names only used by devices, so every
+// device compiles its tables against the same profile index
+// Returns 0 on success, -1 on error
+static int parse_profiles(loader_t *ld, json_t *config_obj, json_t *devices_json, config_t *config) {
+    config->profiles = arena_alloc(ld->arena, MAX_PROFILES * sizeof(profile_t));
+    if (!config->profiles) {
+        loader_error(ld, "profiles", "out of memory");
+        return -1;
+    }
+    config->profiles[0].name = "default";
+    config->profile_count = 1;
+
+    int rc = 0;
+    if (json_object_get(config_obj, "profiles")) {
+        json_t *profiles_json = get_member(ld, config_obj, "profiles", KIND_OBJECT, 0);
+        if (!profiles_json) return -1;
+
+        size_t mark = path_push_key(ld, "profiles");
+        const char *name;
+        json_t *profile_json;
+        json_object_foreach(profiles_json, name, profile_json) {
+            size_t item = path_push_key(ld, name);
+            int index = -1;
+            if (!json_is_object(profile_json)) {
+                loader_error(ld, NULL, "expected object, got %s", json_kind_name(profile_json));
+            } else if (strcmp(name, "default") == 0) {
+                loader_error(ld, NULL, "'default' is reserved for the devices' own remaps");
+            } else if ((index = add_profile(ld, config, name)) < 0) {
+                loader_error(ld, NULL, "too many profiles (max %d)", MAX_PROFILES - 1);
+            }
+            if (index < 0) {
+                rc = -1;
+                path_pop(ld, item);
+                continue;
+            }
+
+            json_t *apps_json = json_object_get(profile_json, "applications") ?
+                                get_member(ld, profile_json, "applications", KIND_ARRAY, 0) : NULL;
+            if (apps_json && json_array_size(apps_json) > 0) {
+                profile_t *profile = &config->profiles[index];
+                profile->applications = arena_alloc(ld->arena, json_array_size(apps_json) * sizeof(char *));
+                size_t apps_mark = path_push_key(ld, "applications");
+                size_t i;
+                json_t *app_json;
+                json_array_foreach(apps_json, i, app_json) {
+                    size_t app_item = path_push_index(ld, i);
+                    if (!json_is_string(app_json)) {
+                        loader_error(ld, NULL, "expected string, got %s", json_kind_name(app_json));
+                        rc = -1;
+                    } else if (profile->applications) {
+                        const char *app = loader_strdup(ld, NULL, json_string_value(app_json));
+                        if (app) profile->applications[profile->application_count++] = app;
+                    }
+                    path_pop(ld, app_item);
+                }
+                path_pop(ld, apps_mark);
+            } else if (json_object_get(profile_json, "applications") && !apps_json) {
+                rc = -1;
+            }
+            check_members(ld, profile_json, g_profile_members);
+            path_pop(ld, item);
+        }
+        path_pop(ld, mark);
+    }
+
+    // Profiles a device defines rules for without a declaration (errors are reported per device)
+    size_t i;
+    json_t *device_json;
+    json_array_foreach(devices_json, i, device_json) {
+        json_t *device_profiles = json_object_get(device_json, "profiles");
+        if (!json_is_object(device_profiles)) continue;
+
+        const char *name;
+        json_t *rules_json;
+        json_object_foreach(device_profiles, name, rules_json) {
+            if (config_find_profile(config, name) < 0) add_profile(ld, config, name);
+        }
+    }
+    return rc;
+}
+
+// Parse paths.debug_log (with expansion)
+// Returns 0 on success, -1 on error
+static int parse_paths(loader_t *ld, json_t *paths, config_t *config) {
+    const char *debug_log = NULL;
+    if (get_string(ld, paths, "debug_log", NULL, &debug_log) != 0) return -1;
+    check_members(ld, paths, g_paths_members);
+    if (!debug_log) return 0;
+
+    char *expanded = expand_path(debug_log);
+    if (!expanded) return 0;
+    const char *copy = loader_strdup(ld, "debug_log", expanded);
+    free(expanded);
+    if (!copy) return -1;
+    config->debug_log = copy;
+    return 0;
+}
+
+// Parse the "config" object
+// Returns 0 on success, -1 on error
+static int parse_config(loader_t *ld, json_t *config_obj, config_t *config) {
+    int rc = 0;
+
+    if (get_bool(ld, config_obj, "debug", &config->debug) != 0) rc = -1;
+
+    if (json_object_get(config_obj, "realtime")) {
+        json_t *realtime_json = get_member(ld, config_obj, "realtime", KIND_OBJECT, 0);
+        if (!realtime_json) {
+            rc = -1;
+        } else {
+            size_t mark = path_push_key(ld, "realtime");
+            if (parse_realtime(ld, realtime_json, &config->realtime) != 0) rc = -1;
+            path_pop(ld, mark);
+        }
+    }
+
+    if (parse_workers(ld, config_obj, config) != 0) rc = -1;
+
+    const char *control_socket = NULL;
+    if (get_string(ld, config_obj, "control_socket", NULL, &control_socket) != 0) {
+        rc = -1;
+    } else if (control_socket) {
+        char *expanded = expand_path(control_socket);
+        if (expanded) {
+            control_socket = loader_strdup(ld, "control_socket", expanded);
+            free(expanded);
+            if (control_socket) {
+                config->control_socket = control_socket;
+            } else {
+                rc = -1;
+            }
+        }
+    }
+
+    json_t *devices_json = get_member(ld, config_obj, "devices", KIND_ARRAY, 1);
+    if (parse_profiles(ld, config_obj, devices_json, config) != 0) rc = -1;
+    if (!devices_json || parse_devices(ld, devices_json, config) != 0) rc = -1;
+
+    // Profiles are merged across files, not a global setting
+    size_t merged_members = (devices_json ? 1 : 0) + (json_object_get(config_obj, "profiles") ? 1 : 0);
+    if (json_object_size(config_obj) > merged_members) config->has_settings = 1;
+
+    check_members(ld, config_obj, g_config_members);
+    return rc;
+}
+
+// Upper bound of the arena space a parsed document needs: every object becomes
+// at most one device or remap entry (plus a key filter array if it sets a
+// filter), every string or number at most one copy
+static size_t estimate_arena_size(json_t *json) {
+    size_t size = 0;
+    size_t index;
+    const char *key;
+    json_t *value;
+
+    switch (json_typeof(json)) {
+        case JSON_OBJECT:
+            size += arena_aligned_size(sizeof(device_config_t) > sizeof(remap_rule_t) ?
+                                       sizeof(device_config_t) : sizeof(remap_rule_t));
+            if (json_object_get(json, "debounce_ms") || json_object_get(json, "max_rate")) {
+                size += arena_aligned_size(KEY_CNT * sizeof(key_filter_t));
+            }
+            json_object_foreach(json, key, value) {
+                size += estimate_arena_size(value);
+            }
+            break;
+        case JSON_ARRAY:
+            json_array_foreach(json, index, value) {
+                size += estimate_arena_size(value);
+            }
+            break;
+        case JSON_STRING:
+            size += arena_aligned_size(json_string_length(json) + 1);
+            break;
+        case JSON_INTEGER:
+            size += arena_aligned_size(16);
+            break;
+        default:
+            break;
+    }
+    return size;
+}
+
+// EV_KEY source codes with a rule
+static void compile_keys(const remap_rule_t *remaps, int remap_count, key_state_t *keys) {
+    key_state_clear(keys);
+    for (int i = 0; i < remap_count; i++) {
+        if (remaps[i].source_type == EV_KEY) {
+            key_state_set(keys, remaps[i].source_code, 1);
+        }
+    }
+}
+
+void config_compile_device(device_config_t *device) {
+    compile_keys(device->remaps, device->remap_count, &device->remap_keys);
+    for (int p = 0; p < device->profile_count; p++) {
+        remap_table_t *table = &device->profiles[p];
+        compile_keys(table->remaps, table->remap_count, &table->remap_keys);
+    }
+}
+
+// Optional strings (NULL = not set) are equal
+static int same_optional(const char *a, const char *b) {
+    return (!a && !b) || (a && b && strcmp(a, b) == 0);
+}
+
+int config_match_equal(const device_match_t *a, const device_match_t *b) {
+    if (a->set != b->set) return 0;
+    if (!a->set) return 1;
+
+    return same_optional(a->phys, b->phys) && same_optional(a->uniq, b->uniq) &&
+           same_optional(a->name, b->name) && same_optional(a->usb_port, b->usb_port) &&
+           a->bus == b->bus && a->version == b->version &&
+           a->require_count == b->require_count && a->forbid_count == b->forbid_count &&
+           (a->require_count == 0 || memcmp(a->require, b->require, a->require_count * sizeof(device_capability_t)) == 0) &&
+           (a->forbid_count == 0 || memcmp(a->forbid, b->forbid, a->forbid_count * sizeof(device_capability_t)) == 0);
+}
+
+int device_needs_userspace(const device_config_t *device) {
+    return device->key_filters || device->scroll.button || device->gestures.button ||
+           device->mouse_keys.key_count || device->modifier_key_count || device->sequences.rule_count ||
+           device->scanner.output;
+}
+
+int config_find_profile(const config_t *config, const char *name) {
+    if (!config || !name) return -1;
+
+    for (int i = 0; i < config->profile_count; i++) {
+        if (strcmp(config->profiles[i].name, name) == 0) return i;
+    }
+    return -1;
+}
+
+int config_find_modifier(const config_t *config, const char *name) {
+    if (!config || !name) return -1;
+
+    for (int i = 0; i < config->modifier_count; i++) {
+        if (strcmp(config->modifiers[i], name) == 0) return i;
+    }
     return -1;
 }
 
-config_t* load_config(const char *config_path) {
+int config_profile_for_application(const config_t *config, const char *application) {
+    if (!config || !application) return 0;
+
+    for (int i = 1; i < config->profile_count; i++) {
+        const profile_t *profile = &config->profiles[i];
+        for (int j = 0; j < profile->application_count; j++) {
+            if (fnmatch(profile->applications[j], application, 0) == 0) return i;
+        }
+    }
+    return 0;
+}
+
+config_t* load_config(const char *config_path, int flags) {
     json_error_t error;
-    json_t *root = json_load_file(config_path, 0, &error);
-    
+    json_t *root = json_load_file(config_path, JSON_REJECT_DUPLICATES, &error);
+
     if (!root) {
-        fprintf(stderr, "ERROR: Failed to load config from %s: %s (line %d)\n", 
-                config_path, error.text, error.line);
+        fprintf(stderr, "ERROR: %s:%d:%d: %s\n", config_path, error.line, error.column, error.text);
         return NULL;
     }
-    
-    config_t *config = calloc(1, sizeof(config_t));
+
+    // The config struct, its arrays and strings share one arena, normally a single
+    // block; paths may still grow on ${VAR} expansion
+    arena_t arena;
+    arena_init(&arena);
+    config_t *config = NULL;
+    if (arena_reserve(&arena, arena_aligned_size(sizeof(config_t)) + estimate_arena_size(root) +
+                              2 * CONFIG_EXPANSION_SLACK) == 0) {
+        config = arena_alloc(&arena, sizeof(config_t));
+    }
     if (!config) {
+        fprintf(stderr, "ERROR: Failed to allocate configuration\n");
+        arena_free(&arena);
         json_decref(root);
         return NULL;
     }
-    
-    // Get paths.debug_log (with expansion)
-    json_t *paths = json_object_get(root, "paths");
-    if (paths && json_is_object(paths)) {
-        json_t *debug_log_json = json_object_get(paths, "debug_log");
-        if (debug_log_json && json_is_string(debug_log_json)) {
-            char *expanded = expand_path(json_string_value(debug_log_json));
-            if (expanded) {
-                strncpy(config->debug_log, expanded, sizeof(config->debug_log) - 1);
-                free(expanded);
-            } else {
-                strncpy(config->debug_log, "/tmp/keyswap-debug.log", sizeof(config->debug_log) - 1);
-            }
-        } else {
-            strncpy(config->debug_log, "/tmp/keyswap-debug.log", sizeof(config->debug_log) - 1);
-        }
+    config->arena = arena;
+    config->debug_log = "/tmp/keyswap-debug.log";
+    config->control_socket = "";
+    config->realtime.enabled = 0;
+    config->realtime.policy = SCHED_FIFO;
+    config->realtime.priority = 50;
+    config->realtime.lock_memory = 1;
+    config->realtime.cpu = -1;
+    for (int i = 0; i < MAX_WORKERS; i++) {
+        config->worker_cpus[i] = -1;
+    }
+
+    loader_t ld;
+    memset(&ld, 0, sizeof(ld));
+    ld.file = config_path;
+    ld.flags = flags;
+    ld.arena = &config->arena;
+    ld.config = config;
+    config->path = loader_strdup(&ld, NULL, config_path);
+
+    int rc = 0;
+    if (!json_is_object(root)) {
+        loader_error(&ld, NULL, "expected object, got %s", json_kind_name(root));
+        rc = -1;
     } else {
-        strncpy(config->debug_log, "/tmp/keyswap-debug.log", sizeof(config->debug_log) - 1);
-    }
-    
-    // Get config.debug
-    json_t *config_obj = json_object_get(root, "config");
-    if (config_obj && json_is_object(config_obj)) {
-        json_t *debug_json = json_object_get(config_obj, "debug");
-        if (debug_json && json_is_boolean(debug_json)) {
-            config->debug = json_is_true(debug_json) ? 1 : 0;
-        }
-        
-        // Get devices array
-        json_t *devices_json = json_object_get(config_obj, "devices");
-        if (devices_json && json_is_array(devices_json)) {
-            size_t device_count = json_array_size(devices_json);
-            config->devices = calloc(device_count, sizeof(device_config_t));
-            if (!config->devices) {
-                json_decref(root);
-                free(config);
-                return NULL;
-            }
-            config->device_count = 0;
-            
-            for (size_t i = 0; i < device_count; i++) {
-                json_t *device_json = json_array_get(devices_json, i);
-                if (!device_json || !json_is_object(device_json)) continue;
-                
-                device_config_t *device = &config->devices[config->device_count];
-                
-                // Get uuid
-                json_t *uuid_json = json_object_get(device_json, "uuid");
-                if (uuid_json && json_is_string(uuid_json)) {
-                    strncpy(device->uuid, json_string_value(uuid_json), sizeof(device->uuid) - 1);
-                }
-                
-                // Get identifier (vendor:product or unique string) or name_match (fallback)
-                json_t *identifier_json = json_object_get(device_json, "identifier");
-                if (!identifier_json) {
-                    // Try legacy "unique" field for backwards compatibility
-                    identifier_json = json_object_get(device_json, "unique");
-                }
-                if (identifier_json && json_is_string(identifier_json)) {
-                    strncpy(device->identifier, json_string_value(identifier_json), sizeof(device->identifier) - 1);
-                    device->identifier[sizeof(device->identifier) - 1] = '\0';
-                } else {
-                    device->identifier[0] = '\0';
-                }
-                
-                // Get name_match (fallback if no identifier)
-                json_t *name_match_json = json_object_get(device_json, "name_match");
-                if (name_match_json && json_is_string(name_match_json)) {
-                    strncpy(device->name_match, json_string_value(name_match_json), sizeof(device->name_match) - 1);
-                    device->name_match[sizeof(device->name_match) - 1] = '\0';
-                } else {
-                    device->name_match[0] = '\0';
-                }
-                
-                // Must have either identifier or name_match
-                if (strlen(device->identifier) == 0 && strlen(device->name_match) == 0) {
-                    fprintf(stderr, "WARNING: Device %zu missing both 'identifier' and 'name_match'\n", i);
-                    continue;
-                }
-                
-                // Get remaps array
-                json_t *remaps_json = json_object_get(device_json, "remaps");
-                if (remaps_json && json_is_array(remaps_json)) {
-                    size_t remap_count = json_array_size(remaps_json);
-                    device->remaps = calloc(remap_count, sizeof(remap_rule_t));
-                    if (!device->remaps) {
-                        fprintf(stderr, "ERROR: Failed to allocate remaps\n");
-                        continue;
-                    }
-                    device->remap_count = 0;
-                    
-                    for (size_t j = 0; j < remap_count; j++) {
-                        json_t *remap_json = json_array_get(remaps_json, j);
-                        if (!remap_json || !json_is_object(remap_json)) continue;
-                        
-                        remap_rule_t *remap = &device->remaps[device->remap_count];
-                        
-                        // Get source
-                        json_t *source_json = json_object_get(remap_json, "source");
-                        if (!source_json) {
-                            fprintf(stderr, "WARNING: Remap %zu in device %zu missing source\n", j, i);
-                            continue;
-                        }
-                        
-                        // Get target
-                        json_t *target_json = json_object_get(remap_json, "target");
-                        if (!target_json) {
-                            fprintf(stderr, "WARNING: Remap %zu in device %zu missing target\n", j, i);
-                            continue;
-                        }
-                        
-                        // Resolve source name/code
-                        if (json_is_string(source_json)) {
-                            const char *source_name = json_string_value(source_json);
-                            strncpy(remap->source_name, source_name, sizeof(remap->source_name) - 1);
-                        } else if (json_is_integer(source_json)) {
-                            snprintf(remap->source_name, sizeof(remap->source_name), "%d", (int)json_integer_value(source_json));
-                        }
-                        
-                        // Resolve target name/code
-                        if (json_is_string(target_json)) {
-                            const char *target_name = json_string_value(target_json);
-                            strncpy(remap->target_name, target_name, sizeof(remap->target_name) - 1);
-                        } else if (json_is_integer(target_json)) {
-                            snprintf(remap->target_name, sizeof(remap->target_name), "%d", (int)json_integer_value(target_json));
-                        }
-                        
-                        // Resolve key codes
-                        if (resolve_json_key(source_json, &remap->source_code, &remap->source_type) != 0) {
-                            fprintf(stderr, "ERROR: Failed to resolve source key '%s' for device %zu, remap %zu\n",
-                                    remap->source_name, i, j);
-                            continue;
-                        }
-                        
-                        if (resolve_json_key(target_json, &remap->target_code, &remap->target_type) != 0) {
-                            fprintf(stderr, "ERROR: Failed to resolve target key '%s' for device %zu, remap %zu\n",
-                                    remap->target_name, i, j);
-                            continue;
-                        }
-                        
-                        // Get description (optional)
-                        json_t *desc_json = json_object_get(remap_json, "description");
-                        if (desc_json && json_is_string(desc_json)) {
-                            strncpy(remap->description, json_string_value(desc_json), sizeof(remap->description) - 1);
-                        }
-                        
-                        device->remap_count++;
-                    }
-                }
-                
-                config->device_count++;
-            }
+        if (json_object_get(root, "metadata") && !get_member(&ld, root, "metadata", KIND_OBJECT, 0)) rc = -1;
+
+        if (json_object_get(root, "paths")) {
+            config->has_settings = 1;
+            json_t *paths = get_member(&ld, root, "paths", KIND_OBJECT, 0);
+            size_t mark = path_push_key(&ld, "paths");
+            if (!paths || parse_paths(&ld, paths, config) != 0) rc = -1;
+            path_pop(&ld, mark);
+        }
+
+        json_t *config_obj = get_member(&ld, root, "config", KIND_OBJECT, 1);
+        if (!config_obj) {
+            rc = -1;
+        } else {
+            size_t mark = path_push_key(&ld, "config");
+            if (parse_config(&ld, config_obj, config) != 0) rc = -1;
+            path_pop(&ld, mark);
         }
+
+        check_members(&ld, root, g_root_members);
     }
-    
     json_decref(root);
+
+    for (int i = 0; i < config->device_count; i++) {
+        config->devices[i].source = config->path;
+    }
+
+    if (ld.errors > 0) {
+        if (rc != 0 || !(flags & CONFIG_ALLOW_PARTIAL)) {
+            fprintf(stderr, "ERROR: %s: %d error%s, configuration rejected\n",
+                    config_path, ld.errors, ld.errors == 1 ? "" : "s");
+            config_free(config);
+            return NULL;
+        }
+        fprintf(stderr, "WARNING: %s: %d error%s, invalid entries skipped\n",
+                config_path, ld.errors, ld.errors == 1 ? "" : "s");
+    }
     return config;
 }
 
 void config_free(config_t *config) {
     if (!config) return;
-    
-    for (int i = 0; i < config->device_count; i++) {
-        if (config->devices[i].remaps) {
-            free(config->devices[i].remaps);
+
+    // config itself lives in the arena
+    arena_t arena = config->arena;
+    arena_free(&arena);
+}
+
+// Add a CONFIG argument to the path list: a file as is, a directory as its *.json files
+// Returns 0 on success, -1 on error
+static int expand_config_arg(const char *arg, char ***paths, int *count) {
+    struct stat st;
+    if (stat(arg, &st) != 0) {
+        fprintf(stderr, "ERROR: Cannot access config %s: %s\n", arg, strerror(errno));
+        return -1;
+    }
+
+    glob_t glob_result;
+    memset(&glob_result, 0, sizeof(glob_result));
+    const char *single[1] = { arg };
+    const char *const *found = single;
+    size_t found_count = 1;
+
+    if (S_ISDIR(st.st_mode)) {
+        char pattern[4096];
+        snprintf(pattern, sizeof(pattern), "%s/*.json", arg);
+        // glob sorts by name: conf.d files are taken in "NN-name.json" order
+        if (glob(pattern, 0, NULL, &glob_result) != 0) {
+            fprintf(stderr, "ERROR: No *.json config files in %s\n", arg);
+            globfree(&glob_result);
+            return -1;
+        }
+        found = (const char *const *)glob_result.gl_pathv;
+        found_count = glob_result.gl_pathc;
+    }
+
+    char **grown = realloc(*paths, (*count + found_count) * sizeof(char *));
+    if (!grown) {
+        globfree(&glob_result);
+        return -1;
+    }
+    *paths = grown;
+
+    int rc = 0;
+    for (size_t i = 0; i < found_count; i++) {
+        char *copy = strdup(found[i]);
+        if (!copy) {
+            rc = -1;
+            break;
+        }
+        (*paths)[(*count)++] = copy;
+    }
+    globfree(&glob_result);
+    return rc;
+}
+
+int config_set_load(config_set_t *set, const char *const *args, int arg_count, int flags) {
+    memset(set, 0, sizeof(*set));
+
+    int rc = 0;
+    for (int i = 0; i < arg_count && rc == 0; i++) {
+        rc = expand_config_arg(args[i], &set->paths, &set->count);
+    }
+
+    if (rc == 0 && set->count > 0) {
+        set->files = calloc(set->count, sizeof(config_t *));
+        if (!set->files) rc = -1;
+    }
+
+    // Load every file so all errors are reported in one go
+    for (int i = 0; rc >= 0 && set->files && i < set->count; i++) {
+        set->files[i] = load_config(set->paths[i], flags);
+        if (!set->files[i]) rc = 1;
+    }
+
+    if (rc != 0 || set->count == 0) {
+        config_set_free(set);
+        return -1;
+    }
+    return 0;
+}
+
+int config_set_find(const config_set_t *set, const char *file) {
+    if (!set || !file) return -1;
+
+    for (int i = 0; i < set->count; i++) {
+        if (strcmp(set->paths[i], file) == 0) return i;
+    }
+    for (int i = 0; i < set->count; i++) {
+        const char *base = strrchr(set->paths[i], '/');
+        if (strcmp(base ? base + 1 : set->paths[i], file) == 0) return i;
+    }
+    return -1;
+}
+
+void config_set_free(config_set_t *set) {
+    if (!set) return;
+
+    for (int i = 0; i < set->count; i++) {
+        if (set->files) config_free(set->files[i]);
+        free(set->paths[i]);
+    }
+    free(set->files);
+    free(set->paths);
+    memset(set, 0, sizeof(*set));
+}
+
+// Arena space a deep copy of remap rules takes
+static size_t rules_copy_size(const remap_rule_t *remaps, int remap_count) {
+    size_t size = arena_aligned_size(remap_count * sizeof(remap_rule_t));
+    for (int i = 0; i < remap_count; i++) {
+        size += arena_aligned_size(strlen(remaps[i].source_name) + 1) +
+                arena_aligned_size(strlen(remaps[i].target_name) + 1) +
+                arena_aligned_size(strlen(remaps[i].description) + 1);
+    }
+    return size;
+}
+
+// Arena space a copy of a device config takes in a config with profile_count profiles
+// Arena space copy_sequences needs
+static size_t sequences_copy_size(const sequence_config_t *sequences) {
+    if (!sequences->rule_count) return 0;
+
+    size_t size = arena_aligned_size(sequences->rule_count * sizeof(sequence_t)) +
+                  arena_aligned_size(KEY_CNT) +
+                  arena_aligned_size((size_t)sequences->state_count * sequences->symbol_count * sizeof(int16_t)) +
+                  arena_aligned_size(sequences->state_count * sizeof(uint8_t)) +
+                  arena_aligned_size(sequences->state_count * sizeof(int16_t));
+    for (int i = 0; i < sequences->rule_count; i++) {
+        size += arena_aligned_size(strlen(sequences->rules[i].name) + 1) +
+                arena_aligned_size(sequences->rules[i].output_count * sizeof(key_combo_t));
+    }
+    return size;
+}
+
+// Deep copy of key sequences and their automaton into another arena
+// Returns 0 on success, -1 on allocation error
+static int copy_sequences(arena_t *arena, sequence_config_t *dst, const sequence_config_t *src) {
+    if (!src->rule_count) return 0;
+
+    dst->rules = arena_alloc(arena, src->rule_count * sizeof(sequence_t));
+    dst->symbols = arena_alloc(arena, KEY_CNT);
+    dst->next = arena_alloc(arena, (size_t)src->state_count * src->symbol_count * sizeof(int16_t));
+    dst->depth = arena_alloc(arena, src->state_count * sizeof(uint8_t));
+    dst->match = arena_alloc(arena, src->state_count * sizeof(int16_t));
+    if (!dst->rules || !dst->symbols || !dst->next || !dst->depth || !dst->match) return -1;
+    memcpy(dst->symbols, src->symbols, KEY_CNT);
+    memcpy(dst->next, src->next, (size_t)src->state_count * src->symbol_count * sizeof(int16_t));
+    memcpy(dst->depth, src->depth, src->state_count * sizeof(uint8_t));
+    memcpy(dst->match, src->match, src->state_count * sizeof(int16_t));
+
+    for (int i = 0; i < src->rule_count; i++) {
+        sequence_t *sequence = &dst->rules[i];
+        *sequence = src->rules[i];
+        sequence->name = arena_strdup(arena, src->rules[i].name);
+        sequence->output = arena_alloc(arena, sequence->output_count * sizeof(key_combo_t));
+        if (!sequence->name || !sequence->output) return -1;
+        memcpy(sequence->output, src->rules[i].output, sequence->output_count * sizeof(key_combo_t));
+    }
+    return 0;
+}
+
+static size_t device_copy_size(const device_config_t *device, int profile_count) {
+    size_t size = arena_aligned_size(strlen(device->uuid) + 1) +
+                  arena_aligned_size(strlen(device->identifier) + 1) +
+                  arena_aligned_size(strlen(device->name_match) + 1) +
+                  arena_aligned_size(strlen(device->source) + 1) +
+                  rules_copy_size(device->remaps, device->remap_count);
+    if (profile_count > 1) {
+        size += arena_aligned_size(profile_count * sizeof(remap_table_t));
+    }
+    if (device->key_filters) {
+        size += arena_aligned_size(KEY_CNT * sizeof(key_filter_t));
+    }
+    if (device->scanner.output) {
+        size += arena_aligned_size(strlen(device->scanner.output) + 1);
+    }
+    size += arena_aligned_size(device->gestures.stroke_count * sizeof(gesture_t)) +
+            arena_aligned_size(device->mouse_keys.key_count * sizeof(mouse_key_t)) +
+            arena_aligned_size(device->modifier_key_count * sizeof(modifier_key_t)) +
+            sequences_copy_size(&device->sequences);
+    const char *match_strings[] = { device->match.phys, device->match.uniq, device->match.name, device->match.usb_port };
+    for (size_t i = 0; i < sizeof(match_strings) / sizeof(match_strings[0]); i++) {
+        if (match_strings[i]) size += arena_aligned_size(strlen(match_strings[i]) + 1);
+    }
+    size += arena_aligned_size(device->match.require_count * sizeof(device_capability_t)) +
+            arena_aligned_size(device->match.forbid_count * sizeof(device_capability_t));
+    for (int p = 1; p < device->profile_count; p++) {
+        if (device->profiles[p].remaps != device->remaps) {
+            size += rules_copy_size(device->profiles[p].remaps, device->profiles[p].remap_count);
+        }
+    }
+    return size;
+}
+
+// Deep copy of remap rules into another arena
+// Returns the copy, NULL on allocation error (or if there are no rules)
+static remap_rule_t* copy_rules(arena_t *arena, const remap_rule_t *src, int count) {
+    remap_rule_t *dst = count > 0 ? arena_alloc(arena, count * sizeof(remap_rule_t)) : NULL;
+    if (!dst) return NULL;
+
+    for (int i = 0; i < count; i++) {
+        remap_rule_t *remap = &dst[i];
+        *remap = src[i];
+        remap->source_name = arena_strdup(arena, src[i].source_name);
+        remap->target_name = arena_strdup(arena, src[i].target_name);
+        remap->description = arena_strdup(arena, src[i].description);
+        if (!remap->source_name || !remap->target_name || !remap->description) return NULL;
+    }
+    return dst;
+}
+
+// Copy of an optional string (NULL stays NULL)
+// Returns 0 on success, -1 on allocation error
+static int copy_optional(arena_t *arena, const char **dst, const char *src) {
+    *dst = src ? arena_strdup(arena, src) : NULL;
+    return src && !*dst ? -1 : 0;
+}
+
+// Copy of a capability list
+// Returns 0 on success, -1 on allocation error
+static int copy_capabilities(arena_t *arena, device_capability_t **dst, const device_capability_t *src, int count) {
+    *dst = NULL;
+    if (count == 0) return 0;
+    *dst = arena_alloc(arena, count * sizeof(device_capability_t));
+    if (!*dst) return -1;
+    memcpy(*dst, src, count * sizeof(device_capability_t));
+    return 0;
+}
+
+// Deep copy of a device match expression
+// Returns 0 on success, -1 on allocation error
+static int copy_match(arena_t *arena, device_match_t *dst, const device_match_t *src) {
+    *dst = *src;
+    if (copy_optional(arena, &dst->phys, src->phys) != 0 ||
+        copy_optional(arena, &dst->uniq, src->uniq) != 0 ||
+        copy_optional(arena, &dst->name, src->name) != 0 ||
+        copy_optional(arena, &dst->usb_port, src->usb_port) != 0 ||
+        copy_capabilities(arena, &dst->require, src->require, src->require_count) != 0 ||
+        copy_capabilities(arena, &dst->forbid, src->forbid, src->forbid_count) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+// Shared modifier bits of src_config renumbered for the merged config (by name)
+static uint64_t translate_modifiers(uint64_t bits, const config_t *src_config, const config_t *merged) {
+    uint64_t translated = 0;
+    for (int i = 0; i < src_config->modifier_count; i++) {
+        if (!(bits & (1ull << i))) continue;
+        int index = config_find_modifier(merged, src_config->modifiers[i]);
+        if (index >= 0) translated |= 1ull << index;
+    }
+    return translated;
+}
+
+static void translate_rules(remap_rule_t *remaps, int count, const config_t *src_config, const config_t *merged) {
+    for (int i = 0; i < count; i++) {
+        remaps[i].when_down = translate_modifiers(remaps[i].when_down, src_config, merged);
+        remaps[i].when_up = translate_modifiers(remaps[i].when_up, src_config, merged);
+    }
+}
+
+// Deep copy of a device config into the merged config, its profile tables
+// re-indexed by name from the file's profiles to the merged ones
+// Returns 0 on success, -1 on allocation error
+static int copy_device(arena_t *arena, device_config_t *dst, const device_config_t *src,
+                       const config_t *src_config, const config_t *merged) {
+    *dst = *src;
+    dst->uuid = arena_strdup(arena, src->uuid);
+    dst->identifier = arena_strdup(arena, src->identifier);
+    dst->name_match = arena_strdup(arena, src->name_match);
+    dst->source = arena_strdup(arena, src->source);
+    dst->remaps = copy_rules(arena, src->remaps, src->remap_count);
+    if (!dst->uuid || !dst->identifier || !dst->name_match || !dst->source ||
+        (src->remap_count > 0 && !dst->remaps) || copy_match(arena, &dst->match, &src->match) != 0) {
+        return -1;
+    }
+    if (src->gestures.stroke_count > 0) {
+        dst->gestures.strokes = arena_alloc(arena, src->gestures.stroke_count * sizeof(gesture_t));
+        if (!dst->gestures.strokes) return -1;
+        memcpy(dst->gestures.strokes, src->gestures.strokes, src->gestures.stroke_count * sizeof(gesture_t));
+    }
+    if (src->mouse_keys.key_count > 0) {
+        dst->mouse_keys.keys = arena_alloc(arena, src->mouse_keys.key_count * sizeof(mouse_key_t));
+        if (!dst->mouse_keys.keys) return -1;
+        memcpy(dst->mouse_keys.keys, src->mouse_keys.keys, src->mouse_keys.key_count * sizeof(mouse_key_t));
+    }
+    if (copy_sequences(arena, &dst->sequences, &src->sequences) != 0) return -1;
+    if (src->scanner.output) {
+        dst->scanner.output = arena_strdup(arena, src->scanner.output);
+        if (!dst->scanner.output) return -1;
+    }
+    if (src->modifier_key_count > 0) {
+        dst->modifier_keys = arena_alloc(arena, src->modifier_key_count * sizeof(modifier_key_t));
+        if (!dst->modifier_keys) return -1;
+        for (int i = 0; i < src->modifier_key_count; i++) {
+            modifier_key_t *modifier = &dst->modifier_keys[i];
+            *modifier = src->modifier_keys[i];
+            modifier->modifier = config_find_modifier(merged, modifier->name);
+            if (modifier->modifier < 0) return -1;
+            modifier->name = merged->modifiers[modifier->modifier];
+        }
+    }
+    translate_rules(dst->remaps, dst->remap_count, src_config, merged);
+
+    dst->profiles = NULL;
+    dst->profile_count = 0;
+    if (merged->profile_count > 1) {
+        dst->profiles = arena_alloc(arena, merged->profile_count * sizeof(remap_table_t));
+        if (!dst->profiles) return -1;
+        dst->profile_count = merged->profile_count;
+    }
+
+    for (int p = 0; p < dst->profile_count; p++) {
+        remap_table_t *table = &dst->profiles[p];
+        int from = p > 0 ? config_find_profile(src_config, merged->profiles[p].name) : -1;
+        if (from > 0 && from < src->profile_count && src->profiles[from].remaps != src->remaps) {
+            table->remap_count = src->profiles[from].remap_count;
+            table->remaps = copy_rules(arena, src->profiles[from].remaps, table->remap_count);
+            if (table->remap_count > 0 && !table->remaps) return -1;
+            translate_rules(table->remaps, table->remap_count, src_config, merged);
+        } else {
+            table->remaps = dst->remaps;
+            table->remap_count = dst->remap_count;
+        }
+    }
+
+    config_compile_device(dst);
+    return compile_key_filters(arena, dst);
+}
+
+// Two devices in different files that would fight over the same input device
+// Returns a description of the conflict, NULL if none
+static const char* device_conflict(const device_config_t *a, const device_config_t *b) {
+    if (strcmp(a->uuid, b->uuid) == 0) return "same uuid";
+    if (strcmp(a->identifier, b->identifier) == 0 && strcmp(a->name_match, b->name_match) == 0 &&
+        config_match_equal(&a->match, &b->match)) {
+        return "same identifier/name_match/match, both would grab one device";
+    }
+    for (int i = 0; i < a->modifier_key_count; i++) {
+        for (int j = 0; j < b->modifier_key_count; j++) {
+            if (strcmp(a->modifier_keys[i].name, b->modifier_keys[j].name) == 0) return "both set the same modifier";
+        }
+    }
+    return NULL;
+}
+
+// Shared modifiers of the merged config: union of all files' names in order
+// Returns 0 on success, -1 on error (reported)
+static int merge_modifiers(arena_t *arena, config_t *merged, config_t *const *files, int count) {
+    merged->modifier_count = 0;
+    for (int i = 0; i < count; i++) {
+        for (int m = 0; m < files[i]->modifier_count; m++) {
+            const char *name = files[i]->modifiers[m];
+            if (config_find_modifier(merged, name) >= 0) continue;
+            if (merged->modifier_count == MAX_MODIFIERS) {
+                fprintf(stderr, "ERROR: %s: more than %d modifiers in all configs\n", files[i]->path, MAX_MODIFIERS);
+                return -1;
+            }
+            merged->modifiers[merged->modifier_count] = arena_strdup(arena, name);
+            if (!merged->modifiers[merged->modifier_count]) return -1;
+            merged->modifier_count++;
+        }
+    }
+    return 0;
+}
+
+// Profiles of the merged config: union of all files in order, with the
+// applications of every file that declares the same name
+// Returns 0 on success, -1 on error
+static int merge_profiles(arena_t *arena, config_t *merged, config_t *const *files, int count) {
+    merged->profiles = arena_alloc(arena, MAX_PROFILES * sizeof(profile_t));
+    if (!merged->profiles) return -1;
+    merged->profiles[0].name = "default";
+    merged->profile_count = 1;
+
+    for (int i = 0; i < count; i++) {
+        for (int p = 1; p < files[i]->profile_count; p++) {
+            const profile_t *profile = &files[i]->profiles[p];
+            if (config_find_profile(merged, profile->name) >= 0) continue;
+            if (merged->profile_count >= MAX_PROFILES) {
+                fprintf(stderr, "ERROR: %s: profile '%s': too many profiles across all config files (max %d)\n",
+                        files[i]->path, profile->name, MAX_PROFILES - 1);
+                return -1;
+            }
+            profile_t *added = &merged->profiles[merged->profile_count++];
+            if (!(added->name = arena_strdup(arena, profile->name))) return -1;
+        }
+    }
+
+    for (int m = 1; m < merged->profile_count; m++) {
+        profile_t *profile = &merged->profiles[m];
+        int total = 0;
+        for (int i = 0; i < count; i++) {
+            int p = config_find_profile(files[i], profile->name);
+            if (p > 0) total += files[i]->profiles[p].application_count;
+        }
+        if (total == 0) continue;
+
+        profile->applications = arena_alloc(arena, total * sizeof(char *));
+        if (!profile->applications) return -1;
+        for (int i = 0; i < count; i++) {
+            int p = config_find_profile(files[i], profile->name);
+            for (int j = 0; p > 0 && j < files[i]->profiles[p].application_count; j++) {
+                const char *app = arena_strdup(arena, files[i]->profiles[p].applications[j]);
+                if (!app) return -1;
+                profile->applications[profile->application_count++] = app;
+            }
+        }
+    }
+    return 0;
+}
+
+config_t* config_set_merge(const config_set_t *set, int replace_index, config_t *replacement, int flags) {
+    if (!set || set->count == 0) return NULL;
+
+    config_t *const *files = set->files;
+    config_t **substituted = NULL;
+    if (replace_index >= 0 && replace_index < set->count) {
+        substituted = malloc(set->count * sizeof(config_t *));
+        if (!substituted) return NULL;
+        memcpy(substituted, set->files, set->count * sizeof(config_t *));
+        substituted[replace_index] = replacement;
+        files = substituted;
+    }
+
+    // Profile count of the merge, to size the per-device tables up front
+    const char *names[MAX_PROFILES];
+    int profile_count = 1;
+    size_t profile_size = arena_aligned_size(MAX_PROFILES * sizeof(profile_t));
+    for (int i = 0; i < set->count; i++) {
+        for (int p = 1; p < files[i]->profile_count; p++) {
+            const profile_t *profile = &files[i]->profiles[p];
+            profile_size += arena_aligned_size(strlen(profile->name) + 1) +
+                            arena_aligned_size(profile->application_count * sizeof(char *));
+            for (int j = 0; j < profile->application_count; j++) {
+                profile_size += arena_aligned_size(strlen(profile->applications[j]) + 1);
+            }
+            int known = 0;
+            for (int k = 1; k < profile_count && !known; k++) {
+                known = strcmp(names[k], profile->name) == 0;
+            }
+            if (!known && profile_count < MAX_PROFILES) names[profile_count++] = profile->name;
+        }
+        for (int m = 0; m < files[i]->modifier_count; m++) {
+            profile_size += arena_aligned_size(strlen(files[i]->modifiers[m]) + 1);
+        }
+    }
+
+    const config_t *primary = files[0];
+    int total = 0;
+    size_t size = arena_aligned_size(sizeof(config_t)) + profile_size +
+                  arena_aligned_size(strlen(primary->path) + 1) +
+                  arena_aligned_size(strlen(primary->debug_log) + 1) +
+                  arena_aligned_size(strlen(primary->control_socket) + 1);
+    for (int i = 0; i < set->count; i++) {
+        total += files[i]->device_count;
+        size += arena_aligned_size(files[i]->device_count * sizeof(device_config_t));
+        for (int j = 0; j < files[i]->device_count; j++) {
+            size += device_copy_size(&files[i]->devices[j], profile_count);
+        }
+    }
+
+    arena_t arena;
+    arena_init(&arena);
+    config_t *merged = NULL;
+    if (arena_reserve(&arena, size) == 0) merged = arena_alloc(&arena, sizeof(config_t));
+    if (!merged) {
+        arena_free(&arena);
+        free(substituted);
+        return NULL;
+    }
+    merged->arena = arena;
+    arena_t *ma = &merged->arena;
+
+    // Global settings: first file only
+    merged->has_settings = primary->has_settings;
+    merged->debug = primary->debug;
+    merged->realtime = primary->realtime;
+    merged->workers = primary->workers;
+    memcpy(merged->worker_cpus, primary->worker_cpus, sizeof(merged->worker_cpus));
+    merged->path = arena_strdup(ma, primary->path);
+    merged->debug_log = arena_strdup(ma, primary->debug_log);
+    merged->control_socket = arena_strdup(ma, primary->control_socket);
+    merged->devices = total > 0 ? arena_alloc(ma, total * sizeof(device_config_t)) : NULL;
+    int errors = (!merged->path || !merged->debug_log || !merged->control_socket || (total > 0 && !merged->devices));
+    if (!errors && merge_profiles(ma, merged, files, set->count) != 0) errors++;
+    if (!errors && merge_modifiers(ma, merged, files, set->count) != 0) errors++;
+
+    for (int i = 1; i < set->count; i++) {
+        if (files[i]->has_settings) {
+            fprintf(stderr, "WARNING: %s: global settings ignored, they are taken from %s\n",
+                    files[i]->path, primary->path);
+        }
+    }
+
+    for (int i = 0; i < set->count && !errors; i++) {
+        for (int j = 0; j < files[i]->device_count; j++) {
+            const device_config_t *device = &files[i]->devices[j];
+            const char *conflict = NULL;
+            int k;
+            for (k = 0; k < merged->device_count && !conflict; k++) {
+                conflict = device_conflict(&merged->devices[k], device);
+            }
+            if (conflict) {
+                const device_config_t *other = &merged->devices[k - 1];
+                fprintf(stderr, "%s: %s: device '%s' conflicts with '%s' from %s (%s)%s\n",
+                        flags & CONFIG_ALLOW_PARTIAL ? "WARNING" : "ERROR", device->source,
+                        device->uuid, other->uuid, other->source, conflict,
+                        flags & CONFIG_ALLOW_PARTIAL ? ", skipped" : "");
+                if (!(flags & CONFIG_ALLOW_PARTIAL)) errors++;
+                continue;
+            }
+            if (copy_device(ma, &merged->devices[merged->device_count], device, files[i], merged) != 0) {
+                fprintf(stderr, "ERROR: Failed to allocate merged configuration\n");
+                errors++;
+                break;
+            }
+            merged->device_count++;
         }
     }
-    
-    if (config->devices) {
-        free(config->devices);
+    free(substituted);
+
+    if (errors) {
+        config_free(merged);
+        return NULL;
+    }
+
+    // Usually a typo: rules that require it never match
+    for (int m = 0; m < merged->modifier_count; m++) {
+        int set_by = 0;
+        for (int i = 0; i < merged->device_count && !set_by; i++) {
+            for (int k = 0; k < merged->devices[i].modifier_key_count && !set_by; k++) {
+                set_by = merged->devices[i].modifier_keys[k].modifier == m;
+            }
+        }
+        if (!set_by) fprintf(stderr, "WARNING: modifier '%s' is not set by any device\n", merged->modifiers[m]);
     }
-    
-    free(config);
-}
\ No newline at end of file
+    return merged;
+}
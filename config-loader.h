@@ -1,44 +1,314 @@
 #ifndef CONFIG_LOADER_H
 #define CONFIG_LOADER_H
 
+#include "arena.h"
 #include "key-database.h"
+#include "key-state.h"
+#include <stdint.h>
 
 // Remap rule structure
+// Strings of a loaded config live in its arena and are never NULL ("" if not set)
 typedef struct {
-    char source_name[64];
-    char target_name[64];
+    const char *source_name;    // As written in the config (key name or code)
+    const char *target_name;
     int source_code;
     int target_code;
     int source_type;
     int target_type;
-    char description[128];
+    const char *description;
+    int debounce_ms;            // Debounce window for the source key, -1 = device setting
+    int max_rate;               // Presses per second for the source key, -1 = device setting
+    int repeat_delay_ms;        // Software autorepeat of the target while held (rule.repeat), 0 = off
+    int repeat_period_ms;
+    int turbo_period_ms;        // Autofire: target pressed and released once per period (rule.turbo), 0 = off
+    uint64_t when_down;         // Shared modifiers that must be held for the rule to match (rule.when)
+    uint64_t when_up;           // Shared modifiers that must not be held ("!name")
 } remap_rule_t;
 
+// Rules of one device under one profile, compiled at load time
+typedef struct {
+    remap_rule_t *remaps;
+    int remap_count;
+    key_state_t remap_keys;
+} remap_table_t;
+
+// Chatter filter of one EV_KEY code, compiled at load time
+typedef struct {
+    uint16_t debounce_ms;       // Drop a press this soon after the key's last release, 0 = off
+    uint16_t interval_ms;       // Drop a press this soon after its last accepted press, 0 = off
+} key_filter_t;
+
+// Capability in a match expression: an event type (code -1) or one event code
+typedef struct {
+    int type;
+    int code;
+} device_capability_t;
+
+// Device identity predicates (device.match), compiled at load time
+// Every predicate that is set must hold; string patterns are fnmatch globs
+typedef struct {
+    int set;                    // Any predicate given
+    const char *phys;           // Physical path (e.g. "usb-0000:00:14.0-2.3/input0"), NULL = any
+    const char *uniq;
+    const char *name;
+    const char *usb_port;       // sysfs USB port path (e.g. "1-2.3"), NULL = any
+    int bus;                    // BUS_* id, -1 = any
+    int version;                // Device id version, -1 = any
+    device_capability_t *require;
+    int require_count;
+    device_capability_t *forbid;
+    int forbid_count;
+} device_match_t;
+
+// Button-hold scrolling (device.scroll): while the button is held, REL_X/REL_Y
+// become horizontal/vertical wheel events (with their _HI_RES variants)
+typedef struct {
+    int button;                 // EV_KEY code that turns motion into scrolling, 0 = off
+    int speed;                  // Hi-res wheel units (1/120 detent) per 100 counts of motion
+    int tap_ms;                 // Released this soon without scrolling = click, 0 = any time
+} scroll_config_t;
+
+// Longest key combo (gestures, sequence expansions)
+#define COMBO_MAX_KEYS 4
+
+// Keys pressed together: in order, then released in reverse
+typedef struct {
+    int keys[COMBO_MAX_KEYS];
+    int key_count;
+} key_combo_t;
+
+// Longest gesture stroke (directions)
+#define GESTURE_MAX_STROKE 8
+
+// Stroke directions (gesture_t.stroke digits)
+#define GESTURE_UP 1
+#define GESTURE_DOWN 2
+#define GESTURE_LEFT 3
+#define GESTURE_RIGHT 4
+
+// Mouse gesture: a stroke and the key combo it emits
+typedef struct {
+    uint32_t stroke;            // Directions as base-5 digits, first direction most significant
+    key_combo_t combo;
+} gesture_t;
+
+// Hold-button mouse gestures (device.gestures)
+typedef struct {
+    int button;                 // EV_KEY code held while stroking, 0 = off
+    int threshold;              // Motion (counts) per stroke direction; the first one starts the gesture
+    gesture_t *strokes;
+    int stroke_count;
+} gesture_config_t;
+
+// Key of the keyboard-driven pointer: moves it in a direction, or holds a button
+typedef struct {
+    int code;                   // Source EV_KEY code
+    int dx, dy;                 // Direction (-1, 0 or 1 per axis), 0/0 for a button
+    int button;                 // Button held while the key is, 0 = moves
+} mouse_key_t;
+
+// Mouse keys (device.mouse_keys): while direction keys are held, a timer tick moves
+// the pointer on the forward device, accelerating from speed to max_speed
+typedef struct {
+    mouse_key_t *keys;
+    int key_count;              // 0 = off
+    key_state_t sources;        // Codes of keys
+    int interval_ms;            // Tick period
+    int speed;                  // Counts per tick when movement starts
+    int max_speed;              // Counts per tick after accel_ms
+    int accel_ms;
+    int curve;                  // Acceleration curve: exponent of elapsed / accel_ms (1 = linear)
+} mouse_keys_config_t;
+
+// Longest key sequence (keys) and expansion (combos)
+#define SEQUENCE_MAX_KEYS 16
+#define SEQUENCE_MAX_OUTPUT 256
+
+// Key sequence and the combos it expands to, typed one after another
+typedef struct {
+    const char *name;           // As written in the config ("caps_lock g s")
+    int keys[SEQUENCE_MAX_KEYS];    // Source EV_KEY codes, pressed in order
+    int key_count;
+    key_combo_t *output;
+    int output_count;
+} sequence_t;
+
+// Key sequences (device.sequences), compiled at load time into an Aho-Corasick
+// automaton over the codes they use: one table lookup per key press however
+// many sequences there are
+typedef struct {
+    sequence_t *rules;
+    int rule_count;             // 0 = off
+    int timeout_ms;             // Longest pause between two keys of a sequence
+    uint8_t *symbols;           // Indexed by EV_KEY code (KEY_CNT entries): alphabet index + 1, 0 = in no sequence
+    int symbol_count;
+    int16_t *next;              // Transitions: [state * symbol_count + symbol] -> state, 0 = nothing matched
+    uint8_t *depth;             // Keys matched per state (the suffix of the input that is held back)
+    int16_t *match;             // Rule completed per state, -1 = none
+    int state_count;
+} sequence_config_t;
+
+// Barcode/HID scanner mode (device.scanner): keystrokes are decoded into text and
+// delivered as records to a local socket or FIFO instead of being injected
+typedef struct {
+    const char *output;         // Unix socket or FIFO path, NULL = off
+    int timeout_ms;             // A pause this long between keys ends a record (as Enter does)
+} scanner_config_t;
+
+// Shared modifiers: named states set by keys of one device (device.modifiers) and
+// tested by rules of any device (rule.when), one bit each
+#define MAX_MODIFIERS 64
+
+// Key that holds a shared modifier while it is down
+typedef struct {
+    int code;
+    int modifier;               // Bit of the modifier (config_t.modifiers index)
+    const char *name;           // Modifier name (config_t.modifiers entry)
+} modifier_key_t;
+
+// Kernel backends a device's rules can be offloaded to (device.offload)
+#define OFFLOAD_NONE 0
+#define OFFLOAD_KEYMAP 1        // Scancode keymap of the source node (true / "keymap")
+#define OFFLOAD_HID_BPF 2       // HID-BPF report rewriting, keymap as fallback ("hid-bpf")
+
 // Device configuration structure
 typedef struct {
-    char uuid[64];
-    char identifier[64];     // Device identifier: vendor:product (e.g., "046d:c08b") or unique string
-    char name_match[128];    // Device name pattern (fallback if no identifier)
+    const char *uuid;
+    const char *identifier;  // Device identifier: vendor:product (e.g., "046d:c08b") or unique string
+    const char *name_match;  // Device name pattern (fallback if no identifier)
+    device_match_t match;    // Additional identity predicates, all must hold
     remap_rule_t *remaps;
     int remap_count;
+    key_state_t remap_keys;  // EV_KEY source codes with a rule (see config_compile_device)
+    int worker;              // Worker thread index in threaded mode, -1 = round-robin
+    int debounce_ms;         // Debounce window for every key (device.debounce_ms), 0 = off
+    int max_rate;            // Presses per second per key (device.max_rate), 0 = unlimited
+    key_filter_t *key_filters;  // Indexed by EV_KEY code (KEY_CNT entries), NULL = no filters
+    int offload;             // Backend rules are offloaded to (device.offload), OFFLOAD_*
+    uint32_t invert_rel;     // Bit per EV_REL axis whose values are negated (device.invert)
+    scroll_config_t scroll;  // Button-hold scrolling, scroll.button 0 = off
+    gesture_config_t gestures;  // Mouse gestures, gestures.button 0 = off
+    mouse_keys_config_t mouse_keys; // Keyboard-driven pointer, mouse_keys.key_count 0 = off
+    sequence_config_t sequences;    // Key sequences, sequences.rule_count 0 = off
+    scanner_config_t scanner;       // Scanner mode, scanner.output NULL = off
+    modifier_key_t *modifier_keys;  // Keys that set shared modifiers (device.modifiers)
+    int modifier_key_count;
+    key_state_t modifier_sources;   // Codes of modifier_keys
+    const char *source;      // Config file the device comes from
+    remap_table_t *profiles; // Indexed like config_t.profiles: the device's rules for that profile
+                             // overlaid on its own remaps, NULL if the config has no profiles
+    int profile_count;
 } device_config_t;
 
+// Maximum profiles including "default" (config.profiles)
+#define MAX_PROFILES 32
+
+// Named remap set selected at runtime (control socket "profile" / "focus")
+typedef struct {
+    const char *name;
+    const char **applications;  // Application ids (fnmatch patterns) that select this profile
+    int application_count;
+} profile_t;
+
+// Low-latency mode for the event loop thread (config.realtime)
+typedef struct {
+    int enabled;
+    int policy;             // SCHED_FIFO or SCHED_RR
+    int priority;           // 1-99
+    int lock_memory;        // mlockall() after setup
+    int cpu;                // CPU to pin to, -1 = no pinning
+} realtime_config_t;
+
+// Maximum worker threads (config.workers)
+#define MAX_WORKERS 64
+
 // Main configuration structure
 typedef struct {
+    const char *path;           // File loaded from (first file of a merged config)
+    int has_settings;           // File sets anything besides config.devices
     int debug;
-    char debug_log[256];
+    const char *debug_log;
+    const char *control_socket; // Control socket path ("@name" = abstract namespace), empty = default
+    realtime_config_t realtime;
+    int workers;                // Device worker threads, 0 = everything on the main loop
+    int worker_cpus[MAX_WORKERS];   // CPU per worker (config.worker_cpus), -1 = not pinned
     device_config_t *devices;
     int device_count;
+    profile_t *profiles;        // [0] = "default" (devices' own remaps)
+    int profile_count;
+    const char *modifiers[MAX_MODIFIERS];   // Shared modifier names, index = bit
+    int modifier_count;
+    arena_t arena;              // Owns this struct, its devices, remaps and strings
 } config_t;
 
-// Load configuration from index.json file
-// Returns config_t* on success, NULL on error
+// load_config flags
+#define CONFIG_ALLOW_PARTIAL 0x1    // Skip invalid devices and remap rules instead of rejecting the config
+
+// Load and validate configuration from index.json file
+// Every schema violation is reported on stderr with its JSON path
+// (e.g. "config.devices[0].remaps[2].source"), unknown fields are warnings
+// Returns config_t* on success, NULL on error or if anything was invalid
+// (unless CONFIG_ALLOW_PARTIAL)
 // Caller must free with config_free()
-config_t* load_config(const char *config_path);
+config_t* load_config(const char *config_path, int flags);
+
+// Config files served by one process, in precedence order
+typedef struct {
+    char **paths;
+    config_t **files;           // Parsed config per path
+    int count;
+} config_set_t;
+
+// Expand CONFIG arguments (files, or conf.d-style directories whose *.json files
+// are taken in name order) and load every file
+// Returns 0 on success, -1 on error (set is left empty)
+int config_set_load(config_set_t *set, const char *const *args, int arg_count, int flags);
+
+// Index of a file in the set, matched by path as loaded or by file name
+// Returns index, or -1 if not found
+int config_set_find(const config_set_t *set, const char *file);
+
+// Merge the set into one config; file replace_index (-1 = none) is taken from
+// replacement instead (per-file reload)
+// Global settings come from the first file, devices from all files in order
+// The same uuid or device match in two files is a conflict (error, or the later
+// device is dropped with CONFIG_ALLOW_PARTIAL)
+// Returns a new config_t* independent of the inputs, NULL on error
+config_t* config_set_merge(const config_set_t *set, int replace_index, config_t *replacement, int flags);
+
+// Free all files of the set
+void config_set_free(config_set_t *set);
 
-// Free configuration structure
+// Free configuration structure (releases its arena in one go)
 void config_free(config_t *config);
 
+// Build the lookup data of a device from its remap rules and profile tables (done
+// by load_config; needed for device configs built by hand)
+void config_compile_device(device_config_t *device);
+
+// Check whether two match expressions select the same devices (compared as written)
+// Returns 1 if equal, 0 otherwise
+int config_match_equal(const device_match_t *a, const device_match_t *b);
+
+// Check whether a device uses a feature only the userspace pipeline has, such as
+// chatter filters or button scrolling: no kernel backend can then do everything
+// for it (axis inversion aside, which HID-BPF can do)
+// Returns 1 if so, 0 otherwise
+int device_needs_userspace(const device_config_t *device);
+
+// Index of a profile by name
+// Returns index, or -1 if not found
+int config_find_profile(const config_t *config, const char *name);
+
+// Bit of a shared modifier by name
+// Returns index, or -1 if not found
+int config_find_modifier(const config_t *config, const char *name);
+
+// Profile selected by a focused application id: the first profile with a
+// matching "applications" pattern
+// Returns profile index, 0 (default) if none matches
+int config_profile_for_application(const config_t *config, const char *application);
+
 // Expand environment variables in path (supports ${VAR:-default} syntax)
 char* expand_path(const char *path);
 
@@ -0,0 +1,450 @@
+#define _GNU_SOURCE
+#include "control-socket.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+
+#define CONTROL_LINE_MAX 512
+#define CONTROL_SEND_TIMEOUT_MS 1000   // Longest wait for a client to take a response
+
+typedef struct control_client {
+    struct control_socket *ctl;
+    int fd;
+    char buf[CONTROL_LINE_MAX];
+    size_t len;
+} control_client_t;
+
+struct control_socket {
+    int listen_fd;
+    char path[108];
+    event_loop_t *loop;
+    control_handler_fn handler;
+    void *userdata;
+    control_client_t clients[CONTROL_MAX_CLIENTS];
+    int reply_fds[CONTROL_MAX_FDS];     // Passed with the next response (SCM_RIGHTS)
+    int reply_fd_count;
+    int reply_sent;                     // Last response went out in full
+};
+
+void control_socket_default_path(const char *config_path, char *path, size_t path_size) {
+    if (!path || path_size == 0) return;
+
+    const char *base = config_path ? strrchr(config_path, '/') : NULL;
+    base = base ? base + 1 : (config_path ? config_path : "index.json");
+
+    // Strip .json extension
+    size_t base_len = strlen(base);
+    if (base_len > 5 && strcmp(base + base_len - 5, ".json") == 0) {
+        base_len -= 5;
+    }
+
+    snprintf(path, path_size, "%s/%.*s.sock", CONTROL_SOCKET_DIR, (int)base_len, base);
+}
+
+// Fill sockaddr_un for a filesystem path or "@name" abstract address
+// Returns address length, or 0 if the path does not fit
+static socklen_t fill_sockaddr(const char *path, struct sockaddr_un *addr) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+
+    size_t len = strlen(path);
+    if (len == 0 || len >= sizeof(addr->sun_path)) return 0;
+
+    if (path[0] == '@') {
+        // Abstract namespace: leading NUL, name is not NUL-terminated
+        memcpy(addr->sun_path + 1, path + 1, len - 1);
+        return (socklen_t)(offsetof(struct sockaddr_un, sun_path) + len);
+    }
+
+    memcpy(addr->sun_path, path, len);
+    return (socklen_t)(offsetof(struct sockaddr_un, sun_path) + len + 1);
+}
+
+static void close_client(control_client_t *client) {
+    if (client->fd < 0) return;
+
+    event_loop_remove(client->ctl->loop, client->fd);
+    close(client->fd);
+    client->fd = -1;
+    client->len = 0;
+}
+
+static int64_t monotonic_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Send data on a non-blocking client socket, waiting up to CONTROL_SEND_TIMEOUT_MS
+// for a client that reads slowly (a large status reply exceeds the socket buffer)
+// fds, if any, travel with the first byte
+// Returns 0 if all of it was sent, -1 otherwise
+static int send_all(int fd, const char *data, size_t len, const int *fds, int fd_count) {
+    char cmsg_buf[CMSG_SPACE(sizeof(int) * CONTROL_MAX_FDS)];
+    int64_t deadline = monotonic_ms() + CONTROL_SEND_TIMEOUT_MS;
+    size_t sent = 0;
+
+    while (sent < len) {
+        struct iovec iov;
+        iov.iov_base = (char *)data + sent;
+        iov.iov_len = len - sent;
+
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+
+        if (sent == 0 && fd_count > 0) {
+            size_t fds_size = sizeof(int) * (size_t)fd_count;
+            memset(cmsg_buf, 0, sizeof(cmsg_buf));
+            msg.msg_control = cmsg_buf;
+            msg.msg_controllen = CMSG_SPACE(fds_size);
+
+            struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+            cmsg->cmsg_level = SOL_SOCKET;
+            cmsg->cmsg_type = SCM_RIGHTS;
+            cmsg->cmsg_len = CMSG_LEN(fds_size);
+            memcpy(CMSG_DATA(cmsg), fds, fds_size);
+        }
+
+        ssize_t n = sendmsg(fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n > 0) {
+            sent += (size_t)n;
+            continue;
+        }
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && errno != EAGAIN) {
+            fprintf(stderr, "WARNING: Failed to send control response: %s\n", strerror(errno));
+            return -1;
+        }
+
+        int64_t remaining_ms = deadline - monotonic_ms();
+        struct pollfd pfd = { fd, POLLOUT, 0 };
+        if (remaining_ms <= 0 || poll(&pfd, 1, (int)remaining_ms) == 0) {
+            fprintf(stderr, "WARNING: Control client not reading, response cut off after %zu of %zu bytes\n",
+                    sent, len);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void send_response(control_client_t *client, json_t *response) {
+    control_socket_t *ctl = client->ctl;
+    char *text = json_dumps(response, JSON_COMPACT);
+    size_t len = text ? strlen(text) : 0;
+    char *line = text ? realloc(text, len + 2) : NULL;
+    if (!line) {
+        free(text);
+        ctl->reply_fd_count = 0;
+        ctl->reply_sent = 0;
+        return;
+    }
+    line[len] = '\n';
+    line[len + 1] = '\0';
+
+    ctl->reply_sent = send_all(client->fd, line, len + 1, ctl->reply_fds, ctl->reply_fd_count) == 0;
+    ctl->reply_fd_count = 0;
+    free(line);
+}
+
+static void handle_line(control_client_t *client, char *line) {
+    // Split "command arg..." on the first space
+    while (*line == ' ') line++;
+    char *arg = strchr(line, ' ');
+    if (arg) {
+        *arg++ = '\0';
+        while (*arg == ' ') arg++;
+    } else {
+        arg = "";
+    }
+
+    if (*line == '\0') return;
+
+    json_t *response = client->ctl->handler(line, arg, client->ctl->userdata);
+    if (!response) {
+        response = json_object();
+        json_object_set_new(response, "ok", json_false());
+        json_object_set_new(response, "error", json_string("unknown command"));
+    }
+
+    // A cut-off response leaves the client mid-line: drop it
+    send_response(client, response);
+    json_decref(response);
+    if (!client->ctl->reply_sent) close_client(client);
+}
+
+static void on_client_readable(int fd, uint32_t events, void *userdata) {
+    (void)events;
+    control_client_t *client = userdata;
+
+    ssize_t n = recv(fd, client->buf + client->len, sizeof(client->buf) - 1 - client->len, MSG_DONTWAIT);
+    if (n <= 0) {
+        if (n < 0 && (errno == EAGAIN || errno == EINTR)) return;
+        close_client(client);
+        return;
+    }
+    client->len += (size_t)n;
+    client->buf[client->len] = '\0';
+
+    // Process every complete line in the buffer
+    char *start = client->buf;
+    char *newline;
+    while (client->fd >= 0 && (newline = strchr(start, '\n')) != NULL) {
+        *newline = '\0';
+        if (newline > start && newline[-1] == '\r') newline[-1] = '\0';
+        handle_line(client, start);
+        start = newline + 1;
+    }
+
+    if (client->fd < 0) return;
+
+    size_t remaining = client->len - (size_t)(start - client->buf);
+    if (remaining == sizeof(client->buf) - 1) {
+        fprintf(stderr, "WARNING: Control request too long, dropping client\n");
+        close_client(client);
+        return;
+    }
+    memmove(client->buf, start, remaining);
+    client->len = remaining;
+}
+
+static void on_listen_readable(int fd, uint32_t events, void *userdata) {
+    (void)events;
+    control_socket_t *ctl = userdata;
+
+    int client_fd = accept(fd, NULL, NULL);
+    if (client_fd < 0) return;
+    fcntl(client_fd, F_SETFL, O_NONBLOCK);
+    fcntl(client_fd, F_SETFD, FD_CLOEXEC);
+
+    // Abstract sockets have no permissions: anyone may connect, and commands
+    // can ungrab devices or take them over. Only root and our own user are served
+    struct ucred peer = { .pid = 0, .uid = (uid_t)-1, .gid = (gid_t)-1 };
+    socklen_t peer_len = sizeof(peer);
+    if (getsockopt(client_fd, SOL_SOCKET, SO_PEERCRED, &peer, &peer_len) != 0 ||
+        (peer.uid != 0 && peer.uid != geteuid())) {
+        fprintf(stderr, "WARNING: Rejecting control client of uid %d\n", (int)peer.uid);
+        close(client_fd);
+        return;
+    }
+
+    for (int i = 0; i < CONTROL_MAX_CLIENTS; i++) {
+        control_client_t *client = &ctl->clients[i];
+        if (client->fd >= 0) continue;
+
+        client->fd = client_fd;
+        client->len = 0;
+        if (event_loop_add(ctl->loop, client_fd, on_client_readable, client) != 0) {
+            close(client_fd);
+            client->fd = -1;
+        }
+        return;
+    }
+
+    fprintf(stderr, "WARNING: Too many control clients, rejecting connection\n");
+    close(client_fd);
+}
+
+control_socket_t* control_socket_open(const char *path, event_loop_t *loop,
+                                      control_handler_fn handler, void *userdata) {
+    if (!path || !loop || !handler) return NULL;
+
+    struct sockaddr_un addr;
+    socklen_t addr_len = fill_sockaddr(path, &addr);
+    if (addr_len == 0) {
+        fprintf(stderr, "ERROR: Invalid control socket path: %s\n", path);
+        return NULL;
+    }
+
+    control_socket_t *ctl = calloc(1, sizeof(control_socket_t));
+    if (!ctl) return NULL;
+
+    strncpy(ctl->path, path, sizeof(ctl->path) - 1);
+    ctl->loop = loop;
+    ctl->handler = handler;
+    ctl->userdata = userdata;
+    for (int i = 0; i < CONTROL_MAX_CLIENTS; i++) {
+        ctl->clients[i].ctl = ctl;
+        ctl->clients[i].fd = -1;
+    }
+
+    ctl->listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (ctl->listen_fd < 0) {
+        fprintf(stderr, "ERROR: Failed to create control socket: %s\n", strerror(errno));
+        free(ctl);
+        return NULL;
+    }
+
+    if (path[0] != '@') {
+        // Default location may not exist yet; remove a stale socket from a previous run
+        if (strncmp(path, CONTROL_SOCKET_DIR "/", strlen(CONTROL_SOCKET_DIR) + 1) == 0) {
+            mkdir(CONTROL_SOCKET_DIR, 0755);
+        }
+        unlink(path);
+    }
+
+    // Control commands can ungrab devices - restrict the socket to the owner
+    mode_t old_umask = umask(0077);
+    int rc = bind(ctl->listen_fd, (struct sockaddr *)&addr, addr_len);
+    umask(old_umask);
+
+    if (rc < 0 || listen(ctl->listen_fd, CONTROL_MAX_CLIENTS) < 0) {
+        fprintf(stderr, "ERROR: Failed to bind control socket %s: %s\n", path, strerror(errno));
+        close(ctl->listen_fd);
+        free(ctl);
+        return NULL;
+    }
+
+    if (event_loop_add(loop, ctl->listen_fd, on_listen_readable, ctl) != 0) {
+        control_socket_close(ctl);
+        return NULL;
+    }
+
+    return ctl;
+}
+
+void control_socket_close(control_socket_t *ctl) {
+    if (!ctl) return;
+
+    for (int i = 0; i < CONTROL_MAX_CLIENTS; i++) {
+        close_client(&ctl->clients[i]);
+    }
+
+    if (ctl->listen_fd >= 0) {
+        event_loop_remove(ctl->loop, ctl->listen_fd);
+        close(ctl->listen_fd);
+        if (ctl->path[0] != '@') {
+            unlink(ctl->path);
+        }
+    }
+
+    free(ctl);
+}
+
+int control_socket_reply_sent(const control_socket_t *ctl) {
+    return ctl && ctl->reply_sent;
+}
+
+void control_socket_attach_fds(control_socket_t *ctl, const int *fds, int count) {
+    if (!ctl || !fds || count < 0) return;
+    if (count > CONTROL_MAX_FDS) count = CONTROL_MAX_FDS;
+
+    memcpy(ctl->reply_fds, fds, sizeof(int) * (size_t)count);
+    ctl->reply_fd_count = count;
+}
+
+int control_socket_request(const char *path, const char *command, char **response) {
+    return control_socket_request_fds(path, command, response, NULL, 0, NULL);
+}
+
+// Collect SCM_RIGHTS fds from a received message; extras beyond max_fds are closed
+static void collect_fds(struct msghdr *msg, int *fds, int max_fds, int *fd_count) {
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) continue;
+
+        int count = (int)((cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+        int *received = (int *)CMSG_DATA(cmsg);
+        for (int i = 0; i < count; i++) {
+            if (fds && fd_count && *fd_count < max_fds) {
+                fds[(*fd_count)++] = received[i];
+            } else {
+                close(received[i]);
+            }
+        }
+    }
+}
+
+int control_socket_request_fds(const char *path, const char *command, char **response,
+                               int *fds, int max_fds, int *fd_count) {
+    if (!path || !command || !response) return -1;
+    *response = NULL;
+    if (fd_count) *fd_count = 0;
+
+    struct sockaddr_un addr;
+    socklen_t addr_len = fill_sockaddr(path, &addr);
+    if (addr_len == 0) {
+        fprintf(stderr, "ERROR: Invalid control socket path: %s\n", path);
+        return -1;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+
+    // Don't hang forever on a wedged daemon
+    struct timeval timeout = { .tv_sec = 2, .tv_usec = 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    if (connect(fd, (struct sockaddr *)&addr, addr_len) < 0) {
+        fprintf(stderr, "ERROR: Could not connect to %s: %s\n", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    size_t command_len = strlen(command);
+    if (send(fd, command, command_len, MSG_NOSIGNAL) < 0 || send(fd, "\n", 1, MSG_NOSIGNAL) < 0) {
+        fprintf(stderr, "ERROR: Failed to send control command: %s\n", strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    // Read one response line of arbitrary length
+    size_t capacity = 4096;
+    size_t len = 0;
+    char *buf = malloc(capacity);
+    if (!buf) {
+        close(fd);
+        return -1;
+    }
+
+    for (;;) {
+        if (len + 1 >= capacity) {
+            capacity *= 2;
+            char *grown = realloc(buf, capacity);
+            if (!grown) break;
+            buf = grown;
+        }
+
+        struct iovec iov;
+        iov.iov_base = buf + len;
+        iov.iov_len = capacity - 1 - len;
+
+        char cmsg_buf[CMSG_SPACE(sizeof(int) * CONTROL_MAX_FDS)];
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = cmsg_buf;
+        msg.msg_controllen = sizeof(cmsg_buf);
+
+        ssize_t n = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+        if (n <= 0) break;
+        collect_fds(&msg, fds, max_fds, fd_count);
+        len += (size_t)n;
+        if (memchr(buf + len - n, '\n', (size_t)n)) break;
+    }
+    close(fd);
+
+    buf[len] = '\0';
+    char *newline = strchr(buf, '\n');
+    if (newline) *newline = '\0';
+
+    if (len == 0) {
+        fprintf(stderr, "ERROR: No response from %s\n", path);
+        free(buf);
+        return -1;
+    }
+
+    *response = buf;
+    return 0;
+}
@@ -0,0 +1,56 @@
+#ifndef CONTROL_SOCKET_H
+#define CONTROL_SOCKET_H
+
+#include <stddef.h>
+#include <jansson.h>
+#include "event-loop.h"
+
+// Directory for default control socket paths
+#define CONTROL_SOCKET_DIR "/run/keyswap"
+
+// Maximum simultaneously connected control clients
+#define CONTROL_MAX_CLIENTS 8
+
+// Maximum fds passed with one response (kernel SCM_MAX_FD is 253)
+#define CONTROL_MAX_FDS 252
+
+// Command handler: returns a JSON response object (ownership passes to caller)
+// or NULL for an unknown command
+// command is the first word of the request line, arg the (possibly empty) rest
+typedef json_t* (*control_handler_fn)(const char *command, const char *arg, void *userdata);
+
+// Opaque control socket server
+typedef struct control_socket control_socket_t;
+
+// Derive the default socket path for a config file
+// /path/to/kensington.json -> /run/keyswap/kensington.sock
+void control_socket_default_path(const char *config_path, char *path, size_t path_size);
+
+// Create a listening control socket and register it with the event loop
+// path: filesystem path, or "@name" for the abstract namespace
+// Returns control_socket_t* on success, NULL on error
+control_socket_t* control_socket_open(const char *path, event_loop_t *loop,
+                                      control_handler_fn handler, void *userdata);
+
+// Close server and all client connections (removes the socket file)
+void control_socket_close(control_socket_t *ctl);
+
+// Attach fds to the response of the command currently being handled
+// (call from inside the handler; fds are duplicated by the kernel, caller keeps ownership)
+void control_socket_attach_fds(control_socket_t *ctl, const int *fds, int count);
+
+// Check whether the response to the last handled command (and its attached fds)
+// was sent in full
+// Returns 1 if so, 0 otherwise
+int control_socket_reply_sent(const control_socket_t *ctl);
+
+// Client side: send one command line and read the one-line JSON response
+// Returns 0 on success (*response must be freed), -1 on error
+int control_socket_request(const char *path, const char *command, char **response);
+
+// Like control_socket_request, also receiving up to max_fds passed fds
+// *fd_count is set to the number of fds stored in fds (caller owns them)
+int control_socket_request_fds(const char *path, const char *command, char **response,
+                               int *fds, int max_fds, int *fd_count);
+
+#endif // CONTROL_SOCKET_H
@@ -10,6 +10,7 @@ SCRIPT_DIR="$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"
 KEYSWAP_BINARY="${KEYSWAP_BINARY:-$SCRIPT_DIR/keyswap}"
 SYSTEMD_DIR="/etc/systemd/system"
 SERVICE_PREFIX="keyswap"
+CONTROL_SOCKET_DIR="/run/keyswap"
 
 # Colors for output
 RED='\033[0;31m'
@@ -55,31 +56,21 @@ check_root() {
 validate_config() {
     local config_file="$1"
     
-    if [[ ! -f "$config_file" ]]; then
+    # A directory is a conf.d: all its *.json files run in one service
+    if [[ ! -f "$config_file" ]] && [[ ! -d "$config_file" ]]; then
         print_error "Config file not found: $config_file"
         return 1
     fi
     
-    # Check if file is valid JSON
-    if ! python3 -m json.tool "$config_file" >/dev/null 2>&1; then
-        print_error "Invalid JSON file: $config_file"
-        return 1
-    fi
-    
-    # Check for required keyswap schema elements
-    local has_metadata=$(python3 -c "import json, sys; data = json.load(open('$config_file')); sys.exit(0 if 'metadata' in data else 1)" 2>/dev/null)
-    local has_config=$(python3 -c "import json, sys; data = json.load(open('$config_file')); sys.exit(0 if 'config' in data else 1)" 2>/dev/null)
-    
-    if [[ $has_metadata -ne 0 ]] || [[ $has_config -ne 0 ]]; then
-        print_error "Config file missing required keyswap schema elements (metadata, config)"
+    # Schema check in one native pass; every error is printed with its JSON path
+    local keyswap_bin
+    if ! keyswap_bin=$(find_keyswap_binary); then
+        print_error "keyswap binary not found. Please build keyswap first (make) or install it."
         return 1
     fi
     
-    # Check if config has devices array
-    local has_devices=$(python3 -c "import json, sys; data = json.load(open('$config_file')); sys.exit(0 if 'devices' in data.get('config', {}) else 1)" 2>/dev/null)
-    
-    if [[ $has_devices -ne 0 ]]; then
-        print_error "Config file missing 'config.devices' array"
+    if ! "$keyswap_bin" --check "$config_file" >/dev/null; then
+        print_error "Invalid config file: $config_file"
         return 1
     fi
     
@@ -142,11 +133,16 @@ Type=simple
 User=root
 WorkingDirectory=${config_dir}
 ExecStart=${keyswap_bin} ${config_path}
+ExecReload=/bin/kill -HUP \$MAINPID
 Restart=always
 RestartSec=5
 StandardOutput=journal
 StandardError=journal
 
+# Control socket directory (shared by all keyswap services)
+RuntimeDirectory=keyswap
+RuntimeDirectoryPreserve=yes
+
 # Security settings
 NoNewPrivileges=true
 PrivateTmp=true
@@ -232,6 +228,10 @@ list_services() {
         return 0
     fi
     
+    # Binary is only needed for health queries; list still works without it
+    local keyswap_bin
+    keyswap_bin=$(find_keyswap_binary 2>/dev/null) || keyswap_bin=""
+    
     local count=1
     while IFS= read -r service_name; do
         if [[ -n "$service_name" ]]; then
@@ -262,6 +262,17 @@ list_services() {
                     echo -e "   Config: ${BLUE}${config_path}${NC}"
                 fi
             fi
+            
+            # Query live device health over the control socket
+            if [[ "$status" == "active" ]] && [[ -n "$keyswap_bin" ]] && [[ -n "$config_path" ]]; then
+                local socket_path="${CONTROL_SOCKET_DIR}/$(basename "$config_path" .json).sock"
+                local health
+                if health=$("$keyswap_bin" --socket "$socket_path" --status 2>/dev/null); then
+                    echo "$health" | sed 's/^/   /'
+                else
+                    echo -e "   Health: ${YELLOW}control socket not responding${NC}"
+                fi
+            fi
             echo ""
             ((count++))
         fi
@@ -402,7 +413,8 @@ usage() {
     echo ""
     echo "Commands:"
     echo "  load <config_file>    Load a keyswap config file and start it as a systemd service"
-    echo "  list                  List all active keyswap services"
+    echo "                        A directory runs all its *.json files in one service"
+    echo "  list                  List all active keyswap services with live device health"
     echo "  delete <name|number>   Delete a keyswap service by name or number"
     echo "  listen [ID|config]    Listen/monitor device events in real-time"
     echo "                        ID: vendor:product (e.g., 046d:c08b) or /dev/input/event8"
@@ -413,6 +425,7 @@ usage() {
     echo ""
     echo "Examples:"
     echo "  $0 load /path/to/kensington.json"
+    echo "  $0 load /etc/keyswap/conf.d"
     echo "  $0 list"
     echo "  $0 delete 1"
     echo "  $0 delete keyswap-kensington"
@@ -6,6 +6,8 @@
 #include <unistd.h>
 #include <glob.h>
 #include <ctype.h>
+#include <limits.h>
+#include <fnmatch.h>
 #include <libevdev/libevdev.h>
 
 // Case-insensitive substring search
@@ -31,18 +33,173 @@ static int strcasestr(const char *haystack, const char *needle) {
     return 0;
 }
 
-int find_matching_device(const char *identifier, const char *name_match, char *device_path, size_t path_size) {
-    if ((!identifier || strlen(identifier) == 0) && (!name_match || strlen(name_match) == 0)) {
-        return -1;
+// Match recorded identity against identifier (vendor:product or unique), then name pattern
+static int info_matches(int vendor_id, int product_id, const char *device_uniq, const char *device_name,
+                        const char *identifier, const char *name_match) {
+    // Try to match by identifier first (vendor:product or unique)
+    if (identifier && strlen(identifier) > 0) {
+        // Check vendor:product format (e.g., "046d:c08b")
+        if (vendor_id > 0 && product_id > 0) {
+            char vendor_product[64];
+            snprintf(vendor_product, sizeof(vendor_product), "%04x:%04x", vendor_id, product_id);
+            if (strcmp(vendor_product, identifier) == 0) {
+                return 1;
+            }
+        }
+        
+        // Check unique identifier
+        if (device_uniq && strlen(device_uniq) > 0 && strcmp(device_uniq, identifier) == 0) {
+            return 1;
+        }
     }
-    if (!device_path || path_size == 0) return -1;
+    
+    // Fallback to name_match
+    if (name_match && strlen(name_match) > 0) {
+        if (device_name && strcasestr(device_name, name_match)) {
+            return 1;
+        }
+    }
+    
+    return 0;
+}
+
+int device_matches(struct libevdev *dev, const char *identifier, const char *name_match) {
+    if (!dev) return 0;
+    
+    return info_matches(libevdev_get_id_vendor(dev), libevdev_get_id_product(dev),
+                        libevdev_get_uniq(dev), libevdev_get_name(dev), identifier, name_match);
+}
+
+// USB port path of an event node from sysfs: the last "bus-port[.port...]"
+// component of its device path (e.g. "1-2.3" for .../usb1/1-2/1-2.3/1-2.3:1.0/...)
+static void read_usb_port(const char *event_path, char *port, size_t port_size) {
+    port[0] = '\0';
+    
+    // /sys/class/input/eventN links to the node under /sys/devices
+    const char *node = strrchr(event_path, '/');
+    char sysfs_path[PATH_MAX];
+    char resolved[PATH_MAX];
+    snprintf(sysfs_path, sizeof(sysfs_path), "/sys/class/input/%s", node ? node + 1 : event_path);
+    ssize_t len = readlink(sysfs_path, resolved, sizeof(resolved) - 1);
+    if (len <= 0) return;
+    resolved[len] = '\0';
+    
+    char *save = NULL;
+    for (char *part = strtok_r(resolved, "/", &save); part; part = strtok_r(NULL, "/", &save)) {
+        // digits '-' then digits and dots only
+        const char *c = part;
+        while (isdigit((unsigned char)*c)) c++;
+        if (c == part || *c != '-' || !isdigit((unsigned char)c[1])) continue;
+        for (c++; isdigit((unsigned char)*c) || *c == '.'; c++);
+        if (*c == '\0') snprintf(port, port_size, "%s", part);
+    }
+}
+
+// Code bitmap of one event type (up to 64 codes)
+static uint64_t code_bits(struct libevdev *dev, unsigned int type, unsigned int count) {
+    uint64_t bits = 0;
+    for (unsigned int code = 0; code < count && code < 64; code++) {
+        if (libevdev_has_event_code(dev, type, code)) bits |= 1ull << code;
+    }
+    return bits;
+}
+
+void device_entry_fill(device_entry_t *entry, const char *path, struct libevdev *dev) {
+    memset(entry, 0, sizeof(*entry));
+    
+    const char *name = libevdev_get_name(dev);
+    const char *uniq = libevdev_get_uniq(dev);
+    const char *phys = libevdev_get_phys(dev);
+    snprintf(entry->path, sizeof(entry->path), "%s", path);
+    snprintf(entry->name, sizeof(entry->name), "%s", name ? name : "");
+    snprintf(entry->uniq, sizeof(entry->uniq), "%s", uniq ? uniq : "");
+    snprintf(entry->phys, sizeof(entry->phys), "%s", phys ? phys : "");
+    entry->vendor = libevdev_get_id_vendor(dev);
+    entry->product = libevdev_get_id_product(dev);
+    entry->bus = libevdev_get_id_bustype(dev);
+    entry->version = libevdev_get_id_version(dev);
+    if (entry->bus == BUS_USB) {
+        read_usb_port(path, entry->usb_port, sizeof(entry->usb_port));
+    }
+    
+    for (unsigned int type = 0; type < EV_CNT && type < 32; type++) {
+        if (libevdev_has_event_type(dev, type)) entry->types |= 1u << type;
+    }
+    for (unsigned int code = 0; code < KEY_CNT; code++) {
+        if (libevdev_has_event_code(dev, EV_KEY, code)) key_state_set(&entry->keys, code, 1);
+    }
+    entry->rel = code_bits(dev, EV_REL, REL_CNT);
+    entry->abs = code_bits(dev, EV_ABS, ABS_CNT);
+    entry->sw = code_bits(dev, EV_SW, SW_CNT);
+    entry->led = code_bits(dev, EV_LED, LED_CNT);
+    entry->msc = code_bits(dev, EV_MSC, MSC_CNT);
+}
+
+// Check whether the entry supports a capability (type only when code is -1)
+static int entry_has(const device_entry_t *entry, const device_capability_t *cap) {
+    if (cap->type < 0 || cap->type >= 32 || !(entry->types & (1u << cap->type))) return 0;
+    if (cap->code < 0) return 1;
+    
+    uint64_t bits;
+    switch (cap->type) {
+        case EV_KEY: return key_state_test(&entry->keys, cap->code);
+        case EV_REL: bits = entry->rel; break;
+        case EV_ABS: bits = entry->abs; break;
+        case EV_SW: bits = entry->sw; break;
+        case EV_LED: bits = entry->led; break;
+        case EV_MSC: bits = entry->msc; break;
+        default: return 0;
+    }
+    return cap->code < 64 && (bits & (1ull << cap->code)) != 0;
+}
+
+// Check every predicate of a match expression
+static int match_holds(const device_entry_t *entry, const device_match_t *match) {
+    if (match->phys && fnmatch(match->phys, entry->phys, 0) != 0) return 0;
+    if (match->uniq && fnmatch(match->uniq, entry->uniq, 0) != 0) return 0;
+    if (match->name && fnmatch(match->name, entry->name, 0) != 0) return 0;
+    if (match->usb_port && fnmatch(match->usb_port, entry->usb_port, 0) != 0) return 0;
+    if (match->bus >= 0 && match->bus != entry->bus) return 0;
+    if (match->version >= 0 && match->version != entry->version) return 0;
+    
+    for (int i = 0; i < match->require_count; i++) {
+        if (!entry_has(entry, &match->require[i])) return 0;
+    }
+    for (int i = 0; i < match->forbid_count; i++) {
+        if (entry_has(entry, &match->forbid[i])) return 0;
+    }
+    return 1;
+}
+
+int device_entry_matches(const device_entry_t *entry, const char *identifier, const char *name_match,
+                         const device_match_t *match) {
+    int by_id = (identifier && strlen(identifier) > 0) || (name_match && strlen(name_match) > 0);
+    int by_match = match && match->set;
+    if (!by_id && !by_match) return 0;
+    
+    if (by_id && !info_matches(entry->vendor, entry->product, entry->uniq, entry->name, identifier, name_match)) {
+        return 0;
+    }
+    return !by_match || match_holds(entry, match);
+}
+
+int device_inventory_scan(device_inventory_t *inventory) {
+    memset(inventory, 0, sizeof(*inventory));
     
     glob_t glob_result;
     memset(&glob_result, 0, sizeof(glob_result));
     
     // Find all /dev/input/event* devices
     int glob_ret = glob("/dev/input/event*", GLOB_NOSORT, NULL, &glob_result);
-    if (glob_ret != 0) {
+    if (glob_ret == GLOB_NOMATCH) {
+        return 0;
+    } else if (glob_ret != 0) {
+        return -1;
+    }
+    
+    inventory->devices = calloc(glob_result.gl_pathc, sizeof(device_entry_t));
+    if (!inventory->devices) {
+        globfree(&glob_result);
         return -1;
     }
     
@@ -54,68 +211,64 @@ int find_matching_device(const char *identifier, const char *name_match, char *d
         if (fd < 0) continue;
         
         struct libevdev *dev = NULL;
-        int rc = libevdev_new_from_fd(fd, &dev);
-        if (rc < 0) {
+        if (libevdev_new_from_fd(fd, &dev) < 0) {
             close(fd);
             continue;
         }
         
-        // Try to match by identifier first (vendor:product or unique)
-        if (identifier && strlen(identifier) > 0) {
-            int vendor_id = libevdev_get_id_vendor(dev);
-            int product_id = libevdev_get_id_product(dev);
-            const char *device_uniq = libevdev_get_uniq(dev);
-            
-            // Check vendor:product format (e.g., "046d:c08b")
-            if (vendor_id > 0 && product_id > 0) {
-                char vendor_product[64];
-                snprintf(vendor_product, sizeof(vendor_product), "%04x:%04x", vendor_id, product_id);
-                if (strcmp(vendor_product, identifier) == 0) {
-                    // Found matching device by vendor:product
-                    strncpy(device_path, event_path, path_size - 1);
-                    device_path[path_size - 1] = '\0';
-                    
-                    libevdev_free(dev);
-                    close(fd);
-                    globfree(&glob_result);
-                    return 0;
-                }
-            }
-            
-            // Check unique identifier
-            if (device_uniq && strlen(device_uniq) > 0 && strcmp(device_uniq, identifier) == 0) {
-                // Found matching device by unique
-                strncpy(device_path, event_path, path_size - 1);
-                device_path[path_size - 1] = '\0';
-                
-                libevdev_free(dev);
-                close(fd);
-                globfree(&glob_result);
-                return 0;
-            }
-        }
-        
-        // Fallback to name_match
-        if (name_match && strlen(name_match) > 0) {
-            const char *device_name = libevdev_get_name(dev);
-            if (device_name && strcasestr(device_name, name_match)) {
-                // Found matching device by name
-                strncpy(device_path, event_path, path_size - 1);
-                device_path[path_size - 1] = '\0';
-                
-                libevdev_free(dev);
-                close(fd);
-                globfree(&glob_result);
-                return 0;
-            }
-        }
+        device_entry_fill(&inventory->devices[inventory->count++], event_path, dev);
         
         libevdev_free(dev);
         close(fd);
     }
     
     globfree(&glob_result);
-    return -1;
+    return 0;
+}
+
+const device_entry_t* device_inventory_find(const device_inventory_t *inventory, const char *identifier,
+                                           const char *name_match, const device_match_t *match,
+                                           const char *const *used, int used_count) {
+    for (int i = 0; i < inventory->count; i++) {
+        const device_entry_t *entry = &inventory->devices[i];
+        
+        int claimed = 0;
+        for (int j = 0; j < used_count && !claimed; j++) {
+            claimed = used[j] && strcmp(used[j], entry->path) == 0;
+        }
+        if (claimed) continue;
+        
+        if (device_entry_matches(entry, identifier, name_match, match)) {
+            return entry;
+        }
+    }
+    
+    return NULL;
+}
+
+void device_inventory_free(device_inventory_t *inventory) {
+    if (!inventory) return;
+    
+    free(inventory->devices);
+    inventory->devices = NULL;
+    inventory->count = 0;
+}
+
+int find_matching_device(const char *identifier, const char *name_match, char *device_path, size_t path_size) {
+    if (!device_path || path_size == 0) return -1;
+    
+    device_inventory_t inventory;
+    if (device_inventory_scan(&inventory) != 0) {
+        return -1;
+    }
+    
+    const device_entry_t *info = device_inventory_find(&inventory, identifier, name_match, NULL, NULL, 0);
+    if (info) {
+        snprintf(device_path, path_size, "%s", info->path);
+    }
+    
+    device_inventory_free(&inventory);
+    return info ? 0 : -1;
 }
 
 int count_matching_devices(const char *identifier, const char *name_match) {
@@ -123,71 +276,19 @@ int count_matching_devices(const char *identifier, const char *name_match) {
         return -1;
     }
     
-    glob_t glob_result;
-    memset(&glob_result, 0, sizeof(glob_result));
-    
-    // Find all /dev/input/event* devices
-    int glob_ret = glob("/dev/input/event*", GLOB_NOSORT, NULL, &glob_result);
-    if (glob_ret != 0) {
+    device_inventory_t inventory;
+    if (device_inventory_scan(&inventory) != 0) {
         return -1;
     }
     
     int match_count = 0;
-    
-    for (size_t i = 0; i < glob_result.gl_pathc; i++) {
-        const char *event_path = glob_result.gl_pathv[i];
-        
-        // Try to open device
-        int fd = open(event_path, O_RDONLY);
-        if (fd < 0) continue;
-        
-        struct libevdev *dev = NULL;
-        int rc = libevdev_new_from_fd(fd, &dev);
-        if (rc < 0) {
-            close(fd);
-            continue;
-        }
-        
-        int is_match = 0;
-        
-        // Try to match by identifier first (vendor:product or unique)
-        if (identifier && strlen(identifier) > 0) {
-            int vendor_id = libevdev_get_id_vendor(dev);
-            int product_id = libevdev_get_id_product(dev);
-            const char *device_uniq = libevdev_get_uniq(dev);
-            
-            // Check vendor:product format (e.g., "046d:c08b")
-            if (vendor_id > 0 && product_id > 0) {
-                char vendor_product[64];
-                snprintf(vendor_product, sizeof(vendor_product), "%04x:%04x", vendor_id, product_id);
-                if (strcmp(vendor_product, identifier) == 0) {
-                    is_match = 1;
-                }
-            }
-            
-            // Check unique identifier
-            if (!is_match && device_uniq && strlen(device_uniq) > 0 && strcmp(device_uniq, identifier) == 0) {
-                is_match = 1;
-            }
-        }
-        
-        // Fallback to name_match
-        if (!is_match && name_match && strlen(name_match) > 0) {
-            const char *device_name = libevdev_get_name(dev);
-            if (device_name && strcasestr(device_name, name_match)) {
-                is_match = 1;
-            }
-        }
-        
-        if (is_match) {
+    for (int i = 0; i < inventory.count; i++) {
+        if (device_entry_matches(&inventory.devices[i], identifier, name_match, NULL)) {
             match_count++;
         }
-        
-        libevdev_free(dev);
-        close(fd);
     }
     
-    globfree(&glob_result);
+    device_inventory_free(&inventory);
     return match_count;
 }
 
@@ -244,6 +345,7 @@ typedef struct {
     char name[256];
     char identifier[64];  // vendor:product or unique, whichever is available
     char event_path[64];  // /dev/input/event* path
+    char usb_port[64];    // sysfs USB port path, tells identical devices apart (match.usb_port)
     int has_identifier;
 } device_info_t;
 
@@ -324,6 +426,9 @@ int list_all_devices(void) {
             // Store event path
             strncpy(devices[device_count].event_path, event_path, sizeof(devices[device_count].event_path) - 1);
             devices[device_count].event_path[sizeof(devices[device_count].event_path) - 1] = '\0';
+            if (libevdev_get_id_bustype(dev) == BUS_USB) {
+                read_usb_port(event_path, devices[device_count].usb_port, sizeof(devices[device_count].usb_port));
+            }
             
             // Get vendor/product IDs (permanent identifier for USB devices)
             int vendor_id = libevdev_get_id_vendor(dev);
@@ -383,10 +488,14 @@ int list_all_devices(void) {
         // Display event path and identifier (vendor:product or unique)
         printf("  %s", devices[i].event_path);
         if (devices[i].has_identifier) {
-            printf(" [%s]\n", devices[i].identifier);
+            printf(" [%s]", devices[i].identifier);
         } else {
-            printf(" [no identifier available]\n");
+            printf(" [no identifier available]");
+        }
+        if (devices[i].usb_port[0] != '\0') {
+            printf(" usb_port %s", devices[i].usb_port);
         }
+        printf("\n");
     }
     
     printf("\nTotal: %d device group(s)\n", group_count);
@@ -2,8 +2,62 @@
 #define DEVICE_MATCHER_H
 
 #include "config-loader.h"
+#include <stdint.h>
 #include <libevdev/libevdev.h>
 
+// Identity of one /dev/input/event* node, captured by a single inventory scan
+typedef struct {
+    char path[256];
+    char name[256];
+    char uniq[64];
+    char phys[128];
+    char usb_port[64];          // sysfs USB port path (e.g. "1-2.3"), empty if not on USB
+    int vendor;
+    int product;
+    int bus;
+    int version;
+    uint32_t types;             // Supported EV_* types, one bit each
+    key_state_t keys;           // Supported EV_KEY codes
+    uint64_t rel;               // Supported EV_REL / EV_ABS / EV_SW / EV_LED / EV_MSC codes
+    uint64_t abs;
+    uint64_t sw;
+    uint64_t led;
+    uint64_t msc;
+} device_entry_t;
+
+// Snapshot of every readable input device
+typedef struct {
+    device_entry_t *devices;
+    int count;
+} device_inventory_t;
+
+// Open every /dev/input/event* node once and record its identity
+// Returns 0 on success, -1 on error
+int device_inventory_scan(device_inventory_t *inventory);
+
+// Find the first inventory entry matching identifier (vendor:product or unique) or name
+// pattern, and match expression (NULL = none)
+// Entries whose path is in used[0..used_count) are skipped (already claimed by another device)
+// Returns the entry, NULL if none matches
+const device_entry_t* device_inventory_find(const device_inventory_t *inventory, const char *identifier,
+                                           const char *name_match, const device_match_t *match,
+                                           const char *const *used, int used_count);
+
+void device_inventory_free(device_inventory_t *inventory);
+
+// Record the identity of an opened device
+void device_entry_fill(device_entry_t *entry, const char *path, struct libevdev *dev);
+
+// Check an entry against identifier (vendor:product or unique) or name pattern, if
+// either is set, and against every predicate of match (NULL = none)
+// Returns 1 on match, 0 otherwise (also when nothing at all is set)
+int device_entry_matches(const device_entry_t *entry, const char *identifier, const char *name_match,
+                         const device_match_t *match);
+
+// Check whether an opened device matches identifier (vendor:product or unique) or name pattern
+// Returns 1 on match, 0 otherwise
+int device_matches(struct libevdev *dev, const char *identifier, const char *name_match);
+
 // Find a device matching identifier (vendor:product or unique) or name pattern
 // Returns 0 on success (device_path filled), -1 on failure
 // Prefers identifier match, falls back to name_match if identifier is empty
@@ -0,0 +1,89 @@
+#include "device-stats.h"
+#include <time.h>
+
+uint64_t stats_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+void stats_record_latency(device_stats_t *stats, const struct input_event *ev, uint64_t now_ns) {
+    if (!stats || !ev) return;
+
+    uint64_t event_ns = (uint64_t)ev->input_event_sec * 1000000000ull +
+                        (uint64_t)ev->input_event_usec * 1000ull;
+    if (event_ns == 0 || event_ns > now_ns) return;
+
+    uint64_t latency_ns = now_ns - event_ns;
+    uint64_t latency_us = latency_ns / 1000;
+
+    // log2 bucket: 0 for < 1us, otherwise bit length of latency_us
+    int bucket = 0;
+    while (latency_us && bucket < LATENCY_BUCKETS - 1) {
+        latency_us >>= 1;
+        bucket++;
+    }
+
+    stats->latency_buckets[bucket]++;
+    stats->latency_count++;
+    stats->latency_sum_ns += latency_ns;
+    if (latency_ns > stats->latency_max_ns) {
+        stats->latency_max_ns = latency_ns;
+    }
+}
+
+void stats_accumulate(device_stats_t *dst, const device_stats_t *src) {
+    if (!dst || !src) return;
+
+    dst->events += src->events;
+    dst->remapped += src->remapped;
+    dst->forwarded += src->forwarded;
+    dst->dropped += src->dropped;
+    dst->syn_dropped += src->syn_dropped;
+    dst->filtered += src->filtered;
+    dst->latency_count += src->latency_count;
+    dst->latency_sum_ns += src->latency_sum_ns;
+    if (src->latency_max_ns > dst->latency_max_ns) {
+        dst->latency_max_ns = src->latency_max_ns;
+    }
+    for (int i = 0; i < LATENCY_BUCKETS; i++) {
+        dst->latency_buckets[i] += src->latency_buckets[i];
+    }
+}
+
+uint64_t stats_bucket_limit_us(int bucket) {
+    if (bucket < 0 || bucket >= LATENCY_BUCKETS - 1) return 0;
+    return 1ull << bucket;
+}
+
+json_t* stats_to_json(const device_stats_t *stats) {
+    json_t *obj = json_object();
+    if (!obj || !stats) return obj;
+
+    json_object_set_new(obj, "events", json_integer((json_int_t)stats->events));
+    json_object_set_new(obj, "remapped", json_integer((json_int_t)stats->remapped));
+    json_object_set_new(obj, "forwarded", json_integer((json_int_t)stats->forwarded));
+    json_object_set_new(obj, "dropped", json_integer((json_int_t)stats->dropped));
+    json_object_set_new(obj, "syn_dropped", json_integer((json_int_t)stats->syn_dropped));
+    json_object_set_new(obj, "filtered", json_integer((json_int_t)stats->filtered));
+
+    json_t *latency = json_object();
+    uint64_t mean_ns = stats->latency_count ? stats->latency_sum_ns / stats->latency_count : 0;
+    json_object_set_new(latency, "count", json_integer((json_int_t)stats->latency_count));
+    json_object_set_new(latency, "mean_us", json_integer((json_int_t)(mean_ns / 1000)));
+    json_object_set_new(latency, "max_us", json_integer((json_int_t)(stats->latency_max_ns / 1000)));
+
+    // Histogram as [limit_us, count] pairs, limit null for the overflow bucket
+    json_t *histogram = json_array();
+    for (int i = 0; i < LATENCY_BUCKETS; i++) {
+        json_t *bucket = json_array();
+        uint64_t limit = stats_bucket_limit_us(i);
+        json_array_append_new(bucket, limit ? json_integer((json_int_t)limit) : json_null());
+        json_array_append_new(bucket, json_integer((json_int_t)stats->latency_buckets[i]));
+        json_array_append_new(histogram, bucket);
+    }
+    json_object_set_new(latency, "histogram", histogram);
+    json_object_set_new(obj, "latency", latency);
+
+    return obj;
+}
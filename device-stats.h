@@ -0,0 +1,44 @@
+#ifndef DEVICE_STATS_H
+#define DEVICE_STATS_H
+
+#include <stdint.h>
+#include <jansson.h>
+#include <linux/input.h>
+
+// Number of log2 latency histogram buckets
+// Bucket 0 counts latencies < 1us, bucket i counts [2^(i-1), 2^i) us,
+// the last bucket collects everything above
+#define LATENCY_BUCKETS 16
+
+// Per-device event counters and latency histogram
+typedef struct {
+    uint64_t events;                      // Events read from the source device
+    uint64_t remapped;                    // Events consumed by a remap rule
+    uint64_t forwarded;                   // Events forwarded unchanged
+    uint64_t dropped;                     // Events that could not be emitted
+    uint64_t syn_dropped;                 // SYN_DROPPED overruns reported by the kernel
+    uint64_t filtered;                    // Key events dropped by debounce / rate limit filters
+    uint64_t latency_count;
+    uint64_t latency_sum_ns;
+    uint64_t latency_max_ns;
+    uint64_t latency_buckets[LATENCY_BUCKETS];
+} device_stats_t;
+
+// Current CLOCK_MONOTONIC time in nanoseconds
+uint64_t stats_now_ns(void);
+
+// Record latency between the kernel event timestamp and now
+// Recorded once per emitted frame, using the source frame's SYN_REPORT timestamp
+// Event timestamps must be CLOCK_MONOTONIC (see setup_device)
+void stats_record_latency(device_stats_t *stats, const struct input_event *ev, uint64_t now_ns);
+
+// Add all counters from src into dst
+void stats_accumulate(device_stats_t *dst, const device_stats_t *src);
+
+// Upper bound (in microseconds) of a histogram bucket, 0 for the overflow bucket
+uint64_t stats_bucket_limit_us(int bucket);
+
+// Serialize counters and latency summary/histogram to a JSON object
+json_t* stats_to_json(const device_stats_t *stats);
+
+#endif // DEVICE_STATS_H
@@ -0,0 +1,143 @@
+#include "event-loop.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/epoll.h>
+
+#define EVENT_LOOP_MAX_EVENTS 32
+
+// Registered fd slot
+// The generation counter lets dispatch ignore events for slots that were
+// removed (and possibly reused) earlier in the same epoll_wait batch
+typedef struct {
+    int fd;
+    uint32_t generation;
+    event_loop_cb cb;
+    void *userdata;
+} event_slot_t;
+
+struct event_loop {
+    int epoll_fd;
+    event_slot_t *slots;
+    int slot_count;
+    int slot_capacity;
+};
+
+event_loop_t* event_loop_new(void) {
+    event_loop_t *loop = calloc(1, sizeof(event_loop_t));
+    if (!loop) return NULL;
+
+    loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (loop->epoll_fd < 0) {
+        fprintf(stderr, "ERROR: Failed to create epoll instance: %s\n", strerror(errno));
+        free(loop);
+        return NULL;
+    }
+
+    return loop;
+}
+
+// Find a free slot (cb == NULL) or grow the slot array
+static int alloc_slot(event_loop_t *loop) {
+    for (int i = 0; i < loop->slot_count; i++) {
+        if (!loop->slots[i].cb) return i;
+    }
+
+    if (loop->slot_count == loop->slot_capacity) {
+        int capacity = loop->slot_capacity ? loop->slot_capacity * 2 : 16;
+        event_slot_t *slots = realloc(loop->slots, capacity * sizeof(event_slot_t));
+        if (!slots) return -1;
+        loop->slots = slots;
+        loop->slot_capacity = capacity;
+    }
+
+    memset(&loop->slots[loop->slot_count], 0, sizeof(event_slot_t));
+    loop->slots[loop->slot_count].fd = -1;
+    return loop->slot_count++;
+}
+
+int event_loop_add(event_loop_t *loop, int fd, event_loop_cb cb, void *userdata) {
+    if (!loop || fd < 0 || !cb) return -1;
+
+    int slot = alloc_slot(loop);
+    if (slot < 0) {
+        fprintf(stderr, "ERROR: Failed to allocate event loop slot\n");
+        return -1;
+    }
+
+    event_slot_t *s = &loop->slots[slot];
+    s->generation++;
+
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.u64 = ((uint64_t)s->generation << 32) | (uint32_t)slot;
+
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        fprintf(stderr, "ERROR: Failed to add fd %d to event loop: %s\n", fd, strerror(errno));
+        return -1;
+    }
+
+    s->fd = fd;
+    s->cb = cb;
+    s->userdata = userdata;
+    return 0;
+}
+
+int event_loop_remove(event_loop_t *loop, int fd) {
+    if (!loop || fd < 0) return -1;
+
+    for (int i = 0; i < loop->slot_count; i++) {
+        event_slot_t *s = &loop->slots[i];
+        if (s->cb && s->fd == fd) {
+            epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+            s->fd = -1;
+            s->cb = NULL;
+            s->userdata = NULL;
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+int event_loop_dispatch(event_loop_t *loop, int timeout_ms) {
+    if (!loop) return -1;
+
+    struct epoll_event events[EVENT_LOOP_MAX_EVENTS];
+    int n = epoll_wait(loop->epoll_fd, events, EVENT_LOOP_MAX_EVENTS, timeout_ms);
+    if (n < 0) {
+        if (errno == EINTR) return 0;
+        fprintf(stderr, "ERROR: epoll_wait failed: %s\n", strerror(errno));
+        return -1;
+    }
+
+    int dispatched = 0;
+    for (int i = 0; i < n; i++) {
+        uint32_t slot = (uint32_t)(events[i].data.u64 & 0xffffffffu);
+        uint32_t generation = (uint32_t)(events[i].data.u64 >> 32);
+
+        if ((int)slot >= loop->slot_count) continue;
+        event_slot_t *s = &loop->slots[slot];
+
+        // Slot removed (or reused) by an earlier callback in this batch
+        if (!s->cb || s->generation != generation) continue;
+
+        s->cb(s->fd, events[i].events, s->userdata);
+        dispatched++;
+    }
+
+    return dispatched;
+}
+
+void event_loop_free(event_loop_t *loop) {
+    if (!loop) return;
+
+    if (loop->epoll_fd >= 0) {
+        close(loop->epoll_fd);
+    }
+    free(loop->slots);
+    free(loop);
+}
@@ -0,0 +1,32 @@
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+#include <stdint.h>
+
+// Callback invoked when a registered fd becomes ready
+// events is the epoll event mask (EPOLLIN, EPOLLHUP, ...)
+typedef void (*event_loop_cb)(int fd, uint32_t events, void *userdata);
+
+// Opaque epoll-based event loop
+typedef struct event_loop event_loop_t;
+
+// Create a new event loop
+// Returns event_loop_t* on success, NULL on error
+event_loop_t* event_loop_new(void);
+
+// Register fd for EPOLLIN readiness
+// Returns 0 on success, -1 on error
+int event_loop_add(event_loop_t *loop, int fd, event_loop_cb cb, void *userdata);
+
+// Unregister fd (safe to call from inside a callback)
+// Returns 0 on success, -1 if fd was not registered
+int event_loop_remove(event_loop_t *loop, int fd);
+
+// Wait up to timeout_ms (-1 = forever) and dispatch ready callbacks
+// Returns number of dispatched callbacks, 0 on timeout/signal, -1 on error
+int event_loop_dispatch(event_loop_t *loop, int timeout_ms);
+
+// Free event loop (registered fds are not closed)
+void event_loop_free(event_loop_t *loop);
+
+#endif // EVENT_LOOP_H
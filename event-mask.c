@@ -0,0 +1,96 @@
+#include "event-mask.h"
+#include <string.h>
+#include <sys/ioctl.h>
+
+// Types whose codes can be masked one by one, with their code count (as evdev)
+static unsigned int code_count(unsigned int type) {
+    switch (type) {
+        case EV_KEY: return KEY_CNT;
+        case EV_REL: return REL_CNT;
+        case EV_ABS: return ABS_CNT;
+        case EV_MSC: return MSC_CNT;
+        case EV_SW: return SW_CNT;
+        case EV_LED: return LED_CNT;
+        case EV_SND: return SND_CNT;
+        case EV_FF: return FF_CNT;
+        default: return 0;
+    }
+}
+
+static inline int test_bit(const unsigned long *bits, unsigned int bit) {
+    return (bits[bit / EVENT_MASK_LONG_BITS] >> (bit % EVENT_MASK_LONG_BITS)) & 1ul;
+}
+
+static inline void set_bit(unsigned long *bits, unsigned int bit) {
+    bits[bit / EVENT_MASK_LONG_BITS] |= 1ul << (bit % EVENT_MASK_LONG_BITS);
+}
+
+void event_mask_clear(event_mask_t *mask) {
+    if (!mask) return;
+
+    memset(mask, 0, sizeof(*mask));
+    set_bit(mask->types, EV_SYN);
+}
+
+void event_mask_add_type(event_mask_t *mask, unsigned int type) {
+    if (!mask || type >= EV_CNT) return;
+
+    set_bit(mask->types, type);
+    mask->by_code &= ~(1u << type);
+}
+
+int event_mask_add_code(event_mask_t *mask, unsigned int type, unsigned int code) {
+    if (!mask || type >= EV_CNT || code >= code_count(type)) return -1;
+
+    if (test_bit(mask->types, type) && !(mask->by_code & (1u << type))) return 0;
+
+    set_bit(mask->types, type);
+    mask->by_code |= 1u << type;
+    set_bit(mask->codes[type], code);
+    return 0;
+}
+
+int event_mask_test(const event_mask_t *mask, unsigned int type, unsigned int code) {
+    if (!mask || type == EV_SYN) return 1;
+    if (type >= EV_CNT || !test_bit(mask->types, type)) return 0;
+    if (!(mask->by_code & (1u << type))) return 1;
+
+    return code < code_count(type) && test_bit(mask->codes[type], code);
+}
+
+static int set_kernel_mask(int fd, unsigned int type, const unsigned long *bits, size_t size) {
+    struct input_mask im;
+    im.type = type;
+    im.codes_size = (uint32_t)size;
+    im.codes_ptr = (uint64_t)(uintptr_t)bits;
+    return ioctl(fd, EVIOCSMASK, &im) < 0 ? -1 : 0;
+}
+
+int event_mask_apply(int fd, const event_mask_t *mask) {
+    if (fd < 0 || !mask) return -1;
+
+    unsigned long all[EVENT_MASK_LONGS(KEY_CNT)];
+    memset(all, 0xff, sizeof(all));
+
+    // Code masks of an earlier call stay installed: every selected type gets its
+    // codes rewritten, and the type mask goes last so no type is let through with
+    // stale codes
+    for (unsigned int type = 1; type < EV_CNT; type++) {
+        if (!code_count(type) || !test_bit(mask->types, type)) continue;
+
+        const unsigned long *codes = mask->by_code & (1u << type) ? mask->codes[type] : all;
+        if (set_kernel_mask(fd, type, codes, sizeof(all)) != 0) return -1;
+    }
+
+    // Type 0 is the type mask itself
+    return set_kernel_mask(fd, 0, mask->types, sizeof(mask->types));
+}
+
+int event_mask_reset(int fd) {
+    event_mask_t mask;
+    event_mask_clear(&mask);
+    for (unsigned int type = 1; type < EV_CNT; type++) {
+        event_mask_add_type(&mask, type);
+    }
+    return event_mask_apply(fd, &mask);
+}
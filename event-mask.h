@@ -0,0 +1,42 @@
+#ifndef EVENT_MASK_H
+#define EVENT_MASK_H
+
+#include <stdint.h>
+#include <linux/input.h>
+
+#define EVENT_MASK_LONG_BITS (8 * sizeof(unsigned long))
+#define EVENT_MASK_LONGS(bits) (((bits) + EVENT_MASK_LONG_BITS - 1) / EVENT_MASK_LONG_BITS)
+
+// Event types and codes a reader wants from a device, installed per open file with
+// EVIOCSMASK: the kernel drops everything else before it is queued, so filtered
+// events cause no wakeup and no read (empty frames are dropped too)
+// EV_SYN is always delivered
+typedef struct {
+    unsigned long types[EVENT_MASK_LONGS(EV_CNT)];
+    uint32_t by_code;                                   // Types selected code by code, the others entirely
+    unsigned long codes[EV_CNT][EVENT_MASK_LONGS(KEY_CNT)];
+} event_mask_t;
+
+// Select nothing (only EV_SYN is delivered)
+void event_mask_clear(event_mask_t *mask);
+
+// Select every code of an event type
+void event_mask_add_type(event_mask_t *mask, unsigned int type);
+
+// Select one code (no-op if its whole type is already selected)
+// Returns 0 on success, -1 if the type has no codes that can be masked
+int event_mask_add_code(event_mask_t *mask, unsigned int type, unsigned int code);
+
+// Check whether an event passes the mask
+int event_mask_test(const event_mask_t *mask, unsigned int type, unsigned int code);
+
+// Install the mask on an evdev file descriptor, replacing the previous one
+// Returns 0 on success, -1 on error (kernels before 4.4 have no EVIOCSMASK and
+// keep delivering everything; readers must still check event_mask_test)
+int event_mask_apply(int fd, const event_mask_t *mask);
+
+// Deliver every event again
+// Returns 0 on success, -1 on error
+int event_mask_reset(int fd);
+
+#endif // EVENT_MASK_H
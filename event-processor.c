@@ -5,14 +5,22 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <errno.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
 #include <linux/input.h>
+#include <linux/uinput.h>
 #include <libevdev/libevdev.h>
 #include <libevdev/libevdev-uinput.h>
 
 int setup_device(const char *device_path, struct libevdev **dev, int *device_fd) {
     if (!device_path || !dev || !device_fd) return -1;
     
-    *device_fd = open(device_path, O_RDONLY);
+    // Non-blocking so the event loop can drain the device without stalling
+    *device_fd = open(device_path, O_RDONLY | O_NONBLOCK);
     if (*device_fd < 0) {
         fprintf(stderr, "ERROR: Failed to open device %s: %s\n", device_path, strerror(errno));
         return -1;
@@ -26,33 +34,456 @@ int setup_device(const char *device_path, struct libevdev **dev, int *device_fd)
         return -1;
     }
     
+    // Monotonic timestamps make event latency measurable against clock_gettime
+    rc = libevdev_set_clock_id(*dev, CLOCK_MONOTONIC);
+    if (rc < 0) {
+        fprintf(stderr, "WARNING: Could not switch event clock to CLOCK_MONOTONIC: %s\n", strerror(-rc));
+    }
+    
     printf("Opened device: %s\n", libevdev_get_name(*dev));
     
+    return 0;
+}
+
+int device_runtime_set_grab(device_runtime_t *rt, int grab) {
+    if (!rt || rt->fd < 0) return -1;
+    
+    // EVIOCGRAB directly rather than libevdev_grab(): libevdev does not know
+    // about grabs inherited through a handover and would skip the ungrab
+    if (ioctl(rt->fd, EVIOCGRAB, grab ? 1 : 0) < 0) {
+        if (grab) {
+            fprintf(stderr, "WARNING: Could not grab device: %s\n", strerror(errno));
+            fprintf(stderr, "Remapped buttons may still be visible to other applications\n");
+        } else {
+            fprintf(stderr, "WARNING: Could not ungrab device: %s\n", strerror(errno));
+        }
+        return -1;
+    }
+    
+    rt->grabbed = grab ? 1 : 0;
+    return 0;
+}
+
+// Config currently published for this runtime (may be swapped by reload)
+static inline device_config_t* runtime_config(const device_runtime_t *rt) {
+    return __atomic_load_n(&rt->cfg, __ATOMIC_ACQUIRE);
+}
+
+int device_runtime_update_mask(device_runtime_t *rt) {
+    if (!rt || rt->fd < 0) return -1;
+    
+    if (!rt->released && !device_runtime_offloaded(rt) && !runtime_config(rt)->scanner.output) {
+        return event_mask_reset(rt->fd);
+    }
+    
+    // Not read at all when offloaded; released devices and scanners only need their keys
+    event_mask_t mask;
+    event_mask_clear(&mask);
+    if (rt->released || runtime_config(rt)->scanner.output) {
+        event_mask_add_type(&mask, EV_KEY);
+    }
+    return event_mask_apply(rt->fd, &mask);
+}
+
+// Keys the keyboard emitter is created with: every EV_KEY remap target of
+// every profile, so switching profiles never needs a new virtual device
+static void keyboard_caps(const device_config_t *device_cfg, key_state_t *caps) {
+    key_state_clear(caps);
+    for (int i = 0; i < device_cfg->remap_count; i++) {
+        if (device_cfg->remaps[i].target_type == EV_KEY) {
+            key_state_set(caps, device_cfg->remaps[i].target_code, 1);
+        }
+    }
+    for (int p = 1; p < device_cfg->profile_count; p++) {
+        const remap_table_t *table = &device_cfg->profiles[p];
+        for (int i = 0; i < table->remap_count; i++) {
+            if (table->remaps[i].target_type == EV_KEY) {
+                key_state_set(caps, table->remaps[i].target_code, 1);
+            }
+        }
+    }
+    for (int i = 0; i < device_cfg->gestures.stroke_count; i++) {
+        const gesture_t *gesture = &device_cfg->gestures.strokes[i];
+        for (int k = 0; k < gesture->combo.key_count; k++) {
+            key_state_set(caps, gesture->combo.keys[k], 1);
+        }
+    }
+    for (int i = 0; i < device_cfg->sequences.rule_count; i++) {
+        const sequence_t *sequence = &device_cfg->sequences.rules[i];
+        for (int c = 0; c < sequence->output_count; c++) {
+            for (int k = 0; k < sequence->output[c].key_count; k++) {
+                key_state_set(caps, sequence->output[c].keys[k], 1);
+            }
+        }
+    }
+    // "none" blocks, it is never emitted
+    key_state_set(caps, KEY_RESERVED, 0);
+}
+
+// Mouse key of a source code, NULL if none
+static const mouse_key_t* find_mouse_key(const mouse_keys_config_t *mouse_keys, int code) {
+    if (!mouse_keys->key_count || !key_state_test(&mouse_keys->sources, code)) return NULL;
+    for (int i = 0; i < mouse_keys->key_count; i++) {
+        if (mouse_keys->keys[i].code == code) return &mouse_keys->keys[i];
+    }
+    return NULL;
+}
+
+// Check whether a mouse key of the config holds button
+static int mouse_keys_clicks(const device_config_t *device_cfg, int button) {
+    for (int i = 0; i < device_cfg->mouse_keys.key_count; i++) {
+        if (device_cfg->mouse_keys.keys[i].button == button) return 1;
+    }
+    return 0;
+}
+
+// Shared modifiers held on all devices (config_t.modifiers bits)
+// Each bit is only written by the thread of the device that sets it
+static uint64_t g_modifiers;
+
+// Publish the shared modifiers the runtime holds, changing only its own bits
+static void publish_modifiers(device_runtime_t *rt, uint64_t modifiers) {
+    uint64_t set = modifiers & ~rt->modifiers;
+    uint64_t cleared = rt->modifiers & ~modifiers;
+    if (set) __atomic_fetch_or(&g_modifiers, set, __ATOMIC_RELEASE);
+    if (cleared) __atomic_fetch_and(&g_modifiers, ~cleared, __ATOMIC_RELEASE);
+    rt->modifiers = modifiers;
+}
+
+// Recompute the runtime's shared modifiers from its held source keys
+static void update_modifiers(device_runtime_t *rt, const device_config_t *device_cfg) {
+    uint64_t modifiers = 0;
+    for (int i = 0; i < device_cfg->modifier_key_count; i++) {
+        const modifier_key_t *key = &device_cfg->modifier_keys[i];
+        if (key_state_test(&rt->source_keys, key->code)) modifiers |= 1ull << key->modifier;
+    }
+    publish_modifiers(rt, modifiers);
+    rt->modifiers_cfg = device_cfg;
+}
+
+// Bring the runtime's shared modifiers in line with a config swapped in by reload
+// (its modifier keys or the bit numbering may have changed)
+static inline void sync_modifiers(device_runtime_t *rt) {
+    const device_config_t *device_cfg = runtime_config(rt);
+    if (rt->modifiers_cfg != device_cfg) update_modifiers(rt, device_cfg);
+}
+
+int device_runtime_config_compatible(const device_runtime_t *rt, const device_config_t *device_cfg) {
+    if (!rt || !device_cfg) return 0;
+    
+    const device_config_t *current = runtime_config(rt);
+    if ((current->offload || device_cfg->offload) && !keymap_offload_same(current, device_cfg)) return 0;
+    // Scanners are read with a different event mask, and keep their output open
+    if (!current->scanner.output != !device_cfg->scanner.output ||
+        (current->scanner.output && strcmp(current->scanner.output, device_cfg->scanner.output) != 0)) {
+        return 0;
+    }
+    if (device_runtime_offloaded(rt)) return 1;
+    // Wheel axes are only enabled on the forward device of a scrolling device,
+    // pointer axes and buttons on that of a mouse keys device
+    if (device_cfg->scroll.button && !current->scroll.button) return 0;
+    if (device_cfg->mouse_keys.key_count && !current->mouse_keys.key_count) return 0;
+    for (int i = 0; i < device_cfg->mouse_keys.key_count; i++) {
+        int button = device_cfg->mouse_keys.keys[i].button;
+        if (button && button != BTN_LEFT && !mouse_keys_clicks(current, button) &&
+            !(rt->dev && libevdev_has_event_code(rt->dev, EV_KEY, button))) {
+            return 0;
+        }
+    }
+    
+    key_state_t needed;
+    keyboard_caps(device_cfg, &needed);
+    for (int code = key_state_next(&needed, 0); code >= 0; code = key_state_next(&needed, code + 1)) {
+        if (!key_state_test(&rt->keyboard.caps, code)) return 0;
+    }
+    return 1;
+}
+
+// Allocate the chatter filter state once a config with filters is used, outside
+// the event hot path (without it the filters stay inactive)
+static void alloc_filter_state(device_runtime_t *rt, const device_config_t *device_cfg) {
+    if (!device_cfg->key_filters || rt->filter) return;
+    
+    rt->filter = calloc(1, sizeof(*rt->filter));
+    if (!rt->filter) {
+        fprintf(stderr, "WARNING: Out of memory, debounce disabled for %s\n", rt->path);
+    }
+}
+
+void device_runtime_swap_config(device_runtime_t *rt, device_config_t *device_cfg) {
+    if (!rt || !device_cfg) return;
+    // Published by the release store below
+    alloc_filter_state(rt, device_cfg);
+    __atomic_store_n(&rt->cfg, device_cfg, __ATOMIC_RELEASE);
+}
+
+// Timer of the generated repeats, created with the virtual devices whether or not
+// the config repeats anything yet (a reload may add rules)
+static void open_repeat_timer(device_runtime_t *rt) {
+    rt->repeat.fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (rt->repeat.fd < 0) {
+        fprintf(stderr, "WARNING: Could not create repeat timer, repeat, turbo and mouse keys disabled: %s\n", strerror(errno));
+    }
+}
+
+void device_runtime_apply_offload(device_runtime_t *rt) {
+    if (!rt || rt->fd < 0) return;
+    
+    // Rules the kernel can do never reach userspace; one backend per device,
+    // HID-BPF falls back to the keymap
+    const device_config_t *device_cfg = runtime_config(rt);
+    if (device_cfg->offload == OFFLOAD_HID_BPF && hid_offload_apply(&rt->hid_offload, rt->path, device_cfg) > 0) {
+        printf("Offloaded %d rule(s)%s to HID-BPF (HID device %d)\n", rt->hid_offload.rule_count,
+               rt->hid_offload.inverted ? " and axis inversion" : "", rt->hid_offload.hid_id);
+    } else if (device_cfg->offload && keymap_offload_apply(&rt->offload, rt->fd, device_cfg) > 0) {
+        printf("Offloaded %d rule(s) to the kernel keymap\n", rt->offload.rule_count);
+    }
+}
+
+int device_runtime_open(device_runtime_t *rt, const char *device_path, device_config_t *device_cfg) {
+    if (!rt || !device_path || !device_cfg) return -1;
+    
+    memset(rt, 0, sizeof(*rt));
+    rt->fd = -1;
+    rt->keyboard.fd = -1;
+    rt->mouse.fd = -1;
+    rt->repeat.fd = -1;
+    rt->cfg = device_cfg;
+    rt->worker = -1;
+    strncpy(rt->path, device_path, sizeof(rt->path) - 1);
+    alloc_filter_state(rt, device_cfg);
+    
+    if (setup_device(device_path, &rt->dev, &rt->fd) != 0) {
+        return -1;
+    }
+    
+    device_runtime_apply_offload(rt);
+    if (device_runtime_offloaded(rt)) {
+        printf("Everything offloaded - device not grabbed\n");
+        device_runtime_update_mask(rt);
+        return 0;
+    }
+    
     // Grab device exclusively
-    rc = libevdev_grab(*dev, LIBEVDEV_GRAB);
-    if (rc < 0) {
-        fprintf(stderr, "WARNING: Could not grab device: %s\n", strerror(-rc));
-        fprintf(stderr, "Remapped buttons may still be visible to other applications\n");
-    } else {
+    if (device_runtime_set_grab(rt, 1) == 0) {
         printf("Grabbed device exclusively - remapped buttons will be consumed\n");
     }
+    // Scanners are only read for their keys
+    if (device_cfg->scanner.output) {
+        device_runtime_update_mask(rt);
+    }
+    
+    if (setup_uinput_devices(rt->dev, &rt->keyboard.uinput, &rt->mouse.uinput, device_cfg) != 0) {
+        fprintf(stderr, "ERROR: Failed to setup uinput devices for %s\n", device_path);
+        device_runtime_close(rt);
+        return -1;
+    }
+    rt->keyboard.fd = libevdev_uinput_get_fd(rt->keyboard.uinput);
+    rt->mouse.fd = rt->mouse.uinput ? libevdev_uinput_get_fd(rt->mouse.uinput) : -1;
+    keyboard_caps(device_cfg, &rt->keyboard.caps);
+    open_repeat_timer(rt);
     
     return 0;
 }
 
+int device_runtime_adopt(device_runtime_t *rt, const char *device_path, device_config_t *device_cfg,
+                         int source_fd, int keyboard_fd, int mouse_fd) {
+    if (!rt || !device_path || !device_cfg || source_fd < 0) return -1;
+    
+    memset(rt, 0, sizeof(*rt));
+    rt->fd = source_fd;
+    rt->keyboard.fd = keyboard_fd;
+    rt->mouse.fd = mouse_fd;
+    rt->repeat.fd = -1;
+    rt->cfg = device_cfg;
+    rt->worker = -1;
+    // Best guess: the previous owner ran a config with the same injected keys
+    keyboard_caps(device_cfg, &rt->keyboard.caps);
+    strncpy(rt->path, device_path, sizeof(rt->path) - 1);
+    alloc_filter_state(rt, device_cfg);
+    
+    // Same open file as the previous owner: grab, O_NONBLOCK and clock id carry over
+    int rc = libevdev_new_from_fd(source_fd, &rt->dev);
+    if (rc < 0) {
+        fprintf(stderr, "ERROR: Failed to create libevdev device: %s\n", strerror(-rc));
+        rt->dev = NULL;
+        device_runtime_close(rt);
+        return -1;
+    }
+    rt->grabbed = 1;
+    open_repeat_timer(rt);
+    
+    printf("Adopted device: %s (%s)\n", libevdev_get_name(rt->dev), device_path);
+    
+    // The previous owner undid its offload before the handover. An offload that
+    // covers everything would leave the device grabbed but unread: such a device
+    // stays in userspace until it is reopened
+    device_runtime_apply_offload(rt);
+    if (device_runtime_offloaded(rt)) {
+        keymap_offload_restore(&rt->offload, rt->fd);
+        hid_offload_detach(&rt->hid_offload);
+        printf("Everything offloadable - kept in userspace until reopened\n");
+    }
+    device_runtime_update_mask(rt);
+    return 0;
+}
+
+// Set the timer to the earliest tick of the held keys, the mouse keys pointer and
+// the sequence and scanner timeouts (disarmed if none)
+// One timer serves every key: it is only rearmed when that deadline changes
+static void repeat_arm(device_runtime_t *rt) {
+    repeat_scheduler_t *rs = &rt->repeat;
+    if (rs->fd < 0) return;
+    
+    uint64_t due_ns = rt->pointer.due_ns;
+    if (rt->sequence.due_ns && (!due_ns || rt->sequence.due_ns < due_ns)) due_ns = rt->sequence.due_ns;
+    if (rt->scanner.due_ns && (!due_ns || rt->scanner.due_ns < due_ns)) due_ns = rt->scanner.due_ns;
+    for (int i = 0; i < rs->count; i++) {
+        if (!due_ns || rs->keys[i].due_ns < due_ns) due_ns = rs->keys[i].due_ns;
+    }
+    if (due_ns == rs->armed_ns) return;
+    
+    struct itimerspec its;
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec = (time_t)(due_ns / 1000000000ull);
+    its.it_value.tv_nsec = (long)(due_ns % 1000000000ull);
+    if (timerfd_settime(rs->fd, TFD_TIMER_ABSTIME, &its, NULL) == 0) {
+        rs->armed_ns = due_ns;
+    }
+}
+
+// Schedule a key just pressed through a repeat or turbo rule: autofire releases
+// the target after half a period, repeats start after the delay
+static void repeat_start(device_runtime_t *rt, const remap_rule_t *remap) {
+    repeat_scheduler_t *rs = &rt->repeat;
+    if (rs->fd < 0) return;
+    
+    repeat_key_t *key = NULL;
+    for (int i = 0; i < rs->count && !key; i++) {
+        if (rs->keys[i].source == remap->source_code) key = &rs->keys[i];
+    }
+    if (!key) {
+        if (rs->count == REPEAT_MAX_KEYS) return;
+        key = &rs->keys[rs->count++];
+    }
+    
+    key->source = (uint16_t)remap->source_code;
+    key->target = (uint16_t)remap->target_code;
+    key->turbo = remap->turbo_period_ms > 0;
+    uint64_t wait_ns = key->turbo ? (uint64_t)remap->turbo_period_ms * 500000ull :
+                                    (uint64_t)remap->repeat_delay_ms * 1000000ull;
+    key->due_ns = stats_now_ns() + wait_ns;
+    repeat_arm(rt);
+}
+
+// Stop generating events for a released source key
+static void repeat_stop(device_runtime_t *rt, int source) {
+    repeat_scheduler_t *rs = &rt->repeat;
+    for (int i = 0; i < rs->count; i++) {
+        if (rs->keys[i].source == source) {
+            rs->keys[i] = rs->keys[--rs->count];
+            repeat_arm(rt);
+            return;
+        }
+    }
+}
+
+// Destroy a virtual device created here or adopted through a handover
+static void emitter_close(emitter_t *em) {
+    if (em->uinput) {
+        libevdev_uinput_destroy(em->uinput);
+    } else if (em->fd >= 0) {
+        ioctl(em->fd, UI_DEV_DESTROY);
+        close(em->fd);
+    }
+    em->uinput = NULL;
+    em->fd = -1;
+    em->pending = 0;
+    key_state_clear(&em->keys);
+}
+
+void device_runtime_release_keys(device_runtime_t *rt) {
+    if (!rt) return;
+    
+    rt->repeat.count = 0;
+    rt->pointer.due_ns = 0;
+    rt->pointer.start_ns = 0;
+    // Held back sequence presses were never emitted: nothing to release
+    rt->sequence.length = 0;
+    rt->sequence.released = 0;
+    rt->sequence.state = 0;
+    rt->sequence.due_ns = 0;
+    key_state_clear(&rt->sequence.consumed);
+    // A record cut off here is incomplete
+    rt->scanner.length = 0;
+    rt->scanner.due_ns = 0;
+    repeat_arm(rt);
+    rt->scroll.held = 0;
+    rt->gesture.held = 0;
+    
+    emitter_t *emitters[] = { &rt->keyboard, &rt->mouse };
+    for (size_t i = 0; i < sizeof(emitters) / sizeof(emitters[0]); i++) {
+        emitter_t *em = emitters[i];
+        if (em->fd < 0 && !em->sink) continue;
+        
+        for (int code = key_state_next(&em->keys, 0); code >= 0; code = key_state_next(&em->keys, code + 1)) {
+            emitter_write(em, EV_KEY, code, 0);
+        }
+        // Also terminates a frame left open mid-event
+        emitter_sync(em);
+    }
+}
+
+void device_runtime_close(device_runtime_t *rt) {
+    if (!rt) return;
+    
+    // Drain: release every held virtual key before the source goes back to the system
+    device_runtime_release_keys(rt);
+    
+    if (rt->grabbed) {
+        device_runtime_set_grab(rt, 0);
+    }
+    if (rt->dev) {
+        libevdev_free(rt->dev);
+        rt->dev = NULL;
+    }
+    emitter_close(&rt->keyboard);
+    emitter_close(&rt->mouse);
+    keymap_offload_restore(&rt->offload, rt->fd);
+    hid_offload_detach(&rt->hid_offload);
+    if (rt->repeat.fd >= 0) {
+        close(rt->repeat.fd);
+        rt->repeat.fd = -1;
+    }
+    if (rt->scanner.connected) {
+        close(rt->scanner.fd);
+        rt->scanner.connected = 0;
+    }
+    if (rt->fd >= 0) {
+        close(rt->fd);
+        rt->fd = -1;
+    }
+    free(rt->filter);
+    rt->filter = NULL;
+    publish_modifiers(rt, 0);
+    rt->modifiers_cfg = NULL;
+}
+
 int setup_uinput_devices(struct libevdev *dev, struct libevdev_uinput **keyboard, struct libevdev_uinput **mouse, device_config_t *device_cfg) {
     if (!dev || !keyboard || !mouse || !device_cfg) return -1;
     
     // Create keyboard device for key injection
+    // No EV_REP: the input core would then repeat every held key on its own,
+    // repeats of injected keys come from the rules (repeat, turbo)
     struct libevdev *keyboard_dev = libevdev_new();
     libevdev_set_name(keyboard_dev, "keyswap-keyboard");
     libevdev_enable_event_type(keyboard_dev, EV_KEY);
     
     // Enable all target keys that might be injected
-    for (int i = 0; i < device_cfg->remap_count; i++) {
-        if (device_cfg->remaps[i].target_type == EV_KEY) {
-            libevdev_enable_event_code(keyboard_dev, EV_KEY, device_cfg->remaps[i].target_code, NULL);
-        }
+    key_state_t caps;
+    keyboard_caps(device_cfg, &caps);
+    for (int code = key_state_next(&caps, 0); code >= 0; code = key_state_next(&caps, code + 1)) {
+        libevdev_enable_event_code(keyboard_dev, EV_KEY, code, NULL);
     }
     
     int rc = libevdev_uinput_create_from_device(keyboard_dev, LIBEVDEV_UINPUT_OPEN_MANAGED, keyboard);
@@ -68,33 +499,17 @@ int setup_uinput_devices(struct libevdev *dev, struct libevdev_uinput **keyboard
     struct libevdev *mouse_dev = libevdev_new();
     libevdev_set_name(mouse_dev, "keyswap-forward");
     
-    // Collect all source codes that should be excluded (consumed, not forwarded)
-    int excluded_codes[256];
-    int excluded_count = 0;
-    for (int i = 0; i < device_cfg->remap_count; i++) {
-        if (device_cfg->remaps[i].source_type == EV_KEY) {
-            excluded_codes[excluded_count++] = device_cfg->remaps[i].source_code;
-        }
-    }
-    
-    // Copy capabilities from original device (excluding remapped buttons/keys)
+    // Copy capabilities from original device
+    // Remapped source codes stay enabled so they can pass through while
+    // remapping is paused from the control socket
     const struct input_absinfo *absinfo;
     unsigned int code;
     
-    // Copy EV_KEY (buttons/keys) - exclude remapped ones
+    // Copy EV_KEY (buttons/keys)
     if (libevdev_has_event_type(dev, EV_KEY)) {
         libevdev_enable_event_type(mouse_dev, EV_KEY);
         for (code = 0; code < KEY_MAX; code++) {
-            // Check if this code should be excluded
-            int is_excluded = 0;
-            for (int i = 0; i < excluded_count; i++) {
-                if (excluded_codes[i] == (int)code) {
-                    is_excluded = 1;
-                    break;
-                }
-            }
-            
-            if (libevdev_has_event_code(dev, EV_KEY, code) && !is_excluded) {
+            if (libevdev_has_event_code(dev, EV_KEY, code)) {
                 libevdev_enable_event_code(mouse_dev, EV_KEY, code, NULL);
             }
         }
@@ -121,11 +536,34 @@ int setup_uinput_devices(struct libevdev *dev, struct libevdev_uinput **keyboard
         }
     }
     
+    // Button-hold scrolling emits wheel events the source may not have
+    if (device_cfg->scroll.button) {
+        static const unsigned int wheel_codes[] = { REL_WHEEL, REL_HWHEEL, REL_WHEEL_HI_RES, REL_HWHEEL_HI_RES };
+        libevdev_enable_event_type(mouse_dev, EV_REL);
+        for (size_t i = 0; i < sizeof(wheel_codes) / sizeof(wheel_codes[0]); i++) {
+            libevdev_enable_event_code(mouse_dev, EV_REL, wheel_codes[i], NULL);
+        }
+    }
+    
+    // Mouse keys move and click on the forward device, whatever the source has
+    // (BTN_LEFT always: without it the device is not taken for a pointer)
+    if (device_cfg->mouse_keys.key_count) {
+        libevdev_enable_event_type(mouse_dev, EV_REL);
+        libevdev_enable_event_code(mouse_dev, EV_REL, REL_X, NULL);
+        libevdev_enable_event_code(mouse_dev, EV_REL, REL_Y, NULL);
+        libevdev_enable_event_type(mouse_dev, EV_KEY);
+        libevdev_enable_event_code(mouse_dev, EV_KEY, BTN_LEFT, NULL);
+        for (int i = 0; i < device_cfg->mouse_keys.key_count; i++) {
+            if (device_cfg->mouse_keys.keys[i].button) {
+                libevdev_enable_event_code(mouse_dev, EV_KEY, device_cfg->mouse_keys.keys[i].button, NULL);
+            }
+        }
+    }
+    
     rc = libevdev_uinput_create_from_device(mouse_dev, LIBEVDEV_UINPUT_OPEN_MANAGED, mouse);
     if (rc < 0) {
         fprintf(stderr, "WARNING: Could not create virtual forward device: %s\n", strerror(-rc));
         fprintf(stderr, "Events will not be forwarded - device may not work normally\n");
-        libevdev_free(mouse_dev);
         *mouse = NULL;
     } else {
         printf("Created virtual forward device for forwarding events\n");
@@ -135,249 +573,1037 @@ int setup_uinput_devices(struct libevdev *dev, struct libevdev_uinput **keyboard
     return 0;
 }
 
-void inject_event(struct libevdev_uinput *uinput, int type, int code, int value) {
-    if (uinput) {
-        libevdev_uinput_write_event(uinput, type, code, value);
-        libevdev_uinput_write_event(uinput, EV_SYN, SYN_REPORT, 0);
+// Raw uinput write (works for devices created here and adopted fds alike)
+static int write_uinput_event(int fd, int type, int code, int value) {
+    struct input_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.type = type;
+    ev.code = code;
+    ev.value = value;
+    
+    ssize_t n = write(fd, &ev, sizeof(ev));
+    if (n < 0) return -errno;
+    return n == (ssize_t)sizeof(ev) ? 0 : -EIO;
+}
+
+// Emit through the sink if one is installed, otherwise to the uinput fd
+static int emitter_emit(emitter_t *em, int type, int code, int value) {
+    if (em->sink) {
+        struct input_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.type = type;
+        ev.code = code;
+        ev.value = value;
+        return em->sink(em->sink_ctx, &ev);
     }
+    return write_uinput_event(em->fd, type, code, value);
 }
 
-void forward_event(struct libevdev_uinput *mouse, struct input_event *ev) {
-    if (mouse && ev) {
-        libevdev_uinput_write_event(mouse, ev->type, ev->code, ev->value);
-        libevdev_uinput_write_event(mouse, EV_SYN, SYN_REPORT, 0);
+int emitter_write(emitter_t *em, int type, int code, int value) {
+    if (!em || (em->fd < 0 && !em->sink)) return -ENODEV;
+    
+    int rc = emitter_emit(em, type, code, value);
+    if (rc < 0) return rc;
+    
+    if (type == EV_KEY && value != 2) {
+        key_state_set(&em->keys, code, value);
     }
+    em->pending++;
+    return 0;
+}
+
+int emitter_sync(emitter_t *em) {
+    if (!em || (em->fd < 0 && !em->sink) || em->pending == 0) return 0;
+    
+    em->pending = 0;
+    return emitter_emit(em, EV_SYN, SYN_REPORT, 0);
 }
 
-// Find remap rule for an event
-static remap_rule_t* find_remap_rule(device_config_t *device_cfg, struct input_event *ev) {
+// Check whether the scheduler repeats or autofires a rule's target (an autofired
+// target is released half of the time)
+static int repeat_scheduled(const device_runtime_t *rt, const remap_rule_t *remap) {
+    for (int i = 0; i < rt->repeat.count; i++) {
+        if (rt->repeat.keys[i].source == remap->source_code && rt->repeat.keys[i].target == remap->target_code) return 1;
+    }
+    return 0;
+}
+
+// Rules of the runtime's profile table that may apply to an event
+// Returns 0 if none can (answered from the bitmap without scanning), 1 otherwise
+static int active_rules(const device_runtime_t *rt, device_config_t *device_cfg, const struct input_event *ev,
+                        remap_rule_t **remaps, int *remap_count) {
+    // Tables are compiled at load time: switching profiles is one index
+    *remaps = device_cfg->remaps;
+    *remap_count = device_cfg->remap_count;
+    const key_state_t *remap_keys = &device_cfg->remap_keys;
+    if (rt->profile > 0 && rt->profile < device_cfg->profile_count) {
+        const remap_table_t *table = &device_cfg->profiles[rt->profile];
+        *remaps = table->remaps;
+        *remap_count = table->remap_count;
+        remap_keys = &table->remap_keys;
+    }
+    
+    // Most key events have no rule
+    // Offloaded rules were applied by the kernel already
+    return ev->type != EV_KEY || (key_state_test(remap_keys, ev->code) &&
+                                  !key_state_test(&rt->offload.sources, ev->code) &&
+                                  !key_state_test(&rt->hid_offload.sources, ev->code));
+}
+
+// Find remap rule for an event in the table of the runtime's profile
+static remap_rule_t* find_remap_rule(const device_runtime_t *rt, device_config_t *device_cfg, struct input_event *ev) {
     if (!device_cfg || !ev) return NULL;
     
-    for (int i = 0; i < device_cfg->remap_count; i++) {
-        if (device_cfg->remaps[i].source_type == ev->type && 
-            device_cfg->remaps[i].source_code == ev->code) {
-            return &device_cfg->remaps[i];
+    remap_rule_t *remaps;
+    int remap_count;
+    if (!active_rules(rt, device_cfg, ev, &remaps, &remap_count)) return NULL;
+    
+    for (int i = 0; i < remap_count; i++) {
+        remap_rule_t *remap = &remaps[i];
+        if (remap->source_type != ev->type || remap->source_code != ev->code) continue;
+        if (!remap->when_down && !remap->when_up) return remap;
+        
+        // Conditional rules come before the source's fallback: a press takes the
+        // first whose shared modifiers hold, repeats stay with the one it took
+        if (ev->type == EV_KEY && ev->value == 2) {
+            if (remap->target_type == EV_KEY && (key_state_test(&rt->keyboard.keys, remap->target_code) ||
+                                                 repeat_scheduled(rt, remap))) {
+                return remap;
+            }
+            continue;
         }
+        uint64_t modifiers = __atomic_load_n(&g_modifiers, __ATOMIC_ACQUIRE);
+        if ((modifiers & remap->when_down) == remap->when_down && !(modifiers & remap->when_up)) return remap;
     }
     
     return NULL;
 }
 
-int process_events(struct libevdev *dev, device_config_t *device_cfg, config_t *config, 
-                   struct libevdev_uinput *keyboard, struct libevdev_uinput *mouse, FILE *debug_fp, int *running_ptr) {
-    if (!dev || !device_cfg || !config) return -1;
+// Route a release to wherever the matching press went, even if remapping was
+// paused/resumed in between
+// Returns emit result, or 1 if nothing was held
+static int route_key_release(device_runtime_t *rt, struct input_event *ev) {
+    int rc = 1;
     
-    struct input_event ev;
-    int rc;
-    const char *device_name = libevdev_get_name(dev);
+    // With shared modifiers the rule the press took may not match any more:
+    // every rule of the source releases its target if held
+    remap_rule_t *remaps;
+    int remap_count;
+    if (active_rules(rt, runtime_config(rt), ev, &remaps, &remap_count)) {
+        for (int i = 0; i < remap_count; i++) {
+            const remap_rule_t *remap = &remaps[i];
+            if (remap->source_type != EV_KEY || remap->source_code != ev->code || remap->target_type != EV_KEY ||
+                !key_state_test(&rt->keyboard.keys, remap->target_code)) {
+                continue;
+            }
+            int key_rc = emitter_write(&rt->keyboard, EV_KEY, remap->target_code, 0);
+            rt->stats.remapped++;
+            if (rc == 1 || key_rc < 0) rc = key_rc;
+        }
+    }
+    if (key_state_test(&rt->mouse.keys, ev->code)) {
+        int mouse_rc = emitter_write(&rt->mouse, EV_KEY, ev->code, 0);
+        rt->stats.forwarded++;
+        if (rc == 1 || mouse_rc < 0) rc = mouse_rc;
+    }
+    
+    return rc;
+}
+
+// EV_REL value after device.invert, unless HID-BPF negated it in the report already
+static inline int inverted_rel(const device_runtime_t *rt, const struct input_event *ev) {
+    if (ev->code < 32 && (runtime_config(rt)->invert_rel & ~rt->hid_offload.inverted & (1u << ev->code))) {
+        return -ev->value;
+    }
+    return ev->value;
+}
+
+// Turn motion during a scroll hold into wheel events: hi-res units accumulate in
+// fixed point (remainders carry to the next event), a detent every 120 units
+static void scroll_motion(device_runtime_t *rt, const struct input_event *ev) {
+    static const int hi_res_codes[2] = { REL_HWHEEL_HI_RES, REL_WHEEL_HI_RES };
+    static const int wheel_codes[2] = { REL_HWHEEL, REL_WHEEL };
+    const device_config_t *device_cfg = runtime_config(rt);
+    scroll_state_t *state = &rt->scroll;
+    
+    // Ball up scrolls up: the wheel counts opposite to REL_Y
+    int axis = ev->code == REL_Y;
+    int64_t motion = axis ? -inverted_rel(rt, ev) : inverted_rel(rt, ev);
+    int64_t units = state->remainder[axis] + motion * device_cfg->scroll.speed;
+    int hi_res = (int)(units / 100);
+    state->remainder[axis] = (int)(units - (int64_t)hi_res * 100);
+    if (hi_res == 0) return;
     
-    printf("Processing events for %s\n", device_name);
-    printf("Press Ctrl+C to stop\n");
+    // A reversal starts a new detent
+    if (state->detent[axis] && (state->detent[axis] > 0) != (hi_res > 0)) {
+        state->detent[axis] = 0;
+    }
+    state->detent[axis] += hi_res;
+    int detents = state->detent[axis] / 120;
+    state->detent[axis] -= detents * 120;
+    
+    int sign = device_cfg->invert_rel & (1u << wheel_codes[axis]) ? -1 : 1;
+    if (emitter_write(&rt->mouse, EV_REL, hi_res_codes[axis], sign * hi_res) < 0) rt->stats.dropped++;
+    if (detents && emitter_write(&rt->mouse, EV_REL, wheel_codes[axis], sign * detents) < 0) rt->stats.dropped++;
+    state->scrolled = 1;
+}
+
+// Click a button whose press was held back: the press as its own frame, the
+// release into the pending one
+static void emit_click(device_runtime_t *rt, int button) {
+    if (emitter_write(&rt->mouse, EV_KEY, button, 1) < 0 || emitter_sync(&rt->mouse) < 0 ||
+        emitter_write(&rt->mouse, EV_KEY, button, 0) < 0) {
+        rt->stats.dropped++;
+    }
+}
+
+// Button-hold scrolling: the button's press is held back, motion while it is
+// held becomes wheel events, and a quick release without scrolling is a click
+// Returns 1 if the event was consumed
+static int scroll_event(device_runtime_t *rt, const struct input_event *ev, int paused) {
+    scroll_state_t *state = &rt->scroll;
     
-    while (running_ptr == NULL || *running_ptr) {
-        rc = libevdev_next_event(dev, LIBEVDEV_READ_FLAG_NORMAL, &ev);
+    if (!state->held) {
+        // Paused: the button passes through like any other
+        const scroll_config_t *scroll = &runtime_config(rt)->scroll;
+        if (paused || !scroll->button || ev->code != scroll->button || ev->value != 1) return 0;
         
-        if (rc == LIBEVDEV_READ_STATUS_SUCCESS) {
-            // Log event if debug enabled
-            if (debug_fp && config->debug) {
-                log_event(debug_fp, &ev, device_name);
-            }
-            
-            // Check if this event matches a remap rule
-            remap_rule_t *remap = find_remap_rule(device_cfg, &ev);
-            if (remap) {
-                // CONSUME: Don't forward this event
-                // INJECT: Send remapped event instead
-                inject_event(keyboard, remap->target_type, remap->target_code, ev.value);
-            } else {
-                // FORWARD: Send event to virtual device
-                forward_event(mouse, &ev);
-            }
-        } else if (rc == LIBEVDEV_READ_STATUS_SYNC) {
-            // Handle sync events - forward them
-            while (libevdev_next_event(dev, LIBEVDEV_READ_FLAG_SYNC, &ev) == LIBEVDEV_READ_STATUS_SUCCESS) {
-                forward_event(mouse, &ev);
-                if (debug_fp && config->debug) {
-                    log_event(debug_fp, &ev, device_name);
-                }
-            }
-        } else if (rc == -EAGAIN) {
-            // No event available, continue
+        memset(state, 0, sizeof(*state));
+        state->held = 1;
+        state->button = ev->code;
+        state->press_ns = (uint64_t)ev->input_event_sec * 1000000000ull + (uint64_t)ev->input_event_usec * 1000ull;
+        return 1;
+    }
+    
+    if (ev->type == EV_REL && (ev->code == REL_X || ev->code == REL_Y)) {
+        scroll_motion(rt, ev);
+        return 1;
+    }
+    if (ev->type != EV_KEY || ev->code != state->button) return 0;
+    if (ev->value != 0) return 1;
+    
+    state->held = 0;
+    uint64_t release_ns = (uint64_t)ev->input_event_sec * 1000000000ull + (uint64_t)ev->input_event_usec * 1000ull;
+    int tap_ms = runtime_config(rt)->scroll.tap_ms;
+    if (!state->scrolled && (!tap_ms || release_ns - state->press_ns < (uint64_t)tap_ms * 1000000ull)) {
+        emit_click(rt, state->button);
+    }
+    return 1;
+}
+
+// Quantize motion during a gesture into directions: whenever the motion since the
+// last direction reaches the threshold on either axis, its dominant axis gives the
+// next direction (the same direction again just continues the stroke)
+static void gesture_motion(device_runtime_t *rt, const struct input_event *ev) {
+    gesture_state_t *state = &rt->gesture;
+    int threshold = runtime_config(rt)->gestures.threshold;
+    
+    if (ev->code == REL_X) {
+        state->dx += inverted_rel(rt, ev);
+    } else {
+        state->dy += inverted_rel(rt, ev);
+    }
+    int ax = abs(state->dx);
+    int ay = abs(state->dy);
+    if (ax < threshold && ay < threshold) return;
+    
+    int direction = ax >= ay ? (state->dx < 0 ? GESTURE_LEFT : GESTURE_RIGHT)
+                             : (state->dy < 0 ? GESTURE_UP : GESTURE_DOWN);
+    state->dx = 0;
+    state->dy = 0;
+    state->active = 1;
+    if (direction == state->last) return;
+    
+    state->last = direction;
+    if (state->length++ < GESTURE_MAX_STROKE) {
+        state->stroke = state->stroke * 5 + (uint32_t)direction;
+    }
+}
+
+// Press a key combo on the keyboard emitter as its own frame and release it into
+// the pending one; keys already held there are left alone
+static void emit_combo(device_runtime_t *rt, const key_combo_t *combo) {
+    int pressed[COMBO_MAX_KEYS];
+    int count = 0;
+    for (int k = 0; k < combo->key_count; k++) {
+        if (key_state_test(&rt->keyboard.keys, combo->keys[k])) continue;
+        if (emitter_write(&rt->keyboard, EV_KEY, combo->keys[k], 1) < 0) {
+            rt->stats.dropped++;
             continue;
+        }
+        pressed[count++] = combo->keys[k];
+    }
+    if (emitter_sync(&rt->keyboard) < 0) rt->stats.dropped++;
+    while (count > 0) {
+        if (emitter_write(&rt->keyboard, EV_KEY, pressed[--count], 0) < 0) rt->stats.dropped++;
+    }
+}
+
+// Emit the key combo of the finished stroke, if any
+static void gesture_finish(device_runtime_t *rt) {
+    const gesture_state_t *state = &rt->gesture;
+    const gesture_config_t *gestures = &runtime_config(rt)->gestures;
+    if (state->length > GESTURE_MAX_STROKE) return;
+    
+    const gesture_t *gesture = NULL;
+    for (int i = 0; i < gestures->stroke_count && !gesture; i++) {
+        if (gestures->strokes[i].stroke == state->stroke) gesture = &gestures->strokes[i];
+    }
+    if (gesture) emit_combo(rt, &gesture->combo);
+}
+
+// Mouse gestures: the button's press is held back; motion passes through until it
+// crosses the threshold, after which it is suppressed and recognized, and the
+// release emits the stroke's key combo (or, without a gesture, the click)
+// Returns 1 if the event was consumed
+static int gesture_event(device_runtime_t *rt, const struct input_event *ev, int paused) {
+    gesture_state_t *state = &rt->gesture;
+    
+    if (!state->held) {
+        const gesture_config_t *gestures = &runtime_config(rt)->gestures;
+        if (paused || !gestures->button || ev->code != gestures->button || ev->value != 1) return 0;
+        
+        memset(state, 0, sizeof(*state));
+        state->held = 1;
+        state->button = ev->code;
+        return 1;
+    }
+    
+    if (ev->type == EV_REL && (ev->code == REL_X || ev->code == REL_Y)) {
+        gesture_motion(rt, ev);
+        return state->active;
+    }
+    if (ev->type != EV_KEY || ev->code != state->button) return 0;
+    if (ev->value != 0) return 1;
+    
+    state->held = 0;
+    if (state->active) {
+        gesture_finish(rt);
+    } else {
+        emit_click(rt, state->button);
+    }
+    return 1;
+}
+
+// Move the pointer by one tick: the held direction keys combine into one vector
+// (opposite keys cancel), at a speed that follows the acceleration curve since the
+// movement began; X and Y go into the same frame
+// Returns 1 while a direction key is held, 0 if the movement is over
+static int mouse_keys_move(device_runtime_t *rt, uint64_t now_ns) {
+    const mouse_keys_config_t *mouse_keys = &runtime_config(rt)->mouse_keys;
+    mouse_keys_state_t *state = &rt->pointer;
+    
+    int held = 0;
+    int direction[2] = { 0, 0 };
+    for (int i = 0; i < mouse_keys->key_count; i++) {
+        const mouse_key_t *key = &mouse_keys->keys[i];
+        if (key->button || !key_state_test(&rt->source_keys, key->code)) continue;
+        held = 1;
+        direction[0] += key->dx;
+        direction[1] += key->dy;
+    }
+    if (!held) return 0;
+    
+    // Counts per tick in 16.16: speed + (max_speed - speed) * (elapsed / accel_ms)^curve
+    uint64_t accel_ns = (uint64_t)mouse_keys->accel_ms * 1000000ull;
+    uint64_t elapsed_ns = now_ns - state->start_ns;
+    int64_t progress = accel_ns && elapsed_ns < accel_ns ? (int64_t)((elapsed_ns << 16) / accel_ns) : 1 << 16;
+    int64_t factor = 1 << 16;
+    for (int i = 0; i < mouse_keys->curve; i++) {
+        factor = (factor * progress) >> 16;
+    }
+    int64_t speed = ((int64_t)mouse_keys->speed << 16) + (int64_t)(mouse_keys->max_speed - mouse_keys->speed) * factor;
+    
+    for (int axis = 0; axis < 2; axis++) {
+        direction[axis] = direction[axis] > 0 ? 1 : direction[axis] < 0 ? -1 : 0;
+    }
+    // Diagonals as fast as straight lines (1/sqrt(2))
+    if (direction[0] && direction[1]) speed = speed * 181 / 256;
+    
+    for (int axis = 0; axis < 2; axis++) {
+        state->remainder[axis] += speed * direction[axis];
+        int64_t counts = state->remainder[axis] / (1 << 16);
+        state->remainder[axis] -= counts * (1 << 16);
+        if (counts && emitter_write(&rt->mouse, EV_REL, axis ? REL_Y : REL_X, (int)counts) < 0) {
+            rt->stats.dropped++;
+        }
+    }
+    return 1;
+}
+
+// Mouse keys: direction keys start the pointer ticks (the first one moves at
+// once), button keys hold their button on the forward device
+// Returns 1 if the event was consumed
+static int mouse_keys_event(device_runtime_t *rt, const struct input_event *ev, int paused) {
+    const mouse_keys_config_t *mouse_keys = &runtime_config(rt)->mouse_keys;
+    const mouse_key_t *key = find_mouse_key(mouse_keys, ev->code);
+    // A press made while paused went to the forward device, its release follows it
+    if (!key || key_state_test(&rt->mouse.keys, ev->code) || (paused && ev->value == 1)) return 0;
+    if (ev->value == 2) return 1;
+    
+    if (key->button) {
+        int down = ev->value == 1;
+        if (down != key_state_test(&rt->mouse.keys, key->button) &&
+            emitter_write(&rt->mouse, EV_KEY, key->button, down) < 0) {
+            rt->stats.dropped++;
+        }
+        return 1;
+    }
+    
+    // Released direction keys are noticed by the next tick
+    mouse_keys_state_t *state = &rt->pointer;
+    if (ev->value == 1 && !state->due_ns && rt->repeat.fd >= 0) {
+        uint64_t now_ns = stats_now_ns();
+        state->start_ns = now_ns;
+        state->remainder[0] = 0;
+        state->remainder[1] = 0;
+        mouse_keys_move(rt, now_ns);
+        state->due_ns = now_ns + (uint64_t)mouse_keys->interval_ms * 1000000ull;
+        repeat_arm(rt);
+    }
+    return 1;
+}
+
+// Remap or forward a single non-SYN event into the pending frames, past the
+// sequence stage
+static void route_unsequenced(device_runtime_t *rt, struct input_event *ev, int paused) {
+    int rc;
+    
+    // Pointing only pays for these checks while the scroll or gesture button is held
+    if ((rt->scroll.held || ev->type == EV_KEY) && scroll_event(rt, ev, paused)) {
+        rt->stats.remapped++;
+        return;
+    }
+    if ((rt->gesture.held || ev->type == EV_KEY) && gesture_event(rt, ev, paused)) {
+        rt->stats.remapped++;
+        return;
+    }
+    if (ev->type == EV_KEY && mouse_keys_event(rt, ev, paused)) {
+        rt->stats.remapped++;
+        return;
+    }
+    
+    if (ev->type == EV_KEY && ev->value == 0) {
+        if (rt->repeat.count) repeat_stop(rt, ev->code);
+        rc = route_key_release(rt, ev);
+        if (rc == 1) return;
+    } else {
+        // Check if this event matches a remap rule
+        remap_rule_t *remap = paused ? NULL : find_remap_rule(rt, runtime_config(rt), ev);
+        if (remap && (remap->repeat_delay_ms || remap->turbo_period_ms)) {
+            // Repeats come from the scheduler, the source's own are dropped
+            rc = 0;
+            if (ev->value == 1) {
+                rc = emitter_write(&rt->keyboard, EV_KEY, remap->target_code, 1);
+                if (rc == 0) repeat_start(rt, remap);
+            }
+            rt->stats.remapped++;
+        } else if (remap) {
+            // CONSUME: Don't forward this event
+            // INJECT: Send remapped event instead (nothing for "none")
+            rc = remap->target_type == EV_KEY && remap->target_code == KEY_RESERVED ? 0 :
+                 emitter_write(&rt->keyboard, remap->target_type, remap->target_code, ev->value);
+            rt->stats.remapped++;
         } else {
-            fprintf(stderr, "ERROR: Failed to read event: %s\n", strerror(-rc));
-            break;
+            // FORWARD: Send event to virtual device, inverted axes negated
+            int value = ev->type == EV_REL && !paused ? inverted_rel(rt, ev) : ev->value;
+            rc = emitter_write(&rt->mouse, ev->type, ev->code, value);
+            rt->stats.forwarded++;
         }
     }
     
-    return 0;
+    if (rc < 0) {
+        rt->stats.dropped++;
+    }
 }
 
-int listen_device(const char *device_path, int *running_ptr) {
-    if (!device_path) return -1;
+// Terminate the pending frame on every virtual device
+static void flush_frames(device_runtime_t *rt, struct input_event *syn) {
+    int wrote = rt->keyboard.pending || rt->mouse.pending;
     
-    int fd = open(device_path, O_RDONLY);
-    if (fd < 0) {
-        fprintf(stderr, "ERROR: Failed to open device %s: %s\n", device_path, strerror(errno));
+    if (emitter_sync(&rt->keyboard) < 0) rt->stats.dropped++;
+    if (emitter_sync(&rt->mouse) < 0) rt->stats.dropped++;
+    
+    if (wrote && syn) {
+        stats_record_latency(&rt->stats, syn, stats_now_ns());
+    }
+}
+
+// Send the first count held back presses of a sequence on through the pipeline
+// (unchanged if paused), with their releases if those were held back too
+static void sequence_replay(device_runtime_t *rt, int count, int paused) {
+    sequence_state_t *state = &rt->sequence;
+    if (count <= 0) return;
+    
+    for (int i = 0; i < count; i++) {
+        struct input_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.type = EV_KEY;
+        ev.code = state->keys[i];
+        ev.value = 1;
+        route_unsequenced(rt, &ev, paused);
+        if (state->released & (1u << i)) {
+            flush_frames(rt, NULL);
+            ev.value = 0;
+            route_unsequenced(rt, &ev, paused);
+        }
+    }
+    state->length -= count;
+    memmove(state->keys, state->keys + count, state->length * sizeof(state->keys[0]));
+    state->released >>= count;
+}
+
+// Check whether keys are held on the source besides the held back ones, those of
+// completed sequences and code: a sequence only starts or goes on without them
+static int sequence_interrupted(const device_runtime_t *rt, int code) {
+    const sequence_state_t *state = &rt->sequence;
+    key_state_t held = rt->source_keys;
+    for (size_t w = 0; w < KEY_STATE_LONGS; w++) {
+        held.bits[w] &= ~state->consumed.bits[w];
+    }
+    for (int i = 0; i < state->length; i++) {
+        if (!(state->released & (1u << i))) key_state_set(&held, state->keys[i], 0);
+    }
+    key_state_set(&held, code, 0);
+    return key_state_next(&held, 0) >= 0;
+}
+
+// Key sequences: a press the automaton can use is held back; presses that drop
+// out of every possible match are replayed unchanged, and a completed sequence
+// types its expansion instead of its keys
+// Returns 1 if the event was consumed
+static int sequence_event(device_runtime_t *rt, const struct input_event *ev, int paused) {
+    sequence_state_t *state = &rt->sequence;
+    const device_config_t *device_cfg = runtime_config(rt);
+    const sequence_config_t *sequences = &device_cfg->sequences;
+    
+    // States are indices into one config's automaton
+    if (state->cfg != device_cfg) {
+        sequence_replay(rt, state->length, paused);
+        state->state = 0;
+        state->due_ns = 0;
+        state->cfg = device_cfg;
+    }
+    
+    if (ev->value != 1) {
+        if (key_state_test(&state->consumed, ev->code)) {
+            if (ev->value == 0) key_state_set(&state->consumed, ev->code, 0);
+            return 1;
+        }
+        for (int i = state->length - 1; i >= 0; i--) {
+            if (state->keys[i] != ev->code) continue;
+            if (ev->value == 0) state->released |= 1u << i;
+            return 1;
+        }
+        return 0;
+    }
+    
+    int symbol = sequences->rule_count && ev->code < KEY_CNT ? sequences->symbols[ev->code] : 0;
+    int next = symbol && !paused && !sequence_interrupted(rt, ev->code) ?
+               sequences->next[state->state * sequences->symbol_count + symbol - 1] : 0;
+    if (next == 0) {
+        // The press goes through after everything held back
+        sequence_replay(rt, state->length, paused);
+        state->state = 0;
+        state->due_ns = 0;
+        repeat_arm(rt);
+        return 0;
+    }
+    
+    state->keys[state->length++] = ev->code;
+    sequence_replay(rt, state->length - sequences->depth[next], 0);
+    state->state = next;
+    
+    int rule = sequences->match[next];
+    if (rule >= 0) {
+        // Keys still held stay silent until released
+        for (int i = 0; i < state->length; i++) {
+            if (!(state->released & (1u << i))) key_state_set(&state->consumed, state->keys[i], 1);
+        }
+        const sequence_t *sequence = &sequences->rules[rule];
+        for (int i = 0; i < sequence->output_count; i++) {
+            emit_combo(rt, &sequence->output[i]);
+            if (emitter_sync(&rt->keyboard) < 0) rt->stats.dropped++;
+        }
+        state->length = 0;
+        state->released = 0;
+        state->state = 0;
+        state->due_ns = 0;
+    } else {
+        state->due_ns = stats_now_ns() + (uint64_t)sequences->timeout_ms * 1000000ull;
+    }
+    repeat_arm(rt);
+    return 1;
+}
+
+// Connect the scanner output: a FIFO is opened for writing (fails while it has no
+// reader), a socket is connected as datagram socket, or as stream socket if it is one
+// Returns 0 on success, -1 on error (errno set)
+static int scanner_connect(scanner_state_t *scanner, const char *path) {
+    struct stat st;
+    if (stat(path, &st) < 0) return -1;
+    
+    if (S_ISFIFO(st.st_mode)) {
+        scanner->fd = open(path, O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+        if (scanner->fd < 0) return -1;
+        scanner->connected = 1;
+        scanner->fifo = 1;
+        return 0;
+    }
+    if (!S_ISSOCK(st.st_mode)) {
+        errno = ENOTSOCK;
         return -1;
     }
     
-    struct libevdev *dev = NULL;
-    int rc = libevdev_new_from_fd(fd, &dev);
-    if (rc < 0) {
-        fprintf(stderr, "ERROR: Failed to create libevdev device: %s\n", strerror(-rc));
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    int types[] = { SOCK_DGRAM, SOCK_STREAM };
+    for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); i++) {
+        int fd = socket(AF_UNIX, types[i] | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0) return -1;
+        if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+            scanner->fd = fd;
+            scanner->connected = 1;
+            scanner->fifo = 0;
+            return 0;
+        }
+        int err = errno;
         close(fd);
+        errno = err;
+        if (err != EPROTOTYPE) return -1;
+    }
+    return -1;
+}
+
+// Connect the scanner output unless an attempt failed less than SCANNER_RETRY_MS
+// ago: while nobody reads, records are dropped without a stat and connect each
+// Returns 0 on success, -1 on error (errno set)
+static int scanner_reconnect(scanner_state_t *scanner, const char *path) {
+    uint64_t now_ns = stats_now_ns();
+    if (now_ns < scanner->retry_ns) {
+        errno = ENOTCONN;
         return -1;
     }
+    if (scanner_connect(scanner, path) == 0) return 0;
     
-    const char *device_name = libevdev_get_name(dev);
-    int vendor_id = libevdev_get_id_vendor(dev);
-    int product_id = libevdev_get_id_product(dev);
-    const char *device_uniq = libevdev_get_uniq(dev);
+    int err = errno;
+    scanner->retry_ns = now_ns + (uint64_t)SCANNER_RETRY_MS * 1000000ull;
+    errno = err;
+    return -1;
+}
+
+// Close the scanner output (reconnected on the next record)
+static void scanner_disconnect(scanner_state_t *scanner) {
+    if (scanner->connected) close(scanner->fd);
+    scanner->connected = 0;
+    scanner->fd = -1;
+}
+
+// Deliver the record typed so far as one newline-terminated write (one datagram on
+// a datagram socket); an empty record is dropped
+static void scanner_deliver(device_runtime_t *rt) {
+    scanner_state_t *scanner = &rt->scanner;
+    int length = scanner->length;
+    scanner->length = 0;
+    scanner->due_ns = 0;
+    if (length == 0) return;
     
-    // Display device info
-    printf("\n=== Listening to device ===\n");
-    printf("Path: %s\n", device_path);
-    printf("Name: %s\n", device_name ? device_name : "unknown");
-    if (vendor_id > 0 && product_id > 0) {
-        printf("Identifier: %04x:%04x\n", vendor_id, product_id);
-    } else if (device_uniq && strlen(device_uniq) > 0) {
-        printf("Identifier: %s\n", device_uniq);
+    const char *path = runtime_config(rt)->scanner.output;
+    scanner->record[length++] = '\n';
+    for (int attempt = 0; attempt < 2; attempt++) {
+        if (!scanner->connected && scanner_reconnect(scanner, path) < 0) break;
+        // One non-blocking write: a reader that falls behind loses the record
+        ssize_t written = scanner->fifo ? write(scanner->fd, scanner->record, (size_t)length) :
+                          send(scanner->fd, scanner->record, (size_t)length, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (written == length) {
+            scanner->failing = 0;
+            return;
+        }
+        if (written < 0 && errno == EAGAIN) break;
+        // The reader may have gone away since (or a stream lost its framing): reconnect once
+        int err = written < 0 ? errno : EIO;
+        scanner_disconnect(scanner);
+        errno = err;
     }
-    printf("\n");
     
-    // Create a virtual uinput device to forward events to (so device still works)
-    struct libevdev *uinput_dev = libevdev_new();
-    libevdev_set_name(uinput_dev, "keyswap-listen-forward");
+    rt->stats.dropped++;
+    if (!scanner->failing) {
+        fprintf(stderr, "WARNING: Could not deliver scanner record to %s: %s\n", path, strerror(errno));
+        scanner->failing = 1;
+    }
+}
+
+// Scanner capture: presses are decoded with the shift state into the record, which
+// Enter or a pause ends; nothing reaches the virtual devices
+// Returns 1 if the event was consumed
+static int scanner_event(device_runtime_t *rt, const struct input_event *ev) {
+    scanner_state_t *scanner = &rt->scanner;
+    // Keys held since remapping was paused are forwarded until released
+    if (ev->type == EV_KEY && key_state_test(&rt->mouse.keys, ev->code)) return 0;
+    if (ev->type != EV_KEY || ev->value != 1) return 1;
     
-    // Copy all capabilities from original device
-    const struct input_absinfo *absinfo;
-    unsigned int code;
+    if (ev->code == KEY_ENTER || ev->code == KEY_KPENTER) {
+        scanner_deliver(rt);
+        repeat_arm(rt);
+        return 1;
+    }
+    int shift = key_state_test(&rt->source_keys, KEY_LEFTSHIFT) || key_state_test(&rt->source_keys, KEY_RIGHTSHIFT);
+    char c = get_layout_char(ev->code, shift);
+    if (!c) return 1;
     
-    // Copy EV_KEY
-    if (libevdev_has_event_type(dev, EV_KEY)) {
-        libevdev_enable_event_type(uinput_dev, EV_KEY);
-        for (code = 0; code < KEY_MAX; code++) {
-            if (libevdev_has_event_code(dev, EV_KEY, code)) {
-                libevdev_enable_event_code(uinput_dev, EV_KEY, code, NULL);
-            }
+    scanner->record[scanner->length++] = c;
+    if (scanner->length == SCANNER_MAX_RECORD) scanner_deliver(rt);
+    if (scanner->length) {
+        scanner->due_ns = stats_now_ns() + (uint64_t)runtime_config(rt)->scanner.timeout_ms * 1000000ull;
+    }
+    repeat_arm(rt);
+    return 1;
+}
+
+// Remap or forward a single non-SYN event into the pending frames
+static void route_event(device_runtime_t *rt, struct input_event *ev, int paused) {
+    if (runtime_config(rt)->scanner.output && !paused && scanner_event(rt, ev)) {
+        rt->stats.remapped++;
+        return;
+    }
+    // Devices without sequences only pay for this check
+    if (ev->type == EV_KEY && (rt->sequence.length || rt->sequence.cfg != runtime_config(rt) ||
+                               runtime_config(rt)->sequences.rule_count) &&
+        sequence_event(rt, ev, paused)) {
+        rt->stats.remapped++;
+        return;
+    }
+    route_unsequenced(rt, ev, paused);
+}
+
+// Chatter filters: drop a key press that follows the key's last release within
+// the debounce window, or its last accepted press within the rate limit
+// interval, together with its repeats and release (nothing is ever held back,
+// so a filtered key cannot get stuck)
+// Returns 1 if the event is dropped, 0 otherwise
+static int filter_key_event(device_runtime_t *rt, const struct input_event *ev) {
+    const key_filter_t *filters = runtime_config(rt)->key_filters;
+    key_filter_state_t *state = rt->filter;
+    if (!filters || !state || ev->code >= KEY_CNT) return 0;
+    
+    const key_filter_t *filter = &filters[ev->code];
+    int suppressed = key_state_test(&state->suppressed, ev->code);
+    if (!suppressed && !filter->debounce_ms && !filter->interval_ms) return 0;
+    
+    uint32_t now_ms = (uint32_t)((uint64_t)ev->input_event_sec * 1000u + (uint64_t)ev->input_event_usec / 1000u);
+    int drop = suppressed;
+    if (ev->value == 0) {
+        // A bouncing release extends the window
+        state->last_release[ev->code] = now_ms;
+        key_state_set(&state->released, ev->code, 1);
+        key_state_set(&state->suppressed, ev->code, 0);
+    } else if (ev->value == 1) {
+        drop = (filter->debounce_ms && key_state_test(&state->released, ev->code) &&
+                now_ms - state->last_release[ev->code] < filter->debounce_ms) ||
+               (filter->interval_ms && key_state_test(&state->pressed, ev->code) &&
+                now_ms - state->last_press[ev->code] < filter->interval_ms);
+        if (drop) {
+            key_state_set(&state->suppressed, ev->code, 1);
+        } else {
+            state->last_press[ev->code] = now_ms;
+            key_state_set(&state->pressed, ev->code, 1);
         }
     }
     
-    // Copy EV_REL
-    if (libevdev_has_event_type(dev, EV_REL)) {
-        libevdev_enable_event_type(uinput_dev, EV_REL);
-        for (code = 0; code < REL_MAX; code++) {
-            if (libevdev_has_event_code(dev, EV_REL, code)) {
-                libevdev_enable_event_code(uinput_dev, EV_REL, code, NULL);
+    if (drop) {
+        state->filtered[ev->code]++;
+    }
+    return drop;
+}
+
+// Run one event through the remap pipeline
+static void handle_event(device_runtime_t *rt, config_t *config, FILE *debug_fp,
+                         const char *device_name, struct input_event *ev, int paused) {
+    rt->stats.events++;
+    
+    // Log event if debug enabled
+    if (debug_fp && config->debug) {
+        log_event(debug_fp, ev, device_name);
+    }
+    
+    // Bounces are dropped before anything sees them
+    if (ev->type == EV_KEY && filter_key_event(rt, ev)) {
+        rt->stats.filtered++;
+        return;
+    }
+    
+    // Track source key state (needed to resync after SYN_DROPPED)
+    if (ev->type == EV_KEY && ev->value != 2) {
+        key_state_set(&rt->source_keys, ev->code, ev->value);
+        // Shared modifiers hold even while released or paused
+        device_config_t *device_cfg = runtime_config(rt);
+        if (key_state_test(&device_cfg->modifier_sources, ev->code)) {
+            update_modifiers(rt, device_cfg);
+        }
+    }
+    
+    // Released via control socket: the kernel delivers events natively
+    if (rt->released) {
+        return;
+    }
+    
+    // Frames are assembled per virtual device and terminated on the source's SYN_REPORT
+    if (ev->type == EV_SYN) {
+        if (ev->code == SYN_REPORT) {
+            flush_frames(rt, ev);
+            return;
+        }
+        if (ev->code != SYN_MT_REPORT) return;
+    }
+    
+    route_event(rt, ev, paused);
+}
+
+// Release virtual keys that no held source key accounts for under the current
+// config and profile, and flush them as one frame per virtual device
+static void release_unexplained_keys(device_runtime_t *rt) {
+    key_state_t expected_keyboard, expected_mouse;
+    key_state_clear(&expected_keyboard);
+    key_state_clear(&expected_mouse);
+    device_config_t *device_cfg = runtime_config(rt);
+    
+    for (int code = key_state_next(&rt->source_keys, 0); code >= 0; code = key_state_next(&rt->source_keys, code + 1)) {
+        struct input_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.type = EV_KEY;
+        ev.code = code;
+        
+        // Any rule of the source may hold its target, whatever the shared modifiers are now
+        remap_rule_t *remaps;
+        int remap_count;
+        if (active_rules(rt, device_cfg, &ev, &remaps, &remap_count)) {
+            for (int i = 0; i < remap_count; i++) {
+                if (remaps[i].source_type == EV_KEY && remaps[i].source_code == code && remaps[i].target_type == EV_KEY) {
+                    key_state_set(&expected_keyboard, remaps[i].target_code, 1);
+                }
             }
         }
+        const mouse_key_t *key = find_mouse_key(&device_cfg->mouse_keys, code);
+        if (key && key->button) {
+            key_state_set(&expected_mouse, key->button, 1);
+        }
+        key_state_set(&expected_mouse, code, 1);
     }
     
-    // Copy EV_ABS
-    if (libevdev_has_event_type(dev, EV_ABS)) {
-        libevdev_enable_event_type(uinput_dev, EV_ABS);
-        for (code = 0; code < ABS_MAX; code++) {
-            if (libevdev_has_event_code(dev, EV_ABS, code)) {
-                absinfo = libevdev_get_abs_info(dev, code);
-                libevdev_enable_event_code(uinput_dev, EV_ABS, code, absinfo);
+    for (int code = key_state_next(&rt->keyboard.keys, 0); code >= 0; code = key_state_next(&rt->keyboard.keys, code + 1)) {
+        if (!key_state_test(&expected_keyboard, code) && emitter_write(&rt->keyboard, EV_KEY, code, 0) < 0) {
+            rt->stats.dropped++;
+        }
+    }
+    for (int code = key_state_next(&rt->mouse.keys, 0); code >= 0; code = key_state_next(&rt->mouse.keys, code + 1)) {
+        if (!key_state_test(&expected_mouse, code) && emitter_write(&rt->mouse, EV_KEY, code, 0) < 0) {
+            rt->stats.dropped++;
+        }
+    }
+    
+    flush_frames(rt, NULL);
+}
+
+// After a SYN_DROPPED resync, bring both virtual devices back in line with
+// the real source key state and emit the differences as one frame each
+static void resync_key_state(device_runtime_t *rt, int paused) {
+    // The synced state is taken as is, dropped presses included
+    if (rt->filter) {
+        key_state_clear(&rt->filter->suppressed);
+    }
+    
+    // 1. Replay source keys whose state changed while events were dropped
+    for (int code = 0; code < KEY_CNT; code++) {
+        int down = libevdev_get_event_value(rt->dev, EV_KEY, code) ? 1 : 0;
+        if (down == key_state_test(&rt->source_keys, code)) continue;
+        
+        key_state_set(&rt->source_keys, code, down);
+        struct input_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.type = EV_KEY;
+        ev.code = code;
+        ev.value = down;
+        route_event(rt, &ev, paused);
+    }
+    
+    // 2. Release virtual keys no held source key can account for
+    release_unexplained_keys(rt);
+}
+
+// Switch the runtime to the active profile before a batch
+// A key held through a rule of the old profile is released now, its release
+// would otherwise go to the new profile's target and leave it stuck
+static void select_profile(device_runtime_t *rt, int profile) {
+    if (rt->profile == profile) return;
+    
+    rt->profile = profile;
+    if (!rt->released) {
+        release_unexplained_keys(rt);
+    }
+}
+
+void device_runtime_repeat(device_runtime_t *rt, int profile) {
+    if (!rt || rt->repeat.fd < 0 || !runtime_config(rt)) return;
+    repeat_scheduler_t *rs = &rt->repeat;
+    
+    // Drain the expiration count; the keys' deadlines say what is due
+    uint64_t expirations;
+    if (read(rs->fd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN) return;
+    rs->armed_ns = 0;
+    select_profile(rt, profile);
+    
+    // Ticks join a frame the source left open instead of splitting it
+    int open_frame = rt->keyboard.pending;
+    device_config_t *device_cfg = runtime_config(rt);
+    uint64_t now_ns = stats_now_ns();
+    
+    for (int i = 0; i < rs->count;) {
+        repeat_key_t *key = &rs->keys[i];
+        if (key->due_ns > now_ns) {
+            i++;
+            continue;
+        }
+        
+        // A reload or profile switch since the press may have changed the rule
+        // (looked up by target: shared modifiers only select a rule at the press)
+        struct input_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.type = EV_KEY;
+        ev.code = key->source;
+        remap_rule_t *remaps, *remap = NULL;
+        int remap_count;
+        if (active_rules(rt, device_cfg, &ev, &remaps, &remap_count)) {
+            for (int r = 0; r < remap_count && !remap; r++) {
+                if (remaps[r].source_type == EV_KEY && remaps[r].source_code == key->source &&
+                    remaps[r].target_code == key->target) {
+                    remap = &remaps[r];
+                }
+            }
+        }
+        int period_ms = !remap ? 0 :
+                        key->turbo ? remap->turbo_period_ms : remap->repeat_period_ms;
+        int held = key_state_test(&rt->keyboard.keys, key->target);
+        
+        if (!period_ms || !key_state_test(&rt->source_keys, key->source) || (!key->turbo && !held)) {
+            if (key->turbo && held && emitter_write(&rt->keyboard, EV_KEY, key->target, 0) < 0) {
+                rt->stats.dropped++;
             }
+            *key = rs->keys[--rs->count];
+            continue;
         }
+        
+        // Autofire toggles the target every half period
+        uint64_t step_ns = (uint64_t)period_ms * 1000000ull;
+        int value = 2;
+        if (key->turbo) {
+            value = held ? 0 : 1;
+            step_ns /= 2;
+        }
+        if (emitter_write(&rt->keyboard, EV_KEY, key->target, value) < 0) {
+            rt->stats.dropped++;
+        }
+        
+        // A late tick is not caught up in a burst
+        key->due_ns += step_ns;
+        if (key->due_ns <= now_ns) key->due_ns = now_ns + step_ns;
+        i++;
     }
     
-    struct libevdev_uinput *uinput = NULL;
-    rc = libevdev_uinput_create_from_device(uinput_dev, LIBEVDEV_UINPUT_OPEN_MANAGED, &uinput);
-    if (rc < 0) {
-        fprintf(stderr, "WARNING: Failed to create virtual device for forwarding: %s\n", strerror(-rc));
-        fprintf(stderr, "Events will be displayed but may not work normally\n");
-        uinput = NULL;
+    if (!open_frame && emitter_sync(&rt->keyboard) < 0) {
+        rt->stats.dropped++;
     }
-    libevdev_free(uinput_dev);
     
-    // Grab device exclusively so we can read events
-    rc = libevdev_grab(dev, LIBEVDEV_GRAB);
-    if (rc < 0) {
-        fprintf(stderr, "WARNING: Could not grab device: %s\n", strerror(-rc));
-        fprintf(stderr, "Events may not be visible if another process is using the device\n");
-    } else {
-        printf("Device grabbed - events will be forwarded so device continues to work\n");
+    // Mouse keys: one frame per tick until no direction key is held
+    mouse_keys_state_t *pointer = &rt->pointer;
+    if (pointer->due_ns && pointer->due_ns <= now_ns) {
+        int open_pointer_frame = rt->mouse.pending;
+        uint64_t step_ns = (uint64_t)device_cfg->mouse_keys.interval_ms * 1000000ull;
+        if (!device_cfg->mouse_keys.key_count || !mouse_keys_move(rt, now_ns)) {
+            pointer->due_ns = 0;
+            pointer->start_ns = 0;
+        } else {
+            pointer->due_ns += step_ns;
+            if (pointer->due_ns <= now_ns) pointer->due_ns = now_ns + step_ns;
+        }
+        if (!open_pointer_frame && emitter_sync(&rt->mouse) < 0) {
+            rt->stats.dropped++;
+        }
     }
     
-    printf("\nPress buttons/keys on the device to see events...\n");
-    printf("Press Ctrl+C to stop\n\n");
+    // Sequence timed out: its keys go through after all
+    sequence_state_t *sequence = &rt->sequence;
+    if (sequence->due_ns && sequence->due_ns <= now_ns) {
+        int open_frames = rt->keyboard.pending || rt->mouse.pending;
+        sequence_replay(rt, sequence->length, 0);
+        sequence->state = 0;
+        sequence->due_ns = 0;
+        if (!open_frames) flush_frames(rt, NULL);
+    }
+    
+    // Scanner paused: the record is complete
+    if (rt->scanner.due_ns && rt->scanner.due_ns <= now_ns) {
+        if (device_cfg->scanner.output) {
+            scanner_deliver(rt);
+        } else {
+            rt->scanner.length = 0;
+            rt->scanner.due_ns = 0;
+        }
+    }
+    repeat_arm(rt);
+}
+
+void device_runtime_feed(device_runtime_t *rt, config_t *config, FILE *debug_fp,
+                         struct input_event *ev, int paused, int profile) {
+    if (!rt || !config || !ev || !runtime_config(rt)) return;
+    select_profile(rt, profile);
+    sync_modifiers(rt);
+    handle_event(rt, config, debug_fp, rt->dev ? libevdev_get_name(rt->dev) : rt->path, ev, paused);
+}
+
+int process_device_events(device_runtime_t *rt, config_t *config, FILE *debug_fp, int paused, int profile) {
+    if (!rt || !rt->dev || !runtime_config(rt) || !config) return -1;
+    
+    select_profile(rt, profile);
+    sync_modifiers(rt);
     
     struct input_event ev;
+    const char *device_name = libevdev_get_name(rt->dev);
     
-    while (running_ptr == NULL || *running_ptr) {
-        rc = libevdev_next_event(dev, LIBEVDEV_READ_FLAG_NORMAL, &ev);
+    for (;;) {
+        int rc = libevdev_next_event(rt->dev, LIBEVDEV_READ_FLAG_NORMAL, &ev);
         
         if (rc == LIBEVDEV_READ_STATUS_SUCCESS) {
-            // Forward event to virtual device (so it still works)
-            if (uinput) {
-                libevdev_uinput_write_event(uinput, ev.type, ev.code, ev.value);
-                libevdev_uinput_write_event(uinput, EV_SYN, SYN_REPORT, 0);
-            }
-            
-            // Skip SYN events (they're just synchronization, not interesting)
-            if (ev.type == EV_SYN) {
-                continue;
-            }
-            
-            // Get canonical name for code if available
-            const char *canonical_name = NULL;
-            if (ev.type == EV_KEY) {
-                canonical_name = get_canonical_name(ev.code, ev.type);
-            }
-            
-            // Format event display
-            printf("[%s] ", get_event_type_name(ev.type));
-            
-            if (canonical_name) {
-                printf("code=%s(%d)", canonical_name, ev.code);
-            } else {
-                printf("code=%d", ev.code);
-            }
-            
-            printf(" value=%d", ev.value);
-            
-            // Add helpful state description for key events
-            if (ev.type == EV_KEY) {
-                if (ev.value == 1) {
-                    printf(" [PRESSED]");
-                } else if (ev.value == 0) {
-                    printf(" [RELEASED]");
-                } else if (ev.value == 2) {
-                    printf(" [REPEAT]");
+            handle_event(rt, config, debug_fp, device_name, &ev, paused);
+        } else if (rc == LIBEVDEV_READ_STATUS_SYNC) {
+            // Kernel buffer overrun (SYN_DROPPED): drain libevdev's resync delta.
+            // Key changes are reconciled afterwards from the synced state so
+            // remapped keys go through the remap path instead of the forward device.
+            rt->stats.syn_dropped++;
+            while (libevdev_next_event(rt->dev, LIBEVDEV_READ_FLAG_SYNC, &ev) == LIBEVDEV_READ_STATUS_SYNC) {
+                rt->stats.events++;
+                if (debug_fp && config->debug) {
+                    log_event(debug_fp, &ev, device_name);
                 }
+                if (rt->released || ev.type == EV_KEY || ev.type == EV_SYN) continue;
+                route_event(rt, &ev, paused);
             }
             
-            printf("\n");
-            fflush(stdout);
-        } else if (rc == LIBEVDEV_READ_STATUS_SYNC) {
-            // Handle sync events - forward them and skip display
-            while (libevdev_next_event(dev, LIBEVDEV_READ_FLAG_SYNC, &ev) == LIBEVDEV_READ_STATUS_SUCCESS) {
-                if (uinput) {
-                    libevdev_uinput_write_event(uinput, ev.type, ev.code, ev.value);
-                    libevdev_uinput_write_event(uinput, EV_SYN, SYN_REPORT, 0);
+            if (!rt->released) {
+                resync_key_state(rt, paused);
+            } else {
+                for (int code = 0; code < KEY_CNT; code++) {
+                    key_state_set(&rt->source_keys, code, libevdev_get_event_value(rt->dev, EV_KEY, code));
                 }
             }
+            update_modifiers(rt, runtime_config(rt));
         } else if (rc == -EAGAIN) {
-            // No event available, continue
-            continue;
+            // Device drained
+            return 0;
         } else {
-            fprintf(stderr, "ERROR: Failed to read event: %s\n", strerror(-rc));
-            break;
+            fprintf(stderr, "ERROR: Failed to read event from %s: %s\n", rt->path, strerror(-rc));
+            return -1;
         }
     }
-    
-    // Ungrab device
-    libevdev_grab(dev, LIBEVDEV_UNGRAB);
-    
-    if (uinput) {
-        libevdev_uinput_destroy(uinput);
-    }
-    libevdev_free(dev);
-    close(fd);
-    
-    return 0;
-}
\ No newline at end of file
+}
@@ -3,35 +3,242 @@
 
 #include "config-loader.h"
 #include "debug-logger.h"
+#include "device-stats.h"
+#include "event-mask.h"
+#include "hid-offload.h"
+#include "key-state.h"
+#include "keymap-offload.h"
 #include <libevdev/libevdev.h>
 #include <libevdev/libevdev-uinput.h>
 #include <linux/input.h>
+#include <stdalign.h>
+#include <stdint.h>
 
-// Setup device and create libevdev instance
+// Replacement for the uinput write (benchmarks): receives every emitted event
+// Returns 0 on success, negative errno on error
+typedef int (*emitter_sink_fn)(void *ctx, const struct input_event *ev);
+
+// Virtual output device with frame and key-state tracking
+typedef struct {
+    struct libevdev_uinput *uinput;     // NULL when adopted through a handover
+    int fd;                             // uinput fd events are written to
+    emitter_sink_fn sink;               // If set, used instead of fd
+    void *sink_ctx;
+    key_state_t keys;                   // Keys currently held down on this device
+    key_state_t caps;                   // EV_KEY codes enabled when the device was created
+    int pending;                        // Events written since the last SYN_REPORT
+} emitter_t;
+
+// Per-code state of the chatter filters (device_config_t.key_filters)
+// Times are kernel event timestamps in milliseconds, wrapping after 49 days
+typedef struct {
+    uint32_t last_press[KEY_CNT];       // Last accepted press
+    uint32_t last_release[KEY_CNT];     // Last release, including dropped ones
+    uint32_t filtered[KEY_CNT];         // Events dropped per code (status)
+    key_state_t pressed;                // last_press is valid
+    key_state_t released;               // last_release is valid
+    key_state_t suppressed;             // Press was dropped: its repeats and release are too
+} key_filter_state_t;
+
+// Button-hold scrolling state (device.scroll)
+typedef struct {
+    int held;                           // Scroll button down, its press held back
+    int button;                         // Button that started the hold
+    int scrolled;                       // Wheel events were emitted during this hold
+    uint64_t press_ns;                  // Event time of the press
+    int remainder[2];                   // Motion not yet worth a hi-res unit (x100), [0] = horizontal
+    int detent[2];                      // Hi-res units not yet worth a detent
+} scroll_state_t;
+
+// Mouse gesture being stroked (device.gestures)
+typedef struct {
+    int held;                           // Gesture button down, its press held back
+    int button;                         // Button that started the gesture
+    int active;                         // Threshold crossed: motion is suppressed, the release runs the gesture
+    int dx, dy;                         // Motion since the last direction
+    int last;                           // Last direction (GESTURE_*), 0 = none yet
+    int length;                         // Directions so far, beyond GESTURE_MAX_STROKE nothing matches
+    uint32_t stroke;                    // Directions as base-5 digits (gesture_t.stroke)
+} gesture_state_t;
+
+// Keyboard-driven pointer (device.mouse_keys), ticked by the repeat timer
+typedef struct {
+    uint64_t start_ns;                  // Movement began (acceleration), 0 = not moving
+    uint64_t due_ns;                    // Next tick, 0 = none
+    int64_t remainder[2];               // Fractions of counts not yet emitted (16.16), [0] = X
+} mouse_keys_state_t;
+
+// Key sequence being matched (device.sequences): presses that may be part of one
+// are held back, exactly the keys matched by the automaton state
+typedef struct {
+    const device_config_t *cfg;         // Config the state belongs to
+    int state;                          // Automaton state, 0 = nothing held back
+    int length;                         // Presses held back (the state's depth)
+    uint16_t keys[SEQUENCE_MAX_KEYS];
+    uint32_t released;                  // Bit per held back press whose release was held back too
+    key_state_t consumed;               // Keys that completed a sequence: their repeats and release are dropped
+    uint64_t due_ns;                    // Timeout, 0 = none
+} sequence_state_t;
+
+// Longest scanner record, longer ones are delivered in pieces
+#define SCANNER_MAX_RECORD 1024
+
+// Least time between attempts to open a scanner output that failed to open
+#define SCANNER_RETRY_MS 1000
+
+// Scanner capture (device.scanner): characters of the record being typed and the
+// lazily opened output
+typedef struct {
+    int fd;                             // Socket or FIFO, valid while connected
+    int connected;
+    int fifo;                           // fd is a FIFO (written with write(), not send())
+    int failing;                        // Last delivery failed (warned once)
+    uint64_t retry_ns;                  // No new open attempt before this
+    int length;                         // Characters in record
+    uint64_t due_ns;                    // Record ends by timeout, 0 = none
+    char record[SCANNER_MAX_RECORD + 1];    // Room for the terminating newline
+} scanner_state_t;
+
+// Keys repeating or autofiring at once per device (more are pressed without)
+#define REPEAT_MAX_KEYS 16
+
+// Held key whose target keyswap repeats (rule.repeat) or autofires (rule.turbo) itself
+typedef struct {
+    uint64_t due_ns;                    // Next tick (CLOCK_MONOTONIC)
+    uint16_t source;
+    uint16_t target;
+    uint8_t turbo;
+} repeat_key_t;
+
+// Software autorepeat of one device: every held key shares one timerfd, armed
+// for the earliest tick (mouse keys ticks, sequence and scanner timeouts included)
+typedef struct {
+    int fd;                             // timerfd, -1 = none (fully offloaded device)
+    int count;
+    uint64_t armed_ns;                  // Deadline the timer is set to, 0 = disarmed
+    repeat_key_t keys[REPEAT_MAX_KEYS];
+} repeat_scheduler_t;
+
+// Cache line size device runtimes are aligned to
+#define DEVICE_RUNTIME_ALIGN 64
+
+// Per-device runtime state driven by the event loop
+// Runtimes are kept in one contiguous array, each starting on its own cache line
+// (no false sharing between devices of different workers); hot fields first
+typedef struct {
+    alignas(DEVICE_RUNTIME_ALIGN) int fd;
+    int released;                       // Ungrabbed via control socket: events pass through natively
+    int grabbed;                        // Source device is grabbed exclusively
+    int worker;                         // Owning worker thread, -1 = main event loop
+    int profile;                        // Profile the last batch ran with (config_t.profiles index)
+    struct libevdev *dev;
+    device_config_t *cfg;               // Swapped atomically on reload, see device_runtime_swap_config
+    device_stats_t stats;
+    emitter_t keyboard;                 // Injection device for remapped events
+    emitter_t mouse;                    // Forward device for everything else
+    key_state_t source_keys;            // Keys held on the source as seen by the pipeline
+    scroll_state_t scroll;              // Button-hold scrolling (device.scroll)
+    gesture_state_t gesture;            // Mouse gesture (device.gestures)
+    mouse_keys_state_t pointer;         // Keyboard-driven pointer (device.mouse_keys)
+    sequence_state_t sequence;          // Key sequence (device.sequences)
+    scanner_state_t scanner;            // Scanner record (device.scanner)
+    uint64_t modifiers;                 // Shared modifiers this device holds (device.modifiers)
+    const device_config_t *modifiers_cfg;   // Config modifiers was computed with
+    key_filter_state_t *filter;         // Allocated with the first config that has filters, NULL = none
+    keymap_offload_t offload;           // Rules done by the kernel keymap (device.offload)
+    hid_offload_t hid_offload;          // Rules and inversions done by HID-BPF (device.offload "hid-bpf")
+    repeat_scheduler_t repeat;          // Generated repeats and autofire of held keys
+    int handed_over;                    // Fds passed to a new process, which owns the device now
+    char path[256];                     // /dev/input/event* node
+} device_runtime_t;
+
+// Check whether a kernel backend does everything for the device: it is neither
+// grabbed nor read, and has no virtual devices
+static inline int device_runtime_offloaded(const device_runtime_t *rt) {
+    return rt->offload.complete || rt->hid_offload.complete;
+}
+
+// Setup device and create libevdev instance (non-blocking, CLOCK_MONOTONIC timestamps)
 // Returns 0 on success, -1 on error
 // Sets *dev and *device_fd on success
 int setup_device(const char *device_path, struct libevdev **dev, int *device_fd);
 
+// Open source device, grab it and create its uinput devices and repeat timer
+// With device.offload, rules the kernel can do are handed to it first: with "hid-bpf"
+// to a HID-BPF program if the device is HID and the kernel supports it, otherwise
+// (or with "keymap") to the scancode keymap; if that covers everything the device is
+// neither grabbed nor given uinput devices (device_runtime_offloaded) and must not be read
+// Returns 0 on success, -1 on error (rt is left closed)
+int device_runtime_open(device_runtime_t *rt, const char *device_path, device_config_t *device_cfg);
+
+// Hand the rules of the runtime's config to a kernel backend (device.offload), as
+// device_runtime_open does; for a device whose offload was undone (handover that failed)
+void device_runtime_apply_offload(device_runtime_t *rt);
+
+// Take over a device from a previous keyswap process (fds received over the control socket)
+// The source is assumed to be grabbed already; mouse_fd may be -1 (a new repeat
+// timer is created, keys held across the handover are not repeated). The offload
+// is redone unless it would cover everything
+// Returns 0 on success, -1 on error (fds are closed)
+int device_runtime_adopt(device_runtime_t *rt, const char *device_path, device_config_t *device_cfg,
+                         int source_fd, int keyboard_fd, int mouse_fd);
+
+// Emit a release for every key held on the virtual devices and flush the frames
+void device_runtime_release_keys(device_runtime_t *rt);
+
+// Release held virtual keys and shared modifiers, ungrab source device, undo its
+// offload and destroy its uinput devices
+void device_runtime_close(device_runtime_t *rt);
+
+// Check whether device_cfg can replace the current config without recreating
+// the virtual devices (every injected key is enabled on the keyboard emitter)
+// or reprogramming the keymap (same offloaded rules)
+// Returns 1 if compatible, 0 otherwise
+int device_runtime_config_compatible(const device_runtime_t *rt, const device_config_t *device_cfg);
+
+// Publish a new config to the owning thread (RCU-style pointer swap)
+// The old config must stay valid until the owner has finished its current event batch
+// Allocates the chatter filter state if device_cfg is the first config with filters
+void device_runtime_swap_config(device_runtime_t *rt, device_config_t *device_cfg);
+
+// Grab (grab=1) or release (grab=0) the source device
+// Returns 0 on success, -1 on error
+int device_runtime_set_grab(device_runtime_t *rt, int grab);
+
+// Have the kernel deliver only the events the runtime's mode needs (EVIOCSMASK):
+// nothing for a fully offloaded device, EV_KEY only while released (source key
+// state), everything while grabbed; call after each change of mode
+// Returns 0 on success, -1 if the kernel cannot mask (everything is delivered)
+int device_runtime_update_mask(device_runtime_t *rt);
+
 // Setup uinput devices (keyboard for injection, mouse for forwarding)
 // Returns 0 on success, -1 on error
 int setup_uinput_devices(struct libevdev *dev, struct libevdev_uinput **keyboard, struct libevdev_uinput **mouse, device_config_t *device_cfg);
 
-// Process events loop
-// Returns 0 on success, -1 on error
-// running_ptr points to flag that controls loop (set to 0 to stop)
-int process_events(struct libevdev *dev, device_config_t *device_cfg, config_t *config, 
-                   struct libevdev_uinput *keyboard, struct libevdev_uinput *mouse, FILE *debug_fp, int *running_ptr);
+// Drain all pending events from a device (call when its fd is readable)
+// paused: forward everything unchanged instead of applying remaps
+// profile: active profile, selects the device's precompiled table (out of range = default);
+// keys held through a rule of the previous profile are released when it changes
+// Returns 0 on success, -1 on read error (e.g. device unplugged)
+int process_device_events(device_runtime_t *rt, config_t *config, FILE *debug_fp, int paused, int profile);
 
-// Inject an event to uinput device
-void inject_event(struct libevdev_uinput *uinput, int type, int code, int value);
+// Emit the repeats, autofire toggles and mouse keys motion that are due, replay the
+// keys of a timed out sequence, deliver a timed out scanner record (call when
+// rt->repeat.fd is readable) and re-arm the timer for the next one
+// profile: as for process_device_events
+void device_runtime_repeat(device_runtime_t *rt, int profile);
 
-// Forward an event to virtual mouse device
-void forward_event(struct libevdev_uinput *mouse, struct input_event *ev);
+// Run one event through the remap pipeline, exactly as process_device_events does
+// For synthetic input (benchmarks); rt->dev may be NULL
+void device_runtime_feed(device_runtime_t *rt, config_t *config, FILE *debug_fp,
+                         struct input_event *ev, int paused, int profile);
 
-// Listen/monitor mode: Open device and display events in real-time
-// Does NOT grab device (device continues to work normally)
-// Returns 0 on success, -1 on error
-// running_ptr points to flag that controls loop (set to 0 to stop)
-int listen_device(const char *device_path, int *running_ptr);
+// Write an event into the emitter's pending frame (no SYN_REPORT)
+// Returns 0 on success, negative errno on error
+int emitter_write(emitter_t *em, int type, int code, int value);
+
+// Terminate the pending frame with SYN_REPORT (no-op if nothing is pending)
+// Returns 0 on success, negative errno on error
+int emitter_sync(emitter_t *em);
 
 #endif // EVENT_PROCESSOR_H
\ No newline at end of file
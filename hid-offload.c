@@ -0,0 +1,569 @@
+#include "hid-offload.h"
+#include "keymap-offload.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/input.h>
+
+#ifdef KEYSWAP_HID_BPF
+#include <stdarg.h>
+#include <bpf/libbpf.h>
+#include "bpf/hid-remap.skel.h"
+#endif
+
+// Usages carry their page in the high 16 bits
+#define HID_USAGE(page, id) (((uint32_t)(page) << 16) | (id))
+#define HID_PAGE_GENERIC_DESKTOP 0x01
+#define HID_PAGE_KEYBOARD 0x07
+#define HID_PAGE_BUTTON 0x09
+#define HID_PAGE_CONSUMER 0x0c
+
+#define HID_MAX_USAGES 256          // Local usages kept per main item
+#define HID_GLOBAL_STACK 4          // Push/Pop depth
+#define HID_MAX_LOCATIONS 8         // Places one key can appear in the input reports
+
+// Keyboard page usages 0x04-0x73 to key codes, as hid-input maps them
+static const uint8_t g_keyboard_usages[0x74] = {
+      0,  0,  0,  0, 30, 48, 46, 32, 18, 33, 34, 35, 23, 36, 37, 38,
+     50, 49, 24, 25, 16, 19, 31, 20, 22, 47, 17, 45, 21, 44,  2,  3,
+      4,  5,  6,  7,  8,  9, 10, 11, 28,  1, 14, 15, 57, 12, 13, 26,
+     27, 43, 43, 39, 40, 41, 51, 52, 53, 58, 59, 60, 61, 62, 63, 64,
+     65, 66, 67, 68, 87, 88, 99, 70,119,110,102,104,111,107,109,106,
+    105,108,103, 69, 98, 55, 74, 78, 96, 79, 80, 81, 75, 76, 77, 71,
+     72, 73, 82, 83, 86,127,116,117,183,184,185,186,187,188,189,190,
+    191,192,193,194
+};
+
+// Keyboard page modifier usages 0xe0-0xe7
+static const uint16_t g_modifier_usages[8] = {
+    KEY_LEFTCTRL, KEY_LEFTSHIFT, KEY_LEFTALT, KEY_LEFTMETA,
+    KEY_RIGHTCTRL, KEY_RIGHTSHIFT, KEY_RIGHTALT, KEY_RIGHTMETA
+};
+
+// One Input main item of a report descriptor
+typedef struct {
+    uint8_t report_id;
+    uint16_t offset;                    // Bits from the start of the report, report id included
+    uint8_t size;                       // Bits per element
+    uint16_t count;
+    int variable;                       // One usage per element, otherwise an array of usage indexes
+    int relative;
+    int32_t logical_min;
+    int32_t logical_max;
+    uint32_t application;               // Usage of the enclosing application collection
+    uint32_t usages[HID_MAX_USAGES];    // Per element (variable) or per index (array)
+    int usage_count;
+} hid_field_t;
+
+// Global items (saved by Push)
+typedef struct {
+    uint32_t usage_page;
+    int32_t logical_min;
+    int32_t logical_max;
+    uint32_t report_size;
+    uint32_t report_count;
+    uint8_t report_id;
+} hid_globals_t;
+
+// Collect the Input fields of a report descriptor
+// Returns number of fields (at most HID_MAX_FIELDS), -1 if malformed
+static int parse_descriptor(const uint8_t *desc, size_t size, hid_field_t *fields) {
+    hid_globals_t globals;
+    hid_globals_t stack[HID_GLOBAL_STACK];
+    int stack_depth = 0;
+    uint32_t usages[HID_MAX_USAGES];
+    int usage_count = 0;
+    uint32_t usage_min = 0;
+    uint32_t application = 0;
+    int collection_depth = 0;
+    uint32_t input_bits[256];           // Input bits so far per report id
+    int numbered = 0;
+    int field_count = 0;
+
+    memset(&globals, 0, sizeof(globals));
+    memset(input_bits, 0, sizeof(input_bits));
+
+    for (size_t pos = 0; pos < size;) {
+        uint8_t prefix = desc[pos++];
+        if (prefix == 0xfe) {
+            // Long item: data size, tag, data (none are defined)
+            if (pos + 2 > size) return -1;
+            pos += 2 + desc[pos];
+            continue;
+        }
+
+        size_t data_size = (prefix & 3) == 3 ? 4 : (prefix & 3);
+        if (pos + data_size > size) return -1;
+        uint32_t data = 0;
+        for (size_t i = 0; i < data_size; i++) {
+            data |= (uint32_t)desc[pos + i] << (8 * i);
+        }
+        int32_t sdata = data_size == 0 ? 0 :
+                        data_size == 4 ? (int32_t)data :
+                        (int32_t)(data << (32 - 8 * data_size)) >> (32 - 8 * data_size);
+        pos += data_size;
+
+        int type = (prefix >> 2) & 3;
+        int tag = prefix >> 4;
+        // A short usage takes the current page
+        uint32_t usage = data_size == 4 ? data : HID_USAGE(globals.usage_page, data);
+
+        if (type == 0) {
+            if (tag == 0x8) {
+                // Input: constant fields are padding
+                uint32_t bits = globals.report_size * globals.report_count;
+                uint32_t offset = (numbered ? 8 : 0) + input_bits[globals.report_id];
+                input_bits[globals.report_id] += bits;
+                if (!(data & 1) && globals.report_size > 0 && globals.report_size <= 32 &&
+                    globals.report_count > 0 && offset + bits <= UINT16_MAX && usage_count > 0 &&
+                    field_count < HID_MAX_FIELDS) {
+                    hid_field_t *field = &fields[field_count++];
+                    field->report_id = globals.report_id;
+                    field->offset = (uint16_t)offset;
+                    field->size = (uint8_t)globals.report_size;
+                    field->count = (uint16_t)globals.report_count;
+                    field->variable = (data & 2) != 0;
+                    field->relative = (data & 4) != 0;
+                    field->logical_min = globals.logical_min;
+                    field->logical_max = globals.logical_max;
+                    field->application = application;
+                    memcpy(field->usages, usages, usage_count * sizeof(uint32_t));
+                    field->usage_count = usage_count;
+                }
+            } else if (tag == 0xa) {
+                // Collection: an application at top level names what follows
+                if (data == 1 && collection_depth == 0) application = usage_count > 0 ? usages[0] : 0;
+                collection_depth++;
+            } else if (tag == 0xc) {
+                if (collection_depth > 0) collection_depth--;
+            }
+            // Every main item ends the local items
+            usage_count = 0;
+        } else if (type == 1) {
+            switch (tag) {
+            case 0x0: globals.usage_page = data; break;
+            case 0x1: globals.logical_min = sdata; break;
+            // Unsigned unless the minimum is negative, as the kernel reads it
+            case 0x2: globals.logical_max = globals.logical_min < 0 ? sdata : (int32_t)data; break;
+            case 0x7: globals.report_size = data; break;
+            case 0x8:
+                if (data == 0 || data > 255) return -1;
+                globals.report_id = (uint8_t)data;
+                numbered = 1;
+                break;
+            case 0x9: globals.report_count = data; break;
+            case 0xa:
+                if (stack_depth == HID_GLOBAL_STACK) return -1;
+                stack[stack_depth++] = globals;
+                break;
+            case 0xb:
+                if (stack_depth == 0) return -1;
+                globals = stack[--stack_depth];
+                break;
+            }
+        } else if (type == 2) {
+            if (tag == 0x0 && usage_count < HID_MAX_USAGES) {
+                usages[usage_count++] = usage;
+            } else if (tag == 0x1) {
+                usage_min = usage;
+            } else if (tag == 0x2) {
+                for (uint32_t u = usage_min; u <= usage && usage_count < HID_MAX_USAGES; u++) {
+                    usages[usage_count++] = u;
+                }
+            }
+        }
+    }
+    return field_count;
+}
+
+// Event an input field usage produces: the part of hid-input's mapping the
+// offload handles (keyboard keys, mouse buttons, relative axes)
+// Returns 1 and sets *type and *code, 0 if not handled
+static int usage_event(const hid_field_t *field, uint32_t usage, int *type, int *code) {
+    uint32_t page = usage >> 16;
+    uint32_t id = usage & 0xffff;
+
+    *type = EV_KEY;
+    if (page == HID_PAGE_KEYBOARD && id < sizeof(g_keyboard_usages) && g_keyboard_usages[id]) {
+        *code = g_keyboard_usages[id];
+        return 1;
+    }
+    if (page == HID_PAGE_KEYBOARD && id >= 0xe0 && id <= 0xe7) {
+        *code = g_modifier_usages[id - 0xe0];
+        return 1;
+    }
+    if (page == HID_PAGE_BUTTON && id >= 1 && id <= 16 &&
+        (field->application == HID_USAGE(HID_PAGE_GENERIC_DESKTOP, 0x02) ||
+         field->application == HID_USAGE(HID_PAGE_GENERIC_DESKTOP, 0x01))) {
+        *code = BTN_MOUSE + (int)id - 1;
+        return 1;
+    }
+
+    *type = EV_REL;
+    if (!field->variable || !field->relative) return 0;
+    switch (usage) {
+    case HID_USAGE(HID_PAGE_GENERIC_DESKTOP, 0x30): *code = REL_X; return 1;
+    case HID_USAGE(HID_PAGE_GENERIC_DESKTOP, 0x31): *code = REL_Y; return 1;
+    case HID_USAGE(HID_PAGE_GENERIC_DESKTOP, 0x38): *code = REL_WHEEL; return 1;
+    case HID_USAGE(HID_PAGE_CONSUMER, 0x238): *code = REL_HWHEEL; return 1;
+    }
+    return 0;
+}
+
+// Usage of element i of a variable field (the last usage repeats)
+static uint32_t element_usage(const hid_field_t *field, int i) {
+    return field->usages[i < field->usage_count ? i : field->usage_count - 1];
+}
+
+// Check whether a field lies within the report bytes the program sees
+static int field_reachable(const hid_field_t *field) {
+    return field->offset + (uint32_t)field->size * field->count <= HID_REMAP_MAX_REPORT * 8;
+}
+
+// Place a key appears in the input reports: one bit of a bitmap, or a value
+// in an array field
+typedef struct {
+    const hid_field_t *field;
+    int bit;                            // Bit offset, -1 = array
+    int32_t value;                      // Array value of the key
+} hid_location_t;
+
+// Find every place key code can appear in
+// Returns number of locations (at most max)
+static int find_key_locations(const hid_field_t *fields, int field_count, int code,
+                              hid_location_t *locations, int max) {
+    int count = 0;
+    int type, mapped;
+
+    for (int f = 0; f < field_count && count < max; f++) {
+        const hid_field_t *field = &fields[f];
+        if (!field_reachable(field)) continue;
+
+        if (field->variable && field->size == 1) {
+            for (int i = 0; i < field->count && count < max; i++) {
+                if (usage_event(field, element_usage(field, i), &type, &mapped) && type == EV_KEY && mapped == code) {
+                    locations[count++] = (hid_location_t){ field, field->offset + i, 0 };
+                }
+            }
+        } else if (!field->variable && field->size <= HID_REMAP_MAX_FIELD_BITS && field->count <= HID_REMAP_MAX_SLOTS) {
+            for (int i = 0; i < field->usage_count && count < max; i++) {
+                int32_t value = field->logical_min + i;
+                if (value > field->logical_max) break;
+                if (usage_event(field, field->usages[i], &type, &mapped) && type == EV_KEY && mapped == code) {
+                    locations[count++] = (hid_location_t){ field, -1, value };
+                }
+            }
+        }
+    }
+    return count;
+}
+
+// Value of an array field meaning "no key" (usage 0)
+// Returns 0 on success, -1 if the field has none
+static int array_empty_value(const hid_field_t *field, int32_t *value) {
+    for (int i = 0; i < field->usage_count && field->logical_min + i <= field->logical_max; i++) {
+        if ((field->usages[i] & 0xffff) == 0) {
+            *value = field->logical_min + i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// Operations doing one rule in every report its source appears in
+// Returns number of operations written (at most max), -1 if the rule does not fit
+// (a source without a target in its report, no empty array value, too many operations)
+static int compile_rule(const hid_field_t *fields, int field_count, const remap_rule_t *remap,
+                        struct hid_remap_op *ops, int max) {
+    hid_location_t sources[HID_MAX_LOCATIONS];
+    hid_location_t targets[HID_MAX_LOCATIONS];
+    int blocked = remap->target_code == KEY_RESERVED;
+    int source_count = find_key_locations(fields, field_count, remap->source_code, sources, HID_MAX_LOCATIONS);
+    int target_count = blocked ? 0 : find_key_locations(fields, field_count, remap->target_code, targets, HID_MAX_LOCATIONS);
+    if (source_count == 0 || source_count > max) return -1;
+
+    for (int s = 0; s < source_count; s++) {
+        const hid_location_t *src = &sources[s];
+        struct hid_remap_op *op = &ops[s];
+        memset(op, 0, sizeof(*op));
+        op->report_id = src->field->report_id;
+
+        // Target in the same report, the source's own array first
+        const hid_location_t *dst = NULL;
+        for (int t = 0; t < target_count; t++) {
+            if (targets[t].field->report_id != src->field->report_id) continue;
+            if (!dst || targets[t].field == src->field) dst = &targets[t];
+        }
+        if (!blocked && !dst) return -1;
+
+        int32_t empty;
+        if (src->bit >= 0) {
+            op->src = (uint16_t)src->bit;
+            if (blocked) {
+                op->kind = HID_REMAP_BIT_CLEAR;
+            } else if (dst->bit >= 0) {
+                op->kind = HID_REMAP_BIT_MOVE;
+                op->dst = (uint16_t)dst->bit;
+            } else {
+                if (array_empty_value(dst->field, &empty) != 0) return -1;
+                op->kind = HID_REMAP_BIT_TO_ARRAY;
+                op->dst = dst->field->offset;
+                op->size = dst->field->size;
+                op->count = (uint8_t)dst->field->count;
+                op->from = empty;
+                op->to = dst->value;
+            }
+        } else {
+            op->src = src->field->offset;
+            op->size = src->field->size;
+            op->count = (uint8_t)src->field->count;
+            op->from = src->value;
+            if (!blocked && dst->field == src->field) {
+                op->kind = HID_REMAP_ARRAY_MAP;
+                op->to = dst->value;
+            } else if (!blocked && dst->bit < 0) {
+                // Between two arrays: left to userspace
+                return -1;
+            } else {
+                if (array_empty_value(src->field, &empty) != 0) return -1;
+                op->kind = blocked ? HID_REMAP_ARRAY_MAP : HID_REMAP_ARRAY_TO_BIT;
+                op->dst = blocked ? 0 : (uint16_t)dst->bit;
+                op->to = empty;
+            }
+        }
+    }
+    return source_count;
+}
+
+// Operations negating every relative field element that produces axis
+// Returns number of operations written (0 if the axis is not in the reports),
+// -1 if more than max are needed or an element is too wide
+static int compile_invert(const hid_field_t *fields, int field_count, int axis,
+                          struct hid_remap_op *ops, int max) {
+    int count = 0;
+    int type, code;
+
+    for (int f = 0; f < field_count; f++) {
+        const hid_field_t *field = &fields[f];
+        if (!field->variable || !field->relative) continue;
+
+        for (int i = 0; i < field->count; i++) {
+            if (!usage_event(field, element_usage(field, i), &type, &code) || type != EV_REL || code != axis) continue;
+            if (count == max || !field_reachable(field) || field->size > HID_REMAP_MAX_FIELD_BITS) return -1;
+
+            struct hid_remap_op *op = &ops[count++];
+            memset(op, 0, sizeof(*op));
+            op->kind = HID_REMAP_NEGATE;
+            op->report_id = field->report_id;
+            op->size = field->size;
+            op->src = (uint16_t)(field->offset + i * field->size);
+        }
+    }
+    return count;
+}
+
+int hid_offload_compile(hid_offload_t *ho, struct hid_remap_table *table,
+                        const uint8_t *descriptor, size_t size, const device_config_t *device_cfg) {
+    if (!ho || !table || !descriptor || !device_cfg) return -1;
+    memset(ho, 0, sizeof(*ho));
+    memset(table, 0, sizeof(*table));
+
+    hid_field_t *fields = calloc(HID_MAX_FIELDS, sizeof(hid_field_t));
+    int *offloaded = calloc(device_cfg->remap_count + 1, sizeof(int));
+    int field_count = fields && offloaded ? parse_descriptor(descriptor, size, fields) : -1;
+    if (field_count < 0) {
+        free(offloaded);
+        free(fields);
+        return -1;
+    }
+
+    // Inversion first, an axis is negated everywhere or not at all; the
+    // high-resolution wheels come from the same fields as their wheel
+    int op_count = 0;
+    for (int axis = 0; axis <= REL_MAX; axis++) {
+        if (!(device_cfg->invert_rel & (1u << axis)) || axis == REL_WHEEL_HI_RES || axis == REL_HWHEEL_HI_RES) continue;
+        int added = compile_invert(fields, field_count, axis, &table->ops[op_count], HID_REMAP_MAX_OPS - op_count);
+        if (added <= 0) continue;
+        op_count += added;
+        ho->inverted |= 1u << axis;
+        if (axis == REL_WHEEL) ho->inverted |= 1u << REL_WHEEL_HI_RES;
+        if (axis == REL_HWHEEL) ho->inverted |= 1u << REL_HWHEEL_HI_RES;
+    }
+
+    // Rules that fit the reports and the operation budget, then the ones whose
+    // target a userspace rule consumes are dropped again
+    struct hid_remap_op scratch[HID_REMAP_MAX_OPS];
+    int budget = HID_REMAP_MAX_OPS - op_count;
+    for (int i = 0; i < device_cfg->remap_count; i++) {
+        const remap_rule_t *remap = &device_cfg->remaps[i];
+        if (!offload_rule_candidate(device_cfg, remap)) continue;
+        int needed = compile_rule(fields, field_count, remap, scratch, budget);
+        if (needed > 0) {
+            offloaded[i] = 1;
+            budget -= needed;
+        }
+    }
+
+    key_state_t userspace;
+    offload_settle_rules(device_cfg, offloaded, &userspace);
+    for (int i = 0; i < device_cfg->remap_count; i++) {
+        if (!offloaded[i]) continue;
+        const remap_rule_t *remap = &device_cfg->remaps[i];
+        op_count += compile_rule(fields, field_count, remap, &table->ops[op_count], HID_REMAP_MAX_OPS - op_count);
+        key_state_set(&ho->sources, remap->source_code, 1);
+        ho->rule_count++;
+    }
+    table->op_count = op_count;
+
+    ho->complete = op_count > 0 && key_state_next(&userspace, 0) < 0 &&
+                   !(device_cfg->invert_rel & ~ho->inverted) && !device_needs_userspace(device_cfg);
+
+    free(offloaded);
+    free(fields);
+    return op_count;
+}
+
+// HID device behind an event node: the parent of its input device, named
+// BUS:VENDOR:PRODUCT.ID (e.g. "0003:046D:C52B.0005")
+// Returns 0 on success, -1 if the node does not belong to a HID device
+static int hid_device_name(const char *event_path, char *name, size_t name_size, int *hid_id) {
+    const char *node = strrchr(event_path, '/');
+    char sysfs_path[PATH_MAX];
+    char resolved[PATH_MAX];
+    snprintf(sysfs_path, sizeof(sysfs_path), "/sys/class/input/%s/device/device", node ? node + 1 : event_path);
+    ssize_t len = readlink(sysfs_path, resolved, sizeof(resolved) - 1);
+    if (len <= 0) return -1;
+    resolved[len] = '\0';
+
+    const char *base = strrchr(resolved, '/');
+    base = base ? base + 1 : resolved;
+    unsigned int bus, vendor, product, id;
+    char extra;
+    if (sscanf(base, "%4x:%4x:%4x.%x%c", &bus, &vendor, &product, &id, &extra) != 4) return -1;
+
+    snprintf(name, name_size, "%s", base);
+    *hid_id = (int)id;
+    return 0;
+}
+
+// Read the report descriptor of a HID device from sysfs
+// Returns its size, -1 on error
+static ssize_t read_descriptor(const char *hid_name, uint8_t *descriptor, size_t size) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "/sys/bus/hid/devices/%s/report_descriptor", hid_name);
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return -1;
+
+    ssize_t total = 0;
+    while ((size_t)total < size) {
+        ssize_t n = read(fd, descriptor + total, size - total);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        total += n;
+    }
+    close(fd);
+    return total;
+}
+
+#ifdef KEYSWAP_HID_BPF
+
+// libbpf output (verifier logs) is replaced by one warning per device
+static int libbpf_quiet(enum libbpf_print_level level, const char *format, va_list args) {
+    (void)level;
+    (void)format;
+    (void)args;
+    return 0;
+}
+
+// Load the rewrite program with table baked in and attach it to the HID device
+// Returns 0 on success, -1 on error (nothing attached)
+static int attach_program(hid_offload_t *ho, int hid_id, const struct hid_remap_table *table) {
+    libbpf_set_print(libbpf_quiet);
+
+    struct hid_remap *skel = hid_remap__open();
+    if (!skel) {
+        fprintf(stderr, "WARNING: Could not open HID-BPF program: %s\n", strerror(errno));
+        return -1;
+    }
+    skel->struct_ops.keyswap_remap->hid_id = hid_id;
+    memcpy((void *)&skel->rodata->table, table, sizeof(*table));
+
+    int err = hid_remap__load(skel);
+    if (err) {
+        fprintf(stderr, "WARNING: Could not load HID-BPF program (kernel without HID-BPF struct_ops?): %s\n",
+                strerror(-err));
+        hid_remap__destroy(skel);
+        return -1;
+    }
+
+    struct bpf_link *link = bpf_map__attach_struct_ops(skel->maps.keyswap_remap);
+    if (!link) {
+        fprintf(stderr, "WARNING: Could not attach HID-BPF program to HID device %d: %s\n", hid_id, strerror(errno));
+        hid_remap__destroy(skel);
+        return -1;
+    }
+
+    ho->program = skel;
+    ho->link = link;
+    return 0;
+}
+
+static void detach_program(hid_offload_t *ho) {
+    bpf_link__destroy(ho->link);
+    hid_remap__destroy(ho->program);
+}
+
+#else
+
+static int attach_program(hid_offload_t *ho, int hid_id, const struct hid_remap_table *table) {
+    (void)ho;
+    (void)hid_id;
+    (void)table;
+    fprintf(stderr, "WARNING: HID-BPF offload unavailable (keyswap built without HID_BPF=1)\n");
+    return -1;
+}
+
+static void detach_program(hid_offload_t *ho) {
+    (void)ho;
+}
+
+#endif // KEYSWAP_HID_BPF
+
+int hid_offload_apply(hid_offload_t *ho, const char *device_path, const device_config_t *device_cfg) {
+    if (!ho || !device_path || !device_cfg) return -1;
+    memset(ho, 0, sizeof(*ho));
+    if (device_cfg->remap_count == 0 && !device_cfg->invert_rel) return 0;
+
+    char hid_name[NAME_MAX + 1];
+    int hid_id;
+    if (hid_device_name(device_path, hid_name, sizeof(hid_name), &hid_id) != 0) return 0;
+
+    uint8_t descriptor[HID_DESCRIPTOR_MAX];
+    ssize_t size = read_descriptor(hid_name, descriptor, sizeof(descriptor));
+    if (size <= 0) return 0;
+
+    struct hid_remap_table table;
+    int op_count = hid_offload_compile(ho, &table, descriptor, (size_t)size, device_cfg);
+    if (op_count <= 0) {
+        if (op_count < 0) fprintf(stderr, "WARNING: Malformed report descriptor on HID device %s\n", hid_name);
+        memset(ho, 0, sizeof(*ho));
+        return 0;
+    }
+
+    if (attach_program(ho, hid_id, &table) != 0) {
+        memset(ho, 0, sizeof(*ho));
+        return -1;
+    }
+    ho->hid_id = hid_id;
+    return op_count;
+}
+
+void hid_offload_detach(hid_offload_t *ho) {
+    if (!ho) return;
+    if (ho->program) detach_program(ho);
+    memset(ho, 0, sizeof(*ho));
+}
@@ -0,0 +1,50 @@
+#ifndef HID_OFFLOAD_H
+#define HID_OFFLOAD_H
+
+#include "config-loader.h"
+#include "key-state.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <linux/types.h>
+#include "bpf/hid-remap.h"
+
+// Largest report descriptor read (HID_MAX_DESCRIPTOR_SIZE)
+#define HID_DESCRIPTOR_MAX 4096
+
+// Input fields of a report descriptor considered
+#define HID_MAX_FIELDS 128
+
+// Rules of a device done by a HID-BPF program rewriting the input reports of its
+// HID device (device.offload "hid-bpf"): key swaps and blocking within one report,
+// and relative axis inversion, before hid-input turns the reports into events
+typedef struct {
+    void *program;                      // Loaded program and its link, NULL = nothing attached
+    void *link;
+    int hid_id;                         // HID device the program is attached to
+    key_state_t sources;                // Rule sources rewritten in the reports: the pipeline skips their rules
+    uint32_t inverted;                  // EV_REL axes negated in the reports
+    int rule_count;                     // Rules offloaded
+    int complete;                       // Every rule and inversion offloaded and nothing else needs
+                                        // userspace: the device is neither grabbed nor read
+} hid_offload_t;
+
+// Compile the rewrite table for device_cfg against a report descriptor
+// Rules are candidates as for the keymap (key to key or to "none", the same in every
+// profile, no filter of their own) whose source and target both live in one input
+// report; inverted axes must be relative fields of at most 16 bits
+// Sets everything in ho except the program, table is fully overwritten
+// Returns number of operations in table, -1 if the descriptor is malformed
+int hid_offload_compile(hid_offload_t *ho, struct hid_remap_table *table,
+                        const uint8_t *descriptor, size_t size, const device_config_t *device_cfg);
+
+// Compile the rules of device_cfg for the HID device behind the event node
+// device_path and attach the rewrite program to it
+// Returns number of operations attached, 0 if nothing can be offloaded (not a
+// HID device, no rule fits a report), -1 if HID-BPF is unavailable or failed
+// (nothing attached; keyswap built without HID_BPF=1 always fails)
+int hid_offload_apply(hid_offload_t *ho, const char *device_path, const device_config_t *device_cfg);
+
+// Detach the program (the reports are no longer rewritten) and forget the offload
+void hid_offload_detach(hid_offload_t *ho);
+
+#endif // HID_OFFLOAD_H
@@ -18,6 +18,9 @@ static int my_strcasecmp(const char *s1, const char *s2) {
 
 // Built-in key name database
 static const key_name_entry_t key_database[] = {
+    // Blocking: a rule with this target swallows its source
+    {"none", {"disabled", "block", "key_reserved"}, 3, KEY_RESERVED, EV_KEY, "KEY_RESERVED"},
+    
     // Mouse buttons
     {"back", {"back_button", "side_button", "btn_side"}, 3, BTN_SIDE, EV_KEY, "BTN_SIDE"},
     {"forward", {"forward_button", "extra_button", "btn_extra"}, 3, BTN_EXTRA, EV_KEY, "BTN_EXTRA"},
@@ -227,4 +230,49 @@ const char* get_canonical_name(int code, int type) {
     }
     
     return NULL;
-}
\ No newline at end of file
+}
+
+// Characters of the US layout by key code: unshifted and shifted
+static const char layout_chars[KEY_CNT][2] = {
+    [KEY_1] = {'1', '!'}, [KEY_2] = {'2', '@'}, [KEY_3] = {'3', '#'}, [KEY_4] = {'4', '$'},
+    [KEY_5] = {'5', '%'}, [KEY_6] = {'6', '^'}, [KEY_7] = {'7', '&'}, [KEY_8] = {'8', '*'},
+    [KEY_9] = {'9', '('}, [KEY_0] = {'0', ')'}, [KEY_MINUS] = {'-', '_'}, [KEY_EQUAL] = {'=', '+'},
+    [KEY_Q] = {'q', 'Q'}, [KEY_W] = {'w', 'W'}, [KEY_E] = {'e', 'E'}, [KEY_R] = {'r', 'R'},
+    [KEY_T] = {'t', 'T'}, [KEY_Y] = {'y', 'Y'}, [KEY_U] = {'u', 'U'}, [KEY_I] = {'i', 'I'},
+    [KEY_O] = {'o', 'O'}, [KEY_P] = {'p', 'P'}, [KEY_LEFTBRACE] = {'[', '{'}, [KEY_RIGHTBRACE] = {']', '}'},
+    [KEY_A] = {'a', 'A'}, [KEY_S] = {'s', 'S'}, [KEY_D] = {'d', 'D'}, [KEY_F] = {'f', 'F'},
+    [KEY_G] = {'g', 'G'}, [KEY_H] = {'h', 'H'}, [KEY_J] = {'j', 'J'}, [KEY_K] = {'k', 'K'},
+    [KEY_L] = {'l', 'L'}, [KEY_SEMICOLON] = {';', ':'}, [KEY_APOSTROPHE] = {'\'', '"'}, [KEY_GRAVE] = {'`', '~'},
+    [KEY_BACKSLASH] = {'\\', '|'}, [KEY_Z] = {'z', 'Z'}, [KEY_X] = {'x', 'X'}, [KEY_C] = {'c', 'C'},
+    [KEY_V] = {'v', 'V'}, [KEY_B] = {'b', 'B'}, [KEY_N] = {'n', 'N'}, [KEY_M] = {'m', 'M'},
+    [KEY_COMMA] = {',', '<'}, [KEY_DOT] = {'.', '>'}, [KEY_SLASH] = {'/', '?'},
+    [KEY_SPACE] = {' ', ' '}, [KEY_TAB] = {'\t', '\t'},
+    [KEY_KP0] = {'0', '0'}, [KEY_KP1] = {'1', '1'}, [KEY_KP2] = {'2', '2'}, [KEY_KP3] = {'3', '3'},
+    [KEY_KP4] = {'4', '4'}, [KEY_KP5] = {'5', '5'}, [KEY_KP6] = {'6', '6'}, [KEY_KP7] = {'7', '7'},
+    [KEY_KP8] = {'8', '8'}, [KEY_KP9] = {'9', '9'}, [KEY_KPDOT] = {'.', '.'}, [KEY_KPMINUS] = {'-', '-'},
+    [KEY_KPPLUS] = {'+', '+'}, [KEY_KPASTERISK] = {'*', '*'}, [KEY_KPSLASH] = {'/', '/'},
+};
+
+char get_layout_char(int code, int shift) {
+    if (code < 0 || code >= KEY_CNT) return 0;
+    return layout_chars[code][shift ? 1 : 0];
+}
+
+int resolve_layout_char(char c, int *code, int *shift) {
+    if (!code || !shift || c == 0) return -1;
+    
+    if (c == '\n') {
+        *code = KEY_ENTER;
+        *shift = 0;
+        return 0;
+    }
+    // Main block only: keypad keys depend on NumLock
+    for (int i = 0; i < KEY_KP7; i++) {
+        if (layout_chars[i][0] == c || layout_chars[i][1] == c) {
+            *code = i;
+            *shift = layout_chars[i][0] != c;
+            return 0;
+        }
+    }
+    return -1;
+}
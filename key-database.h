@@ -25,4 +25,12 @@ int resolve_key_name(const char *name, int *code, int *type);
 // Returns canonical name string, or NULL if not found
 const char* get_canonical_name(int code, int type);
 
+// Character a key types on the US layout (shift: with Shift held)
+// Returns the character, or 0 if the key types none
+char get_layout_char(int code, int shift);
+
+// Key that types a character on the US layout
+// Returns 0 on success (*shift set if Shift must be held), -1 if no key types it
+int resolve_layout_char(char c, int *code, int *shift);
+
 #endif // KEY_DATABASE_H
\ No newline at end of file
@@ -0,0 +1,51 @@
+#ifndef KEY_STATE_H
+#define KEY_STATE_H
+
+#include <string.h>
+#include <linux/input.h>
+
+#define KEY_STATE_LONG_BITS (8 * sizeof(unsigned long))
+#define KEY_STATE_LONGS ((KEY_CNT + KEY_STATE_LONG_BITS - 1) / KEY_STATE_LONG_BITS)
+
+// Bitset of EV_KEY codes currently held down
+typedef struct {
+    unsigned long bits[KEY_STATE_LONGS];
+} key_state_t;
+
+static inline int key_state_test(const key_state_t *ks, unsigned int code) {
+    if (code >= KEY_CNT) return 0;
+    return (ks->bits[code / KEY_STATE_LONG_BITS] >> (code % KEY_STATE_LONG_BITS)) & 1ul;
+}
+
+static inline void key_state_set(key_state_t *ks, unsigned int code, int down) {
+    if (code >= KEY_CNT) return;
+    unsigned long mask = 1ul << (code % KEY_STATE_LONG_BITS);
+    if (down) {
+        ks->bits[code / KEY_STATE_LONG_BITS] |= mask;
+    } else {
+        ks->bits[code / KEY_STATE_LONG_BITS] &= ~mask;
+    }
+}
+
+static inline void key_state_clear(key_state_t *ks) {
+    memset(ks->bits, 0, sizeof(ks->bits));
+}
+
+// Next held code >= from, or -1 if none (iterates set bits only)
+static inline int key_state_next(const key_state_t *ks, int from) {
+    if (from < 0) from = 0;
+    if (from >= KEY_CNT) return -1;
+
+    size_t word = (size_t)from / KEY_STATE_LONG_BITS;
+    unsigned long bits = ks->bits[word] & (~0ul << ((size_t)from % KEY_STATE_LONG_BITS));
+    for (;;) {
+        if (bits) {
+            int code = (int)(word * KEY_STATE_LONG_BITS) + __builtin_ctzl(bits);
+            return code < KEY_CNT ? code : -1;
+        }
+        if (++word >= KEY_STATE_LONGS) return -1;
+        bits = ks->bits[word];
+    }
+}
+
+#endif // KEY_STATE_H
@@ -0,0 +1,257 @@
+#include "keymap-offload.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+
+// Rule for an EV_KEY source in a table, NULL if none
+static const remap_rule_t* find_rule(const remap_rule_t *remaps, int remap_count, int code) {
+    for (int i = 0; i < remap_count; i++) {
+        if (remaps[i].source_type == EV_KEY && remaps[i].source_code == code) return &remaps[i];
+    }
+    return NULL;
+}
+
+// Check whether any rule for an EV_KEY source in a table depends on shared modifiers
+static int conditional_source(const remap_rule_t *remaps, int remap_count, int code) {
+    for (int i = 0; i < remap_count; i++) {
+        if (remaps[i].source_type == EV_KEY && remaps[i].source_code == code &&
+            (remaps[i].when_down || remaps[i].when_up)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int offload_rule_candidate(const device_config_t *device_cfg, const remap_rule_t *remap) {
+    if (remap->source_type != EV_KEY || remap->target_type != EV_KEY) return 0;
+    if (remap->source_code >= KEY_CNT || remap->target_code >= KEY_CNT) return 0;
+    if (remap->debounce_ms >= 0 || remap->max_rate >= 0) return 0;
+    // Generated repeats and autofire come from the userspace scheduler
+    if (remap->repeat_delay_ms || remap->turbo_period_ms) return 0;
+    // Shared modifiers are tested per event, and modifier and sequence keys must
+    // reach the pipeline as themselves
+    if (conditional_source(device_cfg->remaps, device_cfg->remap_count, remap->source_code) ||
+        key_state_test(&device_cfg->modifier_sources, remap->source_code) ||
+        (device_cfg->sequences.rule_count && device_cfg->sequences.symbols[remap->source_code])) {
+        return 0;
+    }
+
+    for (int p = 1; p < device_cfg->profile_count; p++) {
+        const remap_table_t *table = &device_cfg->profiles[p];
+        const remap_rule_t *rule = find_rule(table->remaps, table->remap_count, remap->source_code);
+        if (!rule || rule->target_type != EV_KEY || rule->target_code != remap->target_code) return 0;
+        if (rule->repeat_delay_ms || rule->turbo_period_ms) return 0;
+        if (conditional_source(table->remaps, table->remap_count, remap->source_code)) return 0;
+    }
+    return 1;
+}
+
+// Read every keymap entry of fd by index
+// Returns number of entries (*entries must be freed), -1 if the device has no keymap
+static int read_keymap(int fd, struct input_keymap_entry **entries) {
+    int capacity = 256;
+    int count = 0;
+    *entries = malloc(capacity * sizeof(struct input_keymap_entry));
+    if (!*entries) return -1;
+
+    while (count < KEYMAP_MAX_ENTRIES) {
+        if (count == capacity) {
+            struct input_keymap_entry *grown = realloc(*entries, 2 * capacity * sizeof(struct input_keymap_entry));
+            if (!grown) break;
+            *entries = grown;
+            capacity *= 2;
+        }
+
+        struct input_keymap_entry *entry = &(*entries)[count];
+        memset(entry, 0, sizeof(*entry));
+        entry->flags = INPUT_KEYMAP_BY_INDEX;
+        entry->index = count;
+        if (ioctl(fd, EVIOCGKEYCODE_V2, entry) < 0) break;
+        // Written back by index as well
+        entry->flags = INPUT_KEYMAP_BY_INDEX;
+        entry->index = count;
+        count++;
+    }
+
+    if (count == 0) {
+        free(*entries);
+        *entries = NULL;
+        return -1;
+    }
+    return count;
+}
+
+// Sources of rules the pipeline still handles: every rule of every table whose
+// source is not offloaded
+static void userspace_sources(const device_config_t *device_cfg, const int *offloaded, key_state_t *sources) {
+    key_state_clear(sources);
+    for (int i = 0; i < device_cfg->remap_count; i++) {
+        if (!offloaded[i]) key_state_set(sources, device_cfg->remaps[i].source_code, 1);
+    }
+
+    key_state_t offloaded_sources;
+    key_state_clear(&offloaded_sources);
+    for (int i = 0; i < device_cfg->remap_count; i++) {
+        if (offloaded[i]) key_state_set(&offloaded_sources, device_cfg->remaps[i].source_code, 1);
+    }
+    for (int p = 1; p < device_cfg->profile_count; p++) {
+        const remap_table_t *table = &device_cfg->profiles[p];
+        for (int i = 0; i < table->remap_count; i++) {
+            if (!key_state_test(&offloaded_sources, table->remaps[i].source_code)) {
+                key_state_set(sources, table->remaps[i].source_code, 1);
+            }
+        }
+    }
+}
+
+void offload_settle_rules(const device_config_t *device_cfg, int *offloaded, key_state_t *userspace) {
+    // The pipeline sees codes after the kernel: a code a userspace rule consumes
+    // must still come from its own key only
+    for (int changed = 1; changed;) {
+        changed = 0;
+        userspace_sources(device_cfg, offloaded, userspace);
+        for (int i = 0; i < device_cfg->remap_count; i++) {
+            if (offloaded[i] && key_state_test(userspace, device_cfg->remaps[i].target_code)) {
+                offloaded[i] = 0;
+                changed = 1;
+            }
+        }
+    }
+}
+
+int keymap_offload_apply(keymap_offload_t *ko, int fd, const device_config_t *device_cfg) {
+    if (!ko || fd < 0 || !device_cfg) return -1;
+    memset(ko, 0, sizeof(*ko));
+    if (device_cfg->remap_count == 0) return 0;
+
+    struct input_keymap_entry *entries;
+    int entry_count = read_keymap(fd, &entries);
+    if (entry_count < 0) return 0;
+
+    int *offloaded = calloc(device_cfg->remap_count, sizeof(int));
+    if (!offloaded) {
+        free(entries);
+        return -1;
+    }
+
+    // Candidates: rules the keymap can express whose source has a scancode
+    key_state_t mapped;
+    key_state_clear(&mapped);
+    for (int i = 0; i < entry_count; i++) {
+        key_state_set(&mapped, entries[i].keycode, 1);
+    }
+    for (int i = 0; i < device_cfg->remap_count; i++) {
+        const remap_rule_t *remap = &device_cfg->remaps[i];
+        offloaded[i] = offload_rule_candidate(device_cfg, remap) && key_state_test(&mapped, remap->source_code);
+    }
+
+    key_state_t userspace;
+    offload_settle_rules(device_cfg, offloaded, &userspace);
+
+    ko->saved = malloc(entry_count * sizeof(struct input_keymap_entry));
+    if (!ko->saved) {
+        free(offloaded);
+        free(entries);
+        return -1;
+    }
+
+    // New keycodes come from the snapshot, not from entries already rewritten
+    for (int i = 0; i < entry_count; i++) {
+        const remap_rule_t *remap = NULL;
+        for (int r = 0; r < device_cfg->remap_count && !remap; r++) {
+            if (offloaded[r] && (unsigned int)device_cfg->remaps[r].source_code == entries[i].keycode) {
+                remap = &device_cfg->remaps[r];
+            }
+        }
+        if (!remap) continue;
+
+        struct input_keymap_entry entry = entries[i];
+        entry.keycode = remap->target_code;
+        if (ioctl(fd, EVIOCSKEYCODE_V2, &entry) < 0) {
+            int err = errno;
+            keymap_offload_restore(ko, fd);
+            free(offloaded);
+            free(entries);
+            fprintf(stderr, "WARNING: Failed to set keymap entry %u: %s\n", entries[i].index, strerror(err));
+            return -1;
+        }
+        ko->saved[ko->saved_count++] = entries[i];
+    }
+
+    for (int i = 0; i < device_cfg->remap_count; i++) {
+        if (!offloaded[i]) continue;
+        key_state_set(&ko->sources, device_cfg->remaps[i].source_code, 1);
+        ko->rule_count++;
+    }
+    ko->complete = ko->rule_count > 0 && key_state_next(&userspace, 0) < 0 && !device_cfg->invert_rel &&
+                   !device_needs_userspace(device_cfg);
+
+    free(offloaded);
+    free(entries);
+    return ko->rule_count;
+}
+
+void keymap_offload_restore(keymap_offload_t *ko, int fd) {
+    if (!ko) return;
+
+    // A device that is gone took its keymap with it
+    for (int i = 0; i < ko->saved_count && fd >= 0; i++) {
+        if (ioctl(fd, EVIOCSKEYCODE_V2, &ko->saved[i]) < 0 && errno != ENODEV) {
+            fprintf(stderr, "WARNING: Failed to restore keymap entry %u: %s\n", ko->saved[i].index, strerror(errno));
+        }
+    }
+    free(ko->saved);
+    memset(ko, 0, sizeof(*ko));
+}
+
+// Check whether two devices' sequences use the same keys
+static int same_sequence_keys(const sequence_config_t *a, const sequence_config_t *b) {
+    for (int code = 0; code < KEY_CNT; code++) {
+        int in_a = a->rule_count && a->symbols[code];
+        int in_b = b->rule_count && b->symbols[code];
+        if (in_a != in_b) return 0;
+    }
+    return 1;
+}
+
+// Check whether two rule tables remap the same codes the same way
+static int same_rules(const remap_rule_t *a, int a_count, const remap_rule_t *b, int b_count) {
+    if (a_count != b_count) return 0;
+    for (int i = 0; i < a_count; i++) {
+        if (a[i].source_type != b[i].source_type || a[i].source_code != b[i].source_code ||
+            a[i].target_type != b[i].target_type || a[i].target_code != b[i].target_code ||
+            a[i].debounce_ms != b[i].debounce_ms || a[i].max_rate != b[i].max_rate ||
+            !a[i].repeat_delay_ms != !b[i].repeat_delay_ms || !a[i].turbo_period_ms != !b[i].turbo_period_ms ||
+            a[i].when_down != b[i].when_down || a[i].when_up != b[i].when_up) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int keymap_offload_same(const device_config_t *a, const device_config_t *b) {
+    if (!a || !b || a->offload != b->offload) return 0;
+    if (!a->offload) return 1;
+
+    if (a->debounce_ms != b->debounce_ms || a->max_rate != b->max_rate || a->invert_rel != b->invert_rel ||
+        device_needs_userspace(a) != device_needs_userspace(b) || a->profile_count != b->profile_count ||
+        !same_rules(a->remaps, a->remap_count, b->remaps, b->remap_count)) {
+        return 0;
+    }
+    // Keys the pipeline must see as themselves are never offloaded: the same
+    // counts may still be different keys
+    if (memcmp(&a->modifier_sources, &b->modifier_sources, sizeof(key_state_t)) != 0 ||
+        memcmp(&a->mouse_keys.sources, &b->mouse_keys.sources, sizeof(key_state_t)) != 0 ||
+        !same_sequence_keys(&a->sequences, &b->sequences)) {
+        return 0;
+    }
+    for (int p = 1; p < a->profile_count; p++) {
+        if (!same_rules(a->profiles[p].remaps, a->profiles[p].remap_count,
+                        b->profiles[p].remaps, b->profiles[p].remap_count)) {
+            return 0;
+        }
+    }
+    return 1;
+}
@@ -0,0 +1,49 @@
+#ifndef KEYMAP_OFFLOAD_H
+#define KEYMAP_OFFLOAD_H
+
+#include "config-loader.h"
+#include "key-state.h"
+#include <linux/input.h>
+
+// Most keymap entries read from one device (HID keyboards have a few hundred)
+#define KEYMAP_MAX_ENTRIES 4096
+
+// Rules of a device programmed into the kernel scancode keymap of its source node
+// (device.offload): the kernel emits the target code itself, nothing passes
+// through userspace for them
+typedef struct {
+    struct input_keymap_entry *saved;   // Original entries overwritten, restored on close
+    int saved_count;
+    key_state_t sources;                // Rule sources the kernel now remaps: the pipeline skips their rules
+    int rule_count;                     // Rules offloaded
+    int complete;                       // Every rule offloaded and nothing else needs userspace:
+                                        // the device is neither grabbed nor read
+} keymap_offload_t;
+
+// Check whether a rule of the device's own remaps can be done by a kernel backend:
+// key to key, no filter, repeat or turbo of its own, not changed by any profile
+// Returns 1 if it can, 0 otherwise
+int offload_rule_candidate(const device_config_t *device_cfg, const remap_rule_t *remap);
+
+// Drop rules from offloaded (one flag per device_cfg->remaps entry) whose target
+// is the source of a rule left in userspace, until none is left
+// Sets *userspace to the sources the pipeline still handles (any profile)
+void offload_settle_rules(const device_config_t *device_cfg, int *offloaded, key_state_t *userspace);
+
+// Program the rules of device_cfg that the kernel keymap can express (key to key,
+// the same in every profile, no filter of their own) into the keymap of fd
+// Rules are taken from a snapshot of the keymap, so swaps (a->b, b->a) work; a rule
+// whose target is the source of a rule left in userspace stays in userspace too
+// Returns number of rules offloaded (0 e.g. if the device has no keymap),
+// -1 on error (keymap unchanged)
+int keymap_offload_apply(keymap_offload_t *ko, int fd, const device_config_t *device_cfg);
+
+// Write the saved entries back and forget the offload
+void keymap_offload_restore(keymap_offload_t *ko, int fd);
+
+// Check whether two device configs would offload the same rules (so a reload can
+// keep the device open)
+// Returns 1 if equal, 0 otherwise
+int keymap_offload_same(const device_config_t *a, const device_config_t *b);
+
+#endif // KEYMAP_OFFLOAD_H
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -5,65 +6,1210 @@
 #include <unistd.h>
 #include <errno.h>
 #include <getopt.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/syscall.h>
 #include <libevdev/libevdev.h>
 #include <libevdev/libevdev-uinput.h>
 #include "config-loader.h"
 #include "device-matcher.h"
 #include "event-processor.h"
 #include "debug-logger.h"
+#include "event-loop.h"
+#include "control-socket.h"
+#include "realtime.h"
+#include "worker.h"
+#include "listen-mode.h"
 
 // Global state for cleanup
 static int running = 1;
+static volatile sig_atomic_t g_reload_requested = 0;
+static const char **g_config_args = NULL;  // Config files / directories from the command line
+static int g_config_arg_count = 0;
+static config_set_t g_config_set;          // Files the running configuration was merged from
+static char *g_reload_file = NULL;         // Pending reload of a single file, NULL = all
+static int g_config_flags = 0;  // load_config flags (--allow-partial)
 static config_t *g_config = NULL;
 static FILE *g_debug_fp = NULL;
-static struct libevdev **g_devices = NULL;
-static struct libevdev_uinput **g_keyboards = NULL;
-static struct libevdev_uinput **g_mice = NULL;
-static int *g_device_fds = NULL;
+static device_runtime_t *g_runtimes = NULL;
 static int g_device_count = 0;
+static event_loop_t *g_loop = NULL;
+static control_socket_t *g_control = NULL;
+static int g_paused = 0;
+static int g_profile = 0;       // Active profile (g_config->profiles index), switched atomically
+// How long a new process waits for the previous one to exit after a handover
+#define HANDOVER_EXIT_WAIT_MS 2000
+
+static int g_handed_over = 0;   // Devices passed to a new process: exit without touching them
+static int g_handover_pending = 0;  // Handover response queued, exit once it went out
+static worker_t *g_workers = NULL;
+static int g_worker_count = 0;
 
 void signal_handler(int sig) {
-    (void)sig;
+    if (sig == SIGHUP) {
+        g_reload_requested = 1;
+        return;
+    }
     running = 0;
 }
 
-void cleanup(void) {
-    // Close debug log
+// Install signal_handler persistently (signal() may reset to SIG_DFL after one delivery)
+static void install_signal_handler(int sig) {
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = signal_handler;
+    sigemptyset(&sa.sa_mask);
+    sigaction(sig, &sa, NULL);
+}
+
+// Event loop owning a device: its worker's loop, or the main loop
+static event_loop_t* device_loop(const device_runtime_t *rt) {
+    return rt->worker >= 0 ? g_workers[rt->worker].loop : g_loop;
+}
+
+// Run fn on the thread owning a device and wait for it
+static void run_on_owner(device_runtime_t *rt, worker_fn fn, void *arg) {
+    if (rt->worker >= 0) {
+        worker_call(&g_workers[rt->worker], fn, arg);
+    } else {
+        fn(arg);
+    }
+}
+
+static void barrier_noop(void *arg) {
+    (void)arg;
+}
+
+// Wait until every worker has finished the event batch it is processing
+// Anything published before this call is visible to all workers afterwards
+static void workers_barrier(void) {
+    for (int i = 0; i < g_worker_count; i++) {
+        worker_call(&g_workers[i], barrier_noop, NULL);
+    }
+}
+
+// Remove a device's source and repeat timer from its owning loop
+static void unwatch_device(device_runtime_t *rt) {
+    event_loop_t *loop = device_loop(rt);
+    if (!loop) return;
+    
+    if (rt->fd >= 0) event_loop_remove(loop, rt->fd);
+    if (rt->repeat.fd >= 0) event_loop_remove(loop, rt->repeat.fd);
+}
+
+// Event loop callback: drain a readable source device
+// Runs on the owning thread; shared state is only read through published pointers
+static void on_device_readable(int fd, uint32_t events, void *userdata) {
+    (void)fd;
+    device_runtime_t *rt = userdata;
+    
+    // After a handover the new process owns the devices
+    if (__atomic_load_n(&g_handed_over, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+    
+    config_t *config = __atomic_load_n(&g_config, __ATOMIC_ACQUIRE);
+    FILE *debug_fp = __atomic_load_n(&g_debug_fp, __ATOMIC_ACQUIRE);
+    int paused = __atomic_load_n(&g_paused, __ATOMIC_RELAXED);
+    int profile = __atomic_load_n(&g_profile, __ATOMIC_RELAXED);
+    
+    if (process_device_events(rt, config, debug_fp, paused, profile) != 0 || (events & (EPOLLHUP | EPOLLERR))) {
+        fprintf(stderr, "WARNING: Lost device %s, closing it\n", rt->path);
+        unwatch_device(rt);
+        device_runtime_close(rt);
+    }
+}
+
+// Event loop callback: generated repeats of a device are due
+static void on_repeat_timer(int fd, uint32_t events, void *userdata) {
+    (void)fd;
+    (void)events;
+    device_runtime_t *rt = userdata;
+    
+    if (__atomic_load_n(&g_handed_over, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+    device_runtime_repeat(rt, __atomic_load_n(&g_profile, __ATOMIC_RELAXED));
+}
+
+// Register a device's source and repeat timer with its owning loop
+// Fully offloaded devices are left to the kernel: never read, no wakeups
+// Returns 0 on success, -1 on error (nothing registered)
+static int watch_device(device_runtime_t *rt) {
+    if (device_runtime_offloaded(rt)) return 0;
+    
+    event_loop_t *loop = device_loop(rt);
+    if (event_loop_add(loop, rt->fd, on_device_readable, rt) != 0) return -1;
+    if (rt->repeat.fd >= 0 && event_loop_add(loop, rt->repeat.fd, on_repeat_timer, rt) != 0) {
+        event_loop_remove(loop, rt->fd);
+        return -1;
+    }
+    return 0;
+}
+
+// Create the worker threads requested by config.workers (started by start_workers)
+// Returns 0 on success, -1 on error
+static int create_workers(void) {
+    if (g_config->workers <= 0) return 0;
+    
+    g_workers = calloc(g_config->workers, sizeof(worker_t));
+    if (!g_workers) {
+        fprintf(stderr, "ERROR: Failed to allocate workers\n");
+        return -1;
+    }
+    
+    for (int i = 0; i < g_config->workers; i++) {
+        realtime_config_t realtime = g_config->realtime;
+        realtime.cpu = g_config->worker_cpus[i];
+        if (worker_init(&g_workers[i], i, realtime.cpu, &realtime) != 0) {
+            for (int j = 0; j < i; j++) {
+                worker_destroy(&g_workers[j]);
+            }
+            free(g_workers);
+            g_workers = NULL;
+            return -1;
+        }
+    }
+    
+    g_worker_count = g_config->workers;
+    return 0;
+}
+
+// Start worker threads once their devices are registered
+// Returns 0 on success, -1 if any worker failed to start
+static int start_workers(void) {
+    int failed = 0;
+    for (int i = 0; i < g_worker_count; i++) {
+        if (worker_start(&g_workers[i]) != 0) {
+            failed = 1;
+        }
+    }
+    if (g_worker_count > 0 && !failed) {
+        printf("Started %d worker thread(s)\n", g_worker_count);
+    }
+    return failed ? -1 : 0;
+}
+
+static void stop_workers(void) {
+    for (int i = 0; i < g_worker_count; i++) {
+        worker_stop(&g_workers[i]);
+    }
+}
+
+static void destroy_workers(void) {
+    for (int i = 0; i < g_worker_count; i++) {
+        worker_destroy(&g_workers[i]);
+    }
+    free(g_workers);
+    g_workers = NULL;
+    g_worker_count = 0;
+}
+
+// Worker for a device: config "worker" index if set, otherwise round-robin
+// Returns -1 when everything runs on the main loop
+static int assign_worker(const device_config_t *device_cfg) {
+    if (g_worker_count == 0) return -1;
+    if (device_cfg->worker >= 0) return device_cfg->worker % g_worker_count;
+    return (int)(device_cfg - g_config->devices) % g_worker_count;
+}
+
+// Low-latency settings for the main thread
+// With workers the main thread only serves the control socket: it locks memory
+// for the whole process and leaves priority and pinning to the workers
+static int apply_main_realtime(void) {
+    if (g_worker_count == 0) {
+        return realtime_apply(&g_config->realtime);
+    }
+    // A config without workers may have raised the main thread itself
+    int failed = realtime_unpin_cpu() < 0;
+    if (realtime_clear_priority() < 0) failed = 1;
+    if (g_config->realtime.enabled && g_config->realtime.lock_memory ? realtime_lock_memory() < 0 :
+                                                                       realtime_unlock_memory() < 0) {
+        failed = 1;
+    }
+    return failed ? -1 : 0;
+}
+
+// Close all devices and free runtime state (stops worker threads first)
+static void teardown_devices(void) {
+    stop_workers();
+    
+    for (int i = 0; i < g_device_count; i++) {
+        unwatch_device(&g_runtimes[i]);
+        device_runtime_close(&g_runtimes[i]);
+    }
+    
+    free(g_runtimes);
+    g_runtimes = NULL;
+    g_device_count = 0;
+}
+
+// Allocate runtime state for every configured device
+// Returns 0 on success, -1 on allocation error
+static int alloc_runtimes(void) {
+    // sizeof(device_runtime_t) is a multiple of its alignment, as aligned_alloc requires
+    size_t size = (size_t)(g_config->device_count > 0 ? g_config->device_count : 1) * sizeof(device_runtime_t);
+    g_runtimes = aligned_alloc(DEVICE_RUNTIME_ALIGN, size);
+    if (!g_runtimes) {
+        fprintf(stderr, "ERROR: Failed to allocate device runtimes\n");
+        return -1;
+    }
+    memset(g_runtimes, 0, size);
+    g_device_count = 0;
+    return 0;
+}
+
+// Check whether a device config already has a runtime (e.g. adopted via handover)
+static int is_device_active(const device_config_t *device_cfg) {
+    for (int i = 0; i < g_device_count; i++) {
+        if (g_runtimes[i].cfg == device_cfg) return 1;
+    }
+    return 0;
+}
+
+// Find, grab and register every configured device not already active
+// /dev/input is scanned once for all devices, whatever number of config files they come from
+// Returns number of configured devices
+static int setup_devices(void) {
+    device_inventory_t inventory;
+    if (device_inventory_scan(&inventory) != 0) {
+        fprintf(stderr, "ERROR: Could not scan for devices\n");
+        return g_device_count;
+    }
+    
+    // Paths already open: one input device is never grabbed twice
+    const char **used = calloc(g_config->device_count + 1, sizeof(char *));
+    if (!used) {
+        device_inventory_free(&inventory);
+        return g_device_count;
+    }
+    for (int i = 0; i < g_device_count; i++) {
+        used[i] = g_runtimes[i].path;
+    }
+    
+    // Process each device
+    for (int i = 0; i < g_config->device_count; i++) {
+        device_config_t *device_cfg = &g_config->devices[i];
+        
+        if (is_device_active(device_cfg)) continue;
+        
+        printf("\nProcessing device: %s", device_cfg->uuid);
+        if (strlen(device_cfg->identifier) > 0) {
+            printf(" (identifier: %s)", device_cfg->identifier);
+        } else if (strlen(device_cfg->name_match) > 0) {
+            printf(" (name: %s)", device_cfg->name_match);
+        }
+        printf("\n");
+        
+        // Find matching device (prefers identifier, falls back to name_match)
+        const device_entry_t *info = device_inventory_find(&inventory, device_cfg->identifier, device_cfg->name_match,
+                                                          &device_cfg->match, used, g_device_count);
+        if (!info) {
+            const char *match_str = strlen(device_cfg->identifier) > 0 ? device_cfg->identifier :
+                                    strlen(device_cfg->name_match) > 0 ? device_cfg->name_match : "match";
+            fprintf(stderr, "WARNING: Could not find device matching '%s'\n", match_str);
+            continue;
+        }
+        const char *device_path = info->path;
+        
+        printf("Found device at: %s\n", device_path);
+        
+        device_runtime_t *rt = &g_runtimes[g_device_count];
+        if (device_runtime_open(rt, device_path, device_cfg) != 0) {
+            fprintf(stderr, "ERROR: Failed to setup device %s\n", device_path);
+            continue;
+        }
+        
+        rt->worker = device_runtime_offloaded(rt) ? -1 : assign_worker(device_cfg);
+        if (rt->worker >= 0) {
+            printf("Assigned to worker %d\n", rt->worker);
+        }
+        if (watch_device(rt) != 0) {
+            device_runtime_close(rt);
+            continue;
+        }
+        
+        used[g_device_count] = rt->path;
+        g_device_count++;
+    }
+    
+    free(used);
+    device_inventory_free(&inventory);
+    return g_device_count;
+}
+
+// Check whether new_config keeps the worker threads and their scheduling as they are
+static int same_thread_settings(const config_t *new_config) {
+    return new_config->workers == g_config->workers &&
+           memcmp(new_config->worker_cpus, g_config->worker_cpus, sizeof(new_config->worker_cpus)) == 0 &&
+           memcmp(&new_config->realtime, &g_config->realtime, sizeof(new_config->realtime)) == 0;
+}
+
+// Check whether two device configs select the same input device on the same thread
+static int same_device_match(const device_config_t *a, const device_config_t *b) {
+    return strcmp(a->uuid, b->uuid) == 0 &&
+           strcmp(a->identifier, b->identifier) == 0 &&
+           strcmp(a->name_match, b->name_match) == 0 &&
+           config_match_equal(&a->match, &b->match) &&
+           a->worker == b->worker;
+}
+
+// Check whether new_config only changes what the running devices do (remaps,
+// debug logging), so it can be swapped in without reopening anything
+static int can_swap_config(const config_t *new_config) {
+    if (new_config->device_count != g_config->device_count || g_device_count != g_config->device_count) return 0;
+    if (!same_thread_settings(new_config)) return 0;
+    
+    for (int i = 0; i < new_config->device_count; i++) {
+        if (!same_device_match(&g_config->devices[i], &new_config->devices[i])) return 0;
+    }
+    
+    for (int i = 0; i < g_device_count; i++) {
+        device_runtime_t *rt = &g_runtimes[i];
+        if (!device_runtime_config_compatible(rt, &new_config->devices[rt->cfg - g_config->devices])) return 0;
+    }
+    
+    return 1;
+}
+
+// Debug log for new_config
+// Keeps writing the same log if it is unchanged (opening truncates it), in which
+// case *old_fp is cleared so the caller does not close it
+static FILE* reopen_debug_log(const config_t *new_config, FILE **old_fp) {
+    if (*old_fp && new_config->debug && strcmp(g_config->debug_log, new_config->debug_log) == 0) {
+        FILE *fp = *old_fp;
+        *old_fp = NULL;
+        return fp;
+    }
+    return new_config->debug ? debug_log_open(new_config->debug_log) : NULL;
+}
+
+// Publish new_config to every device (RCU-style) and free the old one once
+// no thread can still be using it
+static void swap_config(config_t *new_config) {
+    config_t *old_config = g_config;
+    FILE *old_debug_fp = g_debug_fp;
+    FILE *new_debug_fp = reopen_debug_log(new_config, &old_debug_fp);
+    
+    for (int i = 0; i < g_device_count; i++) {
+        device_runtime_t *rt = &g_runtimes[i];
+        device_runtime_swap_config(rt, &new_config->devices[rt->cfg - old_config->devices]);
+    }
+    __atomic_store_n(&g_debug_fp, new_debug_fp, __ATOMIC_RELEASE);
+    __atomic_store_n(&g_config, new_config, __ATOMIC_RELEASE);
+    
+    // Grace period: a worker may still be in a batch that loaded the old pointers
+    workers_barrier();
+    
+    config_free(old_config);
+    if (old_debug_fp) {
+        fclose(old_debug_fp);
+    }
+}
+
+// Move to new_config with worker threads unchanged: devices whose config still
+// selects the same input device keep running (no reopen, no ungrab), devices that
+// were removed or changed are closed and new ones are opened
+// Returns 0 on success, -1 on error
+static int reconcile_devices(config_t *new_config) {
+    config_t *old_config = g_config;
+    device_runtime_t *old_runtimes = g_runtimes;
+    int old_count = g_device_count;
+    FILE *old_debug_fp = g_debug_fp;
+    
+    // Runtimes move to a new array: no thread may be dispatching them meanwhile
+    stop_workers();
+    
+    g_config = new_config;
+    if (alloc_runtimes() != 0) {
+        g_config = old_config;
+        g_runtimes = old_runtimes;
+        g_device_count = old_count;
+        start_workers();
+        return -1;
+    }
+    
+    int kept = 0;
+    for (int i = 0; i < old_count; i++) {
+        device_runtime_t *rt = &old_runtimes[i];
+        device_config_t *new_cfg = NULL;
+        if (rt->fd >= 0) {
+            for (int j = 0; j < new_config->device_count && !new_cfg; j++) {
+                if (same_device_match(rt->cfg, &new_config->devices[j]) &&
+                    device_runtime_config_compatible(rt, &new_config->devices[j])) {
+                    new_cfg = &new_config->devices[j];
+                }
+            }
+        }
+        
+        unwatch_device(rt);
+        if (!new_cfg) {
+            printf("Closing device: %s\n", rt->cfg->uuid);
+            device_runtime_close(rt);
+            continue;
+        }
+        
+        device_runtime_t *moved = &g_runtimes[g_device_count];
+        memcpy(moved, rt, sizeof(*moved));
+        device_runtime_swap_config(moved, new_cfg);
+        if (watch_device(moved) != 0) {
+            device_runtime_close(moved);
+            continue;
+        }
+        g_device_count++;
+        kept++;
+    }
+    free(old_runtimes);
+    
+    g_debug_fp = reopen_debug_log(new_config, &old_debug_fp);
+    if (old_debug_fp) {
+        fclose(old_debug_fp);
+    }
+    config_free(old_config);
+    
+    setup_devices();
+    start_workers();
+    
+    printf("Reloaded: %d device(s) kept running, %d opened\n", kept, g_device_count - kept);
+    return 0;
+}
+
+// Select a profile by index; devices pick it up with their next batch
+static void set_profile(int profile) {
+    if (profile == __atomic_load_n(&g_profile, __ATOMIC_RELAXED)) return;
+    
+    __atomic_store_n(&g_profile, profile, __ATOMIC_RELAXED);
+    printf("Profile: %s\n", g_config->profiles[profile].name);
+}
+
+// Active profile of the running config in new_config, by name (default if it is gone)
+static int carry_profile(const config_t *new_config) {
+    int profile = config_find_profile(new_config, g_config->profiles[g_profile].name);
+    if (profile < 0) {
+        printf("Profile '%s' no longer exists, using default\n", g_config->profiles[g_profile].name);
+        return 0;
+    }
+    return profile;
+}
+
+// Switch to new_config: swap it in place when only remaps changed, reconcile the
+// device list when threads are unchanged, otherwise rebuild all devices and workers
+// The active profile is kept by name; until it is republished an index beyond a
+// device's tables selects its default rules
+static int apply_config(config_t *new_config) {
+    int profile = carry_profile(new_config);
+    
+    if (can_swap_config(new_config)) {
+        swap_config(new_config);
+        set_profile(profile);
+        printf("Reloaded in place: %d device(s) keep running\n", g_device_count);
+        return 0;
+    }
+    
+    if (same_thread_settings(new_config)) {
+        int rc = reconcile_devices(new_config);
+        set_profile(rc == 0 ? profile : g_profile);
+        return rc;
+    }
+    
+    __atomic_store_n(&g_profile, profile, __ATOMIC_RELAXED);
+
+    teardown_devices();
+    destroy_workers();
+    config_free(g_config);
+    g_config = new_config;
+    if (alloc_runtimes() != 0) {
+        return -1;
+    }
+    
     if (g_debug_fp) {
         fclose(g_debug_fp);
         g_debug_fp = NULL;
     }
+    if (g_config->debug) {
+        g_debug_fp = debug_log_open(g_config->debug_log);
+    }
+    
+    if (create_workers() != 0) {
+        fprintf(stderr, "WARNING: Could not create workers, using the main loop\n");
+    }
+    
+    if (setup_devices() <= 0) {
+        fprintf(stderr, "WARNING: No devices configured after reload\n");
+        return -1;
+    }
+    
+    start_workers();
+    apply_main_realtime();
+    
+    printf("Reloaded: %d device(s) configured\n", g_device_count);
+    return 0;
+}
+
+// Load every config argument (files, directories of *.json) and merge them
+// Returns the merged configuration with *set filled, NULL on error
+static config_t* load_merged_config(config_set_t *set, const char *const *args, int arg_count, int flags) {
+    if (config_set_load(set, args, arg_count, flags) != 0) {
+        return NULL;
+    }
+    config_t *config = config_set_merge(set, -1, NULL, flags);
+    if (!config) {
+        config_set_free(set);
+    }
+    return config;
+}
+
+// Re-read one config file (file != NULL) or all of them, directories included,
+// and merge the result with the files that did not change
+// The running configuration is kept if the new one fails to load or merge
+static int reload_config(const char *file) {
+    config_t *new_config = NULL;
+    
+    if (file) {
+        int index = config_set_find(&g_config_set, file);
+        if (index < 0) {
+            fprintf(stderr, "ERROR: %s is not part of the running configuration\n", file);
+            return -1;
+        }
+        printf("\nReloading configuration from %s\n", g_config_set.paths[index]);
+        
+        config_t *replacement = load_config(g_config_set.paths[index], g_config_flags);
+        if (replacement) {
+            new_config = config_set_merge(&g_config_set, index, replacement, g_config_flags);
+        }
+        if (!new_config) {
+            config_free(replacement);
+            fprintf(stderr, "ERROR: Reload failed, keeping current configuration\n");
+            return -1;
+        }
+        config_free(g_config_set.files[index]);
+        g_config_set.files[index] = replacement;
+    } else {
+        printf("\nReloading configuration from %s\n", g_config_arg_count == 1 ? g_config_args[0] : "all config files");
+        
+        config_set_t new_set;
+        new_config = load_merged_config(&new_set, g_config_args, g_config_arg_count, g_config_flags);
+        if (!new_config) {
+            fprintf(stderr, "ERROR: Reload failed, keeping current configuration\n");
+            return -1;
+        }
+        config_set_free(&g_config_set);
+        g_config_set = new_set;
+    }
+    
+    return apply_config(new_config);
+}
+
+// Parse "N" / "all" / "" device selector
+// Returns device index, -1 for all devices, -2 if invalid
+static int parse_device_selector(const char *arg) {
+    if (!arg || *arg == '\0' || strcmp(arg, "all") == 0) return -1;
+    
+    char *endptr;
+    long index = strtol(arg, &endptr, 10);
+    if (*endptr != '\0' || index < 0 || index >= g_device_count) return -2;
+    return (int)index;
+}
+
+static json_t* device_to_json(int index) {
+    device_runtime_t *rt = &g_runtimes[index];
+    json_t *obj = json_object();
+    
+    json_object_set_new(obj, "index", json_integer(index));
+    json_object_set_new(obj, "uuid", json_string(rt->cfg->uuid));
+    json_object_set_new(obj, "config", json_string(rt->cfg->source));
+    json_object_set_new(obj, "path", json_string(rt->path));
+    json_object_set_new(obj, "name", json_string(rt->dev ? libevdev_get_name(rt->dev) : ""));
+    json_object_set_new(obj, "present", json_boolean(rt->dev != NULL));
+    json_object_set_new(obj, "grabbed", json_boolean(rt->grabbed));
+    json_object_set_new(obj, "released", json_boolean(rt->released));
+    json_object_set_new(obj, "remaps", json_integer(rt->cfg->remap_count));
+    json_object_set_new(obj, "offloaded", json_integer(rt->offload.rule_count + rt->hid_offload.rule_count));
+    json_object_set_new(obj, "offload", json_string(rt->hid_offload.program ? "hid-bpf" :
+                                                    rt->offload.rule_count > 0 ? "keymap" : "none"));
+    json_object_set_new(obj, "worker", json_integer(rt->worker));
+    json_object_set_new(obj, "stats", stats_to_json(&rt->stats));
+    
+    // Keys the chatter filters fired on: a worn switch shows up here
+    if (rt->filter) {
+        json_t *filtered = json_object();
+        for (int code = 0; code < KEY_CNT; code++) {
+            if (rt->filter->filtered[code] == 0) continue;
+            const char *name = get_canonical_name(code, EV_KEY);
+            char number[16];
+            if (!name) {
+                snprintf(number, sizeof(number), "%d", code);
+                name = number;
+            }
+            json_object_set_new(filtered, name, json_integer(rt->filter->filtered[code]));
+        }
+        json_object_set_new(obj, "filtered_keys", filtered);
+    }
+    
+    return obj;
+}
+
+// Device state captured on its owning thread
+typedef struct {
+    int index;
+    json_t *json;
+    device_stats_t stats;
+} device_snapshot_t;
+
+static void snapshot_device(void *arg) {
+    device_snapshot_t *snap = arg;
+    snap->json = device_to_json(snap->index);
+    snap->stats = g_runtimes[snap->index].stats;
+}
+
+// Scheduling state captured on a worker thread
+typedef struct {
+    worker_t *worker;
+    json_t *json;
+} worker_snapshot_t;
+
+static void snapshot_worker(void *arg) {
+    worker_snapshot_t *snap = arg;
+    snap->json = realtime_to_json(&snap->worker->realtime);
+}
+
+// Add per-device entries to a status response, with stats aggregated per worker
+// and over all devices
+static void add_device_status(json_t *response) {
+    json_t *devices = json_array();
+    device_stats_t totals;
+    device_stats_t *worker_totals = g_worker_count > 0 ? calloc(g_worker_count, sizeof(device_stats_t)) : NULL;
+    int *worker_devices = g_worker_count > 0 ? calloc(g_worker_count, sizeof(int)) : NULL;
+    memset(&totals, 0, sizeof(totals));
     
-    // Cleanup devices
     for (int i = 0; i < g_device_count; i++) {
-        if (g_devices && g_devices[i]) {
-            libevdev_grab(g_devices[i], LIBEVDEV_UNGRAB);
-            libevdev_free(g_devices[i]);
+        device_runtime_t *rt = &g_runtimes[i];
+        device_snapshot_t snap = { .index = i };
+        run_on_owner(rt, snapshot_device, &snap);
+        json_array_append_new(devices, snap.json);
+        
+        stats_accumulate(&totals, &snap.stats);
+        if (rt->worker >= 0 && worker_totals && worker_devices) {
+            stats_accumulate(&worker_totals[rt->worker], &snap.stats);
+            worker_devices[rt->worker]++;
         }
-        if (g_keyboards && g_keyboards[i]) {
-            libevdev_uinput_destroy(g_keyboards[i]);
+    }
+    json_object_set_new(response, "devices", devices);
+    json_object_set_new(response, "totals", stats_to_json(&totals));
+    
+    if (g_worker_count > 0) {
+        json_t *workers = json_array();
+        for (int i = 0; i < g_worker_count; i++) {
+            worker_snapshot_t snap = { .worker = &g_workers[i] };
+            worker_call(&g_workers[i], snapshot_worker, &snap);
+            
+            json_t *worker = json_object();
+            json_object_set_new(worker, "index", json_integer(i));
+            json_object_set_new(worker, "cpu", json_integer(g_workers[i].cpu));
+            json_object_set_new(worker, "devices", json_integer(worker_devices ? worker_devices[i] : 0));
+            json_object_set_new(worker, "realtime", snap.json);
+            json_object_set_new(worker, "stats", worker_totals ? stats_to_json(&worker_totals[i]) : json_object());
+            json_array_append_new(workers, worker);
         }
-        if (g_mice && g_mice[i]) {
-            libevdev_uinput_destroy(g_mice[i]);
+        json_object_set_new(response, "workers", workers);
+    }
+    
+    free(worker_totals);
+    free(worker_devices);
+}
+
+// Grab state change requested through the control socket
+typedef struct {
+    device_runtime_t *rt;
+    int grab;
+    int failed;
+} grab_request_t;
+
+static void apply_grab_request(void *arg) {
+    grab_request_t *req = arg;
+    device_runtime_t *rt = req->rt;
+    // Fully offloaded devices have no virtual devices to grab for
+    if (!rt->dev || device_runtime_offloaded(rt)) return;
+    
+    if (req->grab ? rt->grabbed : !rt->grabbed) {
+        rt->released = !req->grab;
+        device_runtime_update_mask(rt);
+        return;
+    }
+    if (!req->grab) {
+        // Physical releases will bypass us once ungrabbed
+        device_runtime_release_keys(rt);
+    }
+    if (device_runtime_set_grab(rt, req->grab) != 0) {
+        req->failed = 1;
+        return;
+    }
+    rt->released = !req->grab;
+    // Released devices are only read for their key state
+    device_runtime_update_mask(rt);
+    printf("%s %s via control socket\n", req->grab ? "Grabbed" : "Released", rt->path);
+}
+
+static json_t* make_response(int ok, const char *error) {
+    json_t *response = json_object();
+    json_object_set_new(response, "ok", json_boolean(ok));
+    if (error) {
+        json_object_set_new(response, "error", json_string(error));
+    }
+    return response;
+}
+
+static json_t* key_state_to_json(const key_state_t *ks) {
+    json_t *codes = json_array();
+    for (int code = key_state_next(ks, 0); code >= 0; code = key_state_next(ks, code + 1)) {
+        json_array_append_new(codes, json_integer(code));
+    }
+    return codes;
+}
+
+static void key_state_from_json(key_state_t *ks, json_t *codes) {
+    size_t i;
+    json_t *code;
+    key_state_clear(ks);
+    json_array_foreach(codes, i, code) {
+        if (json_is_integer(code)) {
+            key_state_set(ks, (unsigned int)json_integer_value(code), 1);
+        }
+    }
+}
+
+// "handover": pass grabbed source fds and uinput fds (with held-key state) to a
+// new keyswap process, then stop touching them and exit
+static json_t* handle_handover(void) {
+    if (!g_control) {
+        return make_response(0, "control socket unavailable");
+    }
+    
+    int fds[CONTROL_MAX_FDS];
+    int fd_count = 0;
+    json_t *devices = json_array();
+    
+    // Stop all device processing first; after the barrier no worker touches
+    // its devices again, so their state can be read from here
+    __atomic_store_n(&g_handed_over, 1, __ATOMIC_RELEASE);
+    workers_barrier();
+    
+    for (int i = 0; i < g_device_count; i++) {
+        device_runtime_t *rt = &g_runtimes[i];
+        // Devices that are not passed on keep their offload until this process releases them
+        if (!rt->dev || !rt->grabbed || rt->released || rt->keyboard.fd < 0) continue;
+        if (fd_count + 3 > CONTROL_MAX_FDS) {
+            fprintf(stderr, "WARNING: Too many devices for one handover, %s stays here\n", rt->path);
+            continue;
+        }
+        
+        // The new process starts from the original keymap and reports and offloads again itself
+        keymap_offload_restore(&rt->offload, rt->fd);
+        hid_offload_detach(&rt->hid_offload);
+        rt->handed_over = 1;
+        
+        // Don't leave a frame open across the ownership change
+        emitter_sync(&rt->keyboard);
+        emitter_sync(&rt->mouse);
+        
+        json_t *device = json_object();
+        json_object_set_new(device, "uuid", json_string(rt->cfg->uuid));
+        json_object_set_new(device, "path", json_string(rt->path));
+        json_object_set_new(device, "fd_base", json_integer(fd_count));
+        json_object_set_new(device, "has_mouse", json_boolean(rt->mouse.fd >= 0));
+        json_object_set_new(device, "source_keys", key_state_to_json(&rt->source_keys));
+        json_object_set_new(device, "keyboard_keys", key_state_to_json(&rt->keyboard.keys));
+        json_object_set_new(device, "mouse_keys", key_state_to_json(&rt->mouse.keys));
+        json_array_append_new(devices, device);
+        
+        fds[fd_count++] = rt->fd;
+        fds[fd_count++] = rt->keyboard.fd;
+        if (rt->mouse.fd >= 0) {
+            fds[fd_count++] = rt->mouse.fd;
+        }
+    }
+    
+    control_socket_attach_fds(g_control, fds, fd_count);
+    g_handover_pending = 1;
+    printf("Handing over %zu device(s) to a new process\n", json_array_size(devices));
+    
+    json_t *response = make_response(1, NULL);
+    json_object_set_new(response, "pid", json_integer(getpid()));
+    json_object_set_new(response, "devices", devices);
+    return response;
+}
+
+// The handover response never reached the new process: take the devices back,
+// offloads included, and keep running
+static void resume_after_handover(void) {
+    fprintf(stderr, "WARNING: Handover failed, keeping the devices\n");
+    for (int i = 0; i < g_device_count; i++) {
+        device_runtime_t *rt = &g_runtimes[i];
+        if (!rt->handed_over) continue;
+        rt->handed_over = 0;
+        device_runtime_apply_offload(rt);
+    }
+    // Workers see the reapplied offloads before they process events again
+    __atomic_store_n(&g_handed_over, 0, __ATOMIC_RELEASE);
+}
+
+// Wait up to timeout_ms for another process to exit
+static void wait_for_exit(pid_t pid, int timeout_ms) {
+    int pidfd = (int)syscall(SYS_pidfd_open, pid, 0);
+    if (pidfd >= 0) {
+        // Readable once the process has exited (a signal ends the wait early)
+        struct pollfd pfd = { pidfd, POLLIN, 0 };
+        poll(&pfd, 1, timeout_ms);
+        close(pidfd);
+        return;
+    }
+    if (errno == ESRCH) return;
+    
+    // No pidfd_open (kernels before 5.3): check for the pid now and then
+    for (int waited = 0; kill(pid, 0) == 0 && waited < timeout_ms; waited += 10) {
+        struct timespec delay = { 0, 10 * 1000000L };
+        nanosleep(&delay, NULL);
+    }
+}
+
+// Take over grabbed devices and virtual devices from the instance on socket_path
+// Returns number of adopted devices, -1 if the handover failed
+static int takeover_devices(const char *socket_path) {
+    int fds[CONTROL_MAX_FDS];
+    int fd_count = 0;
+    char *response = NULL;
+    
+    if (control_socket_request_fds(socket_path, "handover", &response, fds, CONTROL_MAX_FDS, &fd_count) != 0) {
+        return -1;
+    }
+    
+    json_error_t error;
+    json_t *root = json_loads(response, 0, &error);
+    free(response);
+    if (!root || !json_is_true(json_object_get(root, "ok"))) {
+        fprintf(stderr, "ERROR: Handover refused by %s\n", socket_path);
+        if (root) json_decref(root);
+        for (int i = 0; i < fd_count; i++) close(fds[i]);
+        return -1;
+    }
+    
+    int adopted = 0;
+    size_t i;
+    json_t *device;
+    json_array_foreach(json_object_get(root, "devices"), i, device) {
+        const char *uuid = json_string_value(json_object_get(device, "uuid"));
+        const char *path = json_string_value(json_object_get(device, "path"));
+        int fd_base = (int)json_integer_value(json_object_get(device, "fd_base"));
+        int has_mouse = json_is_true(json_object_get(device, "has_mouse"));
+        int needed = has_mouse ? 3 : 2;
+        
+        if (!uuid || !path || fd_base < 0 || fd_base + needed > fd_count) {
+            fprintf(stderr, "WARNING: Malformed handover entry %zu, skipping\n", i);
+            continue;
+        }
+        
+        int source_fd = fds[fd_base];
+        int keyboard_fd = fds[fd_base + 1];
+        int mouse_fd = has_mouse ? fds[fd_base + 2] : -1;
+        
+        // Adopt only devices the new configuration still knows about
+        device_config_t *device_cfg = NULL;
+        for (int j = 0; j < g_config->device_count; j++) {
+            if (strcmp(g_config->devices[j].uuid, uuid) == 0 && !is_device_active(&g_config->devices[j])) {
+                device_cfg = &g_config->devices[j];
+                break;
+            }
+        }
+        
+        device_runtime_t *rt = &g_runtimes[g_device_count];
+        if (!device_cfg) {
+            // Drain and release it properly instead of leaving keys held
+            static device_config_t unconfigured;
+            device_runtime_t orphan;
+            fprintf(stderr, "WARNING: Handed over device '%s' not in configuration, releasing it\n", uuid);
+            if (device_runtime_adopt(&orphan, path, &unconfigured, source_fd, keyboard_fd, mouse_fd) == 0) {
+                key_state_from_json(&orphan.keyboard.keys, json_object_get(device, "keyboard_keys"));
+                key_state_from_json(&orphan.mouse.keys, json_object_get(device, "mouse_keys"));
+                device_runtime_close(&orphan);
+            }
+            continue;
+        }
+        
+        if (device_runtime_adopt(rt, path, device_cfg, source_fd, keyboard_fd, mouse_fd) != 0) {
+            continue;
         }
-        if (g_device_fds && g_device_fds[i] >= 0) {
-            close(g_device_fds[i]);
+        key_state_from_json(&rt->source_keys, json_object_get(device, "source_keys"));
+        key_state_from_json(&rt->keyboard.keys, json_object_get(device, "keyboard_keys"));
+        key_state_from_json(&rt->mouse.keys, json_object_get(device, "mouse_keys"));
+        
+        rt->worker = assign_worker(device_cfg);
+        if (watch_device(rt) != 0) {
+            device_runtime_close(rt);
+            continue;
         }
+        
+        g_device_count++;
+        adopted++;
     }
     
-    if (g_devices) free(g_devices);
-    if (g_keyboards) free(g_keyboards);
-    if (g_mice) free(g_mice);
-    if (g_device_fds) free(g_device_fds);
+    pid_t pid = (pid_t)json_integer_value(json_object_get(root, "pid"));
+    printf("Took over %d device(s) from pid %d\n", adopted, (int)pid);
+    json_decref(root);
+    
+    // Devices the previous process kept are released (offloads undone) as it
+    // exits; opening them earlier would take its offloaded keymap for the original
+    if (pid > 0) {
+        wait_for_exit(pid, HANDOVER_EXIT_WAIT_MS);
+    }
+    return adopted;
+}
+
+// Control socket command handler
+static json_t* handle_control_command(const char *command, const char *arg, void *userdata) {
+    (void)userdata;
+    
+    if (strcmp(command, "ping") == 0) {
+        json_t *response = make_response(1, NULL);
+        json_object_set_new(response, "pid", json_integer(getpid()));
+        return response;
+    }
+    
+    if (strcmp(command, "status") == 0 || strcmp(command, "stats") == 0) {
+        json_t *response = make_response(1, NULL);
+        json_object_set_new(response, "pid", json_integer(getpid()));
+        json_object_set_new(response, "config", json_string(g_config->path));
+        json_t *configs = json_array();
+        for (int i = 0; i < g_config_set.count; i++) {
+            json_array_append_new(configs, json_string(g_config_set.paths[i]));
+        }
+        json_object_set_new(response, "configs", configs);
+        json_object_set_new(response, "paused", json_boolean(g_paused));
+        json_object_set_new(response, "profile", json_string(g_config->profiles[g_profile].name));
+        json_object_set_new(response, "realtime", realtime_to_json(&g_config->realtime));
+        add_device_status(response);
+        return response;
+    }
+    
+    if (strcmp(command, "reload") == 0) {
+        // Optional argument: reload only that file (path or basename)
+        if (arg && *arg != '\0' && config_set_find(&g_config_set, arg) < 0) {
+            return make_response(0, "not a loaded config file");
+        }
+        
+        // Deferred until the current dispatch batch is done (devices get rebuilt)
+        char *file = arg && *arg != '\0' ? strdup(arg) : NULL;
+        if (g_reload_requested && g_reload_file == NULL) {
+            free(file);     // A full reload is already pending
+        } else if (g_reload_requested && (!file || strcmp(file, g_reload_file) != 0)) {
+            free(file);     // Different files requested: reload everything
+            free(g_reload_file);
+            g_reload_file = NULL;
+        } else {
+            free(g_reload_file);
+            g_reload_file = file;
+        }
+        g_reload_requested = 1;
+        return make_response(1, NULL);
+    }
+    
+    if (strcmp(command, "profile") == 0 || strcmp(command, "focus") == 0) {
+        // "profile NAME" selects directly, "focus APP" through config.profiles applications
+        // (sent by a focus helper on window changes); no argument just reports
+        if (*arg != '\0') {
+            int profile = strcmp(command, "focus") == 0 ? config_profile_for_application(g_config, arg)
+                                                        : config_find_profile(g_config, arg);
+            if (profile < 0) {
+                return make_response(0, "unknown profile");
+            }
+            set_profile(profile);
+        }
+        
+        json_t *response = make_response(1, NULL);
+        json_object_set_new(response, "profile", json_string(g_config->profiles[g_profile].name));
+        json_t *profiles = json_array();
+        for (int i = 0; i < g_config->profile_count; i++) {
+            json_array_append_new(profiles, json_string(g_config->profiles[i].name));
+        }
+        json_object_set_new(response, "profiles", profiles);
+        return response;
+    }
+    
+    if (strcmp(command, "pause") == 0 || strcmp(command, "resume") == 0) {
+        __atomic_store_n(&g_paused, strcmp(command, "pause") == 0, __ATOMIC_RELAXED);
+        printf("Remapping %s via control socket\n", g_paused ? "paused" : "resumed");
+        return make_response(1, NULL);
+    }
+    
+    if (strcmp(command, "grab") == 0 || strcmp(command, "ungrab") == 0) {
+        int grab = strcmp(command, "grab") == 0;
+        int index = parse_device_selector(arg);
+        if (index == -2) {
+            return make_response(0, "invalid device index");
+        }
+        
+        int failed = 0;
+        for (int i = 0; i < g_device_count; i++) {
+            if (index >= 0 && i != index) continue;
+            grab_request_t req = { .rt = &g_runtimes[i], .grab = grab };
+            run_on_owner(req.rt, apply_grab_request, &req);
+            failed |= req.failed;
+        }
+        return make_response(!failed, failed ? "grab state change failed" : NULL);
+    }
+    
+    if (strcmp(command, "handover") == 0) {
+        return handle_handover();
+    }
+    
+    if (strcmp(command, "help") == 0) {
+        json_t *response = make_response(1, NULL);
+        json_object_set_new(response, "commands",
+                            json_string("ping status reload [FILE] profile [NAME] focus APP pause resume "
+                                        "grab [N|all] ungrab [N|all] handover"));
+        return response;
+    }
+    
+    return NULL;
+}
+
+// Resolve control socket path: --socket, then config.control_socket, then default
+static void resolve_socket_path(const char *socket_opt, const char *config_path,
+                                const config_t *config, char *path, size_t path_size) {
+    if (socket_opt && strlen(socket_opt) > 0) {
+        snprintf(path, path_size, "%s", socket_opt);
+    } else if (config && strlen(config->control_socket) > 0) {
+        snprintf(path, path_size, "%s", config->control_socket);
+    } else {
+        control_socket_default_path(config_path, path, path_size);
+    }
+}
+
+// Client mode: send a command to a running instance
+static int run_control_client(const char *socket_path, const char *command, int pretty_status) {
+    char *response = NULL;
+    if (control_socket_request(socket_path, command, &response) != 0) {
+        return 1;
+    }
+    
+    if (!pretty_status) {
+        printf("%s\n", response);
+        free(response);
+        return 0;
+    }
+    
+    json_error_t error;
+    json_t *root = json_loads(response, 0, &error);
+    free(response);
+    if (!root || !json_is_true(json_object_get(root, "ok"))) {
+        fprintf(stderr, "ERROR: Invalid status response\n");
+        if (root) json_decref(root);
+        return 1;
+    }
+    
+    json_t *devices = json_object_get(root, "devices");
+    printf("pid %d, %zu device(s), remapping %s\n",
+           (int)json_integer_value(json_object_get(root, "pid")),
+           json_array_size(devices),
+           json_is_true(json_object_get(root, "paused")) ? "paused" : "active");
+    
+    size_t i;
+    json_t *device;
+    json_array_foreach(devices, i, device) {
+        json_t *stats = json_object_get(device, "stats");
+        json_t *latency = json_object_get(stats, "latency");
+        const char *offload = json_string_value(json_object_get(device, "offload"));
+        const char *state = !json_is_true(json_object_get(device, "present")) ? "missing" :
+                            json_is_true(json_object_get(device, "grabbed")) ? "grabbed" :
+                            offload && strcmp(offload, "hid-bpf") == 0 ? "offloaded to HID-BPF" :
+                            offload && strcmp(offload, "keymap") == 0 ? "offloaded to kernel keymap" : "not grabbed";
+        
+        printf("  [%zu] %s %s (%s)\n", i,
+               json_string_value(json_object_get(device, "uuid")),
+               json_string_value(json_object_get(device, "path")), state);
+        printf("      events=%lld remapped=%lld dropped=%lld syn_dropped=%lld latency mean=%lldus max=%lldus\n",
+               (long long)json_integer_value(json_object_get(stats, "events")),
+               (long long)json_integer_value(json_object_get(stats, "remapped")),
+               (long long)json_integer_value(json_object_get(stats, "dropped")),
+               (long long)json_integer_value(json_object_get(stats, "syn_dropped")),
+               (long long)json_integer_value(json_object_get(latency, "mean_us")),
+               (long long)json_integer_value(json_object_get(latency, "max_us")));
+        
+        json_t *filtered = json_object_get(device, "filtered_keys");
+        if (json_object_size(filtered) > 0) {
+            printf("      filtered=%lld:", (long long)json_integer_value(json_object_get(stats, "filtered")));
+            const char *key;
+            json_t *count;
+            json_object_foreach(filtered, key, count) {
+                printf(" %s=%lld", key, (long long)json_integer_value(count));
+            }
+            printf("\n");
+        }
+    }
+    
+    json_t *worker;
+    json_array_foreach(json_object_get(root, "workers"), i, worker) {
+        json_t *stats = json_object_get(worker, "stats");
+        json_t *latency = json_object_get(stats, "latency");
+        printf("  worker %zu: cpu %d, %d device(s), events=%lld latency mean=%lldus max=%lldus\n", i,
+               (int)json_integer_value(json_object_get(worker, "cpu")),
+               (int)json_integer_value(json_object_get(worker, "devices")),
+               (long long)json_integer_value(json_object_get(stats, "events")),
+               (long long)json_integer_value(json_object_get(latency, "mean_us")),
+               (long long)json_integer_value(json_object_get(latency, "max_us")));
+    }
+    
+    json_decref(root);
+    return 0;
+}
+
+void cleanup(void) {
+    // Workers first: nothing may process events while devices are torn down
+    stop_workers();
+    
+    // Close debug log
+    if (g_debug_fp) {
+        fclose(g_debug_fp);
+        g_debug_fp = NULL;
+    }
+    
+    // Handed over: devices and socket path now belong to the new process,
+    // exit closes our references without ungrabbing or destroying anything;
+    // devices that were not passed on are released as usual (offloads undone)
+    if (g_handed_over) {
+        for (int i = 0; i < g_device_count; i++) {
+            if (g_runtimes[i].handed_over) continue;
+            unwatch_device(&g_runtimes[i]);
+            device_runtime_close(&g_runtimes[i]);
+        }
+        return;
+    }
+    
+    // Cleanup devices
+    teardown_devices();
+    destroy_workers();
+    
+    if (g_control) {
+        control_socket_close(g_control);
+        g_control = NULL;
+    }
+    
+    if (g_loop) {
+        event_loop_free(g_loop);
+        g_loop = NULL;
+    }
     
     if (g_config) {
         config_free(g_config);
         g_config = NULL;
     }
+    config_set_free(&g_config_set);
+    free(g_reload_file);
+    g_reload_file = NULL;
 }
 
 void print_usage(const char *program_name) {
-    printf("Usage: %s [OPTIONS] [CONFIG_FILE]\n", program_name);
+    printf("Usage: %s [OPTIONS] [CONFIG...]\n", program_name);
     printf("\n");
     printf("Options:\n");
     printf("  -l, --list          List all available input devices\n");
@@ -71,32 +1217,79 @@ void print_usage(const char *program_name) {
     printf("                      ID can be vendor:product hex (e.g., 058f:9410) or\n");
     printf("                      event path (e.g., /dev/input/event8)\n");
     printf("                      If no ID, monitor all devices from config file\n");
-    printf("  -r, --run FILE      Run key mapper with specified config file (full path)\n");
+    printf("                      Events of all devices are merged in timestamp order,\n");
+    printf("                      devices plugged in later are picked up automatically\n");
+    printf("                      Devices are read passively (never grabbed)\n");
+    printf("  -C, --coalesce[=MS] Listen: merge REL/ABS motion per device over MS\n");
+    printf("                      milliseconds (default %d)\n", LISTEN_DEFAULT_COALESCE_MS);
+    printf("  -F, --format FMT    Listen output: text (default), json (one object per line)\n");
+    printf("                      or binary (fixed-size records, see listen-mode.h)\n");
+    printf("  -E, --events LIST   Listen: only these event types or codes, comma-separated\n");
+    printf("                      (e.g. key or BTN_LEFT,REL_WHEEL); the kernel drops the\n");
+    printf("                      rest before they are read\n");
+    printf("  -r, --run FILE      Run key mapper with specified config file (full path),\n");
+    printf("                      may be repeated\n");
+    printf("  -s, --socket PATH   Control socket path (default: %s/<config>.sock,\n", CONTROL_SOCKET_DIR);
+    printf("                      \"@name\" for the abstract namespace)\n");
+    printf("  -c, --control CMD   Send a command to a running instance and print the reply\n");
+    printf("                      (ping, status, reload [FILE], profile [NAME], focus APP,\n");
+    printf("                      pause, resume, grab [N], ungrab [N])\n");
+    printf("  -S, --status        Show device health of a running instance\n");
+    printf("  -t, --takeover      Take over grabbed devices from the running instance\n");
+    printf("                      on the control socket without an input gap\n");
+    printf("  -k, --check         Validate the configuration file, report every error\n");
+    printf("                      with its JSON path and exit (0 = valid)\n");
+    printf("  -P, --allow-partial Skip invalid devices and remap rules instead of\n");
+    printf("                      refusing to start (also applies to reloads)\n");
     printf("  -h, --help          Show this help message\n");
     printf("\n");
     printf("Arguments:\n");
-    printf("  CONFIG_FILE         Path to configuration file (default: index.json)\n");
-    printf("                      Note: Use --run/-r to explicitly specify config file\n");
+    printf("  CONFIG              Configuration file, or directory whose *.json files are\n");
+    printf("                      loaded in name order (default: index.json)\n");
+    printf("                      Several configs are merged and served by one process:\n");
+    printf("                      global settings come from the first file, devices from\n");
+    printf("                      all of them; conflicting devices are an error\n");
     printf("\n");
     printf("Examples:\n");
     printf("  %s --listen              # Monitor all devices from config\n", program_name);
     printf("  %s --listen 046d:c08b    # Monitor device by vendor:product\n", program_name);
     printf("  %s --listen /dev/input/event8  # Monitor specific event path\n", program_name);
+    printf("  %s --listen --events key # Monitor key events only, no motion\n", program_name);
+    printf("  %s --status config.json  # Show stats of the instance running config.json\n", program_name);
+    printf("  %s --check config.json   # Validate config.json\n", program_name);
+    printf("  %s main.json conf.d/     # Serve main.json and every conf.d/*.json\n", program_name);
     printf("\n");
 }
 
 int main(int argc, char *argv[]) {
     const char *config_path = "index.json";
+    const char **config_args = calloc(argc + 1, sizeof(char *));
+    int config_arg_count = 0;
     int list_devices = 0;
     int listen_mode = 0;
     const char *listen_identifier = NULL;
-    int run_specified = 0;
+    const char *socket_opt = NULL;
+    const char *control_command = NULL;
+    int status_mode = 0;
+    int takeover = 0;
+    int check_mode = 0;
+    listen_options_t listen_options = { .format = LISTEN_FORMAT_TEXT, .coalesce_ms = 0, .follow_hotplug = 1 };
+    static event_mask_t listen_events;
     
     // Parse command line arguments
     static struct option long_options[] = {
         {"list", no_argument, 0, 'l'},
         {"listen", optional_argument, 0, 'L'},
         {"run", required_argument, 0, 'r'},
+        {"socket", required_argument, 0, 's'},
+        {"control", required_argument, 0, 'c'},
+        {"status", no_argument, 0, 'S'},
+        {"takeover", no_argument, 0, 't'},
+        {"coalesce", optional_argument, 0, 'C'},
+        {"format", required_argument, 0, 'F'},
+        {"events", required_argument, 0, 'E'},
+        {"check", no_argument, 0, 'k'},
+        {"allow-partial", no_argument, 0, 'P'},
         {"help", no_argument, 0, 'h'},
         {0, 0, 0, 0}
     };
@@ -104,7 +1297,12 @@ int main(int argc, char *argv[]) {
     int opt;
     int option_index = 0;
     
-    while ((opt = getopt_long(argc, argv, "lL::r:h", long_options, &option_index)) != -1) {
+    if (!config_args) {
+        return 1;
+    }
+    g_config_args = config_args;
+    
+    while ((opt = getopt_long(argc, argv, "lL::r:s:c:StC::F:E:kPh", long_options, &option_index)) != -1) {
         switch (opt) {
             case 'l':
                 list_devices = 1;
@@ -116,8 +1314,44 @@ int main(int argc, char *argv[]) {
                 }
                 break;
             case 'r':
-                config_path = optarg;
-                run_specified = 1;
+                config_args[config_arg_count++] = optarg;
+                break;
+            case 's':
+                socket_opt = optarg;
+                break;
+            case 'c':
+                control_command = optarg;
+                break;
+            case 'S':
+                status_mode = 1;
+                break;
+            case 't':
+                takeover = 1;
+                break;
+            case 'C':
+                listen_options.coalesce_ms = optarg ? atoi(optarg) : LISTEN_DEFAULT_COALESCE_MS;
+                if (listen_options.coalesce_ms <= 0) {
+                    fprintf(stderr, "ERROR: Invalid coalescing window '%s'\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'F':
+                if (listen_parse_format(optarg, &listen_options.format) != 0) {
+                    fprintf(stderr, "ERROR: Unknown output format '%s' (text, json, binary)\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'E':
+                if (listen_parse_events(optarg, &listen_events) != 0) {
+                    return 1;
+                }
+                listen_options.events = &listen_events;
+                break;
+            case 'k':
+                check_mode = 1;
+                break;
+            case 'P':
+                g_config_flags |= CONFIG_ALLOW_PARTIAL;
                 break;
             case 'h':
                 print_usage(argv[0]);
@@ -134,9 +1368,49 @@ int main(int argc, char *argv[]) {
         optind++;
     }
     
-    // Handle non-option arguments (config file path) - only if --run wasn't specified and not in listen mode
-    if (!run_specified && !listen_mode && optind < argc) {
-        config_path = argv[optind];
+    // Remaining arguments are config files or conf.d directories, merged in order
+    // (not in listen mode, where the first one is the device identifier)
+    while (!listen_mode && optind < argc) {
+        config_args[config_arg_count++] = argv[optind++];
+    }
+    if (config_arg_count == 0) {
+        config_args[config_arg_count++] = config_path;
+    }
+    config_path = config_args[0];
+    
+    // Handle --control / --status (client of a running instance, no root needed)
+    if (control_command || status_mode) {
+        config_t *client_config = NULL;
+        if (!socket_opt && access(config_path, R_OK) == 0) {
+            client_config = load_config(config_path, CONFIG_ALLOW_PARTIAL);
+        }
+        char socket_path[256];
+        resolve_socket_path(socket_opt, config_path, client_config, socket_path, sizeof(socket_path));
+        config_free(client_config);
+        return run_control_client(socket_path, status_mode ? "status" : control_command, status_mode);
+    }
+    
+    // Handle --check (validate only, no devices touched): every file, then the merge
+    if (check_mode) {
+        config_set_t set;
+        config_t *config = load_merged_config(&set, config_args, config_arg_count, g_config_flags);
+        if (!config) {
+            return 1;
+        }
+        for (int i = 0; i <= set.count; i++) {
+            const config_t *checked = i < set.count ? set.files[i] : config;
+            int remap_count = 0;
+            for (int j = 0; j < checked->device_count; j++) {
+                remap_count += checked->devices[j].remap_count;
+            }
+            if (i < set.count || set.count > 1) {
+                printf("%s: OK (%d device(s), %d remap rule(s))\n",
+                       i < set.count ? set.paths[i] : "merged", checked->device_count, remap_count);
+            }
+        }
+        config_free(config);
+        config_set_free(&set);
+        return 0;
     }
     
     // Check for root privileges (required for device access)
@@ -152,46 +1426,37 @@ int main(int argc, char *argv[]) {
     
     // Handle --listen command
     if (listen_mode) {
-        signal(SIGINT, signal_handler);
+        install_signal_handler(SIGINT);
+        install_signal_handler(SIGTERM);
         
         if (listen_identifier) {
-            // Monitor specific device by identifier or event path
-            char device_path[256];
+            // Monitor one event path, or every device matching an identifier
+            listen_filter_t filter;
+            memset(&filter, 0, sizeof(filter));
             
             // Check if identifier is actually an event path
             if (strncmp(listen_identifier, "/dev/input/event", 16) == 0) {
-                // User provided event path directly
-                strncpy(device_path, listen_identifier, sizeof(device_path) - 1);
-                device_path[sizeof(device_path) - 1] = '\0';
+                strncpy(filter.path, listen_identifier, sizeof(filter.path) - 1);
+                listen_options.follow_hotplug = 0;
             } else {
-                // Check if multiple devices match this identifier
+                strncpy(filter.label, listen_identifier, sizeof(filter.label) - 1);
+                strncpy(filter.identifier, listen_identifier, sizeof(filter.identifier) - 1);
+                
                 int match_count = count_matching_devices(listen_identifier, "");
                 if (match_count < 0) {
                     fprintf(stderr, "ERROR: Could not scan for devices\n");
                     return 1;
                 } else if (match_count == 0) {
-                    fprintf(stderr, "ERROR: Could not find device with identifier '%s'\n", listen_identifier);
+                    fprintf(stderr, "No device with identifier '%s' yet, waiting for it to be plugged in\n", listen_identifier);
                     fprintf(stderr, "Use --list to see available devices\n");
-                    return 1;
-                } else if (match_count > 1) {
-                    fprintf(stderr, "ERROR: Multiple devices match identifier '%s' (%d devices found)\n", listen_identifier, match_count);
-                    fprintf(stderr, "Use --list to see all matching devices and specify the full path\n");
-                    fprintf(stderr, "Example: --listen /dev/input/event8\n");
-                    return 1;
-                }
-                
-                // Exactly one match, proceed
-                if (find_matching_device(listen_identifier, "", device_path, sizeof(device_path)) != 0) {
-                    fprintf(stderr, "ERROR: Could not find device with identifier '%s'\n", listen_identifier);
-                    fprintf(stderr, "Use --list to see available devices\n");
-                    return 1;
                 }
             }
             
-            return listen_device(device_path, &running) == 0 ? 0 : 1;
+            return listen_devices(&filter, 1, &listen_options, &running) == 0 ? 0 : 1;
         } else {
             // Monitor all devices from config file
-            config_t *config = load_config(config_path);
+            config_set_t set;
+            config_t *config = load_merged_config(&set, config_args, config_arg_count, g_config_flags);
             if (!config) {
                 fprintf(stderr, "ERROR: Failed to load configuration from %s\n", config_path);
                 fprintf(stderr, "Use --listen <identifier> to monitor a specific device\n");
@@ -202,45 +1467,49 @@ int main(int argc, char *argv[]) {
                 fprintf(stderr, "ERROR: No devices configured in %s\n", config_path);
                 fprintf(stderr, "Use --listen <identifier> to monitor a specific device\n");
                 config_free(config);
+                config_set_free(&set);
                 return 1;
             }
             
-            // For now, monitor the first device (multi-device monitoring would require select/poll)
-            // In the future, we could enhance this to monitor all devices
-            if (config->device_count > 1) {
-                printf("Note: Multiple devices in config. Monitoring first device only.\n");
-                printf("Use --listen <identifier> to monitor a specific device.\n\n");
-            }
-            
-            device_config_t *device_cfg = &config->devices[0];
-            char device_path[256];
-            
-            const char *match_str = strlen(device_cfg->identifier) > 0 ? device_cfg->identifier : device_cfg->name_match;
-            if (find_matching_device(device_cfg->identifier, device_cfg->name_match, device_path, sizeof(device_path)) != 0) {
-                fprintf(stderr, "ERROR: Could not find device matching '%s'\n", match_str);
+            // One filter per configured device, tagged with its uuid
+            listen_filter_t *filters = calloc(config->device_count, sizeof(listen_filter_t));
+            if (!filters) {
                 config_free(config);
                 return 1;
             }
+            for (int i = 0; i < config->device_count; i++) {
+                device_config_t *device_cfg = &config->devices[i];
+                snprintf(filters[i].label, sizeof(filters[i].label), "%s", device_cfg->uuid);
+                snprintf(filters[i].identifier, sizeof(filters[i].identifier), "%s", device_cfg->identifier);
+                snprintf(filters[i].name_match, sizeof(filters[i].name_match), "%s", device_cfg->name_match);
+                filters[i].match = &device_cfg->match;
+            }
             
-            int ret = listen_device(device_path, &running);
+            int ret = listen_devices(filters, config->device_count, &listen_options, &running);
+            free(filters);
             config_free(config);
+            config_set_free(&set);
             return ret == 0 ? 0 : 1;
         }
     }
     
-    // Setup signal handlers
-    signal(SIGINT, signal_handler);
-    signal(SIGTERM, signal_handler);
+    // Setup signal handlers (SIGHUP reloads the configuration)
+    install_signal_handler(SIGINT);
+    install_signal_handler(SIGTERM);
+    install_signal_handler(SIGHUP);
+    // A scanner FIFO whose reader went away fails the write with EPIPE instead
+    signal(SIGPIPE, SIG_IGN);
     atexit(cleanup);
     
     // Load configuration
-    g_config = load_config(config_path);
+    g_config_arg_count = config_arg_count;
+    g_config = load_merged_config(&g_config_set, config_args, config_arg_count, g_config_flags);
     if (!g_config) {
         fprintf(stderr, "ERROR: Failed to load configuration from %s\n", config_path);
         return 1;
     }
     
-    printf("Loaded configuration: %d device(s)\n", g_config->device_count);
+    printf("Loaded configuration: %d device(s) from %d file(s)\n", g_config->device_count, g_config_set.count);
     
     // Open debug log if enabled
     if (g_config->debug) {
@@ -250,72 +1519,78 @@ int main(int argc, char *argv[]) {
         }
     }
     
-    // Allocate arrays for device management
-    g_devices = calloc(g_config->device_count, sizeof(struct libevdev*));
-    g_keyboards = calloc(g_config->device_count, sizeof(struct libevdev_uinput*));
-    g_mice = calloc(g_config->device_count, sizeof(struct libevdev_uinput*));
-    g_device_fds = calloc(g_config->device_count, sizeof(int));
+    g_loop = event_loop_new();
+    if (!g_loop) {
+        return 1;
+    }
     
-    if (!g_devices || !g_keyboards || !g_mice || !g_device_fds) {
-        fprintf(stderr, "ERROR: Failed to allocate device arrays\n");
+    if (alloc_runtimes() != 0) {
         return 1;
     }
     
-    // Process each device
-    for (int i = 0; i < g_config->device_count; i++) {
-        device_config_t *device_cfg = &g_config->devices[i];
-        char device_path[256];
-        
-        printf("\nProcessing device: %s", device_cfg->uuid);
-        if (strlen(device_cfg->identifier) > 0) {
-            printf(" (identifier: %s)", device_cfg->identifier);
-        } else if (strlen(device_cfg->name_match) > 0) {
-            printf(" (name: %s)", device_cfg->name_match);
-        }
-        printf("\n");
-        
-        // Find matching device (prefers identifier, falls back to name_match)
-        if (find_matching_device(device_cfg->identifier, device_cfg->name_match, device_path, sizeof(device_path)) != 0) {
-            const char *match_str = strlen(device_cfg->identifier) > 0 ? device_cfg->identifier : device_cfg->name_match;
-            fprintf(stderr, "WARNING: Could not find device matching '%s'\n", match_str);
-            continue;
-        }
-        
-        printf("Found device at: %s\n", device_path);
-        
-        // Setup device
-        if (setup_device(device_path, &g_devices[g_device_count], &g_device_fds[g_device_count]) != 0) {
-            fprintf(stderr, "ERROR: Failed to setup device %s\n", device_path);
-            continue;
-        }
-        
-        // Setup uinput devices
-        if (setup_uinput_devices(g_devices[g_device_count], &g_keyboards[g_device_count], 
-                                  &g_mice[g_device_count], device_cfg) != 0) {
-            fprintf(stderr, "ERROR: Failed to setup uinput devices for %s\n", device_path);
-            libevdev_free(g_devices[g_device_count]);
-            g_devices[g_device_count] = NULL;
-            close(g_device_fds[g_device_count]);
-            continue;
-        }
-        
-        g_device_count++;
+    // Worker threads are started once their devices are registered
+    if (create_workers() != 0) {
+        fprintf(stderr, "WARNING: Could not create workers, using the main loop\n");
     }
     
-    if (g_device_count == 0) {
+    char socket_path[256];
+    resolve_socket_path(socket_opt, config_path, g_config, socket_path, sizeof(socket_path));
+    
+    // Adopt devices from the running instance first, then open whatever is left
+    if (takeover && takeover_devices(socket_path) < 0) {
+        fprintf(stderr, "WARNING: Takeover failed, opening devices directly\n");
+    }
+    
+    if (setup_devices() <= 0) {
         fprintf(stderr, "ERROR: No devices successfully configured\n");
         return 1;
     }
     
     printf("\nSuccessfully configured %d device(s)\n", g_device_count);
+    
+    if (start_workers() != 0) {
+        fprintf(stderr, "ERROR: Failed to start worker threads\n");
+        return 1;
+    }
+    
+    // Control socket is optional - keep remapping if it can't be created
+    g_control = control_socket_open(socket_path, g_loop, handle_control_command, NULL);
+    if (g_control) {
+        printf("Control socket: %s\n", socket_path);
+    } else {
+        fprintf(stderr, "WARNING: Control socket unavailable, continuing without it\n");
+    }
+    
+    // Low-latency mode last, so everything allocated during setup gets locked
+    if (apply_main_realtime() != 0) {
+        fprintf(stderr, "WARNING: Low-latency mode only partially applied\n");
+    }
+    
     printf("Processing events (press Ctrl+C to stop)...\n\n");
     
-    // Process events for the first device (for now, single device processing)
-    // TODO: Support multiple devices with select/poll
-    if (g_device_count > 0) {
-        process_events(g_devices[0], &g_config->devices[0], g_config, 
-                      g_keyboards[0], g_mice[0], g_debug_fp, &running);
+    // Main loop serves the control socket, and all devices unless workers own them
+    while (running) {
+        if (event_loop_dispatch(g_loop, -1) < 0) {
+            break;
+        }
+        
+        if (g_handover_pending) {
+            g_handover_pending = 0;
+            if (control_socket_reply_sent(g_control)) {
+                running = 0;
+                break;
+            }
+            resume_after_handover();
+        }
+        
+        if (g_reload_requested) {
+            char *file = g_reload_file;
+            g_reload_requested = 0;
+            g_reload_file = NULL;
+            reload_config(file);
+            free(file);
+        }
     }
     
     return 0;
-}
\ No newline at end of file
+}
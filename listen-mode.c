@@ -0,0 +1,693 @@
+#include "listen-mode.h"
+#include "device-matcher.h"
+#include "device-stats.h"
+#include "debug-logger.h"
+#include "event-loop.h"
+#include "key-database.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <glob.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+#include <linux/input.h>
+#include <libevdev/libevdev.h>
+
+// Events are held this long before printing so a device whose events are
+// read slightly later can still be merged in timestamp order
+#define LISTEN_REORDER_NS (5 * 1000000ull)
+
+// Merge buffer capacity (flushed completely when full)
+#define LISTEN_BUFFER_EVENTS 4096
+
+// stdout buffer: output is written once per loop iteration, not per event
+#define LISTEN_OUTPUT_BUFFER (64 * 1024)
+
+#define LISTEN_INPUT_DIR "/dev/input"
+
+typedef struct listen_session listen_session_t;
+
+// One watched device
+typedef struct {
+    listen_session_t *session;
+    int active;
+    uint32_t id;                            // Stable id for JSON/binary output
+    char path[256];
+    char tag[96];                           // "<label>/eventN", printed with every event
+    int fd;
+    struct libevdev *dev;
+
+    // Motion accumulated while coalescing (count 0 = nothing pending for that code)
+    uint64_t motion_start_ns;
+    struct input_event motion_first;        // First coalesced event (timestamp source)
+    int rel_sum[REL_CNT];
+    uint32_t rel_count[REL_CNT];
+    int abs_last[ABS_CNT];
+    uint32_t abs_count[ABS_CNT];
+} listen_source_t;
+
+// Event waiting in the merge buffer
+typedef struct {
+    struct input_event ev;
+    uint64_t ts_ns;
+    uint32_t count;
+    int source;
+} listen_event_t;
+
+struct listen_session {
+    const listen_filter_t *filters;
+    int filter_count;
+    listen_options_t options;
+    uint64_t coalesce_ns;
+    uint64_t hold_ns;                       // Reorder window plus coalescing window
+    FILE *info;                             // Device announcements (stderr for binary output)
+    event_loop_t *loop;
+    int inotify_fd;
+    uint32_t next_id;
+    listen_source_t sources[LISTEN_MAX_SOURCES];
+    int active_count;
+    listen_event_t buffer[LISTEN_BUFFER_EVENTS];    // Sorted by ts_ns
+    int buffered;
+};
+
+int listen_parse_format(const char *name, listen_format_t *format) {
+    if (!name || !format) return -1;
+
+    if (strcmp(name, "text") == 0) {
+        *format = LISTEN_FORMAT_TEXT;
+    } else if (strcmp(name, "json") == 0) {
+        *format = LISTEN_FORMAT_JSON;
+    } else if (strcmp(name, "binary") == 0) {
+        *format = LISTEN_FORMAT_BINARY;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+// Add one entry of an event selection to mask
+// Returns 0 on success, -1 if unknown
+static int add_event_selection(event_mask_t *mask, const char *name) {
+    char upper[64];
+    size_t len = strlen(name);
+    if (len == 0 || len + 3 >= sizeof(upper)) return -1;
+    for (size_t i = 0; i <= len; i++) {
+        upper[i] = (char)toupper((unsigned char)name[i]);
+    }
+
+    // "key" is short for EV_KEY
+    int type = libevdev_event_type_from_name(upper);
+    if (type < 0) {
+        char prefixed[sizeof(upper)];
+        snprintf(prefixed, sizeof(prefixed), "EV_%s", upper);
+        type = libevdev_event_type_from_name(prefixed);
+    }
+    if (type >= 0) {
+        event_mask_add_type(mask, type);
+        return 0;
+    }
+
+    static const struct { const char *prefix; int type; } prefixes[] = {
+        { "KEY_", EV_KEY }, { "BTN_", EV_KEY }, { "REL_", EV_REL }, { "ABS_", EV_ABS },
+        { "SW_", EV_SW }, { "LED_", EV_LED }, { "MSC_", EV_MSC }, { NULL, 0 }
+    };
+    for (int i = 0; prefixes[i].prefix; i++) {
+        if (strncmp(upper, prefixes[i].prefix, strlen(prefixes[i].prefix)) != 0) continue;
+        int code = libevdev_event_code_from_name(prefixes[i].type, upper);
+        if (code < 0) break;
+        return event_mask_add_code(mask, prefixes[i].type, code);
+    }
+
+    int code, key_type;
+    if (resolve_key_name(name, &code, &key_type) != 0) return -1;
+    return event_mask_add_code(mask, key_type, code);
+}
+
+int listen_parse_events(const char *list, event_mask_t *mask) {
+    if (!list || !mask) return -1;
+
+    event_mask_clear(mask);
+
+    char buf[1024];
+    if (strlen(list) >= sizeof(buf)) {
+        fprintf(stderr, "ERROR: Event selection too long\n");
+        return -1;
+    }
+    strcpy(buf, list);
+
+    int count = 0;
+    char *saveptr = NULL;
+    for (char *token = strtok_r(buf, ", ", &saveptr); token; token = strtok_r(NULL, ", ", &saveptr)) {
+        if (add_event_selection(mask, token) != 0) {
+            fprintf(stderr, "ERROR: Unknown event type or code '%s'\n", token);
+            return -1;
+        }
+        count++;
+    }
+    if (count == 0) {
+        fprintf(stderr, "ERROR: Empty event selection\n");
+        return -1;
+    }
+    return 0;
+}
+
+static uint64_t event_ns(const struct input_event *ev) {
+    return (uint64_t)ev->input_event_sec * 1000000000ull + (uint64_t)ev->input_event_usec * 1000ull;
+}
+
+// Write s as a JSON string literal
+static void write_json_string(FILE *fp, const char *s) {
+    fputc('"', fp);
+    for (; *s; s++) {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\') {
+            fputc('\\', fp);
+            fputc(c, fp);
+        } else if (c < 0x20) {
+            fprintf(fp, "\\u%04x", c);
+        } else {
+            fputc(c, fp);
+        }
+    }
+    fputc('"', fp);
+}
+
+static void write_text(const listen_source_t *src, const listen_event_t *le) {
+    const struct input_event *ev = &le->ev;
+
+    printf("%lld.%06ld [%s] ", (long long)ev->input_event_sec, (long)ev->input_event_usec, src->tag);
+
+    if (ev->type == EV_SYN && ev->code == SYN_DROPPED) {
+        printf("SYN_DROPPED (kernel buffer overrun, events lost)\n");
+        return;
+    }
+
+    // Get canonical name for code if available
+    const char *canonical_name = NULL;
+    if (ev->type == EV_KEY) {
+        canonical_name = get_canonical_name(ev->code, ev->type);
+    }
+
+    printf("[%s] ", get_event_type_name(ev->type));
+    if (canonical_name) {
+        printf("code=%s(%d)", canonical_name, ev->code);
+    } else {
+        printf("code=%d", ev->code);
+    }
+    printf(" value=%d", ev->value);
+
+    // Add helpful state description for key events
+    if (ev->type == EV_KEY) {
+        if (ev->value == 1) {
+            printf(" [PRESSED]");
+        } else if (ev->value == 0) {
+            printf(" [RELEASED]");
+        } else if (ev->value == 2) {
+            printf(" [REPEAT]");
+        }
+    }
+    if (le->count > 1) {
+        printf(" (%u events)", le->count);
+    }
+
+    printf("\n");
+}
+
+static void write_json(const listen_source_t *src, const listen_event_t *le) {
+    const struct input_event *ev = &le->ev;
+    const char *canonical_name = ev->type == EV_KEY ? get_canonical_name(ev->code, ev->type) : NULL;
+
+    printf("{\"time\":%lld.%06ld,\"device\":", (long long)ev->input_event_sec, (long)ev->input_event_usec);
+    write_json_string(stdout, src->tag);
+    printf(",\"id\":%u,\"type\":\"%s\",\"code\":%d", src->id, get_event_type_name(ev->type), ev->code);
+    if (canonical_name) {
+        printf(",\"name\":\"%s\"", canonical_name);
+    } else if (ev->type == EV_SYN && ev->code == SYN_DROPPED) {
+        printf(",\"name\":\"SYN_DROPPED\"");
+    }
+    printf(",\"value\":%d,\"count\":%u}\n", ev->value, le->count);
+}
+
+static void write_binary(const listen_source_t *src, const listen_event_t *le) {
+    listen_record_t record;
+    memset(&record, 0, sizeof(record));
+    record.time_ns = le->ts_ns;
+    record.device = src->id;
+    record.type = le->ev.type;
+    record.code = le->ev.code;
+    record.value = le->ev.value;
+    record.count = le->count;
+    fwrite(&record, sizeof(record), 1, stdout);
+}
+
+static void write_event(const listen_session_t *session, const listen_event_t *le) {
+    const listen_source_t *src = &session->sources[le->source];
+
+    switch (session->options.format) {
+        case LISTEN_FORMAT_JSON: write_json(src, le); break;
+        case LISTEN_FORMAT_BINARY: write_binary(src, le); break;
+        default: write_text(src, le); break;
+    }
+}
+
+// Write buffered events up to cutoff_ns (everything if cutoff_ns is UINT64_MAX)
+// Events timestamped in the future (non-monotonic clock) are written right away
+static void flush_buffer(listen_session_t *session, uint64_t cutoff_ns, uint64_t now_ns) {
+    int written = 0;
+    while (written < session->buffered) {
+        const listen_event_t *le = &session->buffer[written];
+        if (le->ts_ns > cutoff_ns && le->ts_ns <= now_ns) break;
+        write_event(session, le);
+        written++;
+    }
+
+    if (written == 0) return;
+
+    session->buffered -= written;
+    memmove(session->buffer, session->buffer + written, session->buffered * sizeof(listen_event_t));
+}
+
+// Insert an event keeping the buffer sorted by timestamp
+// Each device delivers in order, so this usually only compares with the tail
+static void buffer_event(listen_session_t *session, int source, const struct input_event *ev, uint32_t count) {
+    if (session->buffered == LISTEN_BUFFER_EVENTS) {
+        flush_buffer(session, UINT64_MAX, UINT64_MAX);
+    }
+
+    uint64_t ts_ns = event_ns(ev);
+    int pos = session->buffered;
+    while (pos > 0 && session->buffer[pos - 1].ts_ns > ts_ns) {
+        session->buffer[pos] = session->buffer[pos - 1];
+        pos--;
+    }
+
+    session->buffer[pos].ev = *ev;
+    session->buffer[pos].ts_ns = ts_ns;
+    session->buffer[pos].count = count;
+    session->buffer[pos].source = source;
+    session->buffered++;
+}
+
+// Multitouch axes are per-slot state and are never coalesced
+static int is_coalesced(const listen_session_t *session, const struct input_event *ev) {
+    if (session->coalesce_ns == 0) return 0;
+    if (ev->type == EV_REL) return ev->code < REL_CNT;
+    if (ev->type == EV_ABS) return ev->code < ABS_MT_SLOT;
+    return 0;
+}
+
+// Move accumulated motion into the merge buffer, stamped with its first event's time
+static void flush_motion(listen_session_t *session, listen_source_t *src) {
+    if (src->motion_start_ns == 0) return;
+
+    int index = (int)(src - session->sources);
+    struct input_event ev = src->motion_first;
+
+    for (int code = 0; code < REL_CNT; code++) {
+        if (src->rel_count[code] == 0) continue;
+        ev.type = EV_REL;
+        ev.code = code;
+        ev.value = src->rel_sum[code];
+        buffer_event(session, index, &ev, src->rel_count[code]);
+        src->rel_sum[code] = 0;
+        src->rel_count[code] = 0;
+    }
+    for (int code = 0; code < ABS_CNT; code++) {
+        if (src->abs_count[code] == 0) continue;
+        ev.type = EV_ABS;
+        ev.code = code;
+        ev.value = src->abs_last[code];
+        buffer_event(session, index, &ev, src->abs_count[code]);
+        src->abs_count[code] = 0;
+    }
+
+    src->motion_start_ns = 0;
+}
+
+static void coalesce_event(listen_source_t *src, const struct input_event *ev) {
+    if (src->motion_start_ns == 0) {
+        src->motion_start_ns = stats_now_ns();
+        src->motion_first = *ev;
+    }
+
+    if (ev->type == EV_REL) {
+        src->rel_sum[ev->code] += ev->value;
+        src->rel_count[ev->code]++;
+    } else {
+        src->abs_last[ev->code] = ev->value;
+        src->abs_count[ev->code]++;
+    }
+}
+
+static void handle_event(listen_session_t *session, listen_source_t *src, const struct input_event *ev) {
+    // Frames only matter to the kernel consumers; SYN_DROPPED is reported
+    if (ev->type == EV_SYN && ev->code != SYN_DROPPED) return;
+
+    // Kernels without EVIOCSMASK, and libevdev's resync deltas, still deliver the rest
+    if (!event_mask_test(session->options.events, ev->type, ev->code)) return;
+
+    if (is_coalesced(session, ev)) {
+        coalesce_event(src, ev);
+        return;
+    }
+
+    // Keep the device's own order: pending motion goes out before this event
+    flush_motion(session, src);
+    buffer_event(session, (int)(src - session->sources), ev, 1);
+}
+
+static void close_source(listen_session_t *session, listen_source_t *src, const char *reason) {
+    if (!src->active) return;
+
+    // Write what is left of this device before its slot can be reused
+    flush_motion(session, src);
+    flush_buffer(session, UINT64_MAX, UINT64_MAX);
+    if (session->options.format == LISTEN_FORMAT_JSON) {
+        printf("{\"device\":");
+        write_json_string(stdout, src->tag);
+        printf(",\"id\":%u,\"%s\":", src->id, reason);
+        write_json_string(stdout, src->path);
+        printf("}\n");
+    } else {
+        fprintf(session->info, "- [%s] #%u %s %s\n", src->tag, src->id, src->path, reason);
+    }
+    fflush(stdout);
+
+    event_loop_remove(session->loop, src->fd);
+    libevdev_free(src->dev);
+    src->dev = NULL;
+    close(src->fd);
+    src->fd = -1;
+    src->active = 0;
+    session->active_count--;
+}
+
+// Event loop callback: drain a device into the merge buffer
+static void on_source_readable(int fd, uint32_t events, void *userdata) {
+    (void)fd;
+    listen_source_t *src = userdata;
+    listen_session_t *session = src->session;
+    struct input_event ev;
+
+    for (;;) {
+        int rc = libevdev_next_event(src->dev, LIBEVDEV_READ_FLAG_NORMAL, &ev);
+
+        if (rc == LIBEVDEV_READ_STATUS_SUCCESS) {
+            handle_event(session, src, &ev);
+        } else if (rc == LIBEVDEV_READ_STATUS_SYNC) {
+            // Report the overrun, then show the resync delta
+            handle_event(session, src, &ev);
+            while (libevdev_next_event(src->dev, LIBEVDEV_READ_FLAG_SYNC, &ev) == LIBEVDEV_READ_STATUS_SYNC) {
+                handle_event(session, src, &ev);
+            }
+        } else if (rc == -EAGAIN) {
+            break;
+        } else {
+            close_source(session, src, "removed");
+            return;
+        }
+    }
+
+    if (events & (EPOLLHUP | EPOLLERR)) {
+        close_source(session, src, "removed");
+    }
+}
+
+static int is_path_active(const listen_session_t *session, const char *path) {
+    for (int i = 0; i < LISTEN_MAX_SOURCES; i++) {
+        if (session->sources[i].active && strcmp(session->sources[i].path, path) == 0) return 1;
+    }
+    return 0;
+}
+
+// First filter selecting this device, or -1
+static int match_filter(const listen_session_t *session, const char *path, struct libevdev *dev) {
+    for (int i = 0; i < session->filter_count; i++) {
+        const listen_filter_t *filter = &session->filters[i];
+        if (strlen(filter->path) > 0) {
+            if (strcmp(filter->path, path) == 0) return i;
+        } else if (filter->match && filter->match->set) {
+            device_entry_t entry;
+            device_entry_fill(&entry, path, dev);
+            if (device_entry_matches(&entry, filter->identifier, filter->name_match, filter->match)) return i;
+        } else if (device_matches(dev, filter->identifier, filter->name_match)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void announce_source(listen_session_t *session, const listen_source_t *src) {
+    int vendor_id = libevdev_get_id_vendor(src->dev);
+    int product_id = libevdev_get_id_product(src->dev);
+    const char *name = libevdev_get_name(src->dev);
+
+    if (session->options.format == LISTEN_FORMAT_JSON) {
+        printf("{\"device\":");
+        write_json_string(stdout, src->tag);
+        printf(",\"id\":%u,\"added\":", src->id);
+        write_json_string(stdout, src->path);
+        printf(",\"name\":");
+        write_json_string(stdout, name ? name : "");
+        if (vendor_id > 0 && product_id > 0) {
+            printf(",\"identifier\":\"%04x:%04x\"", vendor_id, product_id);
+        }
+        printf("}\n");
+    } else {
+        fprintf(session->info, "+ [%s] #%u %s: %s", src->tag, src->id, src->path, name ? name : "unknown");
+        if (vendor_id > 0 && product_id > 0) {
+            fprintf(session->info, " (%04x:%04x)", vendor_id, product_id);
+        }
+        fprintf(session->info, "\n");
+    }
+    fflush(stdout);
+}
+
+// Open path (read-only, never grabbed) and watch it if a filter selects it
+// quiet: don't report devices that can't be opened (hotplug races with udev permissions)
+// Returns 0 if the device is now watched, -1 otherwise
+static int open_source(listen_session_t *session, const char *path, int quiet) {
+    if (is_path_active(session, path)) return 0;
+
+    int fd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0) {
+        if (!quiet) {
+            fprintf(stderr, "ERROR: Failed to open device %s: %s\n", path, strerror(errno));
+        }
+        return -1;
+    }
+
+    struct libevdev *dev = NULL;
+    if (libevdev_new_from_fd(fd, &dev) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    int filter = match_filter(session, path, dev);
+    listen_source_t *src = NULL;
+    for (int i = 0; i < LISTEN_MAX_SOURCES && filter >= 0; i++) {
+        if (!session->sources[i].active) {
+            src = &session->sources[i];
+            break;
+        }
+    }
+    if (!src) {
+        if (filter >= 0) {
+            fprintf(stderr, "WARNING: Watching too many devices, ignoring %s\n", path);
+        }
+        libevdev_free(dev);
+        close(fd);
+        return -1;
+    }
+
+    // Monotonic timestamps from every device so they can be merged
+    if (libevdev_set_clock_id(dev, CLOCK_MONOTONIC) < 0) {
+        fprintf(stderr, "WARNING: Could not switch %s to CLOCK_MONOTONIC, ordering may be off\n", path);
+    }
+
+    // Unselected events never reach us: no wakeups for motion nobody watches
+    if (session->options.events && event_mask_apply(fd, session->options.events) != 0) {
+        fprintf(stderr, "WARNING: Could not install event mask on %s (%s), filtering in userspace\n",
+                path, strerror(errno));
+    }
+
+    memset(src, 0, sizeof(*src));
+    src->session = session;
+    src->id = session->next_id++;
+    src->fd = fd;
+    src->dev = dev;
+    strncpy(src->path, path, sizeof(src->path) - 1);
+    const char *node = strrchr(path, '/');
+    const char *label = session->filters[filter].label;
+    if (strlen(label) > 0) {
+        snprintf(src->tag, sizeof(src->tag), "%s/%s", label, node ? node + 1 : path);
+    } else {
+        snprintf(src->tag, sizeof(src->tag), "%s", node ? node + 1 : path);
+    }
+
+    if (event_loop_add(session->loop, fd, on_source_readable, src) != 0) {
+        libevdev_free(dev);
+        close(fd);
+        return -1;
+    }
+    src->active = 1;
+    session->active_count++;
+
+    announce_source(session, src);
+    return 0;
+}
+
+// Open every existing device selected by a filter
+static void scan_devices(listen_session_t *session) {
+    for (int i = 0; i < session->filter_count; i++) {
+        if (strlen(session->filters[i].path) > 0) {
+            open_source(session, session->filters[i].path, 0);
+        }
+    }
+
+    glob_t glob_result;
+    memset(&glob_result, 0, sizeof(glob_result));
+    if (glob(LISTEN_INPUT_DIR "/event*", 0, NULL, &glob_result) != 0) {
+        return;
+    }
+    for (size_t i = 0; i < glob_result.gl_pathc; i++) {
+        open_source(session, glob_result.gl_pathv[i], 1);
+    }
+    globfree(&glob_result);
+}
+
+// inotify callback: pick up new event nodes
+// IN_ATTRIB covers nodes that only become readable once udev has set permissions
+static void on_hotplug(int fd, uint32_t events, void *userdata) {
+    (void)events;
+    listen_session_t *session = userdata;
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+    for (;;) {
+        ssize_t len = read(fd, buf, sizeof(buf));
+        if (len <= 0) return;
+
+        for (char *ptr = buf; ptr < buf + len; ) {
+            struct inotify_event *ie = (struct inotify_event *)ptr;
+            ptr += sizeof(struct inotify_event) + ie->len;
+
+            if (ie->len == 0 || strncmp(ie->name, "event", 5) != 0) continue;
+
+            char path[256];
+            snprintf(path, sizeof(path), "%s/%s", LISTEN_INPUT_DIR, ie->name);
+            open_source(session, path, 1);
+        }
+    }
+}
+
+// Flush motion whose coalescing window has ended
+// Returns 1 if any device still has motion pending
+static int expire_motion(listen_session_t *session, uint64_t now_ns) {
+    int pending = 0;
+    for (int i = 0; i < LISTEN_MAX_SOURCES; i++) {
+        listen_source_t *src = &session->sources[i];
+        if (!src->active || src->motion_start_ns == 0) continue;
+        if (now_ns - src->motion_start_ns >= session->coalesce_ns) {
+            flush_motion(session, src);
+        } else {
+            pending = 1;
+        }
+    }
+    return pending;
+}
+
+int listen_devices(const listen_filter_t *filters, int filter_count,
+                   const listen_options_t *options, int *running_ptr) {
+    if (!filters || filter_count <= 0 || !options) return -1;
+
+    listen_session_t *session = calloc(1, sizeof(listen_session_t));
+    if (!session) return -1;
+    session->filters = filters;
+    session->filter_count = filter_count;
+    session->options = *options;
+    session->coalesce_ns = options->coalesce_ms > 0 ? (uint64_t)options->coalesce_ms * 1000000ull : 0;
+    session->hold_ns = LISTEN_REORDER_NS + session->coalesce_ns;
+    session->info = options->format == LISTEN_FORMAT_BINARY ? stderr : stdout;
+    session->inotify_fd = -1;
+
+    // Fully buffered output, written once per loop iteration
+    static char output_buffer[LISTEN_OUTPUT_BUFFER];
+    setvbuf(stdout, output_buffer, _IOFBF, sizeof(output_buffer));
+
+    session->loop = event_loop_new();
+    if (!session->loop) {
+        free(session);
+        return -1;
+    }
+
+    if (options->format == LISTEN_FORMAT_TEXT) {
+        printf("\n=== Listening (passive, devices are not grabbed) ===\n");
+    }
+
+    // Watch for new nodes before scanning so none slips through in between
+    if (options->follow_hotplug) {
+        session->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (session->inotify_fd < 0 ||
+            inotify_add_watch(session->inotify_fd, LISTEN_INPUT_DIR, IN_CREATE | IN_ATTRIB) < 0 ||
+            event_loop_add(session->loop, session->inotify_fd, on_hotplug, session) != 0) {
+            fprintf(stderr, "WARNING: Hotplug following unavailable: %s\n", strerror(errno));
+            if (session->inotify_fd >= 0) close(session->inotify_fd);
+            session->inotify_fd = -1;
+        }
+    }
+
+    scan_devices(session);
+
+    if (session->active_count == 0 && session->inotify_fd < 0) {
+        fprintf(stderr, "ERROR: No matching device could be opened\n");
+        event_loop_free(session->loop);
+        free(session);
+        return -1;
+    }
+
+    if (options->format == LISTEN_FORMAT_TEXT) {
+        printf("\nPress buttons/keys on the devices to see events%s...\n",
+               session->inotify_fd >= 0 ? " (new matching devices are added automatically)" : "");
+        printf("Press Ctrl+C to stop\n\n");
+    }
+    fflush(stdout);
+
+    int motion_pending = 0;
+    while (running_ptr == NULL || *running_ptr) {
+        // Wake up to write held events once their window has passed
+        int timeout_ms = session->buffered || motion_pending ? (int)(session->hold_ns / 1000000) + 1 : -1;
+        if (event_loop_dispatch(session->loop, timeout_ms) < 0) {
+            break;
+        }
+
+        uint64_t now_ns = stats_now_ns();
+        motion_pending = expire_motion(session, now_ns);
+        flush_buffer(session, now_ns - session->hold_ns, now_ns);
+        fflush(stdout);
+
+        if (session->active_count == 0 && session->inotify_fd < 0) {
+            fprintf(session->info, "All devices removed\n");
+            break;
+        }
+    }
+
+    for (int i = 0; i < LISTEN_MAX_SOURCES; i++) {
+        close_source(session, &session->sources[i], "closed");
+    }
+    flush_buffer(session, UINT64_MAX, UINT64_MAX);
+    fflush(stdout);
+
+    if (session->inotify_fd >= 0) {
+        event_loop_remove(session->loop, session->inotify_fd);
+        close(session->inotify_fd);
+    }
+    event_loop_free(session->loop);
+    free(session);
+
+    return 0;
+}
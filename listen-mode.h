@@ -0,0 +1,64 @@
+#ifndef LISTEN_MODE_H
+#define LISTEN_MODE_H
+
+#include <stdint.h>
+#include "config-loader.h"
+#include "event-mask.h"
+
+// Maximum devices watched at once
+#define LISTEN_MAX_SOURCES 64
+
+// Coalescing window used when --coalesce is given without a value
+#define LISTEN_DEFAULT_COALESCE_MS 16
+
+// Which devices to watch: an exact event path, or identifier/name pattern
+typedef struct {
+    char label[64];             // Tag prefix (config uuid or command line identifier)
+    char path[256];             // Exact /dev/input/event* path, empty = match by identifier/name
+    char identifier[64];        // vendor:product or unique string
+    char name_match[128];       // Device name substring
+    const device_match_t *match;    // Config match expression, NULL = none
+} listen_filter_t;
+
+// Output format of listen mode
+typedef enum {
+    LISTEN_FORMAT_TEXT,         // Human-readable lines
+    LISTEN_FORMAT_JSON,         // One JSON object per line
+    LISTEN_FORMAT_BINARY        // Stream of listen_record_t, device announcements on stderr
+} listen_format_t;
+
+typedef struct {
+    listen_format_t format;
+    int coalesce_ms;            // Sum EV_REL deltas / keep last EV_ABS value per window, 0 = off
+    int follow_hotplug;         // Also watch matching devices that appear later
+    const event_mask_t *events; // Only these events, dropped by the kernel (EVIOCSMASK); NULL = all
+} listen_options_t;
+
+// Binary output record (host byte order)
+typedef struct {
+    uint64_t time_ns;           // Kernel timestamp (CLOCK_MONOTONIC)
+    uint32_t device;            // Device id, announced when the device is added
+    uint16_t type;
+    uint16_t code;
+    int32_t value;
+    uint32_t count;             // Source events merged into this record (1 unless coalesced)
+} listen_record_t;
+
+// Parse "text" / "json" / "binary"
+// Returns 0 on success, -1 if unknown
+int listen_parse_format(const char *name, listen_format_t *format);
+
+// Parse a comma-separated event selection: event types ("key", "EV_REL"),
+// kernel code names ("REL_WHEEL", "BTN_LEFT") or key names from the key database
+// Returns 0 on success, -1 on the first unknown entry (reported on stderr)
+int listen_parse_events(const char *list, event_mask_t *mask);
+
+// Watch every device matching any filter until *running_ptr becomes 0
+// Devices are read passively (never grabbed) with options->events installed as their
+// kernel event mask; events from all devices are merged
+// by kernel timestamp and written with a device tag, buffered per batch
+// Returns 0 on success, -1 if no device could be watched
+int listen_devices(const listen_filter_t *filters, int filter_count,
+                   const listen_options_t *options, int *running_ptr);
+
+#endif // LISTEN_MODE_H
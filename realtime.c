@@ -0,0 +1,177 @@
+#define _GNU_SOURCE
+#include "realtime.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <malloc.h>
+#include <sched.h>
+#include <sys/mman.h>
+
+// Stack touched up front so the hot path never takes a page fault growing it
+#define REALTIME_STACK_PREFAULT (256 * 1024)
+
+// Process-wide; set by the event loop thread, read by workers for their status
+static int g_memory_locked = 0;
+
+// Scheduling is per thread: what this thread applied, so it can be undone
+static _Thread_local int t_pinned_cpu = -1;
+static _Thread_local cpu_set_t t_saved_affinity;
+static _Thread_local int t_prioritized = 0;
+
+static void prefault_stack(void) {
+    volatile unsigned char stack[REALTIME_STACK_PREFAULT];
+    for (size_t i = 0; i < sizeof(stack); i += 4096) {
+        stack[i] = 0;
+    }
+}
+
+static const char* policy_name(int policy) {
+    return policy == SCHED_RR ? "SCHED_RR" : "SCHED_FIFO";
+}
+
+int realtime_pin_cpu(int cpu) {
+    if (cpu < 0) return 0;
+    
+    // The affinity from before the first pin is what unpinning restores
+    if (t_pinned_cpu < 0 && sched_getaffinity(0, sizeof(t_saved_affinity), &t_saved_affinity) < 0) {
+        fprintf(stderr, "WARNING: Could not read CPU affinity: %s\n", strerror(errno));
+        return -1;
+    }
+    
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu, &cpus);
+    if (sched_setaffinity(0, sizeof(cpus), &cpus) < 0) {
+        fprintf(stderr, "WARNING: Could not pin thread to CPU %d: %s\n", cpu, strerror(errno));
+        return -1;
+    }
+    t_pinned_cpu = cpu;
+    return 0;
+}
+
+int realtime_unpin_cpu(void) {
+    if (t_pinned_cpu < 0) return 0;
+    
+    if (sched_setaffinity(0, sizeof(t_saved_affinity), &t_saved_affinity) < 0) {
+        fprintf(stderr, "WARNING: Could not unpin thread from CPU %d: %s\n", t_pinned_cpu, strerror(errno));
+        return -1;
+    }
+    printf("Thread unpinned from CPU %d\n", t_pinned_cpu);
+    t_pinned_cpu = -1;
+    return 0;
+}
+
+int realtime_set_priority(const realtime_config_t *realtime) {
+    if (!realtime || !realtime->enabled) return 0;
+    
+    struct sched_param param;
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = realtime->priority;
+    if (sched_setscheduler(0, realtime->policy, &param) < 0) {
+        fprintf(stderr, "WARNING: Could not set %s priority %d: %s\n",
+                policy_name(realtime->policy), realtime->priority, strerror(errno));
+        return -1;
+    }
+    t_prioritized = 1;
+    return 0;
+}
+
+int realtime_clear_priority(void) {
+    if (!t_prioritized) return 0;
+    
+    struct sched_param param;
+    memset(&param, 0, sizeof(param));
+    if (sched_setscheduler(0, SCHED_OTHER, &param) < 0) {
+        fprintf(stderr, "WARNING: Could not return to SCHED_OTHER: %s\n", strerror(errno));
+        return -1;
+    }
+    printf("Thread scheduled SCHED_OTHER\n");
+    t_prioritized = 0;
+    return 0;
+}
+
+int realtime_lock_memory(void) {
+    if (__atomic_load_n(&g_memory_locked, __ATOMIC_RELAXED)) return 0;
+    
+    // Keep freed heap memory mapped so later allocations (control socket,
+    // reload) reuse locked pages instead of faulting in new ones
+    mallopt(M_TRIM_THRESHOLD, -1);
+    mallopt(M_MMAP_MAX, 0);
+    
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0) {
+        fprintf(stderr, "WARNING: Could not lock memory: %s\n", strerror(errno));
+        return -1;
+    }
+    
+    prefault_stack();
+    __atomic_store_n(&g_memory_locked, 1, __ATOMIC_RELAXED);
+    printf("Memory locked\n");
+    return 0;
+}
+
+int realtime_unlock_memory(void) {
+    if (!__atomic_load_n(&g_memory_locked, __ATOMIC_RELAXED)) return 0;
+    
+    if (munlockall() < 0) {
+        fprintf(stderr, "WARNING: Could not unlock memory: %s\n", strerror(errno));
+        return -1;
+    }
+    // The malloc tuning stays: glibc has no way to read the old settings back,
+    // and writing its defaults would drop settings from MALLOC_* variables
+    __atomic_store_n(&g_memory_locked, 0, __ATOMIC_RELAXED);
+    printf("Memory unlocked\n");
+    return 0;
+}
+
+int realtime_apply(const realtime_config_t *realtime) {
+    int failed = 0;
+    
+    // Turned off by a reload: undo what an earlier config applied
+    if (!realtime || !realtime->enabled) {
+        if (realtime_unpin_cpu() < 0) failed = 1;
+        if (realtime_clear_priority() < 0) failed = 1;
+        if (realtime_unlock_memory() < 0) failed = 1;
+        return failed ? -1 : 0;
+    }
+    
+    if (realtime->cpu >= 0) {
+        if (realtime_pin_cpu(realtime->cpu) < 0) {
+            failed = 1;
+        } else {
+            printf("Event loop pinned to CPU %d\n", realtime->cpu);
+        }
+    } else if (realtime_unpin_cpu() < 0) {
+        failed = 1;
+    }
+    
+    if (realtime_set_priority(realtime) < 0) {
+        failed = 1;
+    } else {
+        printf("Event loop scheduled %s priority %d\n", policy_name(realtime->policy), realtime->priority);
+    }
+    
+    if (realtime->lock_memory ? realtime_lock_memory() < 0 : realtime_unlock_memory() < 0) {
+        failed = 1;
+    }
+    
+    return failed ? -1 : 0;
+}
+
+json_t* realtime_to_json(const realtime_config_t *realtime) {
+    json_t *obj = json_object();
+
+    int policy = sched_getscheduler(0);
+    struct sched_param param;
+    memset(&param, 0, sizeof(param));
+    sched_getparam(0, &param);
+
+    const char *policy_name = policy == SCHED_FIFO ? "fifo" : policy == SCHED_RR ? "rr" : "other";
+    json_object_set_new(obj, "enabled", json_boolean(realtime && realtime->enabled));
+    json_object_set_new(obj, "policy", json_string(policy_name));
+    json_object_set_new(obj, "priority", json_integer(param.sched_priority));
+    json_object_set_new(obj, "memory_locked", json_boolean(__atomic_load_n(&g_memory_locked, __ATOMIC_RELAXED)));
+    json_object_set_new(obj, "pinned_cpu", json_integer(t_pinned_cpu));
+    json_object_set_new(obj, "current_cpu", json_integer(sched_getcpu()));
+
+    return obj;
+}
@@ -0,0 +1,43 @@
+#ifndef REALTIME_H
+#define REALTIME_H
+
+#include <jansson.h>
+#include "config-loader.h"
+
+// Apply low-latency mode to the calling (event loop) thread:
+// CPU pinning, SCHED_FIFO/SCHED_RR priority, malloc tuning, stack prefault and mlockall
+// Call after device setup so everything allocated so far is locked in
+// A disabled config (e.g. after a reload) undoes what an earlier call applied
+// Returns 0 if every requested setting was applied, -1 if any failed (best effort)
+int realtime_apply(const realtime_config_t *realtime);
+
+// Pin the calling thread to one CPU (cpu < 0 is a no-op)
+// Returns 0 on success, -1 on error
+int realtime_pin_cpu(int cpu);
+
+// Restore the calling thread's affinity from before realtime_pin_cpu (no-op if not pinned)
+// Returns 0 on success, -1 on error
+int realtime_unpin_cpu(void);
+
+// Apply the configured SCHED_FIFO/SCHED_RR priority to the calling thread
+// Returns 0 on success or if realtime mode is disabled, -1 on error
+int realtime_set_priority(const realtime_config_t *realtime);
+
+// Return the calling thread to SCHED_OTHER if realtime_set_priority raised it
+// Returns 0 on success, -1 on error
+int realtime_clear_priority(void);
+
+// Tune malloc, mlockall() the whole process and prefault the calling thread's stack
+// Returns 0 on success (or if already locked), -1 on error
+int realtime_lock_memory(void);
+
+// munlockall() (no-op if not locked); the malloc tuning of realtime_lock_memory
+// is one-way and stays in effect
+// Returns 0 on success, -1 on error
+int realtime_unlock_memory(void);
+
+// Describe the scheduling state of the calling thread (for the control socket);
+// pinned_cpu is the CPU actually applied, -1 if none
+json_t* realtime_to_json(const realtime_config_t *realtime);
+
+#endif // REALTIME_H
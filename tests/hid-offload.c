@@ -0,0 +1,516 @@
+// HID-BPF offload test against uhid virtual devices
+// First compiles the rewrite tables for a boot keyboard and a boot mouse report
+// descriptor and checks the operations. Then creates both devices through
+// /dev/uhid, opens them the way keyswap does (device_runtime_open) with
+// offload "hid-bpf", sends raw HID reports and checks the events that come out:
+// from the source node itself when a kernel backend does everything, otherwise
+// from keyswap's virtual devices. Without HID-BPF (kernel or build) this checks
+// that the devices fall back cleanly and still behave the same.
+// Needs /dev/uhid; exit status 0 = pass, 1 = failure, 77 = skipped.
+
+#define _GNU_SOURCE
+#include "../event-processor.h"
+#include "../config-loader.h"
+#include "../hid-offload.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <linux/input.h>
+#include <linux/uhid.h>
+
+#define HID_TEST_TIMEOUT_MS 1000        // Wait for expected events
+#define HID_TEST_SETTLE_MS 20           // Keep reading for unexpected extra events
+#define HID_TEST_MAX_EXPECT 8
+#define HID_TEST_MAX_CAPTURE 64
+#define HID_TEST_EXIT_SKIP 77
+
+#define KEYBOARD_NAME "keyswap-hid-keyboard"
+#define MOUSE_NAME "keyswap-hid-mouse"
+
+// Boot keyboard: modifier bitmap, reserved byte, 6-key array (usages 0-0x73)
+static const uint8_t g_keyboard_descriptor[] = {
+    0x05, 0x01, 0x09, 0x06, 0xa1, 0x01,
+    0x05, 0x07, 0x19, 0xe0, 0x29, 0xe7, 0x15, 0x00, 0x25, 0x01, 0x75, 0x01, 0x95, 0x08, 0x81, 0x02,
+    0x95, 0x01, 0x75, 0x08, 0x81, 0x01,
+    0x95, 0x06, 0x75, 0x08, 0x15, 0x00, 0x25, 0x73, 0x05, 0x07, 0x19, 0x00, 0x29, 0x73, 0x81, 0x00,
+    0xc0
+};
+
+// Boot mouse: 5 buttons, padding, relative X/Y
+static const uint8_t g_mouse_descriptor[] = {
+    0x05, 0x01, 0x09, 0x02, 0xa1, 0x01, 0x09, 0x01, 0xa1, 0x00,
+    0x05, 0x09, 0x19, 0x01, 0x29, 0x05, 0x15, 0x00, 0x25, 0x01, 0x95, 0x05, 0x75, 0x01, 0x81, 0x02,
+    0x95, 0x01, 0x75, 0x03, 0x81, 0x01,
+    0x05, 0x01, 0x09, 0x30, 0x09, 0x31, 0x15, 0x81, 0x25, 0x7f, 0x75, 0x08, 0x95, 0x02, 0x81, 0x06,
+    0xc0, 0xc0
+};
+
+// Keyboard usages of F13-F17 and the right meta bit of the modifier byte
+#define USAGE_F13 0x68
+#define USAGE_F14 0x69
+#define USAGE_F15 0x6a
+#define USAGE_F16 0x6b
+#define MOD_RIGHTMETA 0x80
+
+// Expected event; type -1 terminates a list
+typedef struct {
+    int type;
+    int code;
+    int value;
+} expect_t;
+
+#define E_KEY(code, value) { EV_KEY, code, value }
+#define E_REL(code, value) { EV_REL, code, value }
+#define E_END { -1, 0, 0 }
+
+// One raw report and the events it must produce (any order, SYN_REPORT not listed)
+typedef struct {
+    const char *name;
+    int mouse;                                  // Sent on the mouse, otherwise the keyboard
+    uint8_t report[8];
+    expect_t events[HID_TEST_MAX_EXPECT];
+} hid_case_t;
+
+// Rules in the generated config: F13 <-> F14, F15 -> none, right meta -> F17 on the
+// keyboard; side <-> extra button and inverted X on the mouse
+// F13-F24 and the side buttons are unbound on most desktops, X motion nets out
+static const hid_case_t g_cases[] = {
+    { "array swap press", 0, { 0, 0, USAGE_F13 }, { E_KEY(KEY_F14, 1), E_END } },
+    { "array swap release", 0, { 0 }, { E_KEY(KEY_F14, 0), E_END } },
+    { "array swap both", 0, { 0, 0, USAGE_F13, USAGE_F14 }, { E_KEY(KEY_F13, 1), E_KEY(KEY_F14, 1), E_END } },
+    { "array swap both release", 0, { 0 }, { E_KEY(KEY_F13, 0), E_KEY(KEY_F14, 0), E_END } },
+    { "blocked press", 0, { 0, 0, USAGE_F15 }, { E_END } },
+    { "blocked release", 0, { 0 }, { E_END } },
+    { "passthrough press", 0, { 0, 0, USAGE_F16 }, { E_KEY(KEY_F16, 1), E_END } },
+    { "passthrough release", 0, { 0 }, { E_KEY(KEY_F16, 0), E_END } },
+    { "modifier to array press", 0, { MOD_RIGHTMETA }, { E_KEY(KEY_F17, 1), E_END } },
+    { "modifier to array release", 0, { 0 }, { E_KEY(KEY_F17, 0), E_END } },
+    { "button swap press", 1, { 0x08 }, { E_KEY(BTN_EXTRA, 1), E_END } },
+    { "button swap release", 1, { 0 }, { E_KEY(BTN_EXTRA, 0), E_END } },
+    { "inverted axis", 1, { 0, 3 }, { E_REL(REL_X, -3), E_END } },
+    { "inverted axis back", 1, { 0, (uint8_t)-3 }, { E_REL(REL_X, 3), E_END } },
+};
+
+// uhid device opened through the keyswap pipeline
+typedef struct {
+    const char *name;
+    const uint8_t *descriptor;
+    size_t descriptor_size;
+    size_t report_size;
+    int uhid_fd;
+    char node[64];                              // /dev/input/event* of the device
+    config_t *config;
+    device_runtime_t rt;
+    int opened;
+    int passive_fd;                             // Reader on the source node (grabbed by the test if keyswap does not)
+    int keyboard_fd;                            // Readers on keyswap's virtual devices
+    int forward_fd;
+} hid_device_t;
+
+// Events read from a device
+typedef struct {
+    struct input_event events[HID_TEST_MAX_CAPTURE];
+    int count;
+    int overflow;
+} capture_t;
+
+static int g_failures = 0;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void report(const char *name, int ok, const char *detail) {
+    printf("%s %s%s%s\n", ok ? "PASS" : "FAIL", name, detail ? ": " : "", detail ? detail : "");
+    if (!ok) g_failures++;
+}
+
+// Write the test config to a temporary file and load it through the normal loader
+// Third device matches nothing: its rules only go through the compiler
+// Returns config_t* on success, NULL on error
+static config_t* generate_config(void) {
+    char path[] = "/tmp/keyswap-hid-offload-XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        fprintf(stderr, "ERROR: Failed to create config file: %s\n", strerror(errno));
+        return NULL;
+    }
+
+    FILE *fp = fdopen(fd, "w");
+    if (!fp) {
+        close(fd);
+        unlink(path);
+        return NULL;
+    }
+    fprintf(fp,
+            "{\n"
+            "  \"config\": {\n"
+            "    \"devices\": [\n"
+            "      {\n"
+            "        \"uuid\": \"keyboard\", \"name_match\": \"" KEYBOARD_NAME "\", \"offload\": \"hid-bpf\",\n"
+            "        \"remaps\": [\n"
+            "          { \"source\": %d, \"target\": %d },\n"
+            "          { \"source\": %d, \"target\": %d },\n"
+            "          { \"source\": %d, \"target\": \"none\" },\n"
+            "          { \"source\": \"right_super\", \"target\": %d }\n"
+            "        ]\n"
+            "      },\n"
+            "      {\n"
+            "        \"uuid\": \"mouse\", \"name_match\": \"" MOUSE_NAME "\", \"offload\": \"hid-bpf\",\n"
+            "        \"invert\": [\"x\"],\n"
+            "        \"remaps\": [\n"
+            "          { \"source\": \"back\", \"target\": \"forward\" },\n"
+            "          { \"source\": \"forward\", \"target\": \"back\" }\n"
+            "        ]\n"
+            "      },\n"
+            "      {\n"
+            "        \"uuid\": \"partial\", \"name_match\": \"keyswap-hid-nothing\", \"offload\": \"hid-bpf\",\n"
+            "        \"remaps\": [\n"
+            "          { \"source\": %d, \"target\": \"left_click\" },\n"
+            "          { \"source\": %d, \"target\": %d }\n"
+            "        ]\n"
+            "      }\n"
+            "    ]\n"
+            "  }\n"
+            "}\n",
+            KEY_F13, KEY_F14, KEY_F14, KEY_F13, KEY_F15, KEY_F17, KEY_F13, KEY_F14, KEY_F15);
+    fclose(fp);
+
+    config_t *config = load_config(path, 0);
+    unlink(path);
+    if (config && config->device_count != 3) {
+        fprintf(stderr, "ERROR: Generated config did not load as expected\n");
+        config_free(config);
+        return NULL;
+    }
+    return config;
+}
+
+// Count operations of one kind in a table
+static int count_ops(const struct hid_remap_table *table, int kind) {
+    int count = 0;
+    for (unsigned int i = 0; i < table->op_count; i++) {
+        if (table->ops[i].kind == kind) count++;
+    }
+    return count;
+}
+
+// Rewrite tables compiled from the descriptors, no kernel involved
+static void test_compile(const config_t *config) {
+    hid_offload_t ho;
+    struct hid_remap_table table;
+    char detail[128];
+
+    int n = hid_offload_compile(&ho, &table, g_keyboard_descriptor, sizeof(g_keyboard_descriptor), &config->devices[0]);
+    int ok = n == 4 && ho.rule_count == 4 && ho.complete && count_ops(&table, HID_REMAP_ARRAY_MAP) == 3 &&
+             count_ops(&table, HID_REMAP_BIT_TO_ARRAY) == 1 && key_state_test(&ho.sources, KEY_RIGHTMETA);
+    snprintf(detail, sizeof(detail), "%d ops, %d rules, complete=%d", n, ho.rule_count, ho.complete);
+    report("compile keyboard", ok, ok ? NULL : detail);
+
+    n = hid_offload_compile(&ho, &table, g_mouse_descriptor, sizeof(g_mouse_descriptor), &config->devices[1]);
+    ok = n == 3 && ho.rule_count == 2 && ho.complete && ho.inverted == (1u << REL_X) &&
+         count_ops(&table, HID_REMAP_BIT_MOVE) == 2 && count_ops(&table, HID_REMAP_NEGATE) == 1 &&
+         table.ops[0].src == 8 && table.ops[0].size == 8;
+    snprintf(detail, sizeof(detail), "%d ops, %d rules, inverted=0x%x, complete=%d", n, ho.rule_count, ho.inverted, ho.complete);
+    report("compile mouse", ok, ok ? NULL : detail);
+
+    // left_click is not in a keyboard report: that rule stays in userspace
+    n = hid_offload_compile(&ho, &table, g_keyboard_descriptor, sizeof(g_keyboard_descriptor), &config->devices[2]);
+    ok = n == 1 && ho.rule_count == 1 && !ho.complete && key_state_test(&ho.sources, KEY_F14) &&
+         !key_state_test(&ho.sources, KEY_F13);
+    snprintf(detail, sizeof(detail), "%d ops, %d rules, complete=%d", n, ho.rule_count, ho.complete);
+    report("compile partial", ok, ok ? NULL : detail);
+
+    static const uint8_t truncated[] = { 0x05, 0x01, 0x09 };
+    report("compile malformed", hid_offload_compile(&ho, &table, truncated, sizeof(truncated), &config->devices[0]) < 0, NULL);
+}
+
+// Event node of the input device whose name starts with name
+// Returns 0 on success, -1 if not found
+static int find_event_node(const char *name, char *node, size_t node_size) {
+    glob_t names;
+    int found = -1;
+    if (glob("/sys/class/input/event*/device/name", 0, NULL, &names) != 0) return -1;
+
+    for (size_t i = 0; i < names.gl_pathc && found < 0; i++) {
+        char line[256] = "";
+        FILE *fp = fopen(names.gl_pathv[i], "r");
+        if (!fp) continue;
+        if (fgets(line, sizeof(line), fp) && strncmp(line, name, strlen(name)) == 0) {
+            const char *event = names.gl_pathv[i] + strlen("/sys/class/input/");
+            snprintf(node, node_size, "/dev/input/%.*s", (int)strcspn(event, "/"), event);
+            found = 0;
+        }
+        fclose(fp);
+    }
+    globfree(&names);
+    return found;
+}
+
+// Open an event node for reading; containers often have a static /dev without
+// the nodes of new devices, then the node is created privately from sysfs
+// Returns fd on success, -1 on error
+static int open_event_node(const char *devnode) {
+    int fd = open(devnode, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (fd >= 0 || errno != ENOENT) return fd;
+
+    char sys_path[128];
+    unsigned int major_num, minor_num;
+    const char *name = strrchr(devnode, '/');
+    snprintf(sys_path, sizeof(sys_path), "/sys/class/input/%s/dev", name ? name + 1 : devnode);
+    FILE *fp = fopen(sys_path, "r");
+    if (!fp) return -1;
+    if (fscanf(fp, "%u:%u", &major_num, &minor_num) == 2) {
+        char node[] = "/tmp/keyswap-hid-node-XXXXXX";
+        int tmp = mkstemp(node);
+        if (tmp >= 0) {
+            close(tmp);
+            unlink(node);
+            if (mknod(node, S_IFCHR | 0600, makedev(major_num, minor_num)) == 0) {
+                fd = open(node, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+                unlink(node);
+            }
+        }
+    }
+    fclose(fp);
+    return fd;
+}
+
+// Create a uhid device and wait for its event node
+// Returns 0 on success, negative errno on error (-ENOENT: /dev/uhid missing)
+static int create_uhid(hid_device_t *hd) {
+    hd->uhid_fd = open("/dev/uhid", O_RDWR | O_CLOEXEC);
+    if (hd->uhid_fd < 0) return -errno;
+
+    struct uhid_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.type = UHID_CREATE2;
+    snprintf((char *)ev.u.create2.name, sizeof(ev.u.create2.name), "%s", hd->name);
+    memcpy(ev.u.create2.rd_data, hd->descriptor, hd->descriptor_size);
+    ev.u.create2.rd_size = (uint16_t)hd->descriptor_size;
+    ev.u.create2.bus = BUS_USB;
+    ev.u.create2.vendor = 0x1d6b;
+    ev.u.create2.product = 0x0104;
+    if (write(hd->uhid_fd, &ev, sizeof(ev)) != (ssize_t)sizeof(ev)) return -errno;
+
+    for (int attempt = 0; attempt < 100; attempt++) {
+        if (find_event_node(hd->name, hd->node, sizeof(hd->node)) == 0) return 0;
+        struct timespec delay = { 0, 10 * 1000000L };
+        nanosleep(&delay, NULL);
+    }
+    return -ETIMEDOUT;
+}
+
+// Send one input report
+// Returns 0 on success, -1 on error
+static int send_report(hid_device_t *hd, const uint8_t *data) {
+    struct uhid_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.type = UHID_INPUT2;
+    ev.u.input2.size = (uint16_t)hd->report_size;
+    memcpy(ev.u.input2.data, data, hd->report_size);
+    return write(hd->uhid_fd, &ev, sizeof(ev)) == (ssize_t)sizeof(ev) ? 0 : -1;
+}
+
+// Open the device through the pipeline and set up the readers of its output
+// Returns 0 on success, -1 on error
+static int open_device(hid_device_t *hd, device_config_t *device_cfg) {
+    if (device_runtime_open(&hd->rt, hd->node, device_cfg) != 0) return -1;
+    hd->opened = 1;
+
+    const char *backend = hd->rt.hid_offload.program ? "hid-bpf" : hd->rt.offload.rule_count > 0 ? "keymap" : "userspace";
+    printf("%s: %s, backend %s%s\n", hd->name, hd->node, backend,
+           device_runtime_offloaded(&hd->rt) ? " (complete)" : "");
+
+    // Fallback must be clean: nothing half attached, and a device that is
+    // not fully offloaded is grabbed with working virtual devices
+    if (!device_runtime_offloaded(&hd->rt)) {
+        if (!hd->rt.grabbed || !hd->rt.keyboard.uinput || !hd->rt.mouse.uinput) return -1;
+        hd->keyboard_fd = open_event_node(libevdev_uinput_get_devnode(hd->rt.keyboard.uinput));
+        hd->forward_fd = open_event_node(libevdev_uinput_get_devnode(hd->rt.mouse.uinput));
+        return hd->keyboard_fd >= 0 && hd->forward_fd >= 0 ? 0 : -1;
+    }
+
+    // The kernel does everything: read (and hold) the source node itself
+    hd->passive_fd = open_event_node(hd->node);
+    if (hd->passive_fd < 0 || hd->rt.grabbed) return -1;
+    ioctl(hd->passive_fd, EVIOCGRAB, 1);
+    return 0;
+}
+
+// Read everything pending on fd, SYN_REPORTs dropped
+static void capture_drain(int fd, capture_t *capture) {
+    struct input_event buf[64];
+    ssize_t n;
+    while ((n = read(fd, buf, sizeof(buf))) > 0 || (n < 0 && errno == EINTR)) {
+        for (size_t i = 0; n > 0 && i < (size_t)n / sizeof(buf[0]); i++) {
+            if (buf[i].type == EV_SYN || buf[i].type == EV_MSC) continue;
+            if (capture->count < HID_TEST_MAX_CAPTURE) {
+                capture->events[capture->count++] = buf[i];
+            } else {
+                capture->overflow++;
+            }
+        }
+    }
+}
+
+// Run the pipeline (if the device is read) and collect output until want events
+// arrived, then keep reading for the settle time
+static void pump(hid_device_t *hd, capture_t *capture, int want) {
+    struct pollfd fds[4];
+    int nfds = 0;
+    int offloaded = device_runtime_offloaded(&hd->rt);
+    if (offloaded) {
+        fds[nfds++] = (struct pollfd){ hd->passive_fd, POLLIN, 0 };
+    } else {
+        fds[nfds++] = (struct pollfd){ hd->rt.fd, POLLIN, 0 };
+        fds[nfds++] = (struct pollfd){ hd->keyboard_fd, POLLIN, 0 };
+        fds[nfds++] = (struct pollfd){ hd->forward_fd, POLLIN, 0 };
+    }
+
+    uint64_t deadline = now_ns() + (uint64_t)HID_TEST_TIMEOUT_MS * 1000000ull;
+    int settling = 0;
+    for (;;) {
+        if (!settling && capture->count >= want) {
+            settling = 1;
+            deadline = now_ns() + (uint64_t)HID_TEST_SETTLE_MS * 1000000ull;
+        }
+        uint64_t now = now_ns();
+        if (now >= deadline) return;
+
+        int rc = poll(fds, nfds, (int)((deadline - now + 999999ull) / 1000000ull));
+        if (rc < 0 && errno != EINTR) return;
+        if (rc <= 0) continue;
+
+        if (offloaded) {
+            capture_drain(hd->passive_fd, capture);
+            continue;
+        }
+        if (fds[0].revents & POLLIN) process_device_events(&hd->rt, hd->config, NULL, 0, 0);
+        capture_drain(hd->keyboard_fd, capture);
+        capture_drain(hd->forward_fd, capture);
+    }
+}
+
+// Compare captured events against an expected list, in any order
+// Returns 1 if equal, 0 otherwise (detail describes the first difference)
+static int capture_matches(const capture_t *capture, const expect_t *expect, char *detail, size_t detail_size) {
+    int used[HID_TEST_MAX_CAPTURE] = { 0 };
+    int expected = 0;
+    for (; expect[expected].type >= 0; expected++) {
+        int found = 0;
+        for (int i = 0; i < capture->count && !found; i++) {
+            const struct input_event *ev = &capture->events[i];
+            if (!used[i] && ev->type == expect[expected].type && ev->code == expect[expected].code &&
+                ev->value == expect[expected].value) {
+                used[i] = found = 1;
+            }
+        }
+        if (!found) {
+            snprintf(detail, detail_size, "missing (%d,%d,%d)",
+                     expect[expected].type, expect[expected].code, expect[expected].value);
+            return 0;
+        }
+    }
+    for (int i = 0; i < capture->count; i++) {
+        if (!used[i]) {
+            snprintf(detail, detail_size, "unexpected (%d,%d,%d)",
+                     capture->events[i].type, capture->events[i].code, capture->events[i].value);
+            return 0;
+        }
+    }
+    return !capture->overflow;
+}
+
+static void run_case(hid_device_t *hd, const hid_case_t *test) {
+    capture_t capture;
+    char detail[128] = "";
+    capture.count = 0;
+    capture.overflow = 0;
+
+    int want = 0;
+    while (test->events[want].type >= 0) want++;
+
+    if (send_report(hd, test->report) != 0) {
+        report(test->name, 0, "uhid write failed");
+        return;
+    }
+    pump(hd, &capture, want);
+    int ok = capture_matches(&capture, test->events, detail, sizeof(detail));
+    report(test->name, ok, ok ? NULL : detail);
+}
+
+static void hid_device_close(hid_device_t *hd) {
+    if (hd->passive_fd >= 0) close(hd->passive_fd);
+    if (hd->keyboard_fd >= 0) close(hd->keyboard_fd);
+    if (hd->forward_fd >= 0) close(hd->forward_fd);
+    if (hd->opened) device_runtime_close(&hd->rt);
+    // Closing /dev/uhid destroys the device
+    if (hd->uhid_fd >= 0) close(hd->uhid_fd);
+}
+
+int main(void) {
+    config_t *config = generate_config();
+    if (!config) return 1;
+
+    printf("\nkeyswap HID offload\n\n");
+    test_compile(config);
+
+    hid_device_t devices[2];
+    memset(devices, 0, sizeof(devices));
+    for (int i = 0; i < 2; i++) {
+        devices[i].name = i == 0 ? KEYBOARD_NAME : MOUSE_NAME;
+        devices[i].descriptor = i == 0 ? g_keyboard_descriptor : g_mouse_descriptor;
+        devices[i].descriptor_size = i == 0 ? sizeof(g_keyboard_descriptor) : sizeof(g_mouse_descriptor);
+        devices[i].report_size = i == 0 ? 8 : 3;
+        devices[i].config = config;
+        devices[i].uhid_fd = -1;
+        devices[i].passive_fd = -1;
+        devices[i].keyboard_fd = -1;
+        devices[i].forward_fd = -1;
+    }
+
+    int rc = create_uhid(&devices[0]);
+    if (rc == 0) rc = create_uhid(&devices[1]);
+    if (rc < 0) {
+        printf("SKIP cannot create uhid devices: %s\n", strerror(-rc));
+        hid_device_close(&devices[0]);
+        hid_device_close(&devices[1]);
+        config_free(config);
+        printf("\n%s\n", g_failures ? "FAILED" : "OK");
+        return g_failures ? 1 : HID_TEST_EXIT_SKIP;
+    }
+
+    printf("\n");
+    for (int i = 0; i < 2; i++) {
+        if (open_device(&devices[i], &config->devices[i]) != 0) {
+            report(devices[i].name, 0, "open or fallback setup failed");
+        }
+    }
+
+    if (g_failures == 0) {
+        printf("\n");
+        for (size_t i = 0; i < sizeof(g_cases) / sizeof(g_cases[0]); i++) {
+            run_case(&devices[g_cases[i].mouse], &g_cases[i]);
+        }
+    }
+
+    hid_device_close(&devices[0]);
+    hid_device_close(&devices[1]);
+    config_free(config);
+
+    printf("\n%s\n", g_failures ? "FAILED" : "OK");
+    return g_failures ? 1 : 0;
+}
@@ -0,0 +1,1328 @@
+// End-to-end loopback test through the real kernel input stack
+// Creates a synthetic source device via uinput, opens it the way keyswap does
+// (device_runtime_open: exclusive grab + virtual devices) with a generated
+// config, writes events into the source and reads the remapped output back
+// from keyswap's virtual devices. Checks every output frame, then measures the
+// round trip source write -> pipeline -> virtual device read. Features with a
+// config of their own run last, each on a fresh source.
+// Needs only /dev/uinput; exit status 0 = pass, 1 = failure, 77 = skipped.
+
+#define _GNU_SOURCE
+#include "../event-processor.h"
+#include "../config-loader.h"
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <linux/input.h>
+#include <libevdev/libevdev.h>
+#include <libevdev/libevdev-uinput.h>
+
+#define LOOPBACK_DEFAULT_ITERATIONS 1000
+#define LOOPBACK_TIMEOUT_MS 1000        // Wait for an expected frame
+#define LOOPBACK_SETTLE_MS 20           // Keep reading for unexpected extra events
+#define LOOPBACK_MAX_EXPECT 8
+#define LOOPBACK_MAX_CAPTURE 64
+#define LOOPBACK_OVERRUN_FRAMES 512     // Enough to overflow any evdev client buffer
+#define LOOPBACK_EXIT_SKIP 77
+#define LOOPBACK_TIMING_SLACK_MS 25     // Allowed lateness of a timer-generated event
+
+// Expected or injected event; type -1 terminates a list
+typedef struct {
+    int type;
+    int code;
+    int value;
+} expect_t;
+
+#define E_KEY(code, value) { EV_KEY, code, value }
+#define E_REL(code, value) { EV_REL, code, value }
+#define E_SYN { EV_SYN, SYN_REPORT, 0 }
+#define E_END { -1, 0, 0 }
+
+// One step: a source frame and what each virtual device must emit for it
+typedef struct {
+    const char *name;
+    int paused;                                 // Remapping paused (control socket "pause")
+    expect_t input[LOOPBACK_MAX_EXPECT];        // Source frame, SYN_REPORT appended
+    expect_t keyboard[LOOPBACK_MAX_EXPECT];     // Injection device output
+    expect_t forward[LOOPBACK_MAX_EXPECT];      // Forward device output
+} loopback_case_t;
+
+// Events read from one virtual device
+typedef struct {
+    struct input_event events[LOOPBACK_MAX_CAPTURE];
+    int count;
+    int frames;                                 // SYN_REPORTs seen
+    int overflow;                               // Events beyond the capture buffer
+} capture_t;
+
+typedef struct {
+    struct libevdev_uinput *source;
+    config_t *config;                           // Not owned
+    device_runtime_t rt;
+    int keyboard_fd;                            // Reader on keyswap's injection device
+    int forward_fd;                             // Reader on keyswap's forward device
+    int passive_fd;                             // Non-grabbing reader on the source
+    int paused;
+} loopback_t;
+
+// Remaps in the generated config: F13 -> F14, F15 -> F16, side button -> F24
+// F13-F24 are unbound on most desktops, so a test run does not type anywhere
+static const loopback_case_t g_cases[] = {
+    { "remap press", 0,
+      { E_KEY(KEY_F13, 1), E_END },
+      { E_KEY(KEY_F14, 1), E_SYN, E_END },
+      { E_END } },
+    { "remap release", 0,
+      { E_KEY(KEY_F13, 0), E_END },
+      { E_KEY(KEY_F14, 0), E_SYN, E_END },
+      { E_END } },
+    { "forward press", 0,
+      { E_KEY(KEY_F17, 1), E_END },
+      { E_END },
+      { E_KEY(KEY_F17, 1), E_SYN, E_END } },
+    { "forward release", 0,
+      { E_KEY(KEY_F17, 0), E_END },
+      { E_END },
+      { E_KEY(KEY_F17, 0), E_SYN, E_END } },
+    { "button remap", 0,
+      { E_KEY(BTN_SIDE, 1), E_END },
+      { E_KEY(KEY_F24, 1), E_SYN, E_END },
+      { E_END } },
+    { "button remap release", 0,
+      { E_KEY(BTN_SIDE, 0), E_END },
+      { E_KEY(KEY_F24, 0), E_SYN, E_END },
+      { E_END } },
+    { "split frame", 0,
+      { E_KEY(KEY_F15, 1), E_REL(REL_X, 1), E_REL(REL_Y, -1), E_END },
+      { E_KEY(KEY_F16, 1), E_SYN, E_END },
+      { E_REL(REL_X, 1), E_REL(REL_Y, -1), E_SYN, E_END } },
+    { "release follows press while paused", 1,
+      { E_KEY(KEY_F15, 0), E_END },
+      { E_KEY(KEY_F16, 0), E_SYN, E_END },
+      { E_END } },
+    { "paused passthrough", 1,
+      { E_KEY(KEY_F13, 1), E_END },
+      { E_END },
+      { E_KEY(KEY_F13, 1), E_SYN, E_END } },
+    { "release follows press after resume", 0,
+      { E_KEY(KEY_F13, 0), E_END },
+      { E_END },
+      { E_KEY(KEY_F13, 0), E_SYN, E_END } },
+    { "motion", 0,
+      { E_REL(REL_X, -1), E_REL(REL_Y, 1), E_END },
+      { E_END },
+      { E_REL(REL_X, -1), E_REL(REL_Y, 1), E_SYN, E_END } },
+    { "chord", 0,
+      { E_KEY(KEY_F13, 1), E_KEY(KEY_F15, 1), E_KEY(KEY_F17, 1), E_END },
+      { E_KEY(KEY_F14, 1), E_KEY(KEY_F16, 1), E_SYN, E_END },
+      { E_KEY(KEY_F17, 1), E_SYN, E_END } },
+    { "chord release", 0,
+      { E_KEY(KEY_F13, 0), E_KEY(KEY_F15, 0), E_KEY(KEY_F17, 0), E_END },
+      { E_KEY(KEY_F14, 0), E_KEY(KEY_F16, 0), E_SYN, E_END },
+      { E_KEY(KEY_F17, 0), E_SYN, E_END } },
+};
+
+static int g_failures = 0;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void sleep_ms(int ms) {
+    struct timespec delay = { ms / 1000, (long)(ms % 1000) * 1000000L };
+    while (nanosleep(&delay, &delay) != 0 && errno == EINTR) {
+    }
+}
+
+static void report(const char *name, int ok, const char *detail) {
+    printf("%s %s%s%s\n", ok ? "PASS" : "FAIL", name, detail ? ": " : "", detail ? detail : "");
+    if (!ok) g_failures++;
+}
+
+// Source device as a small keyboard + mouse combo
+// Returns 0 on success, negative errno on error
+static int create_source(const char *name, struct libevdev_uinput **source) {
+    struct libevdev *dev = libevdev_new();
+    if (!dev) return -ENOMEM;
+
+    libevdev_set_name(dev, name);
+    libevdev_set_id_bustype(dev, BUS_VIRTUAL);
+    libevdev_enable_event_type(dev, EV_KEY);
+    for (int code = KEY_F13; code <= KEY_F24; code++) {
+        libevdev_enable_event_code(dev, EV_KEY, code, NULL);
+    }
+    // Digits, letters, Enter and shift for the scanner (only typed while grabbed)
+    for (int code = KEY_1; code <= KEY_RIGHTSHIFT; code++) {
+        libevdev_enable_event_code(dev, EV_KEY, code, NULL);
+    }
+    libevdev_enable_event_code(dev, EV_KEY, BTN_LEFT, NULL);
+    libevdev_enable_event_code(dev, EV_KEY, BTN_SIDE, NULL);
+    libevdev_enable_event_type(dev, EV_REL);
+    libevdev_enable_event_code(dev, EV_REL, REL_X, NULL);
+    libevdev_enable_event_code(dev, EV_REL, REL_Y, NULL);
+
+    int rc = libevdev_uinput_create_from_device(dev, LIBEVDEV_UINPUT_OPEN_MANAGED, source);
+    libevdev_free(dev);
+    return rc;
+}
+
+// Write a test config with the given devices (printf format of the members of
+// "devices") to a temporary file and load it through the normal loader
+// Returns config_t* on success, NULL on error
+static config_t* generate_config(const char *devices_format, ...) {
+    char path[] = "/tmp/keyswap-loopback-XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        fprintf(stderr, "ERROR: Failed to create config file: %s\n", strerror(errno));
+        return NULL;
+    }
+
+    FILE *fp = fdopen(fd, "w");
+    if (!fp) {
+        close(fd);
+        unlink(path);
+        return NULL;
+    }
+    va_list args;
+    va_start(args, devices_format);
+    fprintf(fp, "{\n  \"config\": {\n    \"devices\": [\n");
+    vfprintf(fp, devices_format, args);
+    fprintf(fp, "\n    ]\n  }\n}\n");
+    va_end(args);
+    fclose(fp);
+
+    config_t *config = load_config(path, 0);
+    unlink(path);
+    return config;
+}
+
+// Open an event node for reading (non-blocking, CLOCK_MONOTONIC timestamps)
+// Containers often have a static /dev without the nodes of newly created devices;
+// then the node is created privately from its sysfs major:minor
+// Returns fd on success, -1 on error
+static int open_event_node(const char *devnode) {
+    if (!devnode) return -1;
+
+    int fd = -1;
+    for (int attempt = 0; attempt < 100 && fd < 0; attempt++) {
+        fd = open(devnode, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+        if (fd < 0 && errno == ENOENT) {
+            char sys_path[128];
+            unsigned int major_num, minor_num;
+            const char *name = strrchr(devnode, '/');
+            snprintf(sys_path, sizeof(sys_path), "/sys/class/input/%s/dev", name ? name + 1 : devnode);
+            FILE *fp = fopen(sys_path, "r");
+            if (fp) {
+                if (fscanf(fp, "%u:%u", &major_num, &minor_num) == 2) {
+                    char node[] = "/tmp/keyswap-loopback-node-XXXXXX";
+                    int tmp = mkstemp(node);
+                    if (tmp >= 0) {
+                        close(tmp);
+                        unlink(node);
+                        if (mknod(node, S_IFCHR | 0600, makedev(major_num, minor_num)) == 0) {
+                            fd = open(node, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+                            unlink(node);
+                        }
+                    }
+                }
+                fclose(fp);
+            }
+        }
+        if (fd < 0) {
+            // udev may still be settling permissions on a brand new node
+            struct timespec delay = { 0, 10 * 1000000L };
+            nanosleep(&delay, NULL);
+        }
+    }
+    if (fd < 0) {
+        fprintf(stderr, "ERROR: Failed to open %s: %s\n", devnode, strerror(errno));
+        return -1;
+    }
+
+    int clock_id = CLOCK_MONOTONIC;
+    ioctl(fd, EVIOCSCLOCKID, &clock_id);
+    return fd;
+}
+
+static void capture_reset(capture_t *capture) {
+    capture->count = 0;
+    capture->frames = 0;
+    capture->overflow = 0;
+}
+
+// Read everything pending on a virtual device reader
+// Returns 0 on success, -1 on read error
+static int capture_drain(int fd, capture_t *capture) {
+    struct input_event buf[64];
+
+    for (;;) {
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n < 0) {
+            if (errno == EAGAIN) return 0;
+            if (errno == EINTR) continue;
+            fprintf(stderr, "ERROR: Failed to read virtual device: %s\n", strerror(errno));
+            return -1;
+        }
+        if (n == 0) return 0;
+
+        for (size_t i = 0; i < (size_t)n / sizeof(buf[0]); i++) {
+            if (buf[i].type == EV_SYN && buf[i].code == SYN_REPORT) {
+                capture->frames++;
+            }
+            if (capture->count < LOOPBACK_MAX_CAPTURE) {
+                capture->events[capture->count++] = buf[i];
+            } else {
+                capture->overflow++;
+            }
+        }
+    }
+}
+
+// Run the pipeline (source and repeat timer) and read both virtual devices until
+// the wanted number of frames arrived on each, then keep going for settle_ms to
+// catch extras
+// Returns 0 on success, -1 on timeout or error
+static int pump(loopback_t *lb, capture_t *keyboard, capture_t *forward,
+                int want_keyboard, int want_forward, int settle_ms) {
+    struct pollfd fds[4] = {
+        { lb->rt.fd, POLLIN, 0 },
+        { lb->keyboard_fd, POLLIN, 0 },
+        { lb->forward_fd, POLLIN, 0 },
+        { lb->rt.repeat.fd, POLLIN, 0 },
+    };
+    uint64_t deadline = now_ns() + (uint64_t)LOOPBACK_TIMEOUT_MS * 1000000ull;
+    int settling = 0;
+
+    for (;;) {
+        if (!settling && keyboard->frames >= want_keyboard && forward->frames >= want_forward) {
+            if (settle_ms <= 0) return 0;
+            settling = 1;
+            deadline = now_ns() + (uint64_t)settle_ms * 1000000ull;
+        }
+
+        uint64_t now = now_ns();
+        if (now >= deadline) return settling ? 0 : -1;
+        int timeout_ms = (int)((deadline - now + 999999ull) / 1000000ull);
+
+        int rc = poll(fds, 4, timeout_ms);
+        if (rc < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+
+        if (fds[0].revents & POLLIN) {
+            if (process_device_events(&lb->rt, lb->config, NULL, lb->paused, 0) != 0) return -1;
+        }
+        if (fds[3].revents & POLLIN) {
+            device_runtime_repeat(&lb->rt, 0);
+        }
+        if ((fds[1].revents & POLLIN) && capture_drain(lb->keyboard_fd, keyboard) != 0) return -1;
+        if ((fds[2].revents & POLLIN) && capture_drain(lb->forward_fd, forward) != 0) return -1;
+    }
+}
+
+// Write one source frame (SYN_REPORT appended)
+// Returns 0 on success, -1 on error
+static int write_frame(loopback_t *lb, const expect_t *input) {
+    for (int i = 0; input[i].type >= 0; i++) {
+        if (libevdev_uinput_write_event(lb->source, input[i].type, input[i].code, input[i].value) < 0) {
+            return -1;
+        }
+    }
+    return libevdev_uinput_write_event(lb->source, EV_SYN, SYN_REPORT, 0) < 0 ? -1 : 0;
+}
+
+static int count_frames(const expect_t *expect) {
+    int frames = 0;
+    for (int i = 0; expect[i].type >= 0; i++) {
+        if (expect[i].type == EV_SYN && expect[i].code == SYN_REPORT) frames++;
+    }
+    return frames;
+}
+
+// Compare captured events against an expected list
+// Returns 1 if equal, 0 otherwise (detail describes the first difference)
+static int capture_matches(const capture_t *capture, const expect_t *expect,
+                           const char *device, char *detail, size_t detail_size) {
+    int i = 0;
+    for (; expect[i].type >= 0; i++) {
+        if (i >= capture->count) {
+            snprintf(detail, detail_size, "%s: missing event %d (%d,%d,%d)",
+                     device, i, expect[i].type, expect[i].code, expect[i].value);
+            return 0;
+        }
+        const struct input_event *ev = &capture->events[i];
+        if (ev->type != expect[i].type || ev->code != expect[i].code || ev->value != expect[i].value) {
+            snprintf(detail, detail_size, "%s: event %d is (%d,%d,%d), expected (%d,%d,%d)",
+                     device, i, ev->type, ev->code, ev->value,
+                     expect[i].type, expect[i].code, expect[i].value);
+            return 0;
+        }
+    }
+    if (capture->count > i || capture->overflow) {
+        const struct input_event *ev = &capture->events[i];
+        snprintf(detail, detail_size, "%s: unexpected event (%d,%d,%d)",
+                 device, ev->type, ev->code, ev->value);
+        return 0;
+    }
+    return 1;
+}
+
+static void run_case(loopback_t *lb, const loopback_case_t *test) {
+    capture_t keyboard, forward;
+    char detail[128] = "";
+    capture_reset(&keyboard);
+    capture_reset(&forward);
+    lb->paused = test->paused;
+
+    if (write_frame(lb, test->input) != 0) {
+        report(test->name, 0, "source write failed");
+        return;
+    }
+    if (pump(lb, &keyboard, &forward, count_frames(test->keyboard), count_frames(test->forward),
+             LOOPBACK_SETTLE_MS) != 0) {
+        report(test->name, 0, "timed out waiting for output");
+        return;
+    }
+
+    int ok = capture_matches(&keyboard, test->keyboard, "keyboard", detail, sizeof(detail)) &&
+             capture_matches(&forward, test->forward, "forward", detail, sizeof(detail));
+    report(test->name, ok, ok ? NULL : detail);
+}
+
+// Held virtual keys are released on shutdown, and the source's own release
+// afterwards must not produce a second one
+static void test_release_keys(loopback_t *lb) {
+    static const expect_t press[] = { E_KEY(KEY_F15, 1), E_END };
+    static const expect_t release[] = { E_KEY(KEY_F15, 0), E_END };
+    static const expect_t held[] = { E_KEY(KEY_F16, 1), E_SYN, E_END };
+    static const expect_t released[] = { E_KEY(KEY_F16, 0), E_SYN, E_END };
+    static const expect_t none[] = { E_END };
+    capture_t keyboard, forward;
+    char detail[128] = "";
+    lb->paused = 0;
+
+    capture_reset(&keyboard);
+    capture_reset(&forward);
+    int ok = write_frame(lb, press) == 0 && pump(lb, &keyboard, &forward, 1, 0, LOOPBACK_SETTLE_MS) == 0 &&
+             capture_matches(&keyboard, held, "keyboard", detail, sizeof(detail));
+
+    if (ok) {
+        capture_reset(&keyboard);
+        device_runtime_release_keys(&lb->rt);
+        ok = pump(lb, &keyboard, &forward, 1, 0, LOOPBACK_SETTLE_MS) == 0 &&
+             capture_matches(&keyboard, released, "keyboard", detail, sizeof(detail));
+    }
+    if (ok) {
+        capture_reset(&keyboard);
+        ok = write_frame(lb, release) == 0 && pump(lb, &keyboard, &forward, 0, 0, LOOPBACK_SETTLE_MS) == 0 &&
+             capture_matches(&keyboard, none, "keyboard", detail, sizeof(detail)) &&
+             capture_matches(&forward, none, "forward", detail, sizeof(detail));
+    }
+    report("release held keys", ok, ok ? NULL : detail);
+}
+
+// Overflow the source's evdev buffer while a remapped key is held and released:
+// the SYN_DROPPED resync must still release the injected key exactly once
+static void test_syn_dropped(loopback_t *lb) {
+    static const expect_t press[] = { E_KEY(KEY_F13, 1), E_END };
+    static const expect_t held[] = { E_KEY(KEY_F14, 1), E_SYN, E_END };
+    static const expect_t released[] = { E_KEY(KEY_F14, 0), E_SYN, E_END };
+    capture_t keyboard, forward;
+    char detail[128] = "";
+    lb->paused = 0;
+
+    capture_reset(&keyboard);
+    capture_reset(&forward);
+    int ok = write_frame(lb, press) == 0 && pump(lb, &keyboard, &forward, 1, 0, LOOPBACK_SETTLE_MS) == 0 &&
+             capture_matches(&keyboard, held, "keyboard", detail, sizeof(detail));
+    if (!ok) {
+        report("SYN_DROPPED resync", 0, detail);
+        return;
+    }
+
+    // Net-zero motion, never read until the release has been written too
+    uint64_t syn_dropped = lb->rt.stats.syn_dropped;
+    for (int i = 0; i < LOOPBACK_OVERRUN_FRAMES; i++) {
+        libevdev_uinput_write_event(lb->source, EV_REL, REL_X, i % 2 == 0 ? 1 : -1);
+        libevdev_uinput_write_event(lb->source, EV_SYN, SYN_REPORT, 0);
+    }
+    libevdev_uinput_write_event(lb->source, EV_KEY, KEY_F13, 0);
+    libevdev_uinput_write_event(lb->source, EV_SYN, SYN_REPORT, 0);
+
+    capture_reset(&keyboard);
+    ok = pump(lb, &keyboard, &forward, 1, 0, LOOPBACK_SETTLE_MS) == 0 &&
+         capture_matches(&keyboard, released, "keyboard", detail, sizeof(detail));
+    if (ok && lb->rt.stats.syn_dropped == syn_dropped) {
+        snprintf(detail, sizeof(detail), "kernel buffer did not overflow");
+        ok = 0;
+    }
+    report("SYN_DROPPED resync", ok, ok ? NULL : detail);
+
+    // The forward reader itself may have overflowed on the motion burst
+    capture_drain(lb->forward_fd, &forward);
+}
+
+// While grabbed, other readers of the source must see nothing
+static void test_grab(loopback_t *lb) {
+    capture_t passive;
+    capture_reset(&passive);
+    if (capture_drain(lb->passive_fd, &passive) != 0) {
+        report("exclusive grab", 0, "passive read failed");
+        return;
+    }
+    char detail[64];
+    snprintf(detail, sizeof(detail), "%d events leaked to a second reader", passive.count + passive.overflow);
+    report("exclusive grab", passive.count == 0, passive.count == 0 ? NULL : detail);
+}
+
+static int compare_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+// Round trip: source write -> kernel -> keyswap -> virtual device -> reader
+static void measure_latency(loopback_t *lb, int iterations) {
+    uint32_t *samples = malloc((size_t)iterations * sizeof(uint32_t));
+    if (!samples) {
+        fprintf(stderr, "ERROR: Failed to allocate latency samples\n");
+        g_failures++;
+        return;
+    }
+
+    capture_t keyboard, forward;
+    int wrong = 0;
+    int n = 0;
+    lb->paused = 0;
+    memset(&lb->rt.stats, 0, sizeof(lb->rt.stats));
+
+    for (int i = 0; i < iterations; i++) {
+        int value = i % 2 == 0;
+        capture_reset(&keyboard);
+        capture_reset(&forward);
+
+        uint64_t t0 = now_ns();
+        libevdev_uinput_write_event(lb->source, EV_KEY, KEY_F13, value);
+        libevdev_uinput_write_event(lb->source, EV_SYN, SYN_REPORT, 0);
+        if (pump(lb, &keyboard, &forward, 1, 0, 0) != 0) break;
+        uint64_t t1 = now_ns();
+
+        if (keyboard.count != 2 || keyboard.events[0].code != KEY_F14 || keyboard.events[0].value != value ||
+            forward.count != 0) {
+            wrong++;
+        }
+        samples[n++] = (uint32_t)(t1 - t0 > UINT32_MAX ? UINT32_MAX : t1 - t0);
+    }
+
+    // Leave F13/F14 released
+    if (n % 2 == 1) {
+        static const expect_t release[] = { E_KEY(KEY_F13, 0), E_END };
+        capture_reset(&keyboard);
+        capture_reset(&forward);
+        if (write_frame(lb, release) == 0) {
+            pump(lb, &keyboard, &forward, 1, 0, 0);
+        }
+    }
+
+    char detail[64];
+    snprintf(detail, sizeof(detail), "%d frames wrong, %d lost", wrong, iterations - n);
+    report("latency run", wrong == 0 && n == iterations, wrong == 0 && n == iterations ? NULL : detail);
+
+    if (n > 0) {
+        uint64_t sum = 0;
+        for (int i = 0; i < n; i++) sum += samples[i];
+        qsort(samples, n, sizeof(uint32_t), compare_u32);
+
+        const device_stats_t *stats = &lb->rt.stats;
+        printf("\n%-22s %8s %9s %9s %9s %9s\n", "latency", "frames", "mean_us", "p50_us", "p99_us", "max_us");
+        printf("%-22s %8d %9.1f %9.1f %9.1f %9.1f\n", "round trip", n,
+               (double)sum / n / 1000.0, samples[n / 2] / 1000.0,
+               samples[((size_t)n * 99) / 100] / 1000.0, samples[n - 1] / 1000.0);
+        if (stats->latency_count > 0) {
+            printf("%-22s %8llu %9.1f %9s %9s %9.1f\n", "source -> emit",
+                   (unsigned long long)stats->latency_count,
+                   (double)stats->latency_sum_ns / stats->latency_count / 1000.0, "-", "-",
+                   stats->latency_max_ns / 1000.0);
+        }
+    }
+    free(samples);
+}
+
+static void loopback_init(loopback_t *lb) {
+    memset(lb, 0, sizeof(*lb));
+    lb->rt.fd = -1;
+    lb->rt.keyboard.fd = -1;
+    lb->rt.mouse.fd = -1;
+    lb->rt.repeat.fd = -1;
+    lb->keyboard_fd = -1;
+    lb->forward_fd = -1;
+    lb->passive_fd = -1;
+}
+
+// Open the source the way keyswap does with one device of config and attach
+// readers to keyswap's virtual devices
+// Returns 0 on success, -1 on error
+static int loopback_open(loopback_t *lb, config_t *config, int device) {
+    const char *source_node = libevdev_uinput_get_devnode(lb->source);
+    lb->config = config;
+    lb->passive_fd = open_event_node(source_node);
+    if (!config || device >= config->device_count || lb->passive_fd < 0 ||
+        device_runtime_open(&lb->rt, source_node, &config->devices[device]) != 0 ||
+        !lb->rt.grabbed || !lb->rt.mouse.uinput) {
+        fprintf(stderr, "ERROR: Loopback setup failed\n");
+        return -1;
+    }
+
+    // Read keyswap's output back from its virtual devices
+    lb->keyboard_fd = open_event_node(libevdev_uinput_get_devnode(lb->rt.keyboard.uinput));
+    lb->forward_fd = open_event_node(libevdev_uinput_get_devnode(lb->rt.mouse.uinput));
+    if (lb->keyboard_fd < 0 || lb->forward_fd < 0) {
+        fprintf(stderr, "ERROR: Cannot read keyswap's virtual devices\n");
+        return -1;
+    }
+    return 0;
+}
+
+// Leaves lb->config to the caller
+static void loopback_close(loopback_t *lb) {
+    if (lb->keyboard_fd >= 0) close(lb->keyboard_fd);
+    if (lb->forward_fd >= 0) close(lb->forward_fd);
+    if (lb->passive_fd >= 0) close(lb->passive_fd);
+    device_runtime_close(&lb->rt);
+    if (lb->source) libevdev_uinput_destroy(lb->source);
+    loopback_init(lb);
+}
+
+// Fresh source named name, opened with one device of config (a feature test)
+// Returns 0 on success, -1 on error (reported as a failure of the test)
+static int loopback_start(loopback_t *lb, const char *name, config_t *config, int device) {
+    loopback_init(lb);
+    int rc = create_source(name, &lb->source);
+    if (rc < 0) {
+        fprintf(stderr, "ERROR: Failed to create %s: %s\n", name, strerror(-rc));
+    }
+    if (rc < 0 || loopback_open(lb, config, device) != 0) {
+        loopback_close(lb);
+        report(name, 0, "setup failed");
+        return -1;
+    }
+    return 0;
+}
+
+// Config fragments spell integer macros as JSON text
+#define JSON_INT(value) JSON_TEXT(value)
+#define JSON_TEXT(text) #text
+
+#define LOOPBACK_MAX_SOURCES 2
+
+// A feature with a config of its own, run on fresh sources after the main cases
+typedef struct {
+    const char *name;
+    // Members of each source's config device besides uuid and name_match
+    // (printf format: %s is a scratch directory private to the run)
+    const char *devices[LOOPBACK_MAX_SOURCES];
+    const loopback_case_t *cases;               // Run on the first source
+    int case_count;
+    void (*check)(loopback_t *sources, const char *scratch);   // Further checks, or NULL
+} loopback_feature_t;
+
+// Generate the feature's config, open one fresh source per device, then run the
+// case table and the feature's checks
+static void run_feature(const loopback_feature_t *feature) {
+    loopback_t sources[LOOPBACK_MAX_SOURCES];
+    char scratch[] = "/tmp/keyswap-loopback-XXXXXX";
+    char devices[4096];
+    size_t used = 0;
+    int source_count = 0;
+
+    if (!mkdtemp(scratch)) {
+        report(feature->name, 0, "cannot create scratch directory");
+        return;
+    }
+    devices[0] = '\0';
+    for (; source_count < LOOPBACK_MAX_SOURCES && feature->devices[source_count]; source_count++) {
+        char members[2048];
+        snprintf(members, sizeof(members), feature->devices[source_count], scratch);
+        if (used < sizeof(devices)) {
+            used += snprintf(devices + used, sizeof(devices) - used,
+                             "%s      { \"uuid\": \"%s-%d\", \"name_match\": \"keyswap-loopback-%s-%d\", %s }",
+                             source_count ? ",\n" : "", feature->name, source_count,
+                             feature->name, source_count, members);
+        }
+    }
+
+    config_t *config = used < sizeof(devices) ? generate_config("%s", devices) : NULL;
+    int ok = config != NULL;
+    if (!ok) report(feature->name, 0, "config did not load");
+
+    int opened = 0;
+    while (ok && opened < source_count) {
+        char name[64];
+        snprintf(name, sizeof(name), "keyswap-loopback-%s-%d", feature->name, opened);
+        if (loopback_start(&sources[opened], name, config, opened) != 0) {
+            ok = 0;
+        } else {
+            opened++;
+        }
+    }
+    if (ok) {
+        for (int i = 0; i < feature->case_count; i++) {
+            run_case(&sources[0], &feature->cases[i]);
+        }
+        if (feature->check) feature->check(sources, scratch);
+    }
+
+    while (opened > 0) {
+        loopback_close(&sources[--opened]);
+    }
+    if (config) config_free(config);
+    rmdir(scratch);
+}
+
+// Kernel timestamp of an event in microseconds
+static int64_t event_us(const struct input_event *ev) {
+    return (int64_t)ev->input_event_sec * 1000000 + ev->input_event_usec;
+}
+
+// Check a capture of single-key frames: code with values[i] in frame i, the
+// second frame first_ms after the first and each further one period_ms later
+// Times count from the first frame: a late tick does not delay the next one
+// Returns 1 if it matches, 0 otherwise (detail describes the first difference)
+static int ticks_match(const capture_t *capture, int code, const int *values, int count,
+                       int first_ms, int period_ms, char *detail, size_t detail_size) {
+    if (capture->count != count * 2 || capture->overflow) {
+        snprintf(detail, detail_size, "%d events, expected %d frames", capture->count + capture->overflow, count);
+        return 0;
+    }
+    for (int i = 0; i < count; i++) {
+        const struct input_event *ev = &capture->events[i * 2];
+        if (ev->type != EV_KEY || ev->code != code || ev->value != values[i] ||
+            capture->events[i * 2 + 1].type != EV_SYN) {
+            snprintf(detail, detail_size, "frame %d starts with (%d,%d,%d), expected (%d,%d,%d)",
+                     i, ev->type, ev->code, ev->value, EV_KEY, code, values[i]);
+            return 0;
+        }
+        if (i == 0) continue;
+
+        int64_t elapsed_us = event_us(ev) - event_us(&capture->events[0]);
+        int expected_ms = first_ms + (i - 1) * period_ms;
+        if (elapsed_us < (expected_ms - 2) * 1000ll ||
+            elapsed_us > (expected_ms + LOOPBACK_TIMING_SLACK_MS) * 1000ll) {
+            snprintf(detail, detail_size, "frame %d at %.1f ms, expected %d ms",
+                     i, elapsed_us / 1000.0, expected_ms);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+#define REPEAT_DELAY_MS 100
+#define REPEAT_RATE 20                  // Repeats and autofire cycles per second
+#define REPEAT_PERIOD_MS (1000 / REPEAT_RATE)
+
+// Repeat and turbo rules: keyswap generates the repeats itself from the
+// device's timer, and nothing is generated once the source key is up
+static void check_repeat(loopback_t *sources, const char *scratch) {
+    static const expect_t repeat_press[] = { E_KEY(KEY_F13, 1), E_END };
+    static const expect_t repeat_release[] = { E_KEY(KEY_F13, 0), E_END };
+    static const expect_t turbo_press[] = { E_KEY(KEY_F15, 1), E_END };
+    static const expect_t turbo_release[] = { E_KEY(KEY_F15, 0), E_END };
+    static const expect_t released[] = { E_KEY(KEY_F14, 0), E_SYN, E_END };
+    static const expect_t none[] = { E_END };
+    static const int repeats[] = { 1, 2, 2, 2 };
+    static const int toggles[] = { 1, 0, 1, 0 };
+    loopback_t *lb = &sources[0];
+    capture_t keyboard, forward;
+    char detail[128] = "";
+    (void)scratch;
+
+    // Held: press, then value 2 after the delay and every period
+    capture_reset(&keyboard);
+    capture_reset(&forward);
+    int ok = write_frame(lb, repeat_press) == 0 && pump(lb, &keyboard, &forward, 4, 0, 0) == 0;
+    ok = ok && ticks_match(&keyboard, KEY_F14, repeats, 4, REPEAT_DELAY_MS, REPEAT_PERIOD_MS,
+                           detail, sizeof(detail)) &&
+         capture_matches(&forward, none, "forward", detail, sizeof(detail));
+    report("repeat held key", ok, ok ? NULL : detail);
+
+    // One release, then no more repeats
+    capture_reset(&keyboard);
+    capture_reset(&forward);
+    ok = write_frame(lb, repeat_release) == 0 &&
+         pump(lb, &keyboard, &forward, 1, 0, REPEAT_PERIOD_MS * 2) == 0 &&
+         capture_matches(&keyboard, released, "keyboard", detail, sizeof(detail));
+    report("repeat stops on release", ok, ok ? NULL : detail);
+
+    // Turbo: pressed at once, then toggled every half period
+    capture_reset(&keyboard);
+    capture_reset(&forward);
+    ok = write_frame(lb, turbo_press) == 0 && pump(lb, &keyboard, &forward, 4, 0, 0) == 0;
+    ok = ok && ticks_match(&keyboard, KEY_F16, toggles, 4, REPEAT_PERIOD_MS / 2, REPEAT_PERIOD_MS / 2,
+                           detail, sizeof(detail)) &&
+         capture_matches(&forward, none, "forward", detail, sizeof(detail));
+    report("turbo autofire", ok, ok ? NULL : detail);
+
+    // Released by the autofire already: the source release adds nothing
+    capture_reset(&keyboard);
+    capture_reset(&forward);
+    ok = write_frame(lb, turbo_release) == 0 &&
+         pump(lb, &keyboard, &forward, 0, 0, REPEAT_PERIOD_MS * 2) == 0 &&
+         capture_matches(&keyboard, none, "keyboard", detail, sizeof(detail)) &&
+         capture_matches(&forward, none, "forward", detail, sizeof(detail));
+    report("turbo stops on release", ok, ok ? NULL : detail);
+}
+
+// F13 -> F14 repeating, F15 -> F16 autofiring
+static const loopback_feature_t g_repeat_feature = {
+    "repeat",
+    { "\"remaps\": [ { \"source\": " JSON_INT(KEY_F13) ", \"target\": " JSON_INT(KEY_F14) ", \"repeat\": "
+      "{ \"delay_ms\": " JSON_INT(REPEAT_DELAY_MS) ", \"rate\": " JSON_INT(REPEAT_RATE) " } }, "
+      "{ \"source\": " JSON_INT(KEY_F15) ", \"target\": " JSON_INT(KEY_F16) ", "
+      "\"turbo\": " JSON_INT(REPEAT_RATE) " } ]" },
+    NULL, 0, check_repeat
+};
+
+#define SCROLL_TAP_MS 100
+
+// Button scrolling on the side button: 2.5 hi-res units per count, tap within 100 ms
+static const loopback_case_t g_scroll_cases[] = {
+    { "scroll button press held back", 0,
+      { E_KEY(BTN_SIDE, 1), E_END },
+      { E_END },
+      { E_END } },
+    { "scroll hi-res units", 0,
+      { E_REL(REL_Y, -1), E_END },
+      { E_END },
+      { E_REL(REL_WHEEL_HI_RES, 2), E_SYN, E_END } },
+    { "scroll remainder carries", 0,
+      { E_REL(REL_Y, -1), E_END },
+      { E_END },
+      { E_REL(REL_WHEEL_HI_RES, 3), E_SYN, E_END } },
+    { "scroll detent at 120 units", 0,
+      { E_REL(REL_Y, -46), E_END },
+      { E_END },
+      { E_REL(REL_WHEEL_HI_RES, 115), E_REL(REL_WHEEL, 1), E_SYN, E_END } },
+    { "scroll partial detent", 0,
+      { E_REL(REL_Y, -20), E_END },
+      { E_END },
+      { E_REL(REL_WHEEL_HI_RES, 50), E_SYN, E_END } },
+    { "scroll reversal starts a new detent", 0,
+      { E_REL(REL_Y, 48), E_END },
+      { E_END },
+      { E_REL(REL_WHEEL_HI_RES, -120), E_REL(REL_WHEEL, -1), E_SYN, E_END } },
+    { "scroll release after scrolling", 0,
+      { E_KEY(BTN_SIDE, 0), E_END },
+      { E_END },
+      { E_END } },
+    { "scroll tap press", 0,
+      { E_KEY(BTN_SIDE, 1), E_END },
+      { E_END },
+      { E_END } },
+    { "scroll tap clicks", 0,
+      { E_KEY(BTN_SIDE, 0), E_END },
+      { E_END },
+      { E_KEY(BTN_SIDE, 1), E_SYN, E_KEY(BTN_SIDE, 0), E_SYN, E_END } },
+    { "pointing without the button", 0,
+      { E_REL(REL_X, 3), E_REL(REL_Y, -2), E_END },
+      { E_END },
+      { E_REL(REL_X, 3), E_REL(REL_Y, -2), E_SYN, E_END } },
+    { "scroll slow press", 0,
+      { E_KEY(BTN_SIDE, 1), E_END },
+      { E_END },
+      { E_END } },
+};
+
+// After waiting longer than tap_ms
+static const loopback_case_t g_scroll_slow_release = {
+    "scroll slow release does not click", 0,
+    { E_KEY(BTN_SIDE, 0), E_END },
+    { E_END },
+    { E_END } };
+// Released after more than tap_ms: no click
+static void check_scroll_tap(loopback_t *sources, const char *scratch) {
+    (void)scratch;
+    sleep_ms(SCROLL_TAP_MS + 50);
+    run_case(&sources[0], &g_scroll_slow_release);
+}
+
+// Button scrolling: wheel units, detents, reversal and the tap click
+static const loopback_feature_t g_scroll_feature = {
+    "scroll",
+    { "\"scroll\": { \"button\": \"back\", \"speed\": 250, \"tap_ms\": " JSON_INT(SCROLL_TAP_MS) " }, "
+      "\"remaps\": []" },
+    g_scroll_cases, sizeof(g_scroll_cases) / sizeof(g_scroll_cases[0]), check_scroll_tap
+};
+
+#define E_STROKE_RDRD E_REL(REL_X, 40), E_REL(REL_Y, 40), E_REL(REL_X, 40), E_REL(REL_Y, 40)
+
+// Gestures on the side button with a threshold of 40: "RD" -> F13+F14,
+// "RDRDRDRD" (the longest stroke) -> F15
+static const loopback_case_t g_gesture_cases[] = {
+    { "gesture button press held back", 0,
+      { E_KEY(BTN_SIDE, 1), E_END },
+      { E_END },
+      { E_END } },
+    { "gesture motion below threshold passes", 0,
+      { E_REL(REL_X, 10), E_END },
+      { E_END },
+      { E_REL(REL_X, 10), E_SYN, E_END } },
+    { "gesture threshold crossed", 0,
+      { E_REL(REL_X, 35), E_END },
+      { E_END },
+      { E_END } },
+    { "gesture second direction", 0,
+      { E_REL(REL_Y, 50), E_END },
+      { E_END },
+      { E_END } },
+    { "gesture RD emits combo", 0,
+      { E_KEY(BTN_SIDE, 0), E_END },
+      { E_KEY(KEY_F13, 1), E_KEY(KEY_F14, 1), E_SYN, E_KEY(KEY_F14, 0), E_KEY(KEY_F13, 0), E_SYN, E_END },
+      { E_END } },
+    { "gesture click press", 0,
+      { E_KEY(BTN_SIDE, 1), E_END },
+      { E_END },
+      { E_END } },
+    { "gesture click motion passes", 0,
+      { E_REL(REL_Y, -20), E_END },
+      { E_END },
+      { E_REL(REL_Y, -20), E_SYN, E_END } },
+    { "gesture release below threshold clicks", 0,
+      { E_KEY(BTN_SIDE, 0), E_END },
+      { E_END },
+      { E_KEY(BTN_SIDE, 1), E_SYN, E_KEY(BTN_SIDE, 0), E_SYN, E_END } },
+    { "gesture longest stroke press", 0,
+      { E_KEY(BTN_SIDE, 1), E_END },
+      { E_END },
+      { E_END } },
+    { "gesture longest stroke RDRD", 0,
+      { E_STROKE_RDRD, E_END },
+      { E_END },
+      { E_END } },
+    { "gesture longest stroke RDRDRDRD", 0,
+      { E_STROKE_RDRD, E_END },
+      { E_END },
+      { E_END } },
+    { "gesture longest stroke matches", 0,
+      { E_KEY(BTN_SIDE, 0), E_END },
+      { E_KEY(KEY_F15, 1), E_SYN, E_KEY(KEY_F15, 0), E_SYN, E_END },
+      { E_END } },
+    { "gesture overlong stroke press", 0,
+      { E_KEY(BTN_SIDE, 1), E_END },
+      { E_END },
+      { E_END } },
+    { "gesture overlong stroke RDRD", 0,
+      { E_STROKE_RDRD, E_END },
+      { E_END },
+      { E_END } },
+    { "gesture overlong stroke RDRDRDRD", 0,
+      { E_STROKE_RDRD, E_END },
+      { E_END },
+      { E_END } },
+    { "gesture overlong stroke RDRDRDRDR", 0,
+      { E_REL(REL_X, 40), E_END },
+      { E_END },
+      { E_END } },
+    { "gesture overlong stroke matches nothing", 0,
+      { E_KEY(BTN_SIDE, 0), E_END },
+      { E_END },
+      { E_END } },
+};
+// Mouse gestures: a stroke's combo, the click below the threshold, and no match
+// for a stroke longer than the longest one
+static const loopback_feature_t g_gesture_feature = {
+    "gestures",
+    { "\"gestures\": { \"button\": \"back\", \"threshold\": 40, \"strokes\": "
+      "{ \"RD\": \"" JSON_INT(KEY_F13) "+" JSON_INT(KEY_F14) "\", \"RDRDRDRD\": \"" JSON_INT(KEY_F15) "\" } }, "
+      "\"remaps\": []" },
+    g_gesture_cases, sizeof(g_gesture_cases) / sizeof(g_gesture_cases[0]), NULL
+};
+
+#define MOUSE_KEYS_INTERVAL_MS 20
+#define MOUSE_KEYS_SPEED 1
+#define MOUSE_KEYS_MAX_SPEED 21
+#define MOUSE_KEYS_ACCEL_MS 200
+#define MOUSE_KEYS_TICKS 14             // Enough to reach the full speed
+
+// Mouse keys: the speed per tick follows the acceleration curve over the
+// ticks' own timestamps, and the pointer stops with the key's release
+static void check_mouse_keys(loopback_t *sources, const char *scratch) {
+    static const expect_t press[] = { E_KEY(KEY_F13, 1), E_END };
+    static const expect_t release[] = { E_KEY(KEY_F13, 0), E_END };
+    static const expect_t none[] = { E_END };
+    loopback_t *lb = &sources[0];
+    capture_t keyboard, forward;
+    char detail[128] = "";
+    (void)scratch;
+
+    // First frame at the press, then one per tick
+    capture_reset(&keyboard);
+    capture_reset(&forward);
+    int ok = write_frame(lb, press) == 0 && pump(lb, &keyboard, &forward, 0, MOUSE_KEYS_TICKS, 0) == 0;
+    if (!ok) snprintf(detail, sizeof(detail), "timed out waiting for ticks");
+    ok = ok && capture_matches(&keyboard, none, "keyboard", detail, sizeof(detail));
+    if (ok && forward.count != MOUSE_KEYS_TICKS * 2) {
+        snprintf(detail, sizeof(detail), "%d events in %d frames", forward.count, forward.frames);
+        ok = 0;
+    }
+    for (int i = 0; ok && i < MOUSE_KEYS_TICKS; i++) {
+        const struct input_event *ev = &forward.events[i * 2];
+        int64_t elapsed_us = event_us(ev) - event_us(&forward.events[0]);
+        double expected = elapsed_us >= MOUSE_KEYS_ACCEL_MS * 1000ll ? MOUSE_KEYS_MAX_SPEED :
+                          MOUSE_KEYS_SPEED + (MOUSE_KEYS_MAX_SPEED - MOUSE_KEYS_SPEED) *
+                          (double)elapsed_us / (MOUSE_KEYS_ACCEL_MS * 1000.0);
+        // Fractions carry over: a tick may be one count off the curve
+        if (ev->type != EV_REL || ev->code != REL_X ||
+            ev->value < (int)expected - 1 || ev->value > (int)expected + 2) {
+            snprintf(detail, sizeof(detail), "tick %d at %.1f ms is (%d,%d,%d), expected REL_X %.1f",
+                     i, elapsed_us / 1000.0, ev->type, ev->code, ev->value, expected);
+            ok = 0;
+        }
+    }
+    if (ok && forward.events[(MOUSE_KEYS_TICKS - 1) * 2].value != MOUSE_KEYS_MAX_SPEED) {
+        snprintf(detail, sizeof(detail), "last tick %d, expected max_speed %d",
+                 forward.events[(MOUSE_KEYS_TICKS - 1) * 2].value, MOUSE_KEYS_MAX_SPEED);
+        ok = 0;
+    }
+    report("mouse keys acceleration", ok, ok ? NULL : detail);
+
+    // No tick after the release
+    capture_reset(&keyboard);
+    capture_reset(&forward);
+    ok = write_frame(lb, release) == 0 &&
+         pump(lb, &keyboard, &forward, 0, 0, MOUSE_KEYS_INTERVAL_MS * 3) == 0 &&
+         capture_matches(&keyboard, none, "keyboard", detail, sizeof(detail)) &&
+         capture_matches(&forward, none, "forward", detail, sizeof(detail));
+    report("mouse keys stop on release", ok, ok ? NULL : detail);
+}
+
+// F13 moves the pointer right, accelerating linearly
+static const loopback_feature_t g_mouse_keys_feature = {
+    "mouse-keys",
+    { "\"mouse_keys\": { \"keys\": { \"" JSON_INT(KEY_F13) "\": \"right\" }, "
+      "\"interval_ms\": " JSON_INT(MOUSE_KEYS_INTERVAL_MS) ", \"speed\": " JSON_INT(MOUSE_KEYS_SPEED) ", "
+      "\"max_speed\": " JSON_INT(MOUSE_KEYS_MAX_SPEED) ", \"accel_ms\": " JSON_INT(MOUSE_KEYS_ACCEL_MS) ", "
+      "\"curve\": 1 }, \"remaps\": []" },
+    NULL, 0, check_mouse_keys
+};
+
+// One step of a test with several sources
+typedef struct {
+    int source;                                 // Index of the source written to
+    loopback_case_t test;
+} loopback_step_t;
+
+// Source 0 (pedal): F13 holds "pedal" and is blocked
+// Source 1: F15 -> F16 while "pedal" is held, F15 -> F17 otherwise
+static const loopback_step_t g_modifier_steps[] = {
+    { 1, { "modifier not held press", 0,
+           { E_KEY(KEY_F15, 1), E_END },
+           { E_KEY(KEY_F17, 1), E_SYN, E_END },
+           { E_END } } },
+    { 1, { "modifier not held release", 0,
+           { E_KEY(KEY_F15, 0), E_END },
+           { E_KEY(KEY_F17, 0), E_SYN, E_END },
+           { E_END } } },
+    { 0, { "modifier press", 0,
+           { E_KEY(KEY_F13, 1), E_END },
+           { E_END },
+           { E_END } } },
+    { 1, { "modifier held selects rule", 0,
+           { E_KEY(KEY_F15, 1), E_END },
+           { E_KEY(KEY_F16, 1), E_SYN, E_END },
+           { E_END } } },
+    { 0, { "modifier release", 0,
+           { E_KEY(KEY_F13, 0), E_END },
+           { E_END },
+           { E_END } } },
+    { 1, { "release follows the rule of the press", 0,
+           { E_KEY(KEY_F15, 0), E_END },
+           { E_KEY(KEY_F16, 0), E_SYN, E_END },
+           { E_END } } },
+    { 1, { "modifier released press", 0,
+           { E_KEY(KEY_F15, 1), E_END },
+           { E_KEY(KEY_F17, 1), E_SYN, E_END },
+           { E_END } } },
+    { 1, { "modifier released release", 0,
+           { E_KEY(KEY_F15, 0), E_END },
+           { E_KEY(KEY_F17, 0), E_SYN, E_END },
+           { E_END } } },
+};
+// Cross-device modifiers: a modifier held on one source selects the rule a key
+// of another source fires, and its release follows the press
+static void check_modifiers(loopback_t *sources, const char *scratch) {
+    (void)scratch;
+    for (size_t i = 0; i < sizeof(g_modifier_steps) / sizeof(g_modifier_steps[0]); i++) {
+        run_case(&sources[g_modifier_steps[i].source], &g_modifier_steps[i].test);
+    }
+}
+
+static const loopback_feature_t g_modifier_feature = {
+    "modifiers",
+    { "\"modifiers\": { \"" JSON_INT(KEY_F13) "\": \"pedal\" }, "
+      "\"remaps\": [ { \"source\": " JSON_INT(KEY_F13) ", \"target\": \"none\" } ]",
+      "\"remaps\": [ { \"source\": " JSON_INT(KEY_F15) ", \"target\": " JSON_INT(KEY_F16) ", \"when\": \"pedal\" }, "
+      "{ \"source\": " JSON_INT(KEY_F15) ", \"target\": " JSON_INT(KEY_F17) " } ]" },
+    NULL, 0, check_modifiers
+};
+
+#define SEQUENCE_TIMEOUT_MS 150
+
+#define SEQUENCE_HELD_BACK(code, value) { "sequence " #code " " #value " held back", 0, \
+    { E_KEY(code, value), E_END }, { E_END }, { E_END } }
+
+// Sequences "F13 F14 F15" -> F20 and "F14 F16" -> F21, 150 ms timeout; other
+// keys are forwarded
+static const loopback_case_t g_sequence_cases[] = {
+    SEQUENCE_HELD_BACK(KEY_F13, 1),
+    SEQUENCE_HELD_BACK(KEY_F13, 0),
+    SEQUENCE_HELD_BACK(KEY_F14, 1),
+    SEQUENCE_HELD_BACK(KEY_F14, 0),
+    { "sequence match types expansion", 0,
+      { E_KEY(KEY_F15, 1), E_END },
+      { E_KEY(KEY_F20, 1), E_SYN, E_KEY(KEY_F20, 0), E_SYN, E_END },
+      { E_END } },
+    { "sequence key release dropped", 0,
+      { E_KEY(KEY_F15, 0), E_END },
+      { E_END },
+      { E_END } },
+    SEQUENCE_HELD_BACK(KEY_F13, 1),
+    SEQUENCE_HELD_BACK(KEY_F13, 0),
+    { "sequence mismatch replays", 0,
+      { E_KEY(KEY_F17, 1), E_END },
+      { E_END },
+      { E_KEY(KEY_F13, 1), E_SYN, E_KEY(KEY_F13, 0), E_KEY(KEY_F17, 1), E_SYN, E_END } },
+    { "sequence mismatch key release", 0,
+      { E_KEY(KEY_F17, 0), E_END },
+      { E_END },
+      { E_KEY(KEY_F17, 0), E_SYN, E_END } },
+    SEQUENCE_HELD_BACK(KEY_F13, 1),
+    SEQUENCE_HELD_BACK(KEY_F13, 0),
+    SEQUENCE_HELD_BACK(KEY_F14, 1),
+    { "sequence timeout replays", 0,
+      { E_KEY(KEY_F14, 0), E_END },
+      { E_END },
+      { E_KEY(KEY_F13, 1), E_SYN, E_KEY(KEY_F13, 0), E_KEY(KEY_F14, 1), E_SYN, E_KEY(KEY_F14, 0), E_SYN, E_END } },
+    SEQUENCE_HELD_BACK(KEY_F13, 1),
+    SEQUENCE_HELD_BACK(KEY_F13, 0),
+    SEQUENCE_HELD_BACK(KEY_F14, 1),
+    SEQUENCE_HELD_BACK(KEY_F14, 0),
+    { "sequence overlapping prefix", 0,
+      { E_KEY(KEY_F16, 1), E_END },
+      { E_KEY(KEY_F21, 1), E_SYN, E_KEY(KEY_F21, 0), E_SYN, E_END },
+      { E_KEY(KEY_F13, 1), E_SYN, E_KEY(KEY_F13, 0), E_SYN, E_END } },
+    { "sequence overlapping release dropped", 0,
+      { E_KEY(KEY_F16, 0), E_END },
+      { E_END },
+      { E_END } },
+};
+// Key sequences: a match types its expansion, held back keys are replayed on a
+// mismatch and on the timeout, and a failed prefix falls back to an overlapping one
+static const loopback_feature_t g_sequence_feature = {
+    "sequences",
+    { "\"sequences\": { \"timeout_ms\": " JSON_INT(SEQUENCE_TIMEOUT_MS) ", \"expand\": { "
+      "\"" JSON_INT(KEY_F13) " " JSON_INT(KEY_F14) " " JSON_INT(KEY_F15) "\": \"" JSON_INT(KEY_F20) "\", "
+      "\"" JSON_INT(KEY_F14) " " JSON_INT(KEY_F16) "\": \"" JSON_INT(KEY_F21) "\" } }, \"remaps\": []" },
+    g_sequence_cases, sizeof(g_sequence_cases) / sizeof(g_sequence_cases[0]), NULL
+};
+
+#define SCANNER_TIMEOUT_MS 100
+
+// Read a scanner record from the output FIFO
+// Returns 1 if exactly expected was read, 0 otherwise (detail describes it)
+static int scanner_read(int fd, const char *expected, char *detail, size_t detail_size) {
+    char record[64];
+    ssize_t n = read(fd, record, sizeof(record) - 1);
+    if (n < 0 && errno != EAGAIN) {
+        snprintf(detail, detail_size, "read failed: %s", strerror(errno));
+        return 0;
+    }
+    record[n > 0 ? n : 0] = '\0';
+    if (strcmp(record, expected) != 0) {
+        snprintf(detail, detail_size, "read \"%.*s\", expected \"%.*s\"",
+                 (int)strcspn(record, "\n"), record, (int)strcspn(expected, "\n"), expected);
+        return 0;
+    }
+    return 1;
+}
+
+// Barcode scanner: keys are decoded with shift into a record delivered to the
+// FIFO at Enter or after the timeout, and nothing is typed
+static void check_scanner(loopback_t *sources, const char *scratch) {
+    // "Ab1" and Enter, one key per frame
+    static const expect_t enter_record[] = {
+        E_KEY(KEY_LEFTSHIFT, 1), E_SYN, E_KEY(KEY_A, 1), E_SYN, E_KEY(KEY_A, 0), E_SYN,
+        E_KEY(KEY_LEFTSHIFT, 0), E_SYN, E_KEY(KEY_B, 1), E_SYN, E_KEY(KEY_B, 0), E_SYN,
+        E_KEY(KEY_1, 1), E_SYN, E_KEY(KEY_1, 0), E_SYN, E_KEY(KEY_ENTER, 1), E_SYN,
+        E_KEY(KEY_ENTER, 0), E_SYN, E_END
+    };
+    // "x_Y" without a terminator
+    static const expect_t timeout_record[] = {
+        E_KEY(KEY_X, 1), E_SYN, E_KEY(KEY_X, 0), E_SYN, E_KEY(KEY_RIGHTSHIFT, 1), E_SYN,
+        E_KEY(KEY_MINUS, 1), E_SYN, E_KEY(KEY_MINUS, 0), E_SYN, E_KEY(KEY_Y, 1), E_SYN,
+        E_KEY(KEY_Y, 0), E_SYN, E_KEY(KEY_RIGHTSHIFT, 0), E_SYN, E_END
+    };
+    static const expect_t none[] = { E_END };
+    loopback_t *lb = &sources[0];
+    capture_t keyboard, forward;
+    char detail[128] = "";
+    char fifo[64];
+
+    // The output is only opened on the first record
+    snprintf(fifo, sizeof(fifo), "%s/scans", scratch);
+    int reader = mkfifo(fifo, 0600) == 0 ? open(fifo, O_RDONLY | O_NONBLOCK | O_CLOEXEC) : -1;
+    if (reader < 0) {
+        report("scanner", 0, "cannot create output FIFO");
+        unlink(fifo);
+        return;
+    }
+
+    // Frames are written as listed (E_SYN included)
+    capture_reset(&keyboard);
+    capture_reset(&forward);
+    for (int i = 0; enter_record[i].type >= 0; i++) {
+        libevdev_uinput_write_event(lb->source, enter_record[i].type, enter_record[i].code, enter_record[i].value);
+    }
+    int ok = pump(lb, &keyboard, &forward, 0, 0, LOOPBACK_SETTLE_MS) == 0 &&
+             scanner_read(reader, "Ab1\n", detail, sizeof(detail)) &&
+             capture_matches(&keyboard, none, "keyboard", detail, sizeof(detail)) &&
+             capture_matches(&forward, none, "forward", detail, sizeof(detail));
+    report("scanner record ends at Enter", ok, ok ? NULL : detail);
+
+    // Nothing before the timeout, the record after it
+    for (int i = 0; timeout_record[i].type >= 0; i++) {
+        libevdev_uinput_write_event(lb->source, timeout_record[i].type, timeout_record[i].code,
+                                    timeout_record[i].value);
+    }
+    ok = pump(lb, &keyboard, &forward, 0, 0, LOOPBACK_SETTLE_MS) == 0 &&
+         scanner_read(reader, "", detail, sizeof(detail));
+    ok = ok && pump(lb, &keyboard, &forward, 0, 0, SCANNER_TIMEOUT_MS + LOOPBACK_TIMING_SLACK_MS) == 0 &&
+         scanner_read(reader, "x_Y\n", detail, sizeof(detail)) &&
+         capture_matches(&keyboard, none, "keyboard", detail, sizeof(detail)) &&
+         capture_matches(&forward, none, "forward", detail, sizeof(detail));
+    report("scanner record ends at timeout", ok, ok ? NULL : detail);
+
+    close(reader);
+    unlink(fifo);
+}
+
+static const loopback_feature_t g_scanner_feature = {
+    "scanner",
+    { "\"scanner\": { \"output\": \"%s/scans\", \"timeout_ms\": " JSON_INT(SCANNER_TIMEOUT_MS) " }, "
+      "\"remaps\": []" },
+    NULL, 0, check_scanner
+};
+
+// Features in the order they run
+static const loopback_feature_t *const g_features[] = {
+    &g_repeat_feature,
+    &g_scroll_feature,
+    &g_gesture_feature,
+    &g_mouse_keys_feature,
+    &g_modifier_feature,
+    &g_sequence_feature,
+    &g_scanner_feature,
+};
+
+static void print_usage(const char *program_name) {
+    printf("Usage: %s [OPTIONS]\n", program_name);
+    printf("\n");
+    printf("Options:\n");
+    printf("  -n, --iterations N  Frames in the latency run (default %d)\n", LOOPBACK_DEFAULT_ITERATIONS);
+    printf("  -h, --help          Show this help message\n");
+    printf("\n");
+    printf("Needs read/write access to /dev/uinput and the created event nodes.\n");
+    printf("Exit status: 0 = all passed, 1 = failure, %d = skipped (no uinput).\n", LOOPBACK_EXIT_SKIP);
+}
+
+int main(int argc, char *argv[]) {
+    int iterations = LOOPBACK_DEFAULT_ITERATIONS;
+
+    static struct option long_options[] = {
+        {"iterations", required_argument, 0, 'n'},
+        {"help", no_argument, 0, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "n:h", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'n':
+                iterations = atoi(optarg);
+                break;
+            case 'h':
+                print_usage(argv[0]);
+                return 0;
+            default:
+                print_usage(argv[0]);
+                return 1;
+        }
+    }
+    if (iterations <= 0) {
+        fprintf(stderr, "ERROR: --iterations must be positive\n");
+        return 1;
+    }
+
+    loopback_t lb;
+    loopback_init(&lb);
+    int rc = create_source("keyswap-loopback-source", &lb.source);
+    if (rc < 0) {
+        printf("SKIP cannot create uinput device: %s\n", strerror(-rc));
+        return LOOPBACK_EXIT_SKIP;
+    }
+
+    config_t *config = generate_config(
+        "      {\n"
+        "        \"uuid\": \"loopback\",\n"
+        "        \"name_match\": \"keyswap-loopback-source\",\n"
+        "        \"remaps\": [\n"
+        "          { \"source\": %d, \"target\": %d },\n"
+        "          { \"source\": %d, \"target\": %d },\n"
+        "          { \"source\": \"back\", \"target\": %d }\n"
+        "        ]\n"
+        "      }",
+        KEY_F13, KEY_F14, KEY_F15, KEY_F16, KEY_F24);
+    if (config && (config->device_count != 1 || config->devices[0].remap_count != 3)) {
+        fprintf(stderr, "ERROR: Generated config did not load as expected\n");
+        config_free(config);
+        config = NULL;
+    }
+    if (loopback_open(&lb, config, 0) != 0) {
+        loopback_close(&lb);
+        if (config) config_free(config);
+        return 1;
+    }
+    printf("\nkeyswap loopback: %s -> %s, %s\n\n", libevdev_uinput_get_devnode(lb.source),
+           libevdev_uinput_get_devnode(lb.rt.keyboard.uinput),
+           libevdev_uinput_get_devnode(lb.rt.mouse.uinput));
+
+    for (size_t i = 0; i < sizeof(g_cases) / sizeof(g_cases[0]); i++) {
+        run_case(&lb, &g_cases[i]);
+    }
+    test_release_keys(&lb);
+    test_syn_dropped(&lb);
+    test_grab(&lb);
+    measure_latency(&lb, iterations);
+    loopback_close(&lb);
+    config_free(config);
+
+    for (size_t i = 0; i < sizeof(g_features) / sizeof(g_features[0]); i++) {
+        run_feature(g_features[i]);
+    }
+
+    printf("\n%s\n", g_failures ? "FAILED" : "OK");
+    return g_failures ? 1 : 0;
+}
@@ -0,0 +1,161 @@
+#include "worker.h"
+#include "realtime.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/eventfd.h>
+
+// Doorbell: run the pending call (if any); shutdown is noticed by the dispatch loop
+static void on_wake(int fd, uint32_t events, void *userdata) {
+    (void)events;
+    worker_t *w = userdata;
+    uint64_t count;
+
+    if (read(fd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+        fprintf(stderr, "WARNING: Worker %d doorbell read failed: %s\n", w->index, strerror(errno));
+    }
+
+    pthread_mutex_lock(&w->lock);
+    worker_fn fn = w->call_fn;
+    void *arg = w->call_arg;
+    w->call_fn = NULL;
+    pthread_mutex_unlock(&w->lock);
+
+    if (!fn) return;
+    fn(arg);
+
+    pthread_mutex_lock(&w->lock);
+    w->call_done = 1;
+    pthread_cond_broadcast(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+}
+
+static void* worker_main(void *arg) {
+    worker_t *w = arg;
+
+    if (w->cpu >= 0 && realtime_pin_cpu(w->cpu) == 0) {
+        printf("Worker %d pinned to CPU %d\n", w->index, w->cpu);
+    }
+    realtime_set_priority(&w->realtime);
+
+    while (__atomic_load_n(&w->running, __ATOMIC_ACQUIRE)) {
+        if (event_loop_dispatch(w->loop, -1) < 0) {
+            fprintf(stderr, "ERROR: Worker %d event loop failed\n", w->index);
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+static void ring(worker_t *w) {
+    uint64_t one = 1;
+    if (write(w->wake_fd, &one, sizeof(one)) < 0) {
+        fprintf(stderr, "WARNING: Worker %d doorbell write failed: %s\n", w->index, strerror(errno));
+    }
+}
+
+int worker_init(worker_t *w, int index, int cpu, const realtime_config_t *realtime) {
+    if (!w) return -1;
+
+    memset(w, 0, sizeof(*w));
+    w->index = index;
+    w->cpu = cpu;
+    w->wake_fd = -1;
+    if (realtime) {
+        w->realtime = *realtime;
+    }
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_cond_init(&w->cond, NULL);
+
+    w->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (w->wake_fd < 0) {
+        fprintf(stderr, "ERROR: Failed to create worker doorbell: %s\n", strerror(errno));
+        worker_destroy(w);
+        return -1;
+    }
+
+    w->loop = event_loop_new();
+    if (!w->loop || event_loop_add(w->loop, w->wake_fd, on_wake, w) != 0) {
+        worker_destroy(w);
+        return -1;
+    }
+
+    return 0;
+}
+
+int worker_start(worker_t *w) {
+    if (!w || !w->loop || w->started) return -1;
+
+    // Block all signals while creating the thread so it inherits a full mask
+    // and SIGINT/SIGTERM/SIGHUP keep interrupting the main loop
+    sigset_t all, saved;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &saved);
+
+    __atomic_store_n(&w->running, 1, __ATOMIC_RELEASE);
+    int rc = pthread_create(&w->thread, NULL, worker_main, w);
+
+    pthread_sigmask(SIG_SETMASK, &saved, NULL);
+
+    if (rc != 0) {
+        fprintf(stderr, "ERROR: Failed to start worker %d: %s\n", w->index, strerror(rc));
+        __atomic_store_n(&w->running, 0, __ATOMIC_RELEASE);
+        return -1;
+    }
+
+    w->started = 1;
+    return 0;
+}
+
+void worker_call(worker_t *w, worker_fn fn, void *arg) {
+    if (!w || !fn) return;
+
+    if (!w->started) {
+        fn(arg);
+        return;
+    }
+
+    pthread_mutex_lock(&w->lock);
+    w->call_fn = fn;
+    w->call_arg = arg;
+    w->call_done = 0;
+    pthread_mutex_unlock(&w->lock);
+
+    ring(w);
+
+    pthread_mutex_lock(&w->lock);
+    while (!w->call_done) {
+        pthread_cond_wait(&w->cond, &w->lock);
+    }
+    pthread_mutex_unlock(&w->lock);
+}
+
+void worker_stop(worker_t *w) {
+    if (!w || !w->started) return;
+
+    __atomic_store_n(&w->running, 0, __ATOMIC_RELEASE);
+    ring(w);
+    pthread_join(w->thread, NULL);
+    w->started = 0;
+}
+
+void worker_destroy(worker_t *w) {
+    if (!w) return;
+
+    worker_stop(w);
+
+    if (w->loop) {
+        event_loop_free(w->loop);
+        w->loop = NULL;
+    }
+    if (w->wake_fd >= 0) {
+        close(w->wake_fd);
+        w->wake_fd = -1;
+    }
+    pthread_mutex_destroy(&w->lock);
+    pthread_cond_destroy(&w->cond);
+}
@@ -0,0 +1,54 @@
+#ifndef WORKER_H
+#define WORKER_H
+
+#include <pthread.h>
+#include "config-loader.h"
+#include "event-loop.h"
+
+// Function run on a worker thread through worker_call()
+typedef void (*worker_fn)(void *arg);
+
+// Device worker thread with its own event loop
+// Devices owned by a worker are only ever touched from its thread; the main
+// thread reaches them through worker_call()
+typedef struct {
+    int index;
+    int cpu;                            // CPU the thread is pinned to, -1 = not pinned
+    realtime_config_t realtime;         // Scheduling applied to the thread
+    event_loop_t *loop;                 // Devices owned by this worker
+    int wake_fd;                        // eventfd doorbell for calls and shutdown
+    pthread_t thread;
+    int started;
+    int running;                        // Accessed atomically
+
+    // Single-slot mailbox for worker_call()
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    worker_fn call_fn;
+    void *call_arg;
+    int call_done;
+} worker_t;
+
+// Initialize a worker and its event loop (the thread is not started yet,
+// so devices can be registered on w->loop from the calling thread)
+// Returns 0 on success, -1 on error (nothing to destroy)
+int worker_init(worker_t *w, int index, int cpu, const realtime_config_t *realtime);
+
+// Start the worker thread (signals stay directed at the main thread)
+// Returns 0 on success, -1 on error
+int worker_start(worker_t *w);
+
+// Run fn(arg) on the worker thread between two event batches and wait for it
+// Runs fn directly if the worker is not started
+// Also serves as a grace period: once it returns, the worker no longer uses
+// anything it loaded before the call
+// Must only be called from the main thread
+void worker_call(worker_t *w, worker_fn fn, void *arg);
+
+// Stop and join the worker thread (registered devices are left as they are)
+void worker_stop(worker_t *w);
+
+// Stop the worker and free its event loop
+void worker_destroy(worker_t *w);
+
+#endif // WORKER_H